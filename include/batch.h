@@ -0,0 +1,44 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+#include "libijvm.h"
+
+/**
+ * One run of a program over one input file. Every program path is loaded
+ * only once per batch, and all jobs using it share the loaded text and
+ * constant pool.
+ **/
+typedef struct batch_job {
+    const char *program; // Path of the .ijvm binary
+    const char *input;   // Path read by IN, NULL or "-" for no input
+    const char *output;  // Path written by OUT
+    int status;          // Set by batch_run(): 0 on success, -1 on failure
+} batch_job_t;
+
+
+/**
+ * Runs all jobs on a pool of num_threads workers (0 picks one per online
+ * CPU). Each worker owns one ijvm_t and a deque of jobs, and steals from the
+ * other workers once its own deque runs dry. Workers whose thread can't be
+ * started leave their jobs to the others.
+ *
+ * Returns the number of failed jobs, or -1 if the pool can't be allocated.
+ **/
+int batch_run(batch_job_t *jobs, size_t num_jobs, int num_threads);
+
+
+/**
+ * Runs the jobs listed in a manifest file, one job per line:
+ *
+ *     <program.ijvm> <input|-> <output>
+ *
+ * Empty lines and lines starting with '#' are skipped. Paths can not
+ * contain whitespace.
+ *
+ * Returns the number of failed jobs, or -1 if the manifest can't be read
+ * or held in memory.
+ **/
+int batch_run_manifest(const char *manifest_path, int num_threads);
+
+#endif //BATCH_H
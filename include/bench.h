@@ -0,0 +1,96 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "libijvm.h"
+#include "hwcounters.h"
+
+// Instructions a measured repetition runs, on the fast engine; the
+// stepping interpreter runs a tenth of it. Repetitions of programs that
+// take long to load end after BENCH_REPETITION_NS instead
+#define BENCH_MIN_INSTRUCTIONS 20000000u
+#define BENCH_REPETITION_NS 250000000u
+#define BENCH_WARMUPS 1
+#define BENCH_REPETITIONS 5
+// Slowdown over the baseline that counts as a regression, in percent
+#define BENCH_THRESHOLD 10.0
+
+/**
+ * A binary to measure, on an input file or none. Runs are cut off where
+ * their repetition has run enough, so programs that run for minutes can
+ * be part of a quick suite.
+ **/
+typedef struct bench_case {
+    const char *name;
+    const char *binary;
+    const char *input;
+} bench_case_t;
+
+/**
+ * The engines a case is measured on: the one behind ijvm_run() and
+ * ijvm_run_for(), and the interpreter behind ijvm_step().
+ **/
+typedef enum bench_engine {
+    BENCH_FAST,
+    BENCH_STEP,
+    BENCH_ENGINES
+} bench_engine_t;
+
+/**
+ * What one case did on one engine. A repetition loads the binary and runs
+ * it, over and over until it ran BENCH_MIN_INSTRUCTIONS in all;
+ * ns_per_instruction is the median over the repetitions, loading included.
+ **/
+typedef struct bench_result {
+    const char *name;
+    bench_engine_t engine;
+    uint64_t instructions; // Per repetition
+    uint64_t runs; // Of the program, per repetition
+    double ns_per_instruction;
+    double load_ns; // Mean time ijvm_load() took
+    long peak_rss_kb; // Of the process measuring the case
+    // Counts per instruction of the events in include/hwcounters.h, over
+    // the runs alone; negative for events that couldn't be counted
+    double events[HWC_EVENTS];
+    int status; // 0, or -1 if the case couldn't be run
+} bench_result_t;
+
+/**
+ * Shipped binaries, for a suite without arguments: mandelbread,
+ * bfi2 running mandelbrot.b, test-wide2 and Tanenbaum.
+ **/
+extern const bench_case_t bench_default_cases[];
+extern const size_t bench_num_default_cases;
+
+
+/**
+ * Measures every case on every engine, each in a child process of its own
+ * so peak RSS is that of the case alone, after BENCH_WARMUPS repetitions
+ * that aren't counted. out holds num_cases * BENCH_ENGINES results.
+ *
+ * Returns the number of cases that couldn't be run
+ **/
+int bench_run(const bench_case_t *cases, size_t num_cases, int repetitions, bench_result_t *out);
+
+
+/**
+ * Writes the results as a JSON array, one object per line.
+ **/
+void bench_write_json(FILE *f, const bench_result_t *results, size_t n);
+
+
+/**
+ * Writes the results as a table, against those in the baseline file, a
+ * JSON array from bench_write_json(), if given. Results more than
+ * threshold percent slower per instruction than their baseline are
+ * marked as regressions. The events counted follow in a table of their
+ * own.
+ *
+ * Returns the number of regressions, or -1 if the baseline can't be read
+ **/
+int bench_report(FILE *f, const bench_result_t *results, size_t n, const char *baseline,
+                 double threshold);
+
+#endif //BENCH_H
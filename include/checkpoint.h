@@ -0,0 +1,82 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "libijvm.h"
+
+#define CHECKPOINT_MAGIC "IJVMCKPT"
+#define CHECKPOINT_VERSION 1
+
+// Instructions between two checkpoints of ./ijvm --checkpoint
+#define CHECKPOINT_INTERVAL 100000000
+
+/**
+ * Layout of a checkpoint file. The header is followed by three sections,
+ * each starting on a page boundary so it can be mapped as it is:
+ *
+ *   - the program image, the .ijvm binary as loaded
+ *   - the stack, from the base up to and including the top of stack
+ *   - the heap, every array as its size followed by its words
+ *
+ * Everything is in the byte order of the machine that wrote it.
+ **/
+typedef struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // 0x01020304 as written
+    uint32_t page_size; // Alignment of the sections
+    uint32_t pc;
+    uint32_t sp; // Words from the stack base
+    uint32_t lv; // Words from the stack base
+    uint8_t halted;
+    uint8_t wide_index;
+    uint8_t reserved[6];
+    int64_t input_offset; // Bytes taken by IN, -1 if unknown
+    int64_t output_offset; // Bytes written by OUT, -1 if unknown
+    uint64_t image_offset;
+    uint64_t image_size;
+    uint64_t stack_offset;
+    uint64_t stack_size;
+    uint64_t heap_offset;
+    uint64_t heap_size;
+    uint64_t num_arrays;
+} checkpoint_header_t;
+
+
+/**
+ * Saves the complete state of the instance to the file at path: program,
+ * registers, stack, heap, and how far it got in its input and output. The
+ * file is written next to path and renamed over it once complete, so a
+ * crash never leaves half a checkpoint behind.
+ *
+ * Machines with fibers or open sockets can't be saved.
+ *
+ * Returns  0 on success
+ *         -1 on failure
+ **/
+int ijvm_checkpoint(ijvm_t *m, const char *path);
+
+
+/**
+ * Replaces the program and state of the instance with those saved at path.
+ * The program, stack and heap are mapped copy-on-write from the file rather
+ * than read. Input and output stay what they were set to before the call:
+ * a seekable file, or memory, is moved to where the saved machine left off.
+ *
+ * Returns  0 on success
+ *         -1 on failure, leaving the instance as it was
+ **/
+int ijvm_restore(ijvm_t *m, const char *path);
+
+
+/**
+ * Runs the binary on the standard streams, saving a checkpoint at path
+ * every `interval` instructions and whenever it waits for input. If path
+ * already holds a checkpoint, the run resumes from it instead of starting
+ * over. The checkpoint is removed once the program finishes.
+ *
+ * Returns  0 on success
+ *         -1 if the binary couldn't be loaded
+ **/
+int checkpoint_run(const char *binary_path, const char *path, uint64_t interval);
+
+#endif //CHECKPOINT_H
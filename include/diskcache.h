@@ -0,0 +1,48 @@
+#ifndef DISKCACHE_H
+#define DISKCACHE_H
+
+#include "program.h"
+#include "engine.h"
+#include "jas.h"
+
+#define DISKCACHE_MAGIC "IJVMASMC"
+#define DISKCACHE_FORMAT 3
+// What a stored binary depends on besides its source
+#define DISKCACHE_VERSION ((uint32_t) JAS_VERSION << 16 | ENGINE_VERSION)
+
+/**
+ * Layout of a file in the on-disk cache: the binary a .jas source assembled
+ * to, named after the hash of the source text. The header is followed by the
+ * binary, starting on a page boundary so it can be mapped as it is.
+ *
+ * Identical sources share a file, wherever they are loaded from, so a cache
+ * directory can be copied between hosts. A file written by another format,
+ * assembler or engine version is stale, and is replaced on the next load of
+ * its source.
+ **/
+typedef struct diskcache_header {
+    char magic[8];
+    uint32_t format;
+    uint32_t version; // DISKCACHE_VERSION as written
+    uint64_t source_hash; // hash_bytes() of the source
+    uint64_t source_size;
+    uint64_t image_offset;
+    uint64_t image_size;
+} diskcache_header_t;
+
+
+/**
+ * Returns the program stored in the cache directory for the source with the
+ * given hash and size, mapped from the cache; NULL while no cache directory
+ * is set or nothing is stored for the source.
+ **/
+program_t *diskcache_load(uint64_t source_hash, size_t source_size);
+
+/**
+ * Stores the binary the source with the given hash and size assembled to in
+ * the cache directory. Does nothing while no cache directory is set; failing
+ * to write only means the source is assembled again next time.
+ **/
+void diskcache_store(uint64_t source_hash, size_t source_size, const byte_t *image, size_t size);
+
+#endif //DISKCACHE_H
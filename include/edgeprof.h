@@ -0,0 +1,129 @@
+#ifndef EDGEPROF_H
+#define EDGEPROF_H
+
+#include <stdint.h>
+#include "machine.h"
+
+#define EDGEPROF_MAGIC "IJVMEDGE"
+#define EDGEPROF_VERSION 1
+
+/**
+ * Layout of an edge profile, named after the hash of the binary it was
+ * recorded on. The header is followed by num_blocks block records, then
+ * num_branches branch records, hottest first. Only blocks that were
+ * entered and branches that ran are stored.
+ **/
+typedef struct edgeprof_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+    uint64_t hash;
+    uint64_t image_size;
+    uint32_t num_blocks;
+    uint32_t num_branches;
+} edgeprof_header_t;
+
+typedef struct edgeprof_block {
+    uint32_t pc; // Where the block starts
+    uint32_t reserved;
+    uint64_t count; // Times control entered it from a jump, call or return
+} edgeprof_block_t;
+
+typedef struct edgeprof_branch {
+    uint32_t pc; // Of the IFEQ, IFLT or IF_ICMPEQ
+    uint32_t reserved;
+    uint64_t taken;
+    uint64_t not_taken;
+} edgeprof_branch_t;
+
+/**
+ * Counters of a recording machine, indexed by pc of its program.
+ **/
+typedef struct edges {
+    program_t *program; // What the counters belong to, retained
+    uint64_t *entries;
+    uint64_t *taken;
+    uint64_t *not_taken;
+} edges_t;
+
+
+/**
+ * Sets the directory edge profiles are written to and read from. NULL,
+ * the default, turns both off.
+ **/
+void ijvm_set_profile_dir(const char *dir);
+
+
+/**
+ * Starts recording, for every program the instance runs, how often each
+ * basic block is entered and which way each conditional branch goes. A
+ * recording instance always steps through the interpreter.
+ *
+ * Returns  0 on success
+ *         -1 when out of memory
+ **/
+int ijvm_edges_enable(ijvm_t *m);
+
+
+/**
+ * Adds what was recorded on the current program to its profile in the
+ * profile directory, so the profile sums up every run that saved to it,
+ * and starts counting from zero again. Loading another program saves the
+ * counts of the previous one as well.
+ *
+ * Returns  0 on success
+ *         -1 if there is nothing to save, no profile directory, or the
+ *            profile can't be written
+ **/
+int ijvm_edges_save(ijvm_t *m);
+
+
+/**
+ * Stops recording, saving what was recorded since the last save first.
+ **/
+void ijvm_edges_disable(ijvm_t *m);
+
+
+/**
+ * Copies up to max starts of the hottest blocks of the program, hottest
+ * first, from the profile found for it in the profile directory when it
+ * was loaded.
+ *
+ * Returns the number of pcs copied, 0 if the program has no profile
+ **/
+size_t ijvm_program_hot_blocks(ijvm_program_t *p, uint32_t *pcs, size_t max);
+
+
+/**
+ * Looks up how often the IFEQ, IFLT or IF_ICMPEQ at pc jumped and how
+ * often it fell through, according to the profile found for the program
+ * when it was loaded.
+ *
+ * Returns  0 on success
+ *         -1 if the profile has no such branch
+ **/
+int ijvm_program_branch_profile(ijvm_program_t *p, uint32_t pc, uint64_t *taken, uint64_t *not_taken);
+
+
+/**
+ * Saves the counts of the previous program, and counts the program just
+ * loaded from scratch.
+ **/
+void edges_restart(machine_t *m);
+
+
+/**
+ * Counts one executed instruction, op, which started at pc. Called by the
+ * interpreter after executing it.
+ **/
+void edges_step(machine_t *m, byte_t op, uint32_t pc);
+
+
+/**
+ * Gives a freshly loaded program the profile stored for its binary, and
+ * works out its hottest blocks first. Does nothing while no profile
+ * directory is set.
+ **/
+void edgeprof_attach(program_t *p);
+
+#endif //EDGEPROF_H
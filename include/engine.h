@@ -0,0 +1,36 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "machine.h"
+
+// Set in a block length when the block runs off the end of the text
+#define BLOCK_TAIL 0x80000000u
+
+// Bumped whenever the engine would run a binary differently, which makes
+// what older versions stored on disk stale
+#define ENGINE_VERSION 1
+
+/**
+ * Returns the number of instructions in the basic block that starts at pc,
+ * the instruction that ends it included. A block ends with the first
+ * instruction that can jump, call, return, stop the machine or wait; that
+ * last one is left to the interpreter in machine.c whenever the engine
+ * doesn't handle it itself.
+ **/
+uint32_t block_length(program_t *p, uint32_t pc);
+
+/**
+ * Runs the machine with its registers in locals, for up to `budget`
+ * instructions. The budget is charged a whole basic block at a time, on
+ * entering it; only a block that doesn't fit what is left is stepped one
+ * instruction at a time.
+ *
+ * Unless `may_block`, IN returns IJVM_BLOCKED instead of waiting when its
+ * input has nothing to read yet. Output is left in its buffer.
+ *
+ * Instrumented machines (see machine_instrumented()) are stepped one
+ * instruction at a time instead, so that each is seen.
+ **/
+ijvm_status_t engine_run(machine_t *m, uint64_t budget, bool may_block);
+
+#endif //ENGINE_H
@@ -0,0 +1,83 @@
+#ifndef FIBER_H
+#define FIBER_H
+
+#include "machine.h"
+
+// Words in the stack segment of a spawned fiber, which is followed by a
+// guard page
+#define FIBER_STACK_SIZE 0x1000
+#define FIBER_STACK_BYTES (sizeof(word_t) * FIBER_STACK_SIZE)
+
+/**
+ * A guest thread: the registers of one thread of control inside a machine.
+ * The running fiber's registers live in the machine itself, the others are
+ * parked here.
+ **/
+typedef struct fiber {
+    int id;
+    uint32_t pc;
+    word_t *stack;
+    word_t *sp;
+    word_t *lv;
+    struct fiber *next; // In the run queue or the waiters of a descriptor
+} fiber_t;
+
+/**
+ * The fibers waiting for one descriptor.
+ **/
+typedef struct watch {
+    fiber_t *waiters;
+    short events; // Union of what the waiters wait for, 0 if unarmed
+    bool registered; // Whether the descriptor is in the epoll set
+} watch_t;
+
+struct fibers {
+    fiber_t *current;
+    fiber_t main; // The thread the program started with
+    fiber_t *run_head; // Runnable fibers, in order of turn
+    fiber_t *run_tail;
+    watch_t *watches; // Indexed by descriptor
+    int num_watches;
+    int num_waiting;
+    int epfd; // Event loop behind the watches, -1 until first needed
+    int next_id;
+    unsigned int switches;
+};
+
+/**
+ * Starts the method at constant index `method` in a new fiber, moving its
+ * arguments (OBJREF included) off the current stack. The fiber is queued
+ * behind all runnable fibers. The arguments are popped also when it fails,
+ * which it does if the method's frame doesn't fit FIBER_STACK_SIZE.
+ * Returns the id of the new fiber, or 0 on failure.
+ **/
+word_t fiber_spawn(machine_t *m, uint16_t method);
+
+/**
+ * Lets the next runnable fiber run, if there is one.
+ **/
+void fiber_yield(machine_t *m);
+
+/**
+ * Called when an operation on fd would block, with the poll() events it
+ * needs (POLLIN and/or POLLOUT). Parks the current fiber on the descriptor
+ * without moving its pc, so it retries the operation once woken, and
+ * switches to the next fiber that can run. When no other fiber can run,
+ * this blocks in the event loop until one can.
+ *
+ * Returns true if it switched, false if the caller should go ahead.
+ **/
+bool fiber_wait(machine_t *m, int fd, short events);
+
+/**
+ * Ends the current fiber once it returned from its method. Has no effect
+ * on the main fiber, which ends with the machine.
+ **/
+void fiber_exit(machine_t *m);
+
+/**
+ * Frees all fibers and makes the main fiber's stack current again.
+ **/
+void fibers_free(machine_t *m);
+
+#endif //FIBER_H
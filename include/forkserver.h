@@ -0,0 +1,23 @@
+#ifndef FORKSERVER_H
+#define FORKSERVER_H
+
+#include "libijvm.h"
+
+/**
+ * Serves run requests from an already loaded (and possibly warmed up)
+ * instance. Requests are read from `requests`, one per line:
+ *
+ *     <input|-> <output>
+ *
+ * Every request forks a child that inherits the instance exactly as it is,
+ * points IN and OUT at the given files and runs to completion, so a request
+ * never pays for loading or warm-up. Children run concurrently; whenever one
+ * exits, "<request number> <exit status>" is written to `replies`, with
+ * requests numbered from 1 in the order they were read.
+ *
+ * Returns the number of failed requests once `requests` hits end of file and
+ * all children have exited, or -1 if no child could be forked.
+ **/
+int ijvm_fork_server(ijvm_t *m, FILE *requests, FILE *replies);
+
+#endif //FORKSERVER_H
@@ -0,0 +1,122 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "libijvm.h"
+
+// Instructions a program gets before the engines are compared, however far
+// it got by then
+#define FUZZ_MAX_INSTRUCTIONS 1000000u
+// Output compared, past this it is cut off the same way on every engine
+#define FUZZ_OUTPUT_SIZE 0x1000
+#define FUZZ_INPUT_SIZE 16
+// Choices a program is generated from in a standalone campaign
+#define FUZZ_CHOICES 1024
+
+/**
+ * The engines a program is run under. FUZZ_STEP, ijvm_step() through the
+ * interpreter's switch, is the reference the others have to match:
+ *
+ * FUZZ_RUN:          ijvm_run(), the block engine
+ * FUZZ_RUN_FOR:      ijvm_run_for() in budgets of 1 to 16 instructions, so
+ *                    that runs stop and resume all over the blocks
+ * FUZZ_INSTRUMENTED: ijvm_run() with opcode statistics on, which steps
+ *                    instrumented through the interpreter
+ **/
+typedef enum fuzz_engine {
+    FUZZ_STEP,
+    FUZZ_RUN,
+    FUZZ_RUN_FOR,
+    FUZZ_INSTRUMENTED,
+    FUZZ_ENGINES
+} fuzz_engine_t;
+
+extern const char *const fuzz_engine_names[FUZZ_ENGINES];
+
+/**
+ * A generated program and the input it is run with.
+ **/
+typedef struct fuzz_program {
+    byte_t *image; // As gen_image() lays it out
+    size_t size;
+    byte_t input[FUZZ_INPUT_SIZE];
+    size_t input_size;
+} fuzz_program_t;
+
+/**
+ * Where a program run under an engine ended up.
+ **/
+typedef struct fuzz_outcome {
+    bool finished;
+    word_t tos;
+    int stack_size;
+    uint64_t stack_hash; // Of the whole stack, bit for bit
+    size_t output_size;
+    byte_t output[FUZZ_OUTPUT_SIZE];
+} fuzz_outcome_t;
+
+/**
+ * Decides whether the choices still make a program worth keeping, for
+ * fuzz_minimize().
+ **/
+typedef bool (*fuzz_predicate_t)(const byte_t *choices, size_t n, void *arg);
+
+
+/**
+ * Generates a valid program from n bytes of choices, each picking what
+ * comes next; choices of 0, and running out of them, pick the smallest
+ * program. Stack depths never go below what a method started with, locals
+ * and branch targets are always in range, calls go only to methods defined
+ * later and loops count down from at most 8, so every program halts, by
+ * HALT, ERR or an array access out of bounds.
+ * Returns 0 on success, -1 when out of memory
+ **/
+int fuzz_generate(const byte_t *choices, size_t n, fuzz_program_t *p);
+
+void fuzz_program_free(fuzz_program_t *p);
+
+/**
+ * Runs the program for at most FUZZ_MAX_INSTRUCTIONS under the engine.
+ * Returns 0 on success, -1 if the program couldn't be loaded
+ **/
+int fuzz_run(const fuzz_program_t *p, fuzz_engine_t engine, fuzz_outcome_t *out);
+
+/**
+ * Runs the program under every engine and compares each to FUZZ_STEP.
+ * Returns the first engine that came out different, or FUZZ_STEP when
+ * they all agreed; -1 on failure
+ **/
+int fuzz_compare(const fuzz_program_t *p);
+
+/**
+ * Generates a program from the choices and compares the engines on it.
+ * Returns as fuzz_compare() does
+ **/
+int fuzz_check(const byte_t *choices, size_t n);
+
+/**
+ * The predicate of choices whose program makes the engines diverge.
+ **/
+bool fuzz_diverges(const byte_t *choices, size_t n, void *arg);
+
+/**
+ * Shrinks the choices, in place, for as long as the predicate keeps
+ * holding: cutting chunks out and lowering single choices, which makes
+ * the programs smaller. The predicate has to hold for the choices as given.
+ * Returns how many choices are left
+ **/
+size_t fuzz_minimize(byte_t *choices, size_t n, fuzz_predicate_t predicate, void *arg);
+
+/**
+ * Checks count programs from random choices, starting at seed, and writes
+ * a line to report for every one that makes the engines diverge. The first
+ * of those is minimized and, if dir is not NULL, saved as dir/diverged.ijvm
+ * with its input in dir/diverged.in.
+ * Returns the number of programs the engines diverged on, -1 on failure
+ **/
+int fuzz_campaign(uint64_t seed, uint64_t count, const char *dir, FILE *report);
+
+#endif //FUZZ_H
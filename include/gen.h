@@ -0,0 +1,117 @@
+#ifndef GEN_H
+#define GEN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "ijvm.h"
+
+// Where the blocks of a generated binary say they start, as goJASM has it
+#define GEN_CONSTANT_ORIGIN 0x10000
+#define GEN_TEXT_ORIGIN 0
+
+/**
+ * A binary being put together: the constant pool and the text, grown as
+ * they are written. Running out of memory sets failed and drops whatever
+ * comes after, so only gen_image() has to be checked.
+ **/
+typedef struct gen {
+    byte_t *constants;
+    uint32_t constants_size;
+    uint32_t constants_capacity;
+    byte_t *text;
+    uint32_t text_size;
+    uint32_t text_capacity;
+    bool failed;
+} gen_t;
+
+/**
+ * Parameterized stress kernels, each exercising one path of the engine:
+ *
+ * GEN_ARITH:  n iterations of a loop of stack arithmetic on two locals
+ * GEN_CALLS:  n INVOKEVIRTUALs, as whole recursions GEN_CALL_DEPTH deep
+ * GEN_WIDE:   n iterations of a loop over locals past 255, all WIDE
+ * GEN_ARRAYS: n IALOADs and IASTOREs walking a GEN_ARRAY_SIZE array
+ * GEN_OUTPUT: n bytes of OUT
+ *
+ * The output kernel halts with 0 on the stack, the others with a checksum
+ * of what they computed.
+ **/
+typedef enum gen_kernel {
+    GEN_ARITH,
+    GEN_CALLS,
+    GEN_WIDE,
+    GEN_ARRAYS,
+    GEN_OUTPUT,
+    GEN_KERNELS
+} gen_kernel_t;
+
+#define GEN_CALL_DEPTH 1000
+#define GEN_ARRAY_SIZE 1024
+
+extern const char *const gen_kernel_names[GEN_KERNELS];
+
+
+void gen_init(gen_t *g);
+
+void gen_free(gen_t *g);
+
+/**
+ * Appends to the text.
+ **/
+void gen_byte(gen_t *g, byte_t b);
+
+void gen_short(gen_t *g, uint16_t s);
+
+void gen_bytes(gen_t *g, const byte_t *data, uint32_t n);
+
+/**
+ * Appends a word to the constant pool.
+ * Returns its index
+ **/
+uint16_t gen_constant(gen_t *g, word_t value);
+
+/**
+ * Changes a constant, for method addresses known only once the text is.
+ **/
+void gen_set_constant(gen_t *g, uint16_t index, word_t value);
+
+/**
+ * Appends a branch (GOTO, IFEQ, IFLT or IF_ICMPEQ) to target, or, for a
+ * target that isn't known yet, to 0 for gen_patch() to fill in.
+ * Returns where the branch starts
+ **/
+uint32_t gen_branch(gen_t *g, byte_t op, uint32_t target);
+
+/**
+ * Points the branch starting at `at` to target.
+ **/
+void gen_patch(gen_t *g, uint32_t at, uint32_t target);
+
+/**
+ * Lays out the binary as init_ijvm() reads it.
+ * Returns it, in memory of *size bytes to free(), or NULL if out of memory
+ **/
+byte_t *gen_image(gen_t *g, size_t *size);
+
+
+/**
+ * Builds a kernel of size n.
+ * Returns its image as gen_image() does
+ **/
+byte_t *gen_kernel(gen_kernel_t kernel, uint32_t n, size_t *size);
+
+
+/**
+ * Writes a kernel of size n to path.
+ * Returns 0 on success, -1 on failure
+ **/
+int gen_kernel_write(gen_kernel_t kernel, uint32_t n, const char *path);
+
+
+/**
+ * Returns the kernel called name in gen_kernel_names, or -1
+ **/
+int gen_kernel_find(const char *name);
+
+#endif //GEN_H
@@ -0,0 +1,49 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "machine.h"
+
+/**
+ * An array made by NEWARRAY. Arrays live until the program is unloaded.
+ **/
+typedef struct array {
+    word_t size;
+    word_t words[];
+} array_t;
+
+struct heap {
+    array_t **arrays; // Indexed by arrayref - 1
+    size_t num_arrays;
+    size_t capacity;
+    // Mapping that restored arrays live in, back to back, instead of
+    // being allocated one by one
+    byte_t *arena;
+    size_t arena_size;
+};
+
+/**
+ * Allocates a zeroed array of `count` words.
+ * Returns its arrayref, or 0 for a negative count or when out of memory.
+ **/
+word_t heap_new_array(machine_t *m, word_t count);
+
+/**
+ * Returns the element at `index` of the array behind `arrayref`, or NULL
+ * if there is no such array or the index is out of bounds.
+ **/
+word_t *heap_element(machine_t *m, word_t arrayref, word_t index);
+
+/**
+ * Replaces the heap with the `num_arrays` arrays laid out back to back in
+ * `arena`, a mapping of `size` bytes that the heap takes over.
+ * Returns -1 if they don't fit the arena, or when out of memory; the arena
+ * is unmapped either way then.
+ **/
+int heap_adopt(machine_t *m, byte_t *arena, size_t size, size_t num_arrays);
+
+/**
+ * Frees all arrays.
+ **/
+void heap_free(machine_t *m);
+
+#endif //HEAP_H
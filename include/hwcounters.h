@@ -0,0 +1,66 @@
+#ifndef HWCOUNTERS_H
+#define HWCOUNTERS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * The events counted with perf_event_open(), in user space on the calling
+ * thread. All but the task clock (nanoseconds on the CPU, a software event)
+ * need a hardware PMU the kernel lets the process use: none inside most
+ * virtual machines and containers, and not with perf_event_paranoid above
+ * 2. Events that can't be opened are left out.
+ **/
+typedef enum hwc_event {
+    HWC_CYCLES,
+    HWC_INSTRUCTIONS,
+    HWC_BRANCH_MISSES,
+    HWC_L1I_MISSES,
+    HWC_L1D_MISSES,
+    HWC_ITLB_MISSES,
+    HWC_TASK_CLOCK,
+    HWC_EVENTS
+} hwc_event_t;
+
+extern const char *const hwc_event_names[HWC_EVENTS];
+
+/**
+ * Counters of the events, summed over every hwcounters_start() to
+ * hwcounters_stop(). Counts are scaled up for the time the kernel had an
+ * event off the PMU to multiplex others.
+ **/
+typedef struct hwcounters {
+    int fds[HWC_EVENTS]; // -1 for the events left out
+    uint64_t values[HWC_EVENTS];
+} hwcounters_t;
+
+
+/**
+ * Opens every event it can, stopped and at zero.
+ * Returns the number of events opened
+ **/
+int hwcounters_open(hwcounters_t *h);
+
+void hwcounters_close(hwcounters_t *h);
+
+/**
+ * Whether the event is counted.
+ **/
+bool hwcounters_counted(const hwcounters_t *h, hwc_event_t event);
+
+void hwcounters_start(hwcounters_t *h);
+
+/**
+ * Stops counting and adds what was counted since hwcounters_start() to
+ * the values.
+ **/
+void hwcounters_stop(hwcounters_t *h);
+
+/**
+ * Writes every event, in total and per guest instruction, to f; the
+ * events left out as such.
+ **/
+void hwcounters_report(FILE *f, const hwcounters_t *h, uint64_t instructions);
+
+#endif //HWCOUNTERS_H
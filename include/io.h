@@ -0,0 +1,105 @@
+#ifndef IO_H
+#define IO_H
+
+#include <stddef.h>
+#include "ijvm.h"
+
+// Bytes read ahead from a file at once
+#define IO_BUFFER_SIZE 0x10000
+// Bytes read from a stream at once, and the first size of a write buffer,
+// which doubles up to IO_BUFFER_SIZE as output keeps coming. This keeps
+// idle machines small
+#define IO_SMALL_BUFFER_SIZE 0x1000
+
+/**
+ * What IN reads from. A FILE is read ahead in large blocks: regular files
+ * and memory streams through fread(), pipes, terminals and sockets straight
+ * from their descriptor, which returns whatever is there without waiting
+ * for a full block. Caller memory is read in place.
+ **/
+typedef struct io_in {
+    FILE *fp; // NULL when reading caller memory
+    int fd; // Descriptor read for a stream fp, -1 otherwise
+    const byte_t *data; // The read-ahead buffer, or caller memory
+    size_t pos; // Next byte IN returns
+    size_t len;
+    byte_t *buf; // Read-ahead buffer, allocated on first use
+    size_t size; // Of buf
+} io_in_t;
+
+/**
+ * Where OUT writes to. Output for a FILE piles up until the buffer is full
+ * or the machine flushes it; caller memory is written in place, dropping
+ * what doesn't fit.
+ **/
+typedef struct io_out {
+    FILE *fp; // NULL when writing caller memory
+    byte_t *data; // The write buffer, or caller memory
+    size_t len;
+    size_t cap;
+    byte_t *buf; // Write buffer, allocated on first use
+    size_t size; // Of buf
+} io_out_t;
+
+void io_in_file(io_in_t *in, FILE *fp);
+
+void io_in_memory(io_in_t *in, const void *data, size_t size);
+
+/**
+ * Takes the next block once the pending bytes are used up.
+ * Returns the next byte, or -1 at the end of the input.
+ **/
+int io_refill(io_in_t *in);
+
+/**
+ * Gives dst its own copy of the input of src, pending bytes included.
+ * Returns -1 when out of memory.
+ **/
+int io_in_copy(io_in_t *dst, const io_in_t *src);
+
+void io_in_free(io_in_t *in);
+
+/**
+ * Flushes the pending output, then switches to the FILE.
+ **/
+void io_out_file(io_out_t *out, FILE *fp);
+
+void io_out_memory(io_out_t *out, void *data, size_t size);
+
+/**
+ * Hands the pending output to the FILE, which still buffers it as set up
+ * with setvbuf(). No-op for caller memory.
+ **/
+void io_flush(io_out_t *out);
+
+/**
+ * Points dst at what src writes to. The output of src must be flushed.
+ **/
+void io_out_copy(io_out_t *dst, const io_out_t *src);
+
+/**
+ * Flushes, and frees the write buffer.
+ **/
+void io_out_free(io_out_t *out);
+
+// Whether IN can take a byte without refilling
+static inline bool io_ready(const io_in_t *in) {
+    return in->pos < in->len;
+}
+
+static inline int io_getc(io_in_t *in) {
+    if (in->pos < in->len)
+        return in->data[in->pos++];
+    return io_refill(in);
+}
+
+void io_overflow(io_out_t *out, byte_t c);
+
+static inline void io_putc(io_out_t *out, byte_t c) {
+    if (out->len < out->cap)
+        out->data[out->len++] = c;
+    else
+        io_overflow(out, c);
+}
+
+#endif //IO_H
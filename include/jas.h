@@ -0,0 +1,50 @@
+#ifndef JAS_H
+#define JAS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "ijvm.h"
+
+/**
+ * A single-pass assembler for .jas sources, laying binaries out the way
+ * goJASM does: the declared constants first, then the address of every
+ * method in the order they are defined; main's code first in the text,
+ * then each method behind its header of arguments (OBJREF included) and
+ * locals. Locals of main count from 0, those of a method follow its
+ * arguments, which follow OBJREF at 0.
+ *
+ * Names are looked up in a hash table and references to what comes later
+ * are patched in at the end of the method (labels) or of the source
+ * (constants and methods), so the time taken is linear in the source.
+ * Instructions are case-insensitive and include the extensions of this
+ * machine (NEWARRAY, IALOAD, IASTORE, NETBIND, NETCONNECT, NETIN, NETOUT,
+ * NETCLOSE, SPAWN and YIELD).
+ **/
+
+// Bumped whenever a source would assemble differently, which makes binaries
+// cached on disk by older versions stale
+#define JAS_VERSION 1
+
+// Long enough for any message jas_assemble() gives
+#define JAS_ERROR_SIZE 128
+
+/**
+ * Assembles the size bytes of source.
+ * Returns the binary as gen_image() does, in memory of *image_size bytes
+ * to free(), or NULL with what is wrong and on which line in error
+ **/
+byte_t *jas_assemble(const char *source, size_t size, size_t *image_size, char *error, size_t error_size);
+
+/**
+ * Returns whether path names a .jas source rather than a binary.
+ **/
+bool jas_is_source(const char *path);
+
+/**
+ * Assembles the source at jas_path into a binary at ijvm_path, telling
+ * stderr what went wrong, if anything.
+ * Returns 0 on success, -1 on failure
+ **/
+int jas_assemble_file(const char *jas_path, const char *ijvm_path);
+
+#endif //JAS_H
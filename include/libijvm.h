@@ -0,0 +1,188 @@
+#ifndef LIBIJVM_H
+#define LIBIJVM_H
+
+#include "ijvm.h"
+
+/**
+ * Reentrant interface to the IJVM.
+ *
+ * Every function in ijvm.h works on a single, process-wide default instance.
+ * The functions below take an explicit handle instead, so any number of
+ * machines can live side by side. A handle must only be used by one thread
+ * at a time; distinct handles may be used from distinct threads freely.
+ **/
+typedef struct machine ijvm_t;
+
+
+/**
+ * A loaded program that can be shared read-only between any number of
+ * instances, across threads.
+ **/
+typedef struct program ijvm_program_t;
+
+
+/**
+ * Loads the binary found at the provided path, without an instance.
+ * The returned program holds one reference.
+ * Returns NULL on failure.
+ **/
+ijvm_program_t *ijvm_program_load(const char *binary_path);
+
+
+/**
+ * Takes another reference to the program and returns it.
+ **/
+ijvm_program_t *ijvm_program_retain(ijvm_program_t *p);
+
+
+/**
+ * Drops one reference to the program, freeing it with the last one.
+ **/
+void ijvm_program_release(ijvm_program_t *p);
+
+
+/**
+ * Keeps the binary every .jas source loaded from here on assembles to in
+ * the directory at dir, created if missing. Loading an identical source
+ * again, in this or any later process, maps the stored binary instead of
+ * assembling it. NULL, the default, turns the cache off.
+ **/
+void ijvm_set_cache_dir(const char *dir);
+
+
+/**
+ * Allocates a new, empty IJVM instance.
+ * Returns NULL when out of memory.
+ **/
+ijvm_t *ijvm_create(void);
+
+
+/**
+ * Unloads the instance (if a program is loaded) and frees the handle.
+ **/
+void ijvm_destroy(ijvm_t *m);
+
+
+/**
+ * Loads the binary found at the provided path into the instance, replacing
+ * any program that was loaded before.
+ *
+ * Returns  0 on success
+ *         -1 on failure
+ **/
+int ijvm_load(ijvm_t *m, const char *binary_path);
+
+
+/**
+ * Resets the instance to run the given program from the start. The instance
+ * takes its own reference to the program and reuses its stack if it already
+ * had one, which makes this much cheaper than ijvm_load() for repeated runs.
+ *
+ * Returns  0 on success
+ *         -1 on failure
+ **/
+int ijvm_load_program(ijvm_t *m, ijvm_program_t *p);
+
+
+/**
+ * Frees all memory associated with the loaded program, keeping the handle
+ * itself usable for another ijvm_load().
+ **/
+void ijvm_unload(ijvm_t *m);
+
+
+/**
+ * Why ijvm_run_for() returned.
+ **/
+typedef enum ijvm_status {
+    IJVM_HALTED,      // The program finished
+    IJVM_OUT_OF_FUEL, // The budget ran out first
+    IJVM_BLOCKED      // IN has nothing to read yet
+} ijvm_status_t;
+
+
+/**
+ * Runs at most `budget` instructions, counted the way ijvm_step() counts
+ * them. Returns early when the program finishes, or before an IN that
+ * would have to wait for its input; calling it again carries on from
+ * there. Network instructions still wait as they do in ijvm_run().
+ **/
+ijvm_status_t ijvm_run_for(ijvm_t *m, uint64_t budget);
+
+
+/**
+ * See the functions with the same name (without the ijvm_ prefix) in ijvm.h.
+ **/
+bool ijvm_step(ijvm_t *m);
+void ijvm_run(ijvm_t *m);
+bool ijvm_finished(ijvm_t *m);
+word_t ijvm_tos(ijvm_t *m);
+word_t *ijvm_get_stack(ijvm_t *m);
+int ijvm_stack_size(ijvm_t *m);
+byte_t *ijvm_get_text(ijvm_t *m);
+int ijvm_text_size(ijvm_t *m);
+int ijvm_get_program_counter(ijvm_t *m);
+word_t ijvm_get_local_variable(ijvm_t *m, int i);
+word_t ijvm_get_constant(ijvm_t *m, int i);
+byte_t ijvm_get_instruction(ijvm_t *m);
+void ijvm_set_input(ijvm_t *m, FILE *f);
+void ijvm_set_output(ijvm_t *m, FILE *f);
+
+
+/**
+ * Makes IN read the `size` bytes at `data`, after which it reads 0 as at
+ * the end of a file. The memory is read in place and has to stay valid
+ * while the instance runs.
+ **/
+void ijvm_set_input_buffer(ijvm_t *m, const void *data, size_t size);
+
+
+/**
+ * Makes OUT write to the `size` bytes at `data`, from the start. Output
+ * that doesn't fit is dropped. The memory has to stay valid while the
+ * instance runs.
+ **/
+void ijvm_set_output_buffer(ijvm_t *m, void *data, size_t size);
+
+
+/**
+ * Returns the number of bytes OUT wrote to the buffer of the last
+ * ijvm_set_output_buffer(), or 0 when writing to a FILE.
+ **/
+size_t ijvm_output_size(ijvm_t *m);
+
+
+/**
+ * Hands output still buffered by the instance to its FILE. Output is also
+ * flushed at the end of ijvm_run() and ijvm_step(), by ijvm_set_output(),
+ * before IN waits for input, and when the instance is unloaded.
+ **/
+void ijvm_flush(ijvm_t *m);
+
+
+/**
+ * Lets NETBIND share its port with other processes that do the same
+ * (SO_REUSEPORT), with the kernel spreading connections between them.
+ * Takes effect for ports the instance binds after the call. While set,
+ * ijvm_load_program() keeps the bound ports open for the next run, so
+ * connections the kernel already queued on them are not lost.
+ **/
+void ijvm_set_reuseport(ijvm_t *m, bool reuseport);
+
+
+/**
+ * Returns the instance used by the functions in ijvm.h.
+ **/
+ijvm_t *ijvm_default(void);
+
+
+/**
+ * ijvm_run_for() and the in-memory I/O above, for the instance used by the
+ * functions in ijvm.h.
+ **/
+ijvm_status_t run_for(uint64_t budget);
+void set_input_buffer(const void *data, size_t size);
+void set_output_buffer(void *data, size_t size);
+size_t output_size(void);
+
+#endif //LIBIJVM_H
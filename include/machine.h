@@ -2,8 +2,37 @@
 #define MACHINE_H
 
 #include "ijvm.h"
+#include "libijvm.h"
+#include "program.h"
+#include "io.h"
+#include "metrics.h"
 
-typedef struct machine {
+// Extensions to the instruction set of ijvm.h
+#define OP_NEWARRAY       ((byte_t) 0xD1)
+#define OP_IALOAD         ((byte_t) 0xD2)
+#define OP_IASTORE        ((byte_t) 0xD3)
+#define OP_NETBIND        ((byte_t) 0xE1)
+#define OP_NETCONNECT     ((byte_t) 0xE2)
+#define OP_NETIN          ((byte_t) 0xE3)
+#define OP_NETOUT         ((byte_t) 0xE4)
+#define OP_NETCLOSE       ((byte_t) 0xE5)
+#define OP_SPAWN          ((byte_t) 0xE6)
+#define OP_YIELD          ((byte_t) 0xE7)
+
+#define STACK_SIZE 0x10000
+#define STACK_BYTES (sizeof(word_t) * STACK_SIZE)
+
+typedef struct fibers fibers_t;
+typedef struct net net_t;
+typedef struct heap heap_t;
+typedef struct opstats opstats_t;
+typedef struct profile profile_t;
+typedef struct edges edges_t;
+typedef struct ngrams ngrams_t;
+typedef struct trace trace_t;
+
+struct machine {
+    program_t *program; // Loaded program, shared with other machines
     byte_t *text;
     uint32_t text_size;
     byte_t *cpp; // Constant Pool Pointer
@@ -12,22 +41,76 @@ typedef struct machine {
     word_t *lv; // Local Variable Frame pointer
     word_t *stack;
     word_t *sp;
-    FILE *input;
-    FILE *output;
+    io_in_t in;
+    io_out_t out;
     bool halted;
     bool wide_index;
-} machine_t;
+    fibers_t *fibers; // Guest threads, NULL until the first SPAWN
+    net_t *net; // Sockets, NULL until the first network instruction
+    heap_t *heap; // Arrays, NULL until the first NEWARRAY
+    bool reuseport; // NETBIND shares its port with other processes
+    opstats_t *stats; // Opcode counters, NULL unless counting
+    profile_t *profile; // Method profile, NULL unless profiling
+    edges_t *edges; // Block and branch counters, NULL unless recording
+    ngrams_t *ngrams; // Opcode sequence counters, NULL unless counting
+    trace_t *trace; // Ring of executed instructions, NULL unless tracing
+    metrics_t metrics; // Always counted
+};
+
+typedef struct machine machine_t;
+
+word_t *stack_alloc(void);
+
+void stack_free(word_t *stack);
+
+/**
+ * Whether anything watches the instructions of the machine one by one, in
+ * which case it has to be stepped through the interpreter.
+ **/
+static inline bool machine_instrumented(const machine_t *m) {
+    return m->stats != NULL || m->profile != NULL || m->edges != NULL
+           || m->ngrams != NULL || m->trace != NULL;
+}
+
+/**
+ * Executes one instruction like ijvm_step(), but leaves the output in its
+ * buffer. For loops inside the library, which flush when they are done.
+ **/
+bool machine_step(machine_t *m);
+
+/**
+ * Finds the methods of up to max frames, the current one first, through
+ * the links INVOKEVIRTUAL leaves in every frame. Only reads what lies
+ * inside the stack, so it is safe from a signal handler, and gives up on
+ * machines with fibers. Sets truncated when there were more.
+ *
+ * Returns the number of methods found
+ **/
+uint32_t machine_frames(machine_t *m, uint32_t *methods, uint32_t max, bool *truncated);
+
+/**
+ * Returns the size of the instruction at pc of a text of size bytes, its
+ * operands included, as the interpreter steps over it.
+ **/
+uint32_t instruction_size(const byte_t *text, uint32_t size, uint32_t pc);
 
-byte_t *parse_block(FILE *fp, uint32_t *block_size);
+/**
+ * Raises the stack high-water mark to the depth at sp, for INVOKEVIRTUAL.
+ **/
+static inline void machine_stack_depth(machine_t *m, const word_t *sp) {
+    uint64_t depth = (uint64_t) (sp - m->stack) + 1;
+    if (depth > m->metrics.counts.max_stack)
+        m->metrics.counts.max_stack = depth;
+}
 
-void set_local_variable(int index, word_t value);
+void set_local_variable(machine_t *m, int index, word_t value);
 
-int8_t get_byte_operand(uint16_t index);
+int8_t get_byte_operand(machine_t *m, uint16_t index);
 
-uint16_t get_short_operand(uint16_t index);
+uint16_t get_short_operand(machine_t *m, uint16_t index);
 
-void push_stack(word_t value);
+void push_stack(machine_t *m, word_t value);
 
-word_t pop_stack(void);
+word_t pop_stack(machine_t *m);
 
 #endif //MACHINE_H
@@ -0,0 +1,96 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "libijvm.h"
+
+// Instructions between two publications during a long run
+#define METRICS_INTERVAL (1u << 24)
+
+/**
+ * What an instance has done since it was created, over every program it
+ * ran. There is no garbage collector: arrays live until the program is
+ * unloaded, so the live heap only shrinks then. The stack high-water mark
+ * is taken at every call and whenever the counters are published, so the
+ * words a long run pushes between calls may go unseen.
+ **/
+typedef struct ijvm_metrics {
+    uint64_t instructions; // Retired, by any engine or ijvm_step()
+    uint64_t calls; // INVOKEVIRTUAL
+    uint64_t max_stack; // Deepest the stack got, in words, out of stack_size
+    uint64_t stack_size;
+    uint64_t heap_live; // Bytes in the arrays of the loaded program
+    uint64_t heap_allocated; // Bytes ever allocated by NEWARRAY
+    uint64_t arrays; // NEWARRAY
+    uint64_t bytes_in; // IN
+    uint64_t bytes_out; // OUT
+    uint64_t net_in; // NETIN
+    uint64_t net_out; // NETOUT
+    uint64_t wall_ns; // Spent in ijvm_run() and ijvm_run_for()
+    uint64_t busy_ns; // Of wall_ns, less what runs spent waiting for input
+} ijvm_metrics_t;
+
+/**
+ * The counters of an instance, as kept by the thread running it, and two
+ * copies for everyone else. Publishing writes one copy and then the other,
+ * so readers always find one that isn't being written, even when they
+ * interrupt the writer.
+ **/
+typedef struct metrics {
+    ijvm_metrics_t counts;
+    ijvm_metrics_t published[2];
+    atomic_uint seq; // Odd while published[0] is being written
+    uint64_t wall_start; // Of the run in progress
+    uint64_t cpu_start;
+    bool cpu_clock; // Whether the run reads the CPU clock
+} metrics_t;
+
+
+/**
+ * Copies the counters as of the last time the instance published them:
+ * when a run returns, when a step finishes the program, and every
+ * METRICS_INTERVAL instructions of a long run or of steps. Doesn't lock or
+ * allocate, so it may be called from any thread or from a signal handler,
+ * even while the instance runs.
+ **/
+void ijvm_metrics(ijvm_t *m, ijvm_metrics_t *out);
+
+
+/**
+ * Formats the counters as one line of `key=value` pairs, followed by the
+ * instruction rate. Uses neither stdio nor the heap, so it may be called
+ * from a signal handler.
+ *
+ * Returns the length of the line, truncated to fit size
+ **/
+size_t ijvm_metrics_format(const ijvm_metrics_t *metrics, char *buf, size_t size);
+
+
+/**
+ * Writes the published counters of the instance to f, one per line.
+ **/
+void ijvm_metrics_report(ijvm_t *m, FILE *f);
+
+
+/**
+ * For the engine: brackets a run, timing it and publishing the counters
+ * when it returns. Runs that may wait take their busy time off the
+ * thread's CPU clock, which leaves the waits out; the others count their
+ * wall time as busy, as the CPU clock costs as much as a few hundred
+ * instructions to read.
+ **/
+void metrics_begin(ijvm_t *m, bool may_wait);
+
+void metrics_end(ijvm_t *m);
+
+
+/**
+ * For the engine: publishes the counters, and the time of the run so far.
+ * Only the thread running the instance may publish.
+ **/
+void metrics_publish(ijvm_t *m);
+
+#endif //METRICS_H
@@ -0,0 +1,85 @@
+#ifndef NET_H
+#define NET_H
+
+#include "machine.h"
+
+// Bytes read from a socket at once
+#define NET_READ_BUFFER_SIZE 0x4000
+// Pending output is written out once it grows past this many bytes
+#define NET_FLUSH_THRESHOLD 0x4000
+// NETOUT waits for the socket to drain beyond this many pending bytes
+#define NET_WRITE_LIMIT 0x100000
+
+/**
+ * A connection, behind a netref. All sockets are non-blocking, and both
+ * directions are buffered, so byte-at-a-time NETIN and NETOUT mostly stay
+ * out of the kernel.
+ **/
+typedef struct conn {
+    int fd;
+    byte_t rbuf[NET_READ_BUFFER_SIZE];
+    size_t rpos; // Next byte NETIN returns
+    size_t rlen;
+    byte_t *wbuf; // Written by NETOUT, not yet sent
+    size_t wlen;
+    size_t wcap;
+    bool eof;
+    bool dirty; // Whether it is on the list of connections with output
+    struct conn *next_dirty;
+} conn_t;
+
+/**
+ * A NETCONNECT still in progress, of a fiber parked until it completes.
+ **/
+typedef struct connecting {
+    int fd;
+    int fiber; // Id of the fiber, which runs the NETCONNECT again once woken
+    struct connecting *next;
+} connecting_t;
+
+typedef struct listener {
+    int fd;
+    uint16_t port;
+    struct listener *next;
+} listener_t;
+
+struct net {
+    conn_t **conns; // Indexed by netref - 1
+    size_t num_conns;
+    listener_t *listeners; // One per bound port, shared by all NETBINDs
+    conn_t *dirty; // Connections with pending output
+    connecting_t *connecting;
+    // Totals since the first network instruction of this run
+    uint64_t connections;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+};
+
+/**
+ * The network instructions. Each takes its operands from the top of the
+ * stack and returns false, leaving the stack and pc alone, if it had to
+ * wait and another fiber got to run in the meantime; the instruction then
+ * runs again when the fiber is woken.
+ *
+ * NETCONNECT connects without blocking, waiting for the outcome like the
+ * others wait for data. A failed NETBIND or NETCONNECT pushes netref 0.
+ * NETIN pushes 0 at the end of the stream or for an unknown netref.
+ **/
+bool net_bind(machine_t *m);
+bool net_connect(machine_t *m);
+bool net_in(machine_t *m);
+bool net_out(machine_t *m);
+bool net_close(machine_t *m);
+
+/**
+ * Flushes what is left and closes all connections, and those still being
+ * made, keeping the listeners for the next run. The totals start over.
+ **/
+void net_reset(machine_t *m);
+
+/**
+ * Flushes what is left and closes all connections and listeners.
+ **/
+void net_free(machine_t *m);
+
+#endif //NET_H
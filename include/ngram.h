@@ -0,0 +1,74 @@
+#ifndef NGRAM_H
+#define NGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "machine.h"
+#include "opstats.h"
+
+// Longest sequence counted
+#define NGRAM_MAX 3
+
+/**
+ * A sequence of n opcodes, and how often it occurred. Sequences only run
+ * through code that falls from one instruction to the next; a jump, call,
+ * return, taken branch or fiber switch ends one, as those are where a
+ * fused handler would have to stop anyway. WIDE stands for the whole
+ * widened instruction.
+ **/
+typedef struct ngram {
+    byte_t ops[NGRAM_MAX];
+    uint8_t n;
+    uint64_t count;
+} ngram_t;
+
+typedef struct ngrams ngrams_t;
+
+
+/**
+ * Starts counting the opcode pairs and triples the instance executes, and
+ * those in the text of every program it loads, from zero. A counting
+ * instance always steps through the interpreter.
+ *
+ * Returns  0 on success
+ *         -1 when out of memory
+ **/
+int ijvm_ngrams_enable(ijvm_t *m);
+
+
+/**
+ * Stops counting and drops the counters.
+ **/
+void ijvm_ngrams_disable(ijvm_t *m);
+
+
+/**
+ * Copies up to max of the n-grams of length n, 2 or 3, busiest first. The
+ * dynamic ones are those executed, the others those in the text.
+ *
+ * Returns the number copied, 0 if the instance isn't counting
+ **/
+size_t ijvm_ngrams(ijvm_t *m, int n, bool dynamic, ngram_t *out, size_t max);
+
+
+/**
+ * Writes the counters to f: a ranked table of the busiest n-grams of each
+ * kind as text, or all of them as JSON. Prints nothing if the instance
+ * isn't counting.
+ **/
+void ijvm_ngrams_report(ijvm_t *m, FILE *f, opstats_format_t format);
+
+
+/**
+ * Counts one executed instruction, op, which started at pc. Called by the
+ * interpreter after executing it.
+ **/
+void ngrams_step(machine_t *m, byte_t op, uint32_t pc);
+
+
+/**
+ * Starts a new sequence, and counts the text of the program just loaded.
+ **/
+void ngrams_restart(machine_t *m);
+
+#endif //NGRAM_H
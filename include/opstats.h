@@ -0,0 +1,81 @@
+#ifndef OPSTATS_H
+#define OPSTATS_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "libijvm.h"
+
+// One in this many executions of each opcode is timed
+#define OPSTATS_SAMPLE_RATE 64
+// Timing histogram buckets, by the log2 of the cycles a sample took
+#define OPSTATS_BUCKETS 32
+
+/**
+ * Per-opcode counters of an instance. Every executed instruction is
+ * counted; every OPSTATS_SAMPLE_RATE-th execution of an opcode is timed in
+ * cycles of the time stamp counter (nanoseconds where there is none), the
+ * handler alone.
+ **/
+typedef struct opstats {
+    uint64_t count[256];
+    uint64_t samples[256];
+    uint64_t cycles[256]; // Sum over the samples
+    uint64_t histogram[256][OPSTATS_BUCKETS];
+} opstats_t;
+
+typedef enum opstats_format {
+    OPSTATS_TEXT,
+    OPSTATS_JSON
+} opstats_format_t;
+
+
+/**
+ * Starts counting the instructions the instance executes, from zero. An
+ * instance that counts always steps through the interpreter, so each
+ * instruction is seen; one that doesn't pays a single check per run.
+ * Builds with -DIJVM_STATS count on every instance from the start.
+ *
+ * Returns  0 on success
+ *         -1 when out of memory
+ **/
+int ijvm_stats_enable(ijvm_t *m);
+
+
+/**
+ * Stops counting and drops the counters.
+ **/
+void ijvm_stats_disable(ijvm_t *m);
+
+
+/**
+ * Returns the counters of the instance, NULL if it isn't counting.
+ **/
+const opstats_t *ijvm_stats(ijvm_t *m);
+
+
+/**
+ * Writes the counters of the instance to f, busiest opcode first. Prints
+ * nothing if the instance isn't counting.
+ **/
+void ijvm_stats_report(ijvm_t *m, FILE *f, opstats_format_t format);
+
+
+/**
+ * Returns the mnemonic of an opcode, or NULL for a byte that isn't one.
+ **/
+const char *opcode_name(byte_t op);
+
+
+/**
+ * Reads the time stamp counter, or the monotonic clock in nanoseconds on
+ * machines without one.
+ **/
+uint64_t opstats_clock(void);
+
+
+/**
+ * Adds one timed execution of op to the counters.
+ **/
+void opstats_sample(opstats_t *s, byte_t op, uint64_t cycles);
+
+#endif //OPSTATS_H
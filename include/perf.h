@@ -0,0 +1,92 @@
+#ifndef PERF_H
+#define PERF_H
+
+#include "machine.h"
+
+// What ijvm_perf_enable() writes
+#define PERF_MAP     1 // /tmp/perf-<pid>.map
+#define PERF_JITDUMP 2 // jit-<pid>.dump, for perf inject --jit
+
+// Guest calls nested as native frames; deeper ones run in the frame of
+// the last method that got one
+#define PERF_MAX_DEPTH 1024
+
+#define JITDUMP_MAGIC   0x4A695444
+#define JITDUMP_VERSION 1
+#define JIT_CODE_LOAD   0
+
+/**
+ * Layout of a jitdump file, as perf reads it: this header, then records
+ * that each start with a jitdump_record_t.
+ **/
+typedef struct jitdump_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t total_size; // Of the header
+    uint32_t elf_mach;
+    uint32_t pad1;
+    uint32_t pid;
+    uint64_t timestamp;
+    uint64_t flags;
+} jitdump_header_t;
+
+typedef struct jitdump_record {
+    uint32_t id;
+    uint32_t total_size; // Of the record, what follows included
+    uint64_t timestamp;
+} jitdump_record_t;
+
+/**
+ * A JIT_CODE_LOAD record, followed by the name, NUL terminated, and the
+ * code itself.
+ **/
+typedef struct jitdump_code_load {
+    jitdump_record_t header;
+    uint32_t pid;
+    uint32_t tid;
+    uint64_t vma;
+    uint64_t code_addr;
+    uint64_t code_size;
+    uint64_t code_index;
+} jitdump_code_load_t;
+
+
+/**
+ * Makes guest methods show up in Linux perf, for the whole process. Every
+ * guest method gets a small trampoline of native code, named after it in
+ * the files `what` asks for, and machines run every guest call inside the
+ * trampoline of its method. Stack walks by frame pointer, as `perf record
+ * -g` does, then pass through one trampoline per guest frame.
+ *
+ * Like the instrumented modes, this steps through the interpreter. Machines
+ * with fibers run their fibers in the frame they were spawned from.
+ *
+ * Returns  0 on success
+ *         -1 on machines trampolines aren't written for (x86-64 and AArch64
+ *            are), or if a file can't be opened
+ **/
+int ijvm_perf_enable(int what);
+
+
+/**
+ * Stops running guest calls in trampolines, and closes the files. Their
+ * entries stay valid, as do the trampolines, for the life of the process.
+ **/
+void ijvm_perf_disable(void);
+
+
+/**
+ * Whether guest calls run in trampolines.
+ **/
+bool perf_active(void);
+
+
+/**
+ * Calls fn(arg) from the trampoline of the method at address `method` of
+ * p, or of its main code for PERF_MAIN, creating it on first use. Calls it
+ * directly if the trampoline can't be made.
+ **/
+#define PERF_MAIN UINT32_MAX
+void perf_call(program_t *p, uint32_t method, void (*fn)(void *), void *arg);
+
+#endif //PERF_H
@@ -0,0 +1,94 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "libijvm.h"
+
+typedef struct profile profile_t;
+
+/**
+ * What a folded-stack export weighs each stack by.
+ **/
+typedef enum profile_weight {
+    PROFILE_INSTRUCTIONS,
+    PROFILE_CYCLES
+} profile_weight_t;
+
+
+/**
+ * Starts attributing the instructions the instance executes, and the time
+ * they take, to guest methods. Frames are tracked as INVOKEVIRTUAL enters
+ * and IRETURN leaves them, building a tree of every call path taken; the
+ * code outside any method is the root, "main". Time is measured in cycles
+ * of the time stamp counter, per instruction.
+ *
+ * A profiling instance always steps through the interpreter. The profile
+ * covers everything it runs until disabled, restarting at the root with
+ * every program loaded. Fibers share one tree.
+ *
+ * Returns  0 on success
+ *         -1 when out of memory
+ **/
+int ijvm_profile_enable(ijvm_t *m);
+
+
+/**
+ * Stops profiling and drops the profile.
+ **/
+void ijvm_profile_disable(ijvm_t *m);
+
+
+/**
+ * Names methods after the symbol file at path, which holds one method per
+ * line: the address its constant points to and its name, separated by
+ * white space. Lines starting with # are skipped. Methods without a symbol
+ * are named after their address.
+ *
+ * Returns  0 on success
+ *         -1 if the file can't be read, or the instance isn't profiling
+ **/
+int ijvm_profile_load_symbols(ijvm_t *m, const char *path);
+
+
+/**
+ * Writes a table of every method to f, by inclusive instructions: calls,
+ * and exclusive and inclusive instructions and cycles. Recursive calls
+ * are counted once in the inclusive totals.
+ **/
+void ijvm_profile_report(ijvm_t *m, FILE *f);
+
+
+/**
+ * Writes one line per call path to f, its frames from the root separated
+ * by semicolons and followed by its weight, as flamegraph.pl reads it.
+ *
+ * Returns  0 on success
+ *         -1 if the instance isn't profiling
+ **/
+int ijvm_profile_write_folded(ijvm_t *m, FILE *f, profile_weight_t weight);
+
+
+/**
+ * Writes the profile to f as an uncompressed profile.proto, which pprof
+ * reads, with instructions and cycles as its two sample types.
+ *
+ * Returns  0 on success
+ *         -1 if the instance isn't profiling
+ **/
+int ijvm_profile_write_pprof(ijvm_t *m, FILE *f);
+
+
+/**
+ * Charges one executed instruction to the current method and follows the
+ * call or return it made. Called by the interpreter after executing op.
+ **/
+void profile_step(ijvm_t *m, byte_t op);
+
+
+/**
+ * Puts the profile back at its root, for a newly loaded program.
+ **/
+void profile_restart(ijvm_t *m);
+
+#endif //PROFILER_H
@@ -0,0 +1,72 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include "libijvm.h"
+
+/**
+ * A loaded .ijvm binary. Programs are immutable once loaded, so one program
+ * can back any number of machines on any number of threads; the reference
+ * count decides when its image is released.
+ *
+ * The text and constant pool point straight into the image of the file,
+ * which is mapped read-only where possible.
+ **/
+struct program {
+    byte_t *text;
+    uint32_t text_size;
+    byte_t *cpp; // Constant Pool Pointer
+    uint32_t cp_size; // Constant Pool Size
+    atomic_uint refcount;
+    // Instructions in the basic block starting at each pc, worked out by
+    // the engine on first entry; 0 until then
+    atomic_uint *blocks;
+    // Edge profile of earlier runs: blocks hottest first, branches by pc
+    struct edgeprof_block *hot_blocks;
+    uint32_t num_hot_blocks;
+    struct edgeprof_branch *branches;
+    uint32_t num_branches;
+    // Trampolines of its methods for perf, by address, main's at text_size
+    atomic_uintptr_t *_Atomic perf_stubs;
+    byte_t *image; // The whole binary
+    size_t image_size;
+    bool mapped; // Whether image is mmap'd rather than malloc'd
+    // Key in the image cache, for programs loaded from a file
+    bool cached;
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    struct program *next;
+};
+
+typedef struct program program_t;
+
+/**
+ * Creates a program from the complete image of a binary in memory. The
+ * program takes ownership of the image, which must be malloc'd, also when
+ * it turns out to be invalid.
+ * Returns NULL if the image is not a valid binary.
+ **/
+program_t *program_from_image(byte_t *image, size_t size);
+
+/**
+ * Like program_from_image(), for an image mapped with mmap().
+ **/
+program_t *program_from_mapping(byte_t *image, size_t size);
+
+/**
+ * Returns a 64-bit hash of the `size` bytes at `data`.
+ **/
+uint64_t hash_bytes(const byte_t *data, size_t size);
+
+/**
+ * Returns a hash of the whole binary, which names what is stored on disk
+ * about it.
+ **/
+uint64_t program_hash(const program_t *p);
+
+#endif //PROGRAM_H
@@ -0,0 +1,74 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "machine.h"
+
+// Samples per second of CPU time: low enough to leave on, and prime so it
+// doesn't beat with periodic work
+#define SAMPLER_DEFAULT_HZ 97
+// Frames of the guest call stack recorded per sample, innermost first
+#define SAMPLER_DEPTH 16
+// Samples the ring buffer holds until they are aggregated
+#define SAMPLER_RING_SIZE 0x4000
+// Milliseconds between two drains of the ring while sampling, far less than
+// even many busy threads take to fill it
+#define SAMPLER_DRAIN_MS 100
+
+/**
+ * The machine the engine runs on this thread, NULL outside of it. The
+ * engine publishes its pc at every basic block, and its lv at every call
+ * and return, so the sampler sees where the machine is.
+ **/
+extern _Thread_local machine_t *sampler_machine;
+
+
+/**
+ * Starts sampling the whole process, `hz` times per second of CPU time
+ * (0 for SAMPLER_DEFAULT_HZ), through setitimer(ITIMER_PROF). Each SIGPROF
+ * records the pc of the machine running on the interrupted thread and the
+ * methods on its call stack, found through the links INVOKEVIRTUAL leaves
+ * in every frame, into a lock-free ring buffer. Samples that land outside
+ * any machine are only counted. A thread of the sampler's own drains the
+ * ring into the aggregate every SAMPLER_DRAIN_MS, so it can be left on for
+ * as long as the process runs.
+ *
+ * Exact counting (opstats.h, profiler.h) steps every instruction; sampling
+ * leaves the engine as it is and costs one handler run per sample.
+ *
+ * Returns  0 on success
+ *         -1 if the timer or handler can't be set up, or already are
+ **/
+int sampler_start(unsigned int hz);
+
+
+/**
+ * Stops the timer and the draining thread, and aggregates what is left in
+ * the ring buffer.
+ **/
+void sampler_stop(void);
+
+
+/**
+ * Moves the samples in the ring buffer into the aggregate, as the draining
+ * thread, sampler_stop() and the writers below do. Takes a lock, so it may
+ * be called from any thread, but not from a signal handler.
+ **/
+void sampler_drain(void);
+
+
+/**
+ * Writes the hottest methods and pcs to f, by samples.
+ **/
+void sampler_report(FILE *f);
+
+
+/**
+ * Writes one line per sampled call stack to f, methods from the outermost
+ * separated by semicolons and followed by the number of samples, as
+ * flamegraph.pl reads it.
+ **/
+void sampler_write_folded(FILE *f);
+
+#endif //SAMPLER_H
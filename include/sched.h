@@ -0,0 +1,75 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+#include "libijvm.h"
+
+// Instructions a machine runs before the next one gets its turn
+#define SCHED_DEFAULT_SLICE 10000
+
+typedef struct sched sched_t;
+
+/**
+ * Called on a worker thread once a machine finished, with the argument
+ * given to sched_submit(). The machine is the caller's again from here on;
+ * the callback may destroy it.
+ **/
+typedef void (*sched_done_t)(ijvm_t *m, void *arg);
+
+/**
+ * Counters over the lifetime of a scheduler.
+ **/
+typedef struct sched_stats {
+    uint64_t slices; // Turns given to machines
+    uint64_t parks;  // Times a machine waited for input
+    uint64_t steals; // Machines a worker took from another worker
+    uint64_t finished;
+} sched_stats_t;
+
+
+/**
+ * Starts a scheduler that multiplexes any number of machines over
+ * num_workers threads (0 picks one per online CPU). Every worker has a
+ * queue of its own and steals from the others when it runs dry. Machines
+ * take turns of `slice` instructions (0 for SCHED_DEFAULT_SLICE), through
+ * ijvm_run_for().
+ *
+ * A machine whose IN would wait is parked on its input descriptor, off
+ * every queue, until there is something to read; parked machines cost no
+ * CPU time, so a scheduler can hold many more of them than it has workers.
+ * Machines parked on the same descriptor are all woken when it is readable,
+ * and those that find nothing left to read park again.
+ * Machines with fibers still wait inside their turn.
+ *
+ * Returns NULL on failure.
+ **/
+sched_t *sched_create(int num_workers, uint64_t slice);
+
+
+/**
+ * Hands a loaded machine to the scheduler, which runs it until it finishes
+ * and then calls `done` (if not NULL). The machine must not be touched by
+ * anyone else in the meantime.
+ *
+ * Returns  0 on success
+ *         -1 on failure
+ **/
+int sched_submit(sched_t *s, ijvm_t *m, sched_done_t done, void *arg);
+
+
+/**
+ * Waits until every machine submitted so far has finished.
+ **/
+void sched_wait(sched_t *s);
+
+
+void sched_get_stats(sched_t *s, sched_stats_t *stats);
+
+
+/**
+ * Stops the workers once their current turns end, and frees the scheduler.
+ * Machines that didn't finish are handed back without calling `done`.
+ **/
+void sched_destroy(sched_t *s);
+
+#endif //SCHED_H
@@ -0,0 +1,42 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Totals over all runs of all workers of a server.
+ **/
+typedef struct serve_stats {
+    uint64_t runs;      // Runs that ended, by halting or otherwise
+    uint64_t failures;  // Runs that crashed, and workers that could not be forked
+    uint64_t errors;    // Runs that ended in ERR
+    uint64_t instructions;
+    uint64_t connections;
+    uint64_t bytes_in;  // Bytes returned by NETIN
+    uint64_t bytes_out; // Bytes written by NETOUT
+} serve_stats_t;
+
+
+/**
+ * Serves a network program from num_workers pre-forked processes. Every
+ * worker runs the program over and over in its own machine, with NETBIND
+ * binding through SO_REUSEPORT so the kernel balances connections over the
+ * workers. Bound ports stay open between runs. A worker that crashes is
+ * replaced by a fresh one; workers that keep failing right away, and forks
+ * that fail, are retried after a delay. A run that ends in ERR, like one whose NETBIND
+ * failed, is rerun after a delay that doubles while its runs keep doing so.
+ *
+ * Runs until SIGINT or SIGTERM, then stops the workers and returns 0, or
+ * -1 if the binary can't be loaded or the server can't be set up. On SIGUSR1, and when stopping, the
+ * totals are written to `report`.
+ **/
+int ijvm_serve(const char *binary_path, int num_workers, FILE *report);
+
+
+/**
+ * Writes the totals in one line of text.
+ **/
+void serve_stats_print(const serve_stats_t *stats, FILE *fp);
+
+#endif //SERVE_H
@@ -0,0 +1,56 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "libijvm.h"
+
+/**
+ * A frozen copy of an instance: its program, registers and stack.
+ *
+ * On Linux the stack image lives in an anonymous memory file, and clones map
+ * it copy-on-write, so making a clone costs one mmap() no matter how deep
+ * the stack is; pages are only copied once a clone writes to them.
+ **/
+typedef struct snapshot ijvm_snapshot_t;
+
+
+/**
+ * Runs the instance until the program counter reaches pc.
+ * Returns true if pc was reached, false if the machine finished first.
+ **/
+bool ijvm_run_until(ijvm_t *m, uint32_t pc);
+
+
+/**
+ * Captures the current state of the instance, which must have a program
+ * loaded and must not have spawned any fibers or made any arrays. Pending
+ * output is flushed, but the instance is otherwise left untouched; input
+ * it read ahead is copied along.
+ * Returns NULL on failure.
+ **/
+ijvm_snapshot_t *ijvm_snapshot(ijvm_t *m);
+
+
+/**
+ * Creates a new instance in the state captured by the snapshot.
+ * Returns NULL on failure.
+ **/
+ijvm_t *ijvm_clone(ijvm_snapshot_t *s);
+
+
+/**
+ * Resets an existing instance to the state captured by the snapshot,
+ * reusing its stack mapping where possible. Its fibers, arrays and sockets
+ * are released first, as ijvm_load_program() does.
+ *
+ * Returns  0 on success
+ *         -1 on failure
+ **/
+int ijvm_restore_snapshot(ijvm_t *m, ijvm_snapshot_t *s);
+
+
+/**
+ * Frees the snapshot. Clones made from it stay valid.
+ **/
+void ijvm_snapshot_free(ijvm_snapshot_t *s);
+
+#endif //SNAPSHOT_H
@@ -0,0 +1,84 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include "machine.h"
+
+#define TRACE_MAGIC "IJVMTRCE"
+#define TRACE_VERSION 1
+// Records kept when the caller doesn't say, 32 MiB worth
+#define TRACE_DEFAULT_RECORDS 0x100000
+// Bytes of text recorded from the pc on, enough for the longest instruction
+#define TRACE_CODE 8
+
+/**
+ * One executed instruction. The pc and code are as the instruction was
+ * fetched, the top of stack and depth as it left them.
+ **/
+typedef struct trace_record {
+    uint64_t cycles; // Time stamp counter before executing, 0 unless stamped
+    uint32_t pc;
+    uint32_t depth; // Words on the stack
+    word_t tos;
+    uint32_t length; // Bytes of text in code, more than the instruction takes
+    byte_t code[TRACE_CODE];
+} trace_record_t;
+
+/**
+ * Layout of a trace file: this header, then capacity records, the last of
+ * which was written at (head - 1) % capacity. The file is mapped shared,
+ * so a trace survives the process that wrote it, also when it crashed.
+ **/
+typedef struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t capacity; // A power of two
+    uint32_t cycles; // Whether records are stamped
+    uint32_t reserved;
+    volatile uint64_t head; // Records written since tracing started
+    uint64_t unused[3];
+} trace_header_t;
+
+typedef struct trace trace_t;
+
+
+/**
+ * Starts recording every instruction the instance executes into a ring of
+ * the last `records` (rounded up to a power of two, TRACE_DEFAULT_RECORDS
+ * if 0) in the file at path, which is created or truncated. With `cycles`,
+ * records carry a time stamp counter reading. A tracing instance always
+ * steps through the interpreter.
+ *
+ * Returns  0 on success
+ *         -1 if the file can't be created or mapped
+ **/
+int ijvm_trace_enable(ijvm_t *m, const char *path, uint64_t records, bool cycles);
+
+
+/**
+ * Stops recording. The trace file stays as it is.
+ **/
+void ijvm_trace_disable(ijvm_t *m);
+
+
+/**
+ * Prints up to `last` of the newest records in the trace file at path to
+ * f, oldest first, as the lines DEBUG builds log, with the pc, top of stack
+ * and depth next to them. 0 prints all that were kept.
+ *
+ * Returns  0 on success
+ *         -1 if the file isn't a trace
+ **/
+int ijvm_trace_decode(const char *path, FILE *f, uint64_t last);
+
+
+/**
+ * Records one instruction around executing it: begin before, with the pc
+ * it starts at, end after.
+ **/
+void trace_begin(machine_t *m);
+void trace_end(machine_t *m);
+
+#endif //TRACE_H
@@ -0,0 +1,213 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "batch.h"
+#include "util.h"
+
+#define MANIFEST_LINE_SIZE 0x3000
+
+typedef struct deque {
+    pthread_mutex_t lock;
+    size_t top;    // Next job to steal
+    size_t bottom; // One past the next job to run locally
+} deque_t;
+
+typedef struct pool {
+    batch_job_t *jobs;
+    ijvm_program_t **programs; // Program of every job, shared between jobs
+    deque_t *deques;
+    int num_workers;
+} pool_t;
+
+typedef struct worker {
+    pool_t *pool;
+    int id;
+    bool started; // Has a thread of its own running worker_main()
+} worker_t;
+
+static bool take_job(deque_t *d, size_t *job, bool steal) {
+    bool found = false;
+    pthread_mutex_lock(&d->lock);
+    if (d->top < d->bottom) {
+        // Owners work from the bottom, thieves from the top, so they only
+        // contend over the very last job
+        *job = steal ? d->top++ : --d->bottom;
+        found = true;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return found;
+}
+
+static bool next_job(pool_t *pool, int id, size_t *job) {
+    if (take_job(&pool->deques[id], job, false))
+        return true;
+    for (int i = 1; i < pool->num_workers; i++) {
+        int victim = (id + i) % pool->num_workers;
+        if (take_job(&pool->deques[victim], job, true))
+            return true;
+    }
+    return false;
+}
+
+static int run_job(ijvm_t *m, ijvm_program_t *p, batch_job_t *job) {
+    if (p == NULL || ijvm_load_program(m, p) < 0)
+        return -1;
+    bool no_input = job->input == NULL || strcmp(job->input, "-") == 0;
+    FILE *in = fopen(no_input ? "/dev/null" : job->input, "rb");
+    FILE *out = fopen(job->output, "wb");
+    int res = -1;
+    if (in != NULL && out != NULL) {
+        ijvm_set_input(m, in);
+        ijvm_set_output(m, out);
+        ijvm_run(m);
+        res = 0;
+    }
+    if (in != NULL)
+        fclose(in);
+    if (out != NULL && fclose(out) != 0)
+        res = -1;
+    return res;
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    pool_t *pool = w->pool;
+    ijvm_t *m = ijvm_create();
+    size_t job;
+    while (m != NULL && next_job(pool, w->id, &job)) {
+        pool->jobs[job].status = run_job(m, pool->programs[job], &pool->jobs[job]);
+        log("batch: worker %d ran job %zu\n", w->id, job);
+    }
+    ijvm_destroy(m);
+    return NULL;
+}
+
+int batch_run(batch_job_t *jobs, size_t num_jobs, int num_threads) {
+    if (num_threads <= 0)
+        num_threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads <= 0)
+        num_threads = 1;
+    if ((size_t) num_threads > num_jobs)
+        num_threads = num_jobs > 0 ? (int) num_jobs : 1;
+
+    pool_t pool;
+    pool.jobs = jobs;
+    pool.num_workers = num_threads;
+    pool.programs = calloc(num_jobs + 1, sizeof(ijvm_program_t *));
+    pool.deques = calloc(num_threads, sizeof(deque_t));
+    worker_t *workers = calloc(num_threads, sizeof(worker_t));
+    pthread_t *threads = calloc(num_threads, sizeof(pthread_t));
+    size_t *loaded = calloc(num_jobs + 1, sizeof(size_t)); // First job of each program
+    if (pool.programs == NULL || pool.deques == NULL || workers == NULL || threads == NULL
+        || loaded == NULL) {
+        free(loaded);
+        free(threads);
+        free(workers);
+        free(pool.deques);
+        free(pool.programs);
+        return -1;
+    }
+
+    // Load each distinct program once, jobs share it by reference
+    size_t num_loaded = 0;
+    for (size_t i = 0; i < num_jobs; i++) {
+        size_t j = 0;
+        while (j < num_loaded && strcmp(jobs[i].program, jobs[loaded[j]].program) != 0)
+            j++;
+        if (j == num_loaded) {
+            loaded[num_loaded++] = i;
+            pool.programs[i] = ijvm_program_load(jobs[i].program);
+        } else {
+            pool.programs[i] = pool.programs[loaded[j]];
+        }
+        jobs[i].status = -1;
+    }
+
+    // Hand every worker an equal contiguous share of the jobs
+    for (int i = 0; i < num_threads; i++) {
+        pthread_mutex_init(&pool.deques[i].lock, NULL);
+        pool.deques[i].top = num_jobs * i / num_threads;
+        pool.deques[i].bottom = num_jobs * (i + 1) / num_threads;
+        workers[i].pool = &pool;
+        workers[i].id = i;
+    }
+    // A worker whose thread can't be started leaves its share to be stolen
+    // by the others, so the jobs run on fewer threads
+    for (int i = 1; i < num_threads; i++)
+        workers[i].started = pthread_create(&threads[i], NULL, worker_main, &workers[i]) == 0;
+    // The calling thread is worker 0
+    worker_main(&workers[0]);
+    for (int i = 1; i < num_threads; i++) {
+        if (workers[i].started)
+            pthread_join(threads[i], NULL);
+    }
+
+    int failed = 0;
+    for (size_t i = 0; i < num_jobs; i++) {
+        if (jobs[i].status != 0)
+            failed++;
+    }
+    for (size_t i = 0; i < num_loaded; i++)
+        ijvm_program_release(pool.programs[loaded[i]]);
+    for (int i = 0; i < num_threads; i++)
+        pthread_mutex_destroy(&pool.deques[i].lock);
+    free(loaded);
+    free(threads);
+    free(workers);
+    free(pool.deques);
+    free(pool.programs);
+    return failed;
+}
+
+int batch_run_manifest(const char *manifest_path, int num_threads) {
+    FILE *fp = fopen(manifest_path, "r");
+    if (fp == NULL)
+        return -1;
+    char line[MANIFEST_LINE_SIZE];
+    size_t num_jobs = 0, capacity = 16;
+    batch_job_t *jobs = malloc(sizeof(batch_job_t) * capacity);
+    int res = jobs != NULL ? 0 : -1;
+    while (res == 0 && fgets(line, sizeof(line), fp) != NULL) {
+        char *save;
+        char *program = strtok_r(line, " \t\r\n", &save);
+        if (program == NULL || program[0] == '#')
+            continue;
+        char *input = strtok_r(NULL, " \t\r\n", &save);
+        char *output = strtok_r(NULL, " \t\r\n", &save);
+        if (output == NULL) {
+            fprintf(stderr, "%s: expected '<program> <input|-> <output>'\n", manifest_path);
+            res = -1;
+            break;
+        }
+        if (num_jobs == capacity) {
+            batch_job_t *grown = realloc(jobs, sizeof(batch_job_t) * capacity * 2);
+            if (grown == NULL) {
+                res = -1;
+                break;
+            }
+            jobs = grown;
+            capacity *= 2;
+        }
+        jobs[num_jobs].program = strdup(program);
+        jobs[num_jobs].input = strdup(input);
+        jobs[num_jobs].output = strdup(output);
+        // Counted either way, so that whatever was copied is freed
+        num_jobs++;
+        if (jobs[num_jobs - 1].program == NULL || jobs[num_jobs - 1].input == NULL
+            || jobs[num_jobs - 1].output == NULL)
+            res = -1;
+    }
+    fclose(fp);
+
+    if (res == 0)
+        res = batch_run(jobs, num_jobs, num_threads);
+    for (size_t i = 0; i < num_jobs; i++) {
+        free((char *) jobs[i].program);
+        free((char *) jobs[i].input);
+        free((char *) jobs[i].output);
+    }
+    free(jobs);
+    return res;
+}
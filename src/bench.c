@@ -0,0 +1,274 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "bench.h"
+#include "metrics.h"
+
+#define BASELINE_LINE_SIZE 0x400
+
+const bench_case_t bench_default_cases[] = {
+    { "mandelbread", "files/advanced/mandelbread.ijvm", NULL },
+    { "bfi2-mandelbrot", "files/bonus/bfi2.ijvm", "files/bonus/brainfuck/mandelbrot.b" },
+    { "test-wide2", "files/advanced/test-wide2.ijvm", NULL },
+    { "Tanenbaum", "files/advanced/Tanenbaum.ijvm", NULL },
+};
+const size_t bench_num_default_cases = sizeof(bench_default_cases) / sizeof(bench_case_t);
+
+static const char *engine_names[BENCH_ENGINES] = { "fast", "step" };
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// Loads and runs the case once for at most budget instructions, adding
+// what it ran to instructions
+static int run_once(ijvm_t *m, const bench_case_t *c, bench_engine_t engine, uint64_t budget,
+                    FILE *out, uint64_t *instructions, uint64_t *load_ns, hwcounters_t *hw) {
+    uint64_t start = now_ns();
+    if (ijvm_load(m, c->binary) < 0)
+        return -1;
+    *load_ns += now_ns() - start;
+    FILE *in = fopen(c->input != NULL ? c->input : "/dev/null", "rb");
+    if (in == NULL)
+        return -1;
+    ijvm_set_input(m, in);
+    ijvm_set_output(m, out);
+    if (hw != NULL)
+        hwcounters_start(hw);
+    if (engine == BENCH_FAST) {
+        ijvm_metrics_t before, after;
+        ijvm_metrics(m, &before);
+        ijvm_run_for(m, budget);
+        ijvm_metrics(m, &after);
+        *instructions += after.instructions - before.instructions;
+    } else {
+        // Steps publish no metrics until the program is done
+        uint64_t steps = 0;
+        while (steps < budget && !ijvm_finished(m)) {
+            ijvm_step(m);
+            steps++;
+        }
+        *instructions += steps;
+    }
+    if (hw != NULL)
+        hwcounters_stop(hw);
+    // The next load takes the input back to stdin, which isn't ours
+    ijvm_set_input(m, stdin);
+    fclose(in);
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+// Runs the repetitions of a case, in the child measuring it
+static void measure(const bench_case_t *c, bench_engine_t engine, int repetitions,
+                    bench_result_t *r) {
+    uint64_t minimum = engine == BENCH_FAST ? BENCH_MIN_INSTRUCTIONS : BENCH_MIN_INSTRUCTIONS / 10;
+    double *samples = malloc(sizeof(double) * (size_t) repetitions);
+    ijvm_t *m = ijvm_create();
+    FILE *out = fopen("/dev/null", "wb");
+    r->status = samples == NULL || m == NULL || out == NULL ? -1 : 0;
+    uint64_t load_ns = 0, loads = 0, counted = 0;
+    hwcounters_t hw;
+    hwcounters_open(&hw);
+    for (int rep = -BENCH_WARMUPS; rep < repetitions && r->status == 0; rep++) {
+        uint64_t instructions = 0, runs = 0, ignored = 0;
+        uint64_t start = now_ns();
+        while (instructions < minimum && now_ns() - start < BENCH_REPETITION_NS && r->status == 0) {
+            r->status = run_once(m, c, engine, minimum - instructions, out, &instructions,
+                                 rep < 0 ? &ignored : &load_ns, rep < 0 ? NULL : &hw);
+            runs++;
+            // A program that runs nothing would never get there
+            if (instructions == 0)
+                r->status = -1;
+        }
+        uint64_t elapsed = now_ns() - start;
+        if (rep < 0 || r->status != 0)
+            continue;
+        samples[rep] = (double) elapsed / (double) instructions;
+        r->instructions = instructions;
+        r->runs = runs;
+        loads += runs;
+        counted += instructions;
+    }
+    if (r->status == 0) {
+        qsort(samples, (size_t) repetitions, sizeof(double), compare_double);
+        r->ns_per_instruction = samples[repetitions / 2];
+        r->load_ns = (double) load_ns / (double) loads;
+        for (int i = 0; i < HWC_EVENTS; i++)
+            r->events[i] = hwcounters_counted(&hw, (hwc_event_t) i) ? (double) hw.values[i] / (double) counted : -1;
+    }
+    hwcounters_close(&hw);
+    ijvm_destroy(m);
+    if (out != NULL)
+        fclose(out);
+    free(samples);
+}
+
+int bench_run(const bench_case_t *cases, size_t num_cases, int repetitions, bench_result_t *out) {
+    if (repetitions <= 0)
+        repetitions = BENCH_REPETITIONS;
+    int failed = 0;
+    for (size_t i = 0; i < num_cases; i++) {
+        for (int engine = 0; engine < BENCH_ENGINES; engine++) {
+            bench_result_t *r = &out[i * BENCH_ENGINES + engine];
+            memset(r, 0, sizeof(*r));
+            r->name = cases[i].name;
+            r->engine = engine;
+            r->status = -1;
+            int fds[2];
+            if (pipe(fds) < 0) {
+                failed++;
+                continue;
+            }
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(fds[0]);
+                bench_result_t result = *r;
+                measure(&cases[i], engine, repetitions, &result);
+                ssize_t written = write(fds[1], &result, sizeof(result));
+                _exit(written == (ssize_t) sizeof(result) ? 0 : 1);
+            }
+            close(fds[1]);
+            bench_result_t result;
+            bool received = pid > 0 && read(fds[0], &result, sizeof(result)) == (ssize_t) sizeof(result);
+            close(fds[0]);
+            int status;
+            struct rusage usage;
+            if (pid > 0 && wait4(pid, &status, 0, &usage) == pid && received && result.status == 0) {
+                r->instructions = result.instructions;
+                r->runs = result.runs;
+                r->ns_per_instruction = result.ns_per_instruction;
+                r->load_ns = result.load_ns;
+                r->peak_rss_kb = usage.ru_maxrss;
+                memcpy(r->events, result.events, sizeof(r->events));
+                r->status = 0;
+            }
+            if (r->status != 0)
+                failed++;
+        }
+    }
+    return failed;
+}
+
+void bench_write_json(FILE *f, const bench_result_t *results, size_t n) {
+    fprintf(f, "[\n");
+    bool first = true;
+    for (size_t i = 0; i < n; i++) {
+        const bench_result_t *r = &results[i];
+        if (r->status != 0)
+            continue;
+        fprintf(f, "%s  {\"name\": \"%s\", \"engine\": \"%s\", \"instructions\": %llu, \"runs\": %llu, "
+                   "\"ns_per_instruction\": %.4f, \"instructions_per_second\": %.0f, "
+                   "\"load_ns\": %.0f, \"peak_rss_kb\": %ld",
+                first ? "" : ",\n", r->name, engine_names[r->engine],
+                (unsigned long long) r->instructions, (unsigned long long) r->runs,
+                r->ns_per_instruction, 1e9 / r->ns_per_instruction, r->load_ns, r->peak_rss_kb);
+        for (int e = 0; e < HWC_EVENTS; e++)
+            if (r->events[e] >= 0)
+                fprintf(f, ", \"%s_per_instruction\": %.4f", hwc_event_names[e], r->events[e]);
+        fprintf(f, "}");
+        first = false;
+    }
+    fprintf(f, "\n]\n");
+}
+
+// Copies the string value of key in a line of bench_write_json() to value
+static bool string_field(const char *line, const char *key, char *value, size_t size) {
+    const char *at = strstr(line, key);
+    if (at == NULL || size == 0)
+        return false;
+    at += strlen(key);
+    size_t len = strcspn(at, "\"");
+    if (at[len] != '"' || len >= size)
+        return false;
+    memcpy(value, at, len);
+    value[len] = '\0';
+    return true;
+}
+
+// Finds the baseline of a result, 0 if there is none
+static double baseline_of(FILE *baseline, const bench_result_t *r) {
+    char line[BASELINE_LINE_SIZE], name[256], engine[16];
+    rewind(baseline);
+    while (fgets(line, sizeof(line), baseline) != NULL) {
+        const char *ns = strstr(line, "\"ns_per_instruction\": ");
+        if (ns != NULL && string_field(line, "\"name\": \"", name, sizeof(name))
+            && string_field(line, "\"engine\": \"", engine, sizeof(engine))
+            && strcmp(name, r->name) == 0 && strcmp(engine, engine_names[r->engine]) == 0)
+            return strtod(ns + strlen("\"ns_per_instruction\": "), NULL);
+    }
+    return 0;
+}
+
+// Writes the table of events per instruction, if any were counted
+static void report_events(FILE *f, const bench_result_t *results, size_t n) {
+    bool any = false;
+    for (size_t i = 0; i < n; i++)
+        for (int e = 0; e < HWC_EVENTS; e++)
+            any |= results[i].status == 0 && results[i].events[e] >= 0;
+    if (!any)
+        return;
+    fprintf(f, "\n%-20s %-6s", "per instruction", "engine");
+    for (int e = 0; e < HWC_EVENTS; e++)
+        fprintf(f, " %14s", hwc_event_names[e]);
+    fprintf(f, "\n");
+    for (size_t i = 0; i < n; i++) {
+        const bench_result_t *r = &results[i];
+        if (r->status != 0)
+            continue;
+        fprintf(f, "%-20s %-6s", r->name, engine_names[r->engine]);
+        for (int e = 0; e < HWC_EVENTS; e++) {
+            if (r->events[e] >= 0)
+                fprintf(f, " %14.4f", r->events[e]);
+            else
+                fprintf(f, " %14s", "-");
+        }
+        fprintf(f, "\n");
+    }
+}
+
+int bench_report(FILE *f, const bench_result_t *results, size_t n, const char *baseline,
+                 double threshold) {
+    FILE *base = NULL;
+    if (baseline != NULL && (base = fopen(baseline, "r")) == NULL)
+        return -1;
+    int regressions = 0;
+    fprintf(f, "%-20s %-6s %12s %10s %12s %10s", "benchmark", "engine", "Minstr/s", "ns/instr",
+            "load us", "rss KB");
+    if (base != NULL)
+        fprintf(f, " %10s %8s", "baseline", "change");
+    fprintf(f, "\n");
+    for (size_t i = 0; i < n; i++) {
+        const bench_result_t *r = &results[i];
+        if (r->status != 0) {
+            fprintf(f, "%-20s %-6s failed\n", r->name, engine_names[r->engine]);
+            continue;
+        }
+        fprintf(f, "%-20s %-6s %12.1f %10.3f %12.1f %10ld", r->name, engine_names[r->engine],
+                1e3 / r->ns_per_instruction, r->ns_per_instruction, r->load_ns / 1e3,
+                r->peak_rss_kb);
+        double before = base != NULL ? baseline_of(base, r) : 0;
+        if (before > 0) {
+            double change = 100.0 * (r->ns_per_instruction - before) / before;
+            bool regressed = change > threshold;
+            regressions += regressed;
+            fprintf(f, " %10.3f %+7.1f%%%s", before, change, regressed ? "  REGRESSION" : "");
+        }
+        fprintf(f, "\n");
+    }
+    if (base != NULL)
+        fclose(base);
+    report_events(f, results, n);
+    return regressions;
+}
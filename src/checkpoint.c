@@ -0,0 +1,242 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#include "machine.h"
+#include "fiber.h"
+#include "heap.h"
+#include "net.h"
+#include "util.h"
+
+#define BYTE_ORDER_MARK 0x01020304
+
+static uint64_t page_align(uint64_t n, uint64_t page) {
+    return (n + page - 1) / page * page;
+}
+
+static bool write_at(int fd, const void *data, size_t size, uint64_t offset) {
+    const byte_t *p = data;
+    while (size > 0) {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static int64_t input_offset(machine_t *m) {
+    io_in_t *in = &m->in;
+    if (in->fp == NULL)
+        return in->data != NULL ? (int64_t) in->pos : -1;
+    if (in->fd >= 0)
+        return -1;
+    // The FILE is ahead by what was read but not taken yet
+    off_t off = ftello(in->fp);
+    return off < 0 ? -1 : (int64_t) (off - (in->len - in->pos));
+}
+
+static int64_t output_offset(machine_t *m) {
+    io_out_t *out = &m->out;
+    if (out->fp == NULL)
+        return out->data != NULL ? (int64_t) out->len : -1;
+    off_t off = ftello(out->fp);
+    return off < 0 ? -1 : (int64_t) off;
+}
+
+static bool write_sections(int fd, machine_t *m, checkpoint_header_t *h) {
+    if (!write_at(fd, h, sizeof(*h), 0)
+        || !write_at(fd, m->program->image, h->image_size, h->image_offset)
+        || !write_at(fd, m->stack, h->stack_size, h->stack_offset))
+        return false;
+    uint64_t offset = h->heap_offset;
+    for (uint64_t i = 0; i < h->num_arrays; i++) {
+        // An array is its size followed by its words already
+        array_t *a = m->heap->arrays[i];
+        size_t size = sizeof(array_t) + sizeof(word_t) * (size_t) a->size;
+        if (!write_at(fd, a, size, offset))
+            return false;
+        offset += size;
+    }
+    // Pads the last section to a whole page, as mapping needs
+    return ftruncate(fd, page_align(h->heap_offset + h->heap_size, h->page_size)) == 0;
+}
+
+int ijvm_checkpoint(ijvm_t *m, const char *path) {
+    if (m->program == NULL || m->fibers != NULL || m->net != NULL)
+        return -1;
+    io_flush(&m->out);
+    fflush(m->out.fp);
+
+    checkpoint_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.byte_order = BYTE_ORDER_MARK;
+    h.page_size = (uint32_t) sysconf(_SC_PAGESIZE);
+    h.pc = m->pc;
+    h.sp = m->sp - m->stack;
+    h.lv = m->lv - m->stack;
+    h.halted = m->halted;
+    h.wide_index = m->wide_index;
+    h.input_offset = input_offset(m);
+    h.output_offset = output_offset(m);
+    h.image_offset = page_align(sizeof(h), h.page_size);
+    h.image_size = m->program->image_size;
+    h.stack_offset = page_align(h.image_offset + h.image_size, h.page_size);
+    h.stack_size = sizeof(word_t) * (h.sp + 1);
+    h.heap_offset = page_align(h.stack_offset + h.stack_size, h.page_size);
+    if (m->heap != NULL) {
+        h.num_arrays = m->heap->num_arrays;
+        for (size_t i = 0; i < m->heap->num_arrays; i++)
+            h.heap_size += sizeof(array_t) + sizeof(word_t) * (size_t) m->heap->arrays[i]->size;
+    }
+
+    size_t len = strlen(path);
+    char *tmp = malloc(len + 5);
+    if (tmp == NULL)
+        return -1;
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".tmp", 5);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write_sections(fd, m, &h) && fsync(fd) == 0;
+    if (fd >= 0 && close(fd) != 0)
+        ok = false;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok)
+        unlink(tmp);
+    free(tmp);
+    if (ok)
+        log("checkpoint: saved pc %u, %u words of stack, %llu arrays to %s\n",
+            h.pc, h.sp + 1, (unsigned long long) h.num_arrays, path);
+    return ok ? 0 : -1;
+}
+
+static bool valid_header(const checkpoint_header_t *h, uint64_t file_size) {
+    uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+    if (memcmp(h->magic, CHECKPOINT_MAGIC, sizeof(h->magic)) != 0
+        || h->version != CHECKPOINT_VERSION || h->byte_order != BYTE_ORDER_MARK)
+        return false;
+    // Mapping needs sections on boundaries of this machine's pages
+    if (h->image_offset % page || h->stack_offset % page || h->heap_offset % page)
+        return false;
+    if (h->sp >= STACK_SIZE || h->lv > h->sp || h->stack_size != sizeof(word_t) * (h->sp + 1))
+        return false;
+    return h->image_size > 0
+           && h->image_offset + h->image_size <= file_size
+           && h->stack_offset + page_align(h->stack_size, page) <= file_size
+           && h->heap_offset + h->heap_size <= file_size;
+}
+
+int ijvm_restore(ijvm_t *m, const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    checkpoint_header_t h;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t) sizeof(h)
+        || !valid_header(&h, st.st_size)) {
+        close(fd);
+        return -1;
+    }
+
+    // Map everything first, so a failure leaves the instance alone
+    program_t *p = NULL;
+    void *image = mmap(NULL, h.image_size, PROT_READ, MAP_PRIVATE, fd, h.image_offset);
+    if (image != MAP_FAILED)
+        p = program_from_mapping(image, h.image_size);
+    word_t *stack = p != NULL && h.pc <= p->text_size ? stack_alloc() : NULL;
+    if (stack != NULL) {
+        size_t size = page_align(h.stack_size, sysconf(_SC_PAGESIZE));
+        if (mmap(stack, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                 fd, h.stack_offset) == MAP_FAILED) {
+            stack_free(stack);
+            stack = NULL;
+        }
+    }
+    machine_t arrays;
+    memset(&arrays, 0, sizeof(arrays));
+    bool ok = stack != NULL;
+    if (ok && h.num_arrays > 0) {
+        void *arena = mmap(NULL, h.heap_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, h.heap_offset);
+        ok = arena != MAP_FAILED && heap_adopt(&arrays, arena, h.heap_size, h.num_arrays) == 0;
+    }
+    close(fd);
+    if (!ok) {
+        stack_free(stack);
+        ijvm_program_release(p);
+        return -1;
+    }
+
+    fibers_free(m);
+    net_free(m);
+    heap_free(m);
+    m->heap = arrays.heap;
+    ijvm_program_release(m->program);
+    m->program = p;
+    m->text = p->text;
+    m->text_size = p->text_size;
+    m->cpp = p->cpp;
+    m->cp_size = p->cp_size;
+    stack_free(m->stack);
+    m->stack = stack;
+    m->pc = h.pc;
+    m->sp = stack + h.sp;
+    m->lv = stack + h.lv;
+    m->halted = h.halted;
+    m->wide_index = h.wide_index;
+
+    // Pick up the input and output where the saved machine left them
+    io_in_t *in = &m->in;
+    if (h.input_offset >= 0 && in->fp == NULL && in->data != NULL) {
+        in->pos = (uint64_t) h.input_offset < in->len ? (size_t) h.input_offset : in->len;
+    } else if (h.input_offset >= 0 && in->fp != NULL && in->fd < 0
+               && fseeko(in->fp, h.input_offset, SEEK_SET) == 0) {
+        // Drops what was read ahead from the old position
+        io_in_file(in, in->fp);
+    }
+    io_out_t *out = &m->out;
+    io_flush(out);
+    if (h.output_offset >= 0 && out->fp == NULL && out->data != NULL)
+        out->len = (uint64_t) h.output_offset < out->cap ? (size_t) h.output_offset : out->cap;
+    else if (h.output_offset >= 0 && out->fp != NULL)
+        fseeko(out->fp, h.output_offset, SEEK_SET);
+    log("checkpoint: restored pc %u from %s\n", h.pc, path);
+    return 0;
+}
+
+int checkpoint_run(const char *binary_path, const char *path, uint64_t interval) {
+    ijvm_t *m = ijvm_create();
+    if (m == NULL)
+        return -1;
+    // Attached before the restore, which moves them to where the saved run
+    // left off
+    ijvm_set_input(m, stdin);
+    ijvm_set_output(m, stdout);
+    if (ijvm_restore(m, path) == 0) {
+        fprintf(stderr, "Resuming from checkpoint %s\n", path);
+    } else if (ijvm_load(m, binary_path) < 0) {
+        ijvm_destroy(m);
+        return -1;
+    }
+    ijvm_status_t res;
+    while ((res = ijvm_run_for(m, interval)) != IJVM_HALTED) {
+        if (ijvm_checkpoint(m, path) < 0)
+            fprintf(stderr, "Couldn't write checkpoint %s\n", path);
+        // Waits for the input run_for() wouldn't wait for
+        if (res == IJVM_BLOCKED)
+            ijvm_step(m);
+    }
+    unlink(path);
+    ijvm_destroy(m);
+    return 0;
+}
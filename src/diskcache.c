@@ -0,0 +1,112 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "diskcache.h"
+#include "util.h"
+
+static char *cache_dir;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void ijvm_set_cache_dir(const char *dir) {
+    char *copy = dir == NULL ? NULL : strdup(dir);
+    pthread_mutex_lock(&dir_lock);
+    free(cache_dir);
+    cache_dir = copy;
+    pthread_mutex_unlock(&dir_lock);
+}
+
+// The cache file of the source, or NULL while there is no cache directory
+static char *cache_path(uint64_t source_hash, char **dir) {
+    pthread_mutex_lock(&dir_lock);
+    *dir = cache_dir == NULL ? NULL : strdup(cache_dir);
+    pthread_mutex_unlock(&dir_lock);
+    if (*dir == NULL)
+        return NULL;
+    char *path = malloc(strlen(*dir) + 32);
+    if (path != NULL)
+        sprintf(path, "%s/%016llx.ijvmc", *dir, (unsigned long long) source_hash);
+    return path;
+}
+
+program_t *diskcache_load(uint64_t source_hash, size_t source_size) {
+    char *dir;
+    char *path = cache_path(source_hash, &dir);
+    int fd = path == NULL ? -1 : open(path, O_RDONLY | O_CLOEXEC);
+    free(dir);
+    if (fd < 0) {
+        free(path);
+        return NULL;
+    }
+    diskcache_header_t h;
+    struct stat cst;
+    uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+    bool ok = fstat(fd, &cst) == 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)
+              && memcmp(h.magic, DISKCACHE_MAGIC, sizeof(h.magic)) == 0
+              && h.format == DISKCACHE_FORMAT && h.version == DISKCACHE_VERSION
+              && h.source_hash == source_hash && h.source_size == source_size
+              && h.image_offset % page == 0 && h.image_offset >= sizeof(h) && h.image_size > 0
+              && h.image_offset + h.image_size <= (uint64_t) cst.st_size;
+    void *image = MAP_FAILED;
+    if (ok)
+        image = mmap(NULL, h.image_size, PROT_READ, MAP_PRIVATE, fd, (off_t) h.image_offset);
+    close(fd);
+    program_t *p = image == MAP_FAILED ? NULL : program_from_mapping(image, h.image_size);
+    if (p != NULL)
+        log("diskcache: binary of the source mapped from %s\n", path);
+    free(path);
+    return p;
+}
+
+void diskcache_store(uint64_t source_hash, size_t source_size, const byte_t *image, size_t size) {
+    uint64_t page = (uint64_t) sysconf(_SC_PAGESIZE);
+    diskcache_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DISKCACHE_MAGIC, sizeof(h.magic));
+    h.format = DISKCACHE_FORMAT;
+    h.version = DISKCACHE_VERSION;
+    h.source_hash = source_hash;
+    h.source_size = source_size;
+    h.image_offset = (sizeof(h) + page - 1) / page * page;
+    h.image_size = size;
+    char *dir;
+    char *path = cache_path(source_hash, &dir);
+    if (path == NULL || (mkdir(dir, 0755) < 0 && errno != EEXIST)) {
+        free(path);
+        free(dir);
+        return;
+    }
+
+    // Written aside and renamed into place, so readers only ever see
+    // complete files, also when processes race to store the same source
+    char *tmp = malloc(strlen(dir) + 16);
+    int fd = -1;
+    if (tmp != NULL) {
+        sprintf(tmp, "%s/.tmp-XXXXXX", dir);
+        fd = mkstemp(tmp);
+    }
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+    } else {
+        bool ok = fwrite(&h, sizeof(h), 1, fp) == 1
+                  && fseek(fp, (long) h.image_offset, SEEK_SET) == 0
+                  && fwrite(image, 1, size, fp) == size;
+        if (fclose(fp) != 0)
+            ok = false;
+        if (!ok || chmod(tmp, 0644) < 0 || rename(tmp, path) < 0)
+            unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+    free(dir);
+}
@@ -0,0 +1,320 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "edgeprof.h"
+#include "engine.h"
+#include "util.h"
+
+static char *profile_dir;
+static pthread_mutex_t dir_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void ijvm_set_profile_dir(const char *dir) {
+    char *copy = dir == NULL ? NULL : strdup(dir);
+    pthread_mutex_lock(&dir_lock);
+    free(profile_dir);
+    profile_dir = copy;
+    pthread_mutex_unlock(&dir_lock);
+}
+
+static char *get_profile_dir(void) {
+    pthread_mutex_lock(&dir_lock);
+    char *dir = profile_dir == NULL ? NULL : strdup(profile_dir);
+    pthread_mutex_unlock(&dir_lock);
+    return dir;
+}
+
+static void free_counters(edges_t *e) {
+    free(e->entries);
+    free(e->taken);
+    free(e->not_taken);
+    e->entries = e->taken = e->not_taken = NULL;
+    ijvm_program_release(e->program);
+    e->program = NULL;
+}
+
+// Sets up counters for the program the machine runs, if any
+static int start_counting(machine_t *m) {
+    edges_t *e = m->edges;
+    if (m->program == NULL)
+        return 0;
+    size_t n = (size_t) m->program->text_size + 1;
+    e->entries = calloc(n, sizeof(uint64_t));
+    e->taken = calloc(n, sizeof(uint64_t));
+    e->not_taken = calloc(n, sizeof(uint64_t));
+    if (e->entries == NULL || e->taken == NULL || e->not_taken == NULL) {
+        free_counters(e);
+        return -1;
+    }
+    e->program = ijvm_program_retain(m->program);
+    // Entering the program enters its first block
+    if (m->pc == 0 && !m->halted)
+        e->entries[0]++;
+    return 0;
+}
+
+int ijvm_edges_enable(ijvm_t *m) {
+    if (m->edges != NULL)
+        return 0;
+    m->edges = calloc(1, sizeof(edges_t));
+    if (m->edges == NULL || start_counting(m) < 0) {
+        free(m->edges);
+        m->edges = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void ijvm_edges_disable(ijvm_t *m) {
+    if (m->edges == NULL)
+        return;
+    ijvm_edges_save(m);
+    free_counters(m->edges);
+    free(m->edges);
+    m->edges = NULL;
+}
+
+void edges_restart(machine_t *m) {
+    ijvm_edges_save(m);
+    free_counters(m->edges);
+    // Out of memory only costs the profile of this program
+    start_counting(m);
+}
+
+void edges_step(machine_t *m, byte_t op, uint32_t pc) {
+    edges_t *e = m->edges;
+    if (e->entries == NULL || m->program != e->program || m->pc > e->program->text_size)
+        return;
+    switch (op) {
+        case OP_IFEQ:
+        case OP_IFLT:
+        case OP_ICMPEQ:
+            if (m->pc == pc + 3)
+                e->not_taken[pc]++;
+            else
+                e->taken[pc]++;
+            e->entries[m->pc]++;
+            break;
+        case OP_GOTO:
+        case OP_INVOKEVIRTUAL:
+        case OP_IRETURN:
+            e->entries[m->pc]++;
+            break;
+        default:
+            break;
+    }
+}
+
+static int compare_blocks(const void *a, const void *b) {
+    const edgeprof_block_t *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static int compare_branches(const void *a, const void *b) {
+    const edgeprof_branch_t *x = a, *y = b;
+    uint64_t nx = x->taken + x->not_taken, ny = y->taken + y->not_taken;
+    if (nx != ny)
+        return nx < ny ? 1 : -1;
+    return (x->pc > y->pc) - (x->pc < y->pc);
+}
+
+static int compare_branch_pcs(const void *a, const void *b) {
+    uint32_t x = ((const edgeprof_branch_t *) a)->pc, y = ((const edgeprof_branch_t *) b)->pc;
+    return (x > y) - (x < y);
+}
+
+// A profile as read from disk, records checked against the program
+typedef struct profile_file {
+    edgeprof_header_t header;
+    edgeprof_block_t *blocks;
+    edgeprof_branch_t *branches;
+} profile_file_t;
+
+static bool read_profile(FILE *fp, const program_t *p, uint64_t hash, profile_file_t *f) {
+    edgeprof_header_t *h = &f->header;
+    f->blocks = NULL;
+    f->branches = NULL;
+    if (fread(h, sizeof(*h), 1, fp) != 1 || memcmp(h->magic, EDGEPROF_MAGIC, sizeof(h->magic)) != 0
+        || h->version != EDGEPROF_VERSION || h->hash != hash || h->image_size != p->image_size
+        || h->num_blocks > p->text_size + 1 || h->num_branches > p->text_size)
+        return false;
+    f->blocks = malloc(sizeof(edgeprof_block_t) * h->num_blocks + 1);
+    f->branches = malloc(sizeof(edgeprof_branch_t) * h->num_branches + 1);
+    bool ok = f->blocks != NULL && f->branches != NULL
+              && fread(f->blocks, sizeof(edgeprof_block_t), h->num_blocks, fp) == h->num_blocks
+              && fread(f->branches, sizeof(edgeprof_branch_t), h->num_branches, fp) == h->num_branches;
+    for (uint32_t i = 0; ok && i < h->num_blocks; i++)
+        ok = f->blocks[i].pc <= p->text_size;
+    for (uint32_t i = 0; ok && i < h->num_branches; i++)
+        ok = f->branches[i].pc < p->text_size;
+    if (!ok) {
+        free(f->blocks);
+        free(f->branches);
+        f->blocks = NULL;
+        f->branches = NULL;
+    }
+    return ok;
+}
+
+static char *profile_path(const char *dir, uint64_t hash) {
+    char *path = malloc(strlen(dir) + 32);
+    if (path != NULL)
+        sprintf(path, "%s/%016llx.ijvmp", dir, (unsigned long long) hash);
+    return path;
+}
+
+// Writes the counters as the profile at path, written aside and renamed
+// into place so readers only ever see complete files
+static int write_profile(const edges_t *e, const char *dir, const char *path, uint64_t hash) {
+    program_t *p = e->program;
+    size_t n = (size_t) p->text_size + 1;
+    edgeprof_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, EDGEPROF_MAGIC, sizeof(h.magic));
+    h.version = EDGEPROF_VERSION;
+    h.hash = hash;
+    h.image_size = p->image_size;
+    edgeprof_block_t *blocks = calloc(n, sizeof(edgeprof_block_t));
+    edgeprof_branch_t *branches = calloc(n, sizeof(edgeprof_branch_t));
+    char *tmp = malloc(strlen(dir) + 16);
+    int res = -1;
+    if (blocks == NULL || branches == NULL || tmp == NULL)
+        goto out;
+    for (uint32_t pc = 0; pc < n; pc++) {
+        if (e->entries[pc] != 0)
+            blocks[h.num_blocks++] = (edgeprof_block_t) { .pc = pc, .count = e->entries[pc] };
+        if (e->taken[pc] != 0 || e->not_taken[pc] != 0)
+            branches[h.num_branches++] = (edgeprof_branch_t) {
+                .pc = pc, .taken = e->taken[pc], .not_taken = e->not_taken[pc]
+            };
+    }
+    qsort(blocks, h.num_blocks, sizeof(edgeprof_block_t), compare_blocks);
+    qsort(branches, h.num_branches, sizeof(edgeprof_branch_t), compare_branches);
+
+    sprintf(tmp, "%s/.tmp-XXXXXX", dir);
+    int fd = mkstemp(tmp);
+    FILE *fp = fd < 0 ? NULL : fdopen(fd, "wb");
+    if (fp == NULL) {
+        if (fd >= 0) {
+            close(fd);
+            unlink(tmp);
+        }
+        goto out;
+    }
+    bool ok = fwrite(&h, sizeof(h), 1, fp) == 1
+              && fwrite(blocks, sizeof(edgeprof_block_t), h.num_blocks, fp) == h.num_blocks
+              && fwrite(branches, sizeof(edgeprof_branch_t), h.num_branches, fp) == h.num_branches;
+    if (fclose(fp) != 0)
+        ok = false;
+    if (!ok || chmod(tmp, 0644) < 0 || rename(tmp, path) < 0)
+        unlink(tmp);
+    else
+        res = 0;
+out:
+    free(blocks);
+    free(branches);
+    free(tmp);
+    return res;
+}
+
+int ijvm_edges_save(ijvm_t *m) {
+    edges_t *e = m->edges;
+    if (e == NULL || e->entries == NULL)
+        return -1;
+    char *dir = get_profile_dir();
+    if (dir == NULL)
+        return -1;
+    program_t *p = e->program;
+    uint64_t hash = program_hash(p);
+    char *path = profile_path(dir, hash);
+    int res = -1;
+    if (path == NULL || (mkdir(dir, 0755) < 0 && errno != EEXIST))
+        goto out;
+    // Other processes save to the same profile, merge one at a time
+    int lock = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (lock < 0)
+        goto out;
+    if (flock(lock, LOCK_EX) < 0) {
+        close(lock);
+        goto out;
+    }
+    FILE *fp = fopen(path, "rb");
+    profile_file_t f;
+    if (fp != NULL && read_profile(fp, p, hash, &f)) {
+        for (uint32_t i = 0; i < f.header.num_blocks; i++)
+            e->entries[f.blocks[i].pc] += f.blocks[i].count;
+        for (uint32_t i = 0; i < f.header.num_branches; i++) {
+            e->taken[f.branches[i].pc] += f.branches[i].taken;
+            e->not_taken[f.branches[i].pc] += f.branches[i].not_taken;
+        }
+        free(f.blocks);
+        free(f.branches);
+    }
+    if (fp != NULL)
+        fclose(fp);
+    res = write_profile(e, dir, path, hash);
+    close(lock);
+    if (res == 0)
+        log("edgeprof: profile of %016llx saved to %s\n", (unsigned long long) hash, path);
+    // Either saved, or there is nowhere to save to: start over
+    size_t n = (size_t) p->text_size + 1;
+    memset(e->entries, 0, sizeof(uint64_t) * n);
+    memset(e->taken, 0, sizeof(uint64_t) * n);
+    memset(e->not_taken, 0, sizeof(uint64_t) * n);
+out:
+    free(path);
+    free(dir);
+    return res;
+}
+
+void edgeprof_attach(program_t *p) {
+    char *dir = get_profile_dir();
+    if (dir == NULL)
+        return;
+    uint64_t hash = program_hash(p);
+    char *path = profile_path(dir, hash);
+    FILE *fp = path == NULL ? NULL : fopen(path, "rb");
+    profile_file_t f;
+    if (fp != NULL && read_profile(fp, p, hash, &f)) {
+        p->hot_blocks = f.blocks;
+        p->num_hot_blocks = f.header.num_blocks;
+        qsort(f.branches, f.header.num_branches, sizeof(edgeprof_branch_t), compare_branch_pcs);
+        p->branches = f.branches;
+        p->num_branches = f.header.num_branches;
+        // Analyze the blocks the program spends its time in before it runs,
+        // hottest first, so the first entries don't pay for it
+        for (uint32_t i = 0; i < p->num_hot_blocks; i++)
+            block_length(p, p->hot_blocks[i].pc);
+        log("edgeprof: profile of %016llx read from %s\n", (unsigned long long) hash, path);
+    }
+    if (fp != NULL)
+        fclose(fp);
+    free(path);
+    free(dir);
+}
+
+size_t ijvm_program_hot_blocks(ijvm_program_t *p, uint32_t *pcs, size_t max) {
+    size_t n = 0;
+    for (; n < max && n < p->num_hot_blocks; n++)
+        pcs[n] = p->hot_blocks[n].pc;
+    return n;
+}
+
+int ijvm_program_branch_profile(ijvm_program_t *p, uint32_t pc, uint64_t *taken, uint64_t *not_taken) {
+    edgeprof_branch_t key = { .pc = pc };
+    edgeprof_branch_t *b = p->num_branches == 0 ? NULL
+        : bsearch(&key, p->branches, p->num_branches, sizeof(edgeprof_branch_t), compare_branch_pcs);
+    if (b == NULL)
+        return -1;
+    *taken = b->taken;
+    *not_taken = b->not_taken;
+    return 0;
+}
@@ -0,0 +1,395 @@
+#define _POSIX_C_SOURCE 200809L
+#include <poll.h>
+#include <stdlib.h>
+#include "engine.h"
+#include "sampler.h"
+#include "perf.h"
+
+// Size of an instruction that can't end a basic block, 0 for one that can
+static uint32_t straight_size(byte_t op) {
+    switch (op) {
+        case OP_DUP:
+        case OP_IADD:
+        case OP_IAND:
+        case OP_IOR:
+        case OP_ISUB:
+        case OP_NOP:
+        case OP_OUT:
+        case OP_POP:
+        case OP_SWAP:
+            return 1;
+        case OP_BIPUSH:
+        case OP_ILOAD:
+        case OP_ISTORE:
+            return 2;
+        case OP_IINC:
+        case OP_LDC_W:
+            return 3;
+        default:
+            return 0;
+    }
+}
+
+uint32_t block_length(program_t *p, uint32_t pc) {
+    // Racing threads work out the same length, so relaxed is enough
+    uint32_t n = atomic_load_explicit(&p->blocks[pc], memory_order_relaxed);
+    if (n != 0)
+        return n;
+    uint32_t at = pc;
+    while (true) {
+        if (at >= p->text_size) {
+            n |= BLOCK_TAIL;
+            break;
+        }
+        n++;
+        uint32_t size = straight_size(p->text[at]);
+        if (size == 0)
+            break;
+        at += size;
+    }
+    atomic_store_explicit(&p->blocks[pc], n, memory_order_relaxed);
+    return n;
+}
+
+static inline uint16_t short_at(const byte_t *text, uint32_t pc) {
+    return (uint16_t) (text[pc] << 8 | text[pc + 1]);
+}
+
+static inline word_t constant_at(const byte_t *cpp, uint16_t index) {
+    const byte_t *c = cpp + index * sizeof(word_t);
+    return (word_t) ((uint32_t) c[0] << 24 | (uint32_t) c[1] << 16 | (uint32_t) c[2] << 8 | c[3]);
+}
+
+// Whether IN would have to wait for its input
+static bool input_pending(machine_t *m) {
+    if (io_ready(&m->in) || m->in.fd < 0)
+        return false;
+    struct pollfd pfd = { m->in.fd, POLLIN, 0 };
+    return poll(&pfd, 1, 0) == 0;
+}
+
+// Whether the IN about to run would wait when it mustn't
+static bool would_block(machine_t *m, bool may_block) {
+    if (may_block || m->fibers != NULL || m->text[m->pc] != OP_IN || io_ready(&m->in))
+        return false;
+    io_flush(&m->out);
+    return input_pending(m);
+}
+
+// Instrumented machines step every instruction through the interpreter,
+// which reports each; the budget is charged per instruction
+static ijvm_status_t step_run(machine_t *m, uint64_t budget, bool may_block) {
+    for (; budget > 0 && !ijvm_finished(m); budget--) {
+        if (would_block(m, may_block))
+            return IJVM_BLOCKED;
+        machine_step(m);
+        if (++m->metrics.counts.instructions % METRICS_INTERVAL == 0)
+            metrics_publish(m);
+    }
+    return ijvm_finished(m) ? IJVM_HALTED : IJVM_OUT_OF_FUEL;
+}
+
+// A run with every guest frame inside the perf trampoline of its method
+typedef struct perf_run {
+    machine_t *m;
+    uint64_t budget;
+    bool may_block;
+    bool over;
+    ijvm_status_t status;
+    uint32_t methods[PERF_MAX_DEPTH]; // Frames live at the start, innermost first
+    uint32_t live;
+    uint32_t level; // Of the frame being entered
+    uint32_t flat; // Calls running in the frame of their caller
+} perf_run_t;
+
+// Steps the frame at r->level until it returns or the run is over,
+// nesting the frames of the calls it makes
+static void perf_frame(void *arg) {
+    perf_run_t *r = arg;
+    machine_t *m = r->m;
+    uint32_t level = r->level;
+    // Frames that were live when the run started are entered first
+    if (level < r->live) {
+        r->level = level + 1;
+        perf_call(m->program, r->methods[r->live - 1 - level], perf_frame, r);
+        if (r->over)
+            return;
+    }
+    while (true) {
+        if (r->budget == 0 || ijvm_finished(m)) {
+            r->status = ijvm_finished(m) ? IJVM_HALTED : IJVM_OUT_OF_FUEL;
+            r->over = true;
+            return;
+        }
+        if (would_block(m, r->may_block)) {
+            r->status = IJVM_BLOCKED;
+            r->over = true;
+            return;
+        }
+        byte_t op = m->text[m->pc];
+        word_t *lv = m->lv;
+        machine_step(m);
+        r->budget--;
+        if (++m->metrics.counts.instructions % METRICS_INTERVAL == 0)
+            metrics_publish(m);
+        // Fibers switch stacks under the frames, they run flat
+        if (op == OP_INVOKEVIRTUAL && m->lv != lv) {
+            if (level + 1 < PERF_MAX_DEPTH && m->fibers == NULL) {
+                r->level = level + 1;
+                perf_call(m->program, m->pc - 4, perf_frame, r);
+                if (r->over)
+                    return;
+            } else {
+                r->flat++;
+            }
+        } else if (op == OP_IRETURN && m->fibers == NULL) {
+            if (r->flat > 0)
+                r->flat--;
+            else if (level > 0)
+                return;
+        }
+    }
+}
+
+static ijvm_status_t perf_run(machine_t *m, uint64_t budget, bool may_block) {
+    perf_run_t *r = malloc(sizeof(perf_run_t));
+    if (r == NULL)
+        return step_run(m, budget, may_block);
+    bool truncated;
+    r->m = m;
+    r->budget = budget;
+    r->may_block = may_block;
+    r->over = false;
+    r->live = m->lv == NULL ? 0 : machine_frames(m, r->methods, PERF_MAX_DEPTH - 1, &truncated);
+    r->level = 0;
+    r->flat = 0;
+    perf_call(m->program, PERF_MAIN, perf_frame, r);
+    ijvm_status_t status = r->status;
+    free(r);
+    return status;
+}
+
+static ijvm_status_t fast_run(machine_t *m, uint64_t budget, bool may_block) {
+    if (perf_active() && m->text != NULL)
+        return perf_run(m, budget, may_block);
+    if (machine_instrumented(m))
+        return step_run(m, budget, may_block);
+    program_t *p = m->program;
+    const byte_t *text = m->text;
+    const byte_t *cpp = m->cpp;
+    uint32_t pc = m->pc;
+    word_t *sp = m->sp;
+    word_t *lv = m->lv;
+    uint64_t fuel = budget;
+    uint64_t counted = budget; // Fuel when instructions were last counted
+
+// Hands the registers to the machine, and takes them back
+#define SAVE() (m->pc = pc, m->sp = sp, m->lv = lv)
+#define LOAD() (pc = m->pc, sp = m->sp, lv = m->lv)
+// Counts the instructions retired since last time
+#define COUNT() (m->metrics.counts.instructions += counted - fuel, counted = fuel)
+// Shows a SIGPROF handler interrupting the loop where the machine is
+#define PUBLISH_PC() (*(volatile uint32_t *) &m->pc = pc)
+#define PUBLISH_LV() (*(word_t *volatile *) &m->lv = lv)
+
+    while (!m->halted && pc < m->text_size) {
+        PUBLISH_PC();
+        if (counted - fuel >= METRICS_INTERVAL) {
+            SAVE();
+            COUNT();
+            metrics_publish(m);
+        }
+        uint32_t n = block_length(p, pc);
+        if ((n & BLOCK_TAIL) || n > fuel) {
+            // Step what fits of a block that doesn't fit as a whole. Its
+            // last instruction, the one that may wait, is never reached
+            uint64_t k = n & ~BLOCK_TAIL;
+            if (k > fuel)
+                k = fuel;
+            if (k == 0) {
+                SAVE();
+                COUNT();
+                return IJVM_OUT_OF_FUEL;
+            }
+            // Charged for the steps taken, the one that finishes the
+            // machine included
+            uint64_t taken = 0;
+            SAVE();
+            while (taken < k) {
+                taken++;
+                if (!machine_step(m))
+                    break;
+            }
+            LOAD();
+            fuel -= taken;
+            continue;
+        }
+        fuel -= n;
+        // Straight-line instructions continue, the one that ends the
+        // block breaks out to charge the next
+        for (;;) {
+            switch (text[pc]) {
+                case OP_BIPUSH:
+                    *++sp = (int8_t) text[pc + 1];
+                    pc += 2;
+                    continue;
+                case OP_DUP:
+                    sp[1] = sp[0];
+                    sp++;
+                    pc += 1;
+                    continue;
+                case OP_IADD:
+                    sp[-1] = (word_t) ((uint32_t) sp[-1] + (uint32_t) sp[0]);
+                    sp--;
+                    pc += 1;
+                    continue;
+                case OP_ISUB:
+                    sp[-1] = (word_t) ((uint32_t) sp[-1] - (uint32_t) sp[0]);
+                    sp--;
+                    pc += 1;
+                    continue;
+                case OP_IAND:
+                    sp[-1] &= sp[0];
+                    sp--;
+                    pc += 1;
+                    continue;
+                case OP_IOR:
+                    sp[-1] |= sp[0];
+                    sp--;
+                    pc += 1;
+                    continue;
+                case OP_ILOAD:
+                    *++sp = lv[text[pc + 1]];
+                    pc += 2;
+                    continue;
+                case OP_ISTORE:
+                    lv[text[pc + 1]] = *sp--;
+                    pc += 2;
+                    continue;
+                case OP_IINC:
+                    lv[text[pc + 1]] = (word_t) ((uint32_t) lv[text[pc + 1]] + (int8_t) text[pc + 2]);
+                    pc += 3;
+                    continue;
+                case OP_LDC_W:
+                    *++sp = constant_at(cpp, short_at(text, pc + 1));
+                    pc += 3;
+                    continue;
+                case OP_NOP:
+                    pc += 1;
+                    continue;
+                case OP_OUT:
+                    io_putc(&m->out, (byte_t) *sp--);
+                    m->metrics.counts.bytes_out++;
+                    pc += 1;
+                    continue;
+                case OP_POP:
+                    sp--;
+                    pc += 1;
+                    continue;
+                case OP_SWAP: {
+                    word_t tmp = sp[0];
+                    sp[0] = sp[-1];
+                    sp[-1] = tmp;
+                    pc += 1;
+                    continue;
+                }
+                case OP_GOTO:
+                    pc += (int16_t) short_at(text, pc + 1);
+                    break;
+                case OP_IFEQ:
+                    pc += *sp-- == 0 ? (int16_t) short_at(text, pc + 1) : 3;
+                    break;
+                case OP_IFLT:
+                    pc += *sp-- < 0 ? (int16_t) short_at(text, pc + 1) : 3;
+                    break;
+                case OP_ICMPEQ:
+                    pc += sp[0] == sp[-1] ? (int16_t) short_at(text, pc + 1) : 3;
+                    sp -= 2;
+                    break;
+                case OP_INVOKEVIRTUAL: {
+                    uint32_t prev_pc = pc;
+                    word_t *prev_lv = lv;
+                    pc = constant_at(cpp, short_at(text, pc + 1));
+                    uint16_t num_args = short_at(text, pc);
+                    uint16_t num_locals = short_at(text, pc + 2);
+                    lv = sp - num_args + 1;
+                    sp += num_locals;
+                    // Return address, linked from the OBJREF slot, then
+                    // the caller's frame
+                    *++sp = prev_pc;
+                    *lv = sp - lv;
+                    *++sp = prev_lv - m->stack;
+                    pc += 4;
+                    m->metrics.counts.calls++;
+                    machine_stack_depth(m, sp);
+                    PUBLISH_LV();
+                    break;
+                }
+                case OP_IRETURN: {
+                    if (m->fibers != NULL)
+                        goto interpret;
+                    word_t return_value = *sp;
+                    word_t caller_pc = lv[*lv];
+                    word_t caller_lv = lv[*lv + 1];
+                    sp = lv;
+                    *sp = return_value;
+                    lv = m->stack + caller_lv;
+                    pc = caller_pc + 3;
+                    PUBLISH_LV();
+                    break;
+                }
+                case OP_IN: {
+                    if (m->fibers != NULL)
+                        goto interpret;
+                    if (!io_ready(&m->in)) {
+                        // Show a prompt before waiting for the answer
+                        io_flush(&m->out);
+                        if (!may_block && input_pending(m)) {
+                            // Give back what this IN was charged
+                            fuel += 1;
+                            SAVE();
+                            COUNT();
+                            return IJVM_BLOCKED;
+                        }
+                    }
+                    int input = io_getc(&m->in);
+                    *++sp = input < 0 ? 0 : input;
+                    m->metrics.counts.bytes_in += input >= 0;
+                    pc += 1;
+                    break;
+                }
+                case OP_HALT:
+                case OP_ERR:
+                    m->halted = true;
+                    break;
+                default:
+                interpret:
+                    // Everything else, fiber switches included, goes
+                    // through the interpreter
+                    SAVE();
+                    machine_step(m);
+                    LOAD();
+                    break;
+            }
+            break;
+        }
+    }
+    SAVE();
+    COUNT();
+    return IJVM_HALTED;
+
+#undef SAVE
+#undef LOAD
+#undef COUNT
+#undef PUBLISH_PC
+#undef PUBLISH_LV
+}
+
+ijvm_status_t engine_run(machine_t *m, uint64_t budget, bool may_block) {
+    sampler_machine = m;
+    metrics_begin(m, may_block || m->fibers != NULL);
+    ijvm_status_t res = fast_run(m, budget, may_block);
+    metrics_end(m);
+    sampler_machine = NULL;
+    return res;
+}
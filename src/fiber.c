@@ -0,0 +1,311 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include "fiber.h"
+#include "util.h"
+
+// Waiting fibers are checked for readiness at least this often
+#define POLL_INTERVAL 64
+// Events handled per round of the event loop
+#define MAX_EVENTS 64
+
+static void save(machine_t *m, fiber_t *f) {
+    f->pc = m->pc;
+    f->stack = m->stack;
+    f->sp = m->sp;
+    f->lv = m->lv;
+}
+
+static void restore(machine_t *m, fiber_t *f) {
+    m->pc = f->pc;
+    m->stack = f->stack;
+    m->sp = f->sp;
+    m->lv = f->lv;
+    m->fibers->current = f;
+}
+
+static void enqueue(fibers_t *fs, fiber_t *f) {
+    f->next = NULL;
+    if (fs->run_tail != NULL)
+        fs->run_tail->next = f;
+    else
+        fs->run_head = f;
+    fs->run_tail = f;
+}
+
+static fiber_t *dequeue(fibers_t *fs) {
+    fiber_t *f = fs->run_head;
+    if (f != NULL) {
+        fs->run_head = f->next;
+        if (fs->run_head == NULL)
+            fs->run_tail = NULL;
+    }
+    return f;
+}
+
+static watch_t *watch_for(fibers_t *fs, int fd) {
+    if (fd >= fs->num_watches) {
+        int num = fs->num_watches ? fs->num_watches : 64;
+        while (num <= fd)
+            num *= 2;
+        watch_t *watches = realloc(fs->watches, sizeof(watch_t) * num);
+        if (watches == NULL)
+            return NULL;
+        memset(watches + fs->num_watches, 0, sizeof(watch_t) * (num - fs->num_watches));
+        fs->watches = watches;
+        fs->num_watches = num;
+    }
+    return &fs->watches[fd];
+}
+
+// Moves all waiters of fd to the run queue
+static void wake(fibers_t *fs, int fd) {
+    watch_t *w = &fs->watches[fd];
+    while (w->waiters != NULL) {
+        fiber_t *f = w->waiters;
+        w->waiters = f->next;
+        enqueue(fs, f);
+        fs->num_waiting--;
+    }
+    w->events = 0;
+}
+
+#ifdef __linux__
+
+static bool arm(fibers_t *fs, int fd, watch_t *w) {
+    if (fs->epfd < 0)
+        fs->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (fs->epfd < 0)
+        return false;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLONESHOT
+                | (w->events & POLLIN ? EPOLLIN : 0)
+                | (w->events & POLLOUT ? EPOLLOUT : 0);
+    ev.data.fd = fd;
+    // The registration of a closed descriptor is gone, and a new one may
+    // have taken its number, so fall back between the two
+    int op = w->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int res = epoll_ctl(fs->epfd, op, fd, &ev);
+    if (res < 0 && (errno == ENOENT || errno == EEXIST)) {
+        op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        res = epoll_ctl(fs->epfd, op, fd, &ev);
+    }
+    w->registered = res == 0;
+    return res == 0;
+}
+
+static void wait_events(fibers_t *fs, int timeout) {
+    struct epoll_event evs[MAX_EVENTS];
+    if (fs->epfd < 0 || fs->num_waiting == 0)
+        return;
+    int n;
+    while ((n = epoll_wait(fs->epfd, evs, MAX_EVENTS, timeout)) < 0 && errno == EINTR);
+    for (int i = 0; i < n; i++)
+        wake(fs, evs[i].data.fd);
+}
+
+#else
+
+static bool arm(fibers_t *fs, int fd, watch_t *w) {
+    (void) fs;
+    (void) fd;
+    (void) w;
+    return true;
+}
+
+static void wait_events(fibers_t *fs, int timeout) {
+    if (fs->num_waiting == 0)
+        return;
+    struct pollfd *fds = malloc(sizeof(struct pollfd) * fs->num_waiting);
+    if (fds == NULL)
+        return;
+    int n = 0;
+    for (int fd = 0; fd < fs->num_watches; fd++) {
+        if (fs->watches[fd].waiters != NULL)
+            fds[n++] = (struct pollfd) { fd, fs->watches[fd].events, 0 };
+    }
+    int res;
+    while ((res = poll(fds, n, timeout)) < 0 && errno == EINTR);
+    for (int i = 0; res > 0 && i < n; i++) {
+        if (fds[i].revents != 0)
+            wake(fs, fds[i].fd);
+    }
+    free(fds);
+}
+
+#endif
+
+// Picks the fiber to run after the current one stopped running
+static fiber_t *next_fiber(fibers_t *fs) {
+    if (fs->run_head == NULL || ++fs->switches % POLL_INTERVAL == 0)
+        wait_events(fs, 0);
+    fiber_t *f = dequeue(fs);
+    while (f == NULL && fs->num_waiting > 0) {
+        // Nothing can run, so block until something can
+        wait_events(fs, -1);
+        f = dequeue(fs);
+    }
+    return f;
+}
+
+static fibers_t *fibers_init(machine_t *m) {
+    fibers_t *fs = calloc(1, sizeof(fibers_t));
+    if (fs == NULL)
+        return NULL;
+    fs->main.id = 1;
+    fs->current = &fs->main;
+    fs->epfd = -1;
+    fs->next_id = 2;
+    m->fibers = fs;
+    return fs;
+}
+
+// Maps a fiber stack with a page above it that faults on access, so a
+// fiber recursing too deep crashes rather than writing over other memory
+static word_t *fiber_stack_alloc(void) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t size = (FIBER_STACK_BYTES + page - 1) / page * page;
+    byte_t *stack = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (stack == MAP_FAILED)
+        return NULL;
+    if (mprotect(stack + size, page, PROT_NONE) < 0) {
+        munmap(stack, size + page);
+        return NULL;
+    }
+    return (word_t *) stack;
+}
+
+static void fiber_stack_free(word_t *stack) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    if (stack != NULL)
+        munmap(stack, (FIBER_STACK_BYTES + page - 1) / page * page + page);
+}
+
+word_t fiber_spawn(machine_t *m, uint16_t method) {
+    uint32_t entry = ijvm_get_constant(m, method);
+    // Read number of arguments and locals from the method header
+    uint16_t num_args = m->text[entry] * 0x100 + m->text[entry + 1];
+    uint16_t num_locals = m->text[entry + 2] * 0x100 + m->text[entry + 3];
+    // The arguments leave the spawning fiber, also when the spawn fails
+    m->sp -= num_args;
+    // The frame, with its link and the caller's lv, must fit the stack
+    if ((uint32_t) num_args + num_locals + 2 > FIBER_STACK_SIZE)
+        return 0;
+    fibers_t *fs = m->fibers != NULL ? m->fibers : fibers_init(m);
+    fiber_t *f = fs != NULL ? calloc(1, sizeof(fiber_t)) : NULL;
+    if (f != NULL)
+        f->stack = fiber_stack_alloc();
+    if (f == NULL || f->stack == NULL) {
+        free(f);
+        return 0;
+    }
+    for (int i = 0; i < num_args; i++)
+        f->stack[i] = m->sp[i + 1];
+    // Build the frame INVOKEVIRTUAL would, returning past the end of the
+    // text so the fiber finishes when its method returns
+    f->lv = f->stack;
+    f->sp = f->stack + num_args - 1 + num_locals;
+    *++f->sp = m->text_size;
+    *f->lv = f->sp - f->lv;
+    *++f->sp = 0;
+    f->pc = entry + 4;
+    f->id = fs->next_id++;
+    enqueue(fs, f);
+    log("SPAWN fiber %d at %u\n", f->id, f->pc);
+    return f->id;
+}
+
+void fiber_yield(machine_t *m) {
+    fibers_t *fs = m->fibers;
+    if (fs == NULL)
+        return;
+    if (fs->run_head == NULL)
+        wait_events(fs, 0);
+    fiber_t *f = dequeue(fs);
+    if (f == NULL)
+        return;
+    save(m, fs->current);
+    enqueue(fs, fs->current);
+    restore(m, f);
+}
+
+bool fiber_wait(machine_t *m, int fd, short events) {
+    fibers_t *fs = m->fibers;
+    if (fs == NULL)
+        return false;
+    watch_t *w = watch_for(fs, fd);
+    if (w == NULL)
+        return false;
+    short armed = w->events;
+    w->events |= events;
+    // Descriptors the event loop can't watch, like regular files, are
+    // always ready anyway
+    if (w->events != armed && !arm(fs, fd, w)) {
+        w->events = armed;
+        return false;
+    }
+    fiber_t *self = fs->current;
+    save(m, self);
+    self->next = w->waiters;
+    w->waiters = self;
+    fs->num_waiting++;
+
+    fiber_t *f = next_fiber(fs);
+    // Got our own turn back: the descriptor is ready
+    if (f == self)
+        return false;
+    restore(m, f);
+    return true;
+}
+
+void fiber_exit(machine_t *m) {
+    fibers_t *fs = m->fibers;
+    if (fs == NULL || fs->current == &fs->main)
+        return;
+    fiber_t *self = fs->current;
+    fiber_t *f = next_fiber(fs);
+    log("fiber %d exited\n", self->id);
+    // The main fiber is always runnable or waiting, so f is never NULL
+    restore(m, f);
+    fiber_stack_free(self->stack);
+    free(self);
+}
+
+static void free_list(fiber_t *f, fiber_t *main) {
+    while (f != NULL) {
+        fiber_t *next = f->next;
+        if (f != main) {
+            fiber_stack_free(f->stack);
+            free(f);
+        }
+        f = next;
+    }
+}
+
+void fibers_free(machine_t *m) {
+    fibers_t *fs = m->fibers;
+    if (fs == NULL)
+        return;
+    if (fs->current != &fs->main) {
+        m->stack = fs->main.stack;
+        fiber_stack_free(fs->current->stack);
+        free(fs->current);
+    }
+    free_list(fs->run_head, &fs->main);
+    for (int fd = 0; fd < fs->num_watches; fd++)
+        free_list(fs->watches[fd].waiters, &fs->main);
+    if (fs->epfd >= 0)
+        close(fs->epfd);
+    free(fs->watches);
+    free(fs);
+    m->fibers = NULL;
+}
@@ -0,0 +1,103 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "forkserver.h"
+#include "util.h"
+
+#define REQUEST_LINE_SIZE 0x2000
+
+typedef struct child {
+    pid_t pid;
+    int request;
+} child_t;
+
+typedef struct children {
+    child_t *list;
+    size_t count;
+    size_t capacity;
+    int failed;
+} children_t;
+
+static void serve_request(ijvm_t *m, const char *input, const char *output) {
+    bool no_input = strcmp(input, "-") == 0;
+    FILE *in = fopen(no_input ? "/dev/null" : input, "rb");
+    FILE *out = fopen(output, "wb");
+    if (in == NULL || out == NULL)
+        _exit(1);
+    ijvm_set_input(m, in);
+    ijvm_set_output(m, out);
+    ijvm_run(m);
+    // Skip exit() so the parent's stdio buffers are not flushed twice
+    _exit(fclose(out) == 0 ? 0 : 1);
+}
+
+static void reap(children_t *c, FILE *replies, bool block) {
+    int status;
+    pid_t pid;
+    while (c->count > 0 && (pid = waitpid(-1, &status, block ? 0 : WNOHANG)) > 0) {
+        for (size_t i = 0; i < c->count; i++) {
+            if (c->list[i].pid != pid)
+                continue;
+            int code = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            if (code != 0)
+                c->failed++;
+            fprintf(replies, "%d %d\n", c->list[i].request, code);
+            c->list[i] = c->list[--c->count];
+            break;
+        }
+    }
+    fflush(replies);
+}
+
+int ijvm_fork_server(ijvm_t *m, FILE *requests, FILE *replies) {
+    children_t c = { NULL, 0, 0, 0 };
+    char line[REQUEST_LINE_SIZE];
+    int request = 0;
+    int forked = 0;
+    while (fgets(line, sizeof(line), requests) != NULL) {
+        char *save;
+        char *input = strtok_r(line, " \t\r\n", &save);
+        char *output = strtok_r(NULL, " \t\r\n", &save);
+        if (input == NULL)
+            continue;
+        request++;
+        if (output == NULL) {
+            fprintf(replies, "%d -1\n", request);
+            c.failed++;
+            continue;
+        }
+        if (c.count == c.capacity) {
+            size_t capacity = c.capacity ? c.capacity * 2 : 16;
+            child_t *list = realloc(c.list, sizeof(child_t) * capacity);
+            // Without room to track the child, don't fork it
+            if (list == NULL) {
+                fprintf(replies, "%d -1\n", request);
+                c.failed++;
+                reap(&c, replies, false);
+                continue;
+            }
+            c.list = list;
+            c.capacity = capacity;
+        }
+        // Children must not inherit unwritten output of the parent
+        fflush(NULL);
+        pid_t pid = fork();
+        if (pid == 0)
+            serve_request(m, input, output);
+        if (pid < 0) {
+            fprintf(replies, "%d -1\n", request);
+            c.failed++;
+        } else {
+            c.list[c.count++] = (child_t) { pid, request };
+            forked++;
+            log("fork-server: request %d served by %d\n", request, (int) pid);
+        }
+        reap(&c, replies, false);
+    }
+    reap(&c, replies, true);
+    free(c.list);
+    return request > 0 && forked == 0 ? -1 : c.failed;
+}
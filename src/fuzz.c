@@ -0,0 +1,518 @@
+#include <stdlib.h>
+#include <string.h>
+#include "fuzz.h"
+#include "gen.h"
+#include "machine.h"
+#include "opstats.h"
+
+// Shape of the generated programs
+#define MAX_CONSTANTS 4
+#define MAX_METHODS 3
+#define MAX_ARGS 3
+#define MAX_LOCALS 4
+#define MAX_NESTING 2     // Of loops, each with a counter local of its own
+#define MAX_LOOP_COUNT 8
+#define MAX_STATEMENTS 48 // In a method, nested ones included
+#define MAX_DEPTH 32      // Stack depth over which statements only pop
+#define MAX_ARRAY_SIZE 8   // Of the array every method starts with
+
+const char *const fuzz_engine_names[FUZZ_ENGINES] = { "step", "run", "run_for", "instrumented" };
+
+typedef struct choices {
+    const byte_t *data;
+    size_t n;
+    size_t at;
+} choices_t;
+
+// A choice below range, 0 once the choices run out
+static uint32_t choose(choices_t *c, uint32_t range) {
+    if (c->at >= c->n)
+        return 0;
+    return c->data[c->at++] % range;
+}
+
+static word_t choose_word(choices_t *c) {
+    uint32_t w = 0;
+    for (int i = 0; i < 4; i++)
+        w = w << 8 | choose(c, 256);
+    return (word_t) w;
+}
+
+typedef struct generator {
+    choices_t *c;
+    gen_t *g;
+    uint32_t num_constants;
+    uint32_t num_methods;
+    uint32_t num_args[MAX_METHODS];
+    int method;          // Being generated, -1 for main
+    uint32_t first_local; // Locals are stored to from here on...
+    uint32_t counters;   // ...up to the loop counters, then the array
+    uint32_t depth;      // Of the stack, in the current method
+    uint32_t statements; // Left for the current method
+} generator_t;
+
+static void push_byte(generator_t *gen) {
+    gen_byte(gen->g, OP_BIPUSH);
+    gen_byte(gen->g, (byte_t) choose(gen->c, 256));
+    gen->depth++;
+}
+
+static void pop(generator_t *gen) {
+    gen_byte(gen->g, OP_POP);
+    gen->depth--;
+}
+
+static uint32_t choose_local(generator_t *gen, bool loads) {
+    // Loads may read OBJREF, the loop counters and the array, stores must not
+    uint32_t first = loads ? 0 : gen->first_local;
+    uint32_t last = loads ? gen->counters + MAX_NESTING + 1 : gen->counters;
+    return first + choose(gen->c, last - first);
+}
+
+static void local_op(generator_t *gen, byte_t op, uint32_t index) {
+    // Now and then the same index, WIDE
+    if (choose(gen->c, 8) == 7) {
+        gen_byte(gen->g, OP_WIDE);
+        gen_byte(gen->g, op);
+        gen_short(gen->g, (uint16_t) index);
+    } else {
+        gen_byte(gen->g, op);
+        gen_byte(gen->g, (byte_t) index);
+    }
+}
+
+static void block(generator_t *gen, uint32_t nesting);
+
+// Generates a block that leaves the stack as it found it
+static void neutral_block(generator_t *gen, uint32_t nesting) {
+    uint32_t depth = gen->depth;
+    block(gen, nesting);
+    while (gen->depth > depth)
+        pop(gen);
+}
+
+static void branch(generator_t *gen, uint32_t floor, uint32_t nesting) {
+    static const byte_t ops[] = { OP_GOTO, OP_IFEQ, OP_IFLT, OP_ICMPEQ };
+    byte_t op = ops[choose(gen->c, 4)];
+    uint32_t operands = op == OP_GOTO ? 0 : op == OP_ICMPEQ ? 2 : 1;
+    while (gen->depth < floor + operands)
+        push_byte(gen);
+    gen->depth -= operands;
+    // Forward over the block, so that both ways meet at the same depth
+    uint32_t at = gen_branch(gen->g, op, 0);
+    neutral_block(gen, nesting);
+    gen_patch(gen->g, at, gen->g->text_size);
+}
+
+static void loop(generator_t *gen, uint32_t nesting) {
+    byte_t counter = (byte_t) (gen->counters + nesting);
+    gen_byte(gen->g, OP_BIPUSH);
+    gen_byte(gen->g, (byte_t) (1 + choose(gen->c, MAX_LOOP_COUNT)));
+    gen_byte(gen->g, OP_ISTORE);
+    gen_byte(gen->g, counter);
+    uint32_t top = gen->g->text_size;
+    gen_byte(gen->g, OP_ILOAD);
+    gen_byte(gen->g, counter);
+    uint32_t exit = gen_branch(gen->g, OP_IFEQ, 0);
+    neutral_block(gen, nesting + 1);
+    gen_byte(gen->g, OP_IINC);
+    gen_byte(gen->g, counter);
+    gen_byte(gen->g, 0xFF);
+    gen_branch(gen->g, OP_GOTO, top);
+    gen_patch(gen->g, exit, gen->g->text_size);
+}
+
+static void call(generator_t *gen) {
+    // Only methods defined later, so that nothing recurses
+    uint32_t first = (uint32_t) (gen->method + 1);
+    uint32_t method = first + choose(gen->c, gen->num_methods - first);
+    gen_byte(gen->g, OP_LDC_W);
+    gen_short(gen->g, (uint16_t) choose(gen->c, gen->num_constants));
+    for (uint32_t i = 0; i < gen->num_args[method]; i++)
+        push_byte(gen);
+    gen_byte(gen->g, OP_INVOKEVIRTUAL);
+    gen_short(gen->g, (uint16_t) (gen->num_constants + method));
+    gen->depth -= gen->num_args[method];
+    gen->depth++;
+}
+
+// Loads from or stores to the array of the method, now and then at an
+// index out of its bounds or in whatever another local holds
+static void array(generator_t *gen, uint32_t floor) {
+    bool store = choose(gen->c, 2);
+    if (store && gen->depth == floor)
+        push_byte(gen);
+    gen_byte(gen->g, OP_BIPUSH);
+    gen_byte(gen->g, (byte_t) choose(gen->c, MAX_ARRAY_SIZE + 1));
+    gen_byte(gen->g, OP_ILOAD);
+    gen_byte(gen->g, (byte_t) (choose(gen->c, 16) == 15 ? choose_local(gen, false) : gen->counters + MAX_NESTING));
+    gen_byte(gen->g, store ? OP_IASTORE : OP_IALOAD);
+    if (store)
+        gen->depth--;
+    else
+        gen->depth++;
+}
+
+// Starts a method with its array
+static void prologue(generator_t *gen) {
+    gen_byte(gen->g, OP_BIPUSH);
+    gen_byte(gen->g, MAX_ARRAY_SIZE);
+    gen_byte(gen->g, OP_NEWARRAY);
+    gen_byte(gen->g, OP_ISTORE);
+    gen_byte(gen->g, (byte_t) (gen->counters + MAX_NESTING));
+}
+
+// Generates statements until a choice of 0 or the method's statements run
+// out, never popping below the depth the block started at
+static void block(generator_t *gen, uint32_t nesting) {
+    static const byte_t binary[] = { OP_IADD, OP_ISUB, OP_IAND, OP_IOR };
+    uint32_t floor = gen->depth;
+    for (; gen->statements > 0; gen->statements--) {
+        uint32_t above = gen->depth - floor;
+        // One in 64 ends the block early
+        uint32_t kind = choose(gen->c, 64);
+        if (kind == 0)
+            return;
+        kind = 1 + kind % 19;
+        // Too deep, make room
+        if (gen->depth >= MAX_DEPTH && above > 0)
+            kind = 8;
+        switch (kind) {
+            case 1:
+                push_byte(gen);
+                break;
+            case 2:
+                gen_byte(gen->g, OP_LDC_W);
+                gen_short(gen->g, (uint16_t) choose(gen->c, gen->num_constants));
+                gen->depth++;
+                break;
+            case 3:
+                local_op(gen, OP_ILOAD, choose_local(gen, true));
+                gen->depth++;
+                break;
+            case 4:
+                if (above == 0)
+                    push_byte(gen);
+                gen_byte(gen->g, OP_DUP);
+                gen->depth++;
+                break;
+            case 5:
+                gen_byte(gen->g, OP_IN);
+                gen->depth++;
+                break;
+            case 6:
+            case 7:
+                while (gen->depth < floor + 2)
+                    push_byte(gen);
+                gen_byte(gen->g, kind == 6 ? binary[choose(gen->c, 4)] : OP_SWAP);
+                gen->depth -= kind == 6;
+                break;
+            case 8:
+            case 9:
+            case 10:
+                if (above == 0)
+                    push_byte(gen);
+                if (kind == 10) {
+                    local_op(gen, OP_ISTORE, choose_local(gen, false));
+                    gen->depth--;
+                } else if (kind == 9) {
+                    gen_byte(gen->g, OP_OUT);
+                    gen->depth--;
+                } else {
+                    pop(gen);
+                }
+                break;
+            case 11:
+                gen_byte(gen->g, OP_IINC);
+                gen_byte(gen->g, (byte_t) choose_local(gen, false));
+                gen_byte(gen->g, (byte_t) choose(gen->c, 256));
+                break;
+            case 12:
+            case 13:
+                branch(gen, floor, nesting);
+                break;
+            case 14:
+                if (nesting < MAX_NESTING)
+                    loop(gen, nesting);
+                break;
+            case 15:
+                if (gen->method + 1 < (int) gen->num_methods)
+                    call(gen);
+                break;
+            case 16:
+                array(gen, floor);
+                break;
+            case 17:
+                // Rarely, an error
+                if (choose(gen->c, 8) == 7)
+                    gen_byte(gen->g, OP_ERR);
+                break;
+            default:
+                gen_byte(gen->g, OP_NOP);
+                break;
+        }
+    }
+}
+
+int fuzz_generate(const byte_t *choices, size_t n, fuzz_program_t *p) {
+    choices_t c = { .data = choices, .n = n };
+    gen_t g;
+    gen_init(&g);
+    generator_t gen = { .c = &c, .g = &g, .method = -1 };
+
+    gen.num_constants = 1 + choose(&c, MAX_CONSTANTS);
+    for (uint32_t i = 0; i < gen.num_constants; i++)
+        gen_constant(&g, choose_word(&c));
+    gen.num_methods = choose(&c, MAX_METHODS + 1);
+    uint32_t num_locals[MAX_METHODS];
+    for (uint32_t i = 0; i < gen.num_methods; i++) {
+        gen.num_args[i] = choose(&c, MAX_ARGS + 1);
+        num_locals[i] = 1 + choose(&c, MAX_LOCALS);
+        gen_constant(&g, 0);
+    }
+
+    // Main's locals are the stored ones and the loop counters
+    gen.first_local = 0;
+    gen.counters = 1 + choose(&c, MAX_LOCALS);
+    gen.statements = MAX_STATEMENTS;
+    prologue(&gen);
+    block(&gen, 0);
+    gen_byte(&g, choose(&c, 16) == 15 ? OP_ERR : OP_HALT);
+
+    for (uint32_t i = 0; i < gen.num_methods; i++) {
+        gen_set_constant(&g, (uint16_t) (gen.num_constants + i), (word_t) g.text_size);
+        gen_short(&g, (uint16_t) (1 + gen.num_args[i]));
+        gen_short(&g, (uint16_t) (num_locals[i] + MAX_NESTING + 1));
+        gen.method = (int) i;
+        gen.first_local = 1;
+        gen.counters = 1 + gen.num_args[i] + num_locals[i];
+        gen.depth = 0;
+        gen.statements = MAX_STATEMENTS;
+        prologue(&gen);
+        block(&gen, 0);
+        if (gen.depth == 0)
+            push_byte(&gen);
+        gen_byte(&g, OP_IRETURN);
+    }
+
+    p->input_size = choose(&c, FUZZ_INPUT_SIZE + 1);
+    for (size_t i = 0; i < p->input_size; i++)
+        p->input[i] = (byte_t) choose(&c, 256);
+    p->image = gen_image(&g, &p->size);
+    gen_free(&g);
+    return p->image == NULL ? -1 : 0;
+}
+
+void fuzz_program_free(fuzz_program_t *p) {
+    free(p->image);
+    p->image = NULL;
+}
+
+static uint64_t hash_words(const word_t *words, size_t n) {
+    // 64-bit FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < n; i++) {
+        h ^= (uint32_t) words[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+int fuzz_run(const fuzz_program_t *p, fuzz_engine_t engine, fuzz_outcome_t *out) {
+    byte_t *image = malloc(p->size);
+    if (image == NULL)
+        return -1;
+    memcpy(image, p->image, p->size);
+    program_t *program = program_from_image(image, p->size);
+    ijvm_t *m = ijvm_create();
+    if (program == NULL || m == NULL || ijvm_load_program(m, program) < 0) {
+        ijvm_program_release(program);
+        if (m != NULL)
+            ijvm_destroy(m);
+        return -1;
+    }
+    ijvm_program_release(program);
+    memset(out, 0, sizeof(*out));
+    ijvm_set_input_buffer(m, p->input, p->input_size);
+    ijvm_set_output_buffer(m, out->output, FUZZ_OUTPUT_SIZE);
+
+    uint64_t ran = 0;
+    switch (engine) {
+        case FUZZ_STEP:
+            for (; ran < FUZZ_MAX_INSTRUCTIONS && !ijvm_finished(m); ran++)
+                ijvm_step(m);
+            break;
+        case FUZZ_RUN_FOR:
+            for (uint64_t i = 0; ran < FUZZ_MAX_INSTRUCTIONS && !ijvm_finished(m); i++) {
+                uint64_t budget = 1 + (i * 7) % 16;
+                if (budget > FUZZ_MAX_INSTRUCTIONS - ran)
+                    budget = FUZZ_MAX_INSTRUCTIONS - ran;
+                ijvm_run_for(m, budget);
+                ran += budget;
+            }
+            break;
+        case FUZZ_INSTRUMENTED:
+            if (ijvm_stats_enable(m) < 0) {
+                ijvm_destroy(m);
+                return -1;
+            }
+            ijvm_run_for(m, FUZZ_MAX_INSTRUCTIONS);
+            break;
+        case FUZZ_RUN:
+        case FUZZ_ENGINES:
+            ijvm_run_for(m, FUZZ_MAX_INSTRUCTIONS);
+            break;
+    }
+
+    out->finished = ijvm_finished(m);
+    out->tos = ijvm_tos(m);
+    out->stack_size = ijvm_stack_size(m);
+    out->stack_hash = hash_words(ijvm_get_stack(m), out->stack_size >= 0 ? (size_t) out->stack_size + 1 : 0);
+    out->output_size = ijvm_output_size(m);
+    ijvm_destroy(m);
+    return 0;
+}
+
+static bool same_outcome(const fuzz_outcome_t *a, const fuzz_outcome_t *b) {
+    return a->finished == b->finished && a->tos == b->tos && a->stack_size == b->stack_size
+           && a->stack_hash == b->stack_hash && a->output_size == b->output_size
+           && memcmp(a->output, b->output, a->output_size) == 0;
+}
+
+int fuzz_compare(const fuzz_program_t *p) {
+    fuzz_outcome_t *outcomes = malloc(2 * sizeof(fuzz_outcome_t));
+    if (outcomes == NULL || fuzz_run(p, FUZZ_STEP, &outcomes[0]) < 0) {
+        free(outcomes);
+        return -1;
+    }
+    int res = FUZZ_STEP;
+    for (int engine = FUZZ_STEP + 1; engine < FUZZ_ENGINES && res == FUZZ_STEP; engine++) {
+        if (fuzz_run(p, (fuzz_engine_t) engine, &outcomes[1]) < 0)
+            res = -1;
+        else if (!same_outcome(&outcomes[0], &outcomes[1]))
+            res = engine;
+    }
+    free(outcomes);
+    return res;
+}
+
+int fuzz_check(const byte_t *choices, size_t n) {
+    fuzz_program_t p;
+    if (fuzz_generate(choices, n, &p) < 0)
+        return -1;
+    int res = fuzz_compare(&p);
+    fuzz_program_free(&p);
+    return res;
+}
+
+bool fuzz_diverges(const byte_t *choices, size_t n, void *arg) {
+    (void) arg;
+    return fuzz_check(choices, n) > FUZZ_STEP;
+}
+
+size_t fuzz_minimize(byte_t *choices, size_t n, fuzz_predicate_t predicate, void *arg) {
+    byte_t *attempt = malloc(n > 0 ? n : 1);
+    if (attempt == NULL)
+        return n;
+    for (bool progress = true; progress;) {
+        progress = false;
+        // Cut out ever smaller chunks
+        for (size_t chunk = n / 2; chunk > 0; chunk /= 2) {
+            for (size_t at = 0; at + chunk <= n;) {
+                memcpy(attempt, choices, at);
+                memcpy(attempt + at, choices + at + chunk, n - at - chunk);
+                if (predicate(attempt, n - chunk, arg)) {
+                    memcpy(choices, attempt, n - chunk);
+                    n -= chunk;
+                    progress = true;
+                } else {
+                    at += chunk;
+                }
+            }
+        }
+        // Lower what is left, to 0 if possible
+        for (size_t i = 0; i < n; i++) {
+            byte_t original = choices[i];
+            for (byte_t lower = 0; lower < original; lower = (byte_t) (lower + (original - lower + 1) / 2)) {
+                choices[i] = lower;
+                if (predicate(choices, n, arg)) {
+                    progress = true;
+                    break;
+                }
+                choices[i] = original;
+            }
+        }
+    }
+    free(attempt);
+    return n;
+}
+
+// Fills the choices from xorshift64* seeded with seed
+static void random_choices(uint64_t seed, byte_t *choices, size_t n) {
+    uint64_t x = seed * 0x9E3779B97F4A7C15ull + 1;
+    for (size_t i = 0; i < n; i++) {
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        choices[i] = (byte_t) ((x * 0x2545F4914F6CDD1Dull) >> 56);
+    }
+}
+
+static int save(const char *dir, const char *name, const void *data, size_t size) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *fp = fopen(path, "wb");
+    int res = fp != NULL && (size == 0 || fwrite(data, 1, size, fp) == size) ? 0 : -1;
+    if (fp != NULL && fclose(fp) != 0)
+        res = -1;
+    return res;
+}
+
+// Minimizes the choices of a program the engines diverged on, then tells
+// how they differ and saves it
+static int report_divergence(byte_t *choices, size_t n, const char *dir, FILE *report) {
+    n = fuzz_minimize(choices, n, fuzz_diverges, NULL);
+    fuzz_program_t p;
+    if (fuzz_generate(choices, n, &p) < 0)
+        return -1;
+    int engine = fuzz_compare(&p);
+    fuzz_outcome_t *outcomes = malloc(2 * sizeof(fuzz_outcome_t));
+    if (engine <= FUZZ_STEP || outcomes == NULL
+        || fuzz_run(&p, FUZZ_STEP, &outcomes[0]) < 0 || fuzz_run(&p, engine, &outcomes[1]) < 0) {
+        free(outcomes);
+        fuzz_program_free(&p);
+        return -1;
+    }
+    fprintf(report, "minimized to %zu choices, a %zu byte binary with %zu bytes of input:\n", n, p.size, p.input_size);
+    for (int i = 0; i < 2; i++) {
+        fuzz_outcome_t *o = &outcomes[i];
+        fprintf(report, "  %-12s finished=%d tos=%d stack_size=%d stack_hash=%016llx output=%zu bytes\n",
+                fuzz_engine_names[i == 0 ? FUZZ_STEP : engine], o->finished, o->tos, o->stack_size,
+                (unsigned long long) o->stack_hash, o->output_size);
+    }
+    int res = 0;
+    if (dir != NULL) {
+        res = save(dir, "diverged.ijvm", p.image, p.size) | save(dir, "diverged.in", p.input, p.input_size);
+        fprintf(report, "saved as %s/diverged.ijvm, input %s/diverged.in\n", dir, dir);
+    }
+    free(outcomes);
+    fuzz_program_free(&p);
+    return res;
+}
+
+int fuzz_campaign(uint64_t seed, uint64_t count, const char *dir, FILE *report) {
+    byte_t choices[FUZZ_CHOICES];
+    int diverged = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        random_choices(seed + i, choices, FUZZ_CHOICES);
+        int engine = fuzz_check(choices, FUZZ_CHOICES);
+        if (engine < 0)
+            return -1;
+        if (engine == FUZZ_STEP)
+            continue;
+        fprintf(report, "seed %llu: %s diverged from step\n", (unsigned long long) (seed + i), fuzz_engine_names[engine]);
+        if (diverged++ == 0 && report_divergence(choices, FUZZ_CHOICES, dir, report) < 0)
+            return -1;
+    }
+    return diverged;
+}
@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "gen.h"
+#include "machine.h"
+
+#define OBJREF 0xCAFE
+
+const char *const gen_kernel_names[GEN_KERNELS] = { "arith", "calls", "wide", "arrays", "output" };
+
+void gen_init(gen_t *g) {
+    memset(g, 0, sizeof(*g));
+}
+
+void gen_free(gen_t *g) {
+    free(g->constants);
+    free(g->text);
+    gen_init(g);
+}
+
+// Makes room for n more bytes in a block
+static bool reserve(gen_t *g, byte_t **block, uint32_t size, uint32_t *capacity, uint32_t n) {
+    if (g->failed)
+        return false;
+    if (size + n <= *capacity)
+        return true;
+    uint32_t grown = *capacity ? *capacity : 0x100;
+    while (grown < size + n)
+        grown *= 2;
+    byte_t *data = realloc(*block, grown);
+    if (data == NULL) {
+        g->failed = true;
+        return false;
+    }
+    *block = data;
+    *capacity = grown;
+    return true;
+}
+
+static void put_word(byte_t *at, uint32_t value) {
+    at[0] = (byte_t) (value >> 24);
+    at[1] = (byte_t) (value >> 16);
+    at[2] = (byte_t) (value >> 8);
+    at[3] = (byte_t) value;
+}
+
+void gen_byte(gen_t *g, byte_t b) {
+    if (reserve(g, &g->text, g->text_size, &g->text_capacity, 1))
+        g->text[g->text_size++] = b;
+}
+
+void gen_short(gen_t *g, uint16_t s) {
+    gen_byte(g, (byte_t) (s >> 8));
+    gen_byte(g, (byte_t) s);
+}
+
+void gen_bytes(gen_t *g, const byte_t *data, uint32_t n) {
+    if (n > 0 && reserve(g, &g->text, g->text_size, &g->text_capacity, n)) {
+        memcpy(g->text + g->text_size, data, n);
+        g->text_size += n;
+    }
+}
+
+uint16_t gen_constant(gen_t *g, word_t value) {
+    uint16_t index = (uint16_t) (g->constants_size / sizeof(word_t));
+    if (reserve(g, &g->constants, g->constants_size, &g->constants_capacity, sizeof(word_t))) {
+        put_word(g->constants + g->constants_size, (uint32_t) value);
+        g->constants_size += sizeof(word_t);
+    }
+    return index;
+}
+
+void gen_set_constant(gen_t *g, uint16_t index, word_t value) {
+    if (!g->failed)
+        put_word(g->constants + index * sizeof(word_t), (uint32_t) value);
+}
+
+uint32_t gen_branch(gen_t *g, byte_t op, uint32_t target) {
+    uint32_t at = g->text_size;
+    gen_byte(g, op);
+    gen_short(g, (uint16_t) (target - at));
+    return at;
+}
+
+void gen_patch(gen_t *g, uint32_t at, uint32_t target) {
+    if (g->failed)
+        return;
+    uint16_t offset = (uint16_t) (target - at);
+    g->text[at + 1] = (byte_t) (offset >> 8);
+    g->text[at + 2] = (byte_t) offset;
+}
+
+byte_t *gen_image(gen_t *g, size_t *size) {
+    if (g->failed)
+        return NULL;
+    *size = 4 + 8 + g->constants_size + 8 + g->text_size;
+    byte_t *image = malloc(*size);
+    if (image == NULL)
+        return NULL;
+    byte_t *at = image;
+    put_word(at, MAGIC_NUMBER);
+    put_word(at + 4, GEN_CONSTANT_ORIGIN);
+    put_word(at + 8, g->constants_size);
+    at += 12;
+    if (g->constants_size > 0)
+        memcpy(at, g->constants, g->constants_size);
+    at += g->constants_size;
+    put_word(at, GEN_TEXT_ORIGIN);
+    put_word(at + 4, g->text_size);
+    if (g->text_size > 0)
+        memcpy(at + 8, g->text, g->text_size);
+    return image;
+}
+
+static void op_byte(gen_t *g, byte_t op, byte_t operand) {
+    gen_byte(g, op);
+    gen_byte(g, operand);
+}
+
+static void op_short(gen_t *g, byte_t op, uint16_t operand) {
+    gen_byte(g, op);
+    gen_short(g, operand);
+}
+
+static void wide(gen_t *g, byte_t op, uint16_t index) {
+    gen_byte(g, OP_WIDE);
+    op_short(g, op, index);
+}
+
+static void iinc(gen_t *g, byte_t index, int8_t delta) {
+    gen_byte(g, OP_IINC);
+    gen_byte(g, index);
+    gen_byte(g, (byte_t) delta);
+}
+
+// Counts local 0 down from n to 0, around a body that gen_kernel() writes
+// between the two; returns where the exit branch is
+static uint32_t loop_start(gen_t *g, uint32_t n, uint32_t *top) {
+    op_short(g, OP_LDC_W, gen_constant(g, (word_t) n));
+    op_byte(g, OP_ISTORE, 0);
+    *top = g->text_size;
+    op_byte(g, OP_ILOAD, 0);
+    return gen_branch(g, OP_IFEQ, 0);
+}
+
+static void loop_end(gen_t *g, uint32_t top, uint32_t exit) {
+    iinc(g, 0, -1);
+    gen_branch(g, OP_GOTO, top);
+    gen_patch(g, exit, g->text_size);
+}
+
+static void method_header(gen_t *g, uint16_t num_args, uint16_t num_locals) {
+    gen_short(g, num_args);
+    gen_short(g, num_locals);
+}
+
+static void arith(gen_t *g, uint32_t n) {
+    uint32_t top;
+    op_byte(g, OP_BIPUSH, 0);
+    op_byte(g, OP_ISTORE, 1);
+    uint32_t exit = loop_start(g, n, &top);
+    op_byte(g, OP_ILOAD, 1);
+    op_byte(g, OP_ILOAD, 0);
+    gen_byte(g, OP_IADD);
+    gen_byte(g, OP_DUP);
+    gen_byte(g, OP_IADD);
+    op_byte(g, OP_BIPUSH, 7);
+    gen_byte(g, OP_IOR);
+    op_byte(g, OP_ILOAD, 0);
+    gen_byte(g, OP_ISUB);
+    op_byte(g, OP_ISTORE, 1);
+    loop_end(g, top, exit);
+    op_byte(g, OP_ILOAD, 1);
+    gen_byte(g, OP_HALT);
+}
+
+static void calls(gen_t *g, uint32_t n) {
+    uint32_t depth = n < GEN_CALL_DEPTH ? n : GEN_CALL_DEPTH;
+    uint16_t objref = gen_constant(g, OBJREF);
+    uint16_t method = gen_constant(g, 0);
+    uint32_t top;
+    op_byte(g, OP_BIPUSH, 0);
+    op_byte(g, OP_ISTORE, 1);
+    uint32_t exit = loop_start(g, depth ? n / depth : 0, &top);
+    op_short(g, OP_LDC_W, objref);
+    op_short(g, OP_LDC_W, gen_constant(g, (word_t) depth));
+    op_short(g, OP_INVOKEVIRTUAL, method);
+    op_byte(g, OP_ILOAD, 1);
+    gen_byte(g, OP_IADD);
+    op_byte(g, OP_ISTORE, 1);
+    loop_end(g, top, exit);
+    op_byte(g, OP_ILOAD, 1);
+    gen_byte(g, OP_HALT);
+
+    // Counts its argument k down to 1, returning k
+    gen_set_constant(g, method, (word_t) g->text_size);
+    method_header(g, 2, 0);
+    op_byte(g, OP_ILOAD, 1);
+    op_byte(g, OP_BIPUSH, 1);
+    gen_byte(g, OP_ISUB);
+    uint32_t base = gen_branch(g, OP_IFEQ, 0);
+    op_short(g, OP_LDC_W, objref);
+    op_byte(g, OP_ILOAD, 1);
+    op_byte(g, OP_BIPUSH, 1);
+    gen_byte(g, OP_ISUB);
+    op_short(g, OP_INVOKEVIRTUAL, method);
+    op_byte(g, OP_BIPUSH, 1);
+    gen_byte(g, OP_IADD);
+    gen_byte(g, OP_IRETURN);
+    gen_patch(g, base, g->text_size);
+    op_byte(g, OP_BIPUSH, 1);
+    gen_byte(g, OP_IRETURN);
+}
+
+static void wide_frames(gen_t *g, uint32_t n) {
+    uint16_t method = gen_constant(g, 0);
+    op_short(g, OP_LDC_W, gen_constant(g, OBJREF));
+    op_short(g, OP_LDC_W, gen_constant(g, (word_t) n));
+    op_short(g, OP_INVOKEVIRTUAL, method);
+    gen_byte(g, OP_HALT);
+
+    // A sum in local 300 and a step in local 256, counting the argument
+    // in local 1 down
+    gen_set_constant(g, method, (word_t) g->text_size);
+    method_header(g, 2, 300);
+    op_byte(g, OP_BIPUSH, 0);
+    wide(g, OP_ISTORE, 300);
+    op_byte(g, OP_BIPUSH, 0);
+    wide(g, OP_ISTORE, 256);
+    uint32_t top = g->text_size;
+    op_byte(g, OP_ILOAD, 1);
+    uint32_t exit = gen_branch(g, OP_IFEQ, 0);
+    wide(g, OP_ILOAD, 300);
+    wide(g, OP_ILOAD, 256);
+    gen_byte(g, OP_IADD);
+    wide(g, OP_ISTORE, 300);
+    wide(g, OP_ILOAD, 256);
+    op_byte(g, OP_BIPUSH, 3);
+    gen_byte(g, OP_IADD);
+    wide(g, OP_ISTORE, 256);
+    iinc(g, 1, -1);
+    gen_branch(g, OP_GOTO, top);
+    gen_patch(g, exit, g->text_size);
+    wide(g, OP_ILOAD, 300);
+    gen_byte(g, OP_IRETURN);
+}
+
+static void arrays(gen_t *g, uint32_t n) {
+    uint16_t mask = gen_constant(g, GEN_ARRAY_SIZE - 1);
+    op_short(g, OP_LDC_W, gen_constant(g, GEN_ARRAY_SIZE));
+    gen_byte(g, OP_NEWARRAY);
+    op_byte(g, OP_ISTORE, 2);
+    op_byte(g, OP_BIPUSH, 0);
+    op_byte(g, OP_ISTORE, 1);
+    uint32_t top;
+    uint32_t exit = loop_start(g, n, &top);
+    // a[i & mask] = a[(i + 1) & mask] + i, summed up in local 1
+    op_byte(g, OP_ILOAD, 0);
+    op_byte(g, OP_BIPUSH, 1);
+    gen_byte(g, OP_IADD);
+    op_short(g, OP_LDC_W, mask);
+    gen_byte(g, OP_IAND);
+    op_byte(g, OP_ILOAD, 2);
+    gen_byte(g, OP_IALOAD);
+    op_byte(g, OP_ILOAD, 0);
+    gen_byte(g, OP_IADD);
+    gen_byte(g, OP_DUP);
+    op_byte(g, OP_ILOAD, 1);
+    gen_byte(g, OP_IADD);
+    op_byte(g, OP_ISTORE, 1);
+    op_byte(g, OP_ILOAD, 0);
+    op_short(g, OP_LDC_W, mask);
+    gen_byte(g, OP_IAND);
+    op_byte(g, OP_ILOAD, 2);
+    gen_byte(g, OP_IASTORE);
+    loop_end(g, top, exit);
+    op_byte(g, OP_ILOAD, 1);
+    gen_byte(g, OP_HALT);
+}
+
+static void output(gen_t *g, uint32_t n) {
+    uint32_t top;
+    uint32_t exit = loop_start(g, n, &top);
+    // Cycles through the 64 characters from '0'
+    op_byte(g, OP_ILOAD, 0);
+    op_byte(g, OP_BIPUSH, 0x3F);
+    gen_byte(g, OP_IAND);
+    op_byte(g, OP_BIPUSH, '0');
+    gen_byte(g, OP_IADD);
+    gen_byte(g, OP_OUT);
+    loop_end(g, top, exit);
+    op_byte(g, OP_BIPUSH, 0);
+    gen_byte(g, OP_HALT);
+}
+
+byte_t *gen_kernel(gen_kernel_t kernel, uint32_t n, size_t *size) {
+    gen_t g;
+    gen_init(&g);
+    switch (kernel) {
+        case GEN_ARITH:
+            arith(&g, n);
+            break;
+        case GEN_CALLS:
+            calls(&g, n);
+            break;
+        case GEN_WIDE:
+            wide_frames(&g, n);
+            break;
+        case GEN_ARRAYS:
+            arrays(&g, n);
+            break;
+        case GEN_OUTPUT:
+            output(&g, n);
+            break;
+        default:
+            gen_free(&g);
+            return NULL;
+    }
+    byte_t *image = gen_image(&g, size);
+    gen_free(&g);
+    return image;
+}
+
+int gen_kernel_write(gen_kernel_t kernel, uint32_t n, const char *path) {
+    size_t size;
+    byte_t *image = gen_kernel(kernel, n, &size);
+    if (image == NULL)
+        return -1;
+    FILE *fp = fopen(path, "wb");
+    int res = fp != NULL && fwrite(image, 1, size, fp) == size ? 0 : -1;
+    if (fp != NULL && fclose(fp) != 0)
+        res = -1;
+    free(image);
+    return res;
+}
+
+int gen_kernel_find(const char *name) {
+    for (int i = 0; i < GEN_KERNELS; i++)
+        if (strcmp(gen_kernel_names[i], name) == 0)
+            return i;
+    return -1;
+}
@@ -0,0 +1,88 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "heap.h"
+
+word_t heap_new_array(machine_t *m, word_t count) {
+    if (count < 0)
+        return 0;
+    if (m->heap == NULL && (m->heap = calloc(1, sizeof(heap_t))) == NULL)
+        return 0;
+    heap_t *heap = m->heap;
+    if (heap->num_arrays == heap->capacity) {
+        size_t capacity = heap->capacity ? heap->capacity * 2 : 16;
+        array_t **arrays = realloc(heap->arrays, sizeof(array_t *) * capacity);
+        if (arrays == NULL)
+            return 0;
+        heap->arrays = arrays;
+        heap->capacity = capacity;
+    }
+    array_t *a = calloc(1, sizeof(array_t) + sizeof(word_t) * (size_t) count);
+    if (a == NULL)
+        return 0;
+    a->size = count;
+    heap->arrays[heap->num_arrays++] = a;
+    uint64_t bytes = sizeof(array_t) + sizeof(word_t) * (uint64_t) count;
+    m->metrics.counts.heap_live += bytes;
+    m->metrics.counts.heap_allocated += bytes;
+    m->metrics.counts.arrays++;
+    return heap->num_arrays;
+}
+
+word_t *heap_element(machine_t *m, word_t arrayref, word_t index) {
+    heap_t *heap = m->heap;
+    if (heap == NULL || arrayref <= 0 || (size_t) arrayref > heap->num_arrays)
+        return NULL;
+    array_t *a = heap->arrays[arrayref - 1];
+    if (index < 0 || index >= a->size)
+        return NULL;
+    return &a->words[index];
+}
+
+int heap_adopt(machine_t *m, byte_t *arena, size_t size, size_t num_arrays) {
+    heap_free(m);
+    heap_t *heap = calloc(1, sizeof(heap_t));
+    array_t **arrays = calloc(num_arrays ? num_arrays : 1, sizeof(array_t *));
+    // Only the sizes are read, to find where each array starts
+    size_t offset = 0;
+    size_t i = 0;
+    while (heap != NULL && arrays != NULL && i < num_arrays
+           && size - offset >= sizeof(array_t)) {
+        array_t *a = (array_t *) (arena + offset);
+        if (a->size < 0 || (size - offset - sizeof(array_t)) / sizeof(word_t) < (size_t) a->size)
+            break;
+        arrays[i++] = a;
+        offset += sizeof(array_t) + sizeof(word_t) * (size_t) a->size;
+    }
+    if (heap == NULL || arrays == NULL || i < num_arrays) {
+        munmap(arena, size);
+        free(arrays);
+        free(heap);
+        return -1;
+    }
+    heap->arrays = arrays;
+    heap->num_arrays = num_arrays;
+    heap->capacity = num_arrays ? num_arrays : 1;
+    heap->arena = arena;
+    heap->arena_size = size;
+    m->heap = heap;
+    m->metrics.counts.heap_live = offset;
+    return 0;
+}
+
+void heap_free(machine_t *m) {
+    heap_t *heap = m->heap;
+    m->metrics.counts.heap_live = 0;
+    if (heap == NULL)
+        return;
+    for (size_t i = 0; i < heap->num_arrays; i++) {
+        byte_t *a = (byte_t *) heap->arrays[i];
+        if (a < heap->arena || a >= heap->arena + heap->arena_size)
+            free(a);
+    }
+    if (heap->arena != NULL)
+        munmap(heap->arena, heap->arena_size);
+    free(heap->arrays);
+    free(heap);
+    m->heap = NULL;
+}
@@ -0,0 +1,96 @@
+#define _DEFAULT_SOURCE
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "hwcounters.h"
+
+const char *const hwc_event_names[HWC_EVENTS] = {
+    "cycles", "instructions", "branch_misses", "l1i_misses", "l1d_misses", "itlb_misses", "task_clock_ns"
+};
+
+#define CACHE_MISSES(cache) \
+    ((cache) | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16)
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[HWC_EVENTS] = {
+    [HWC_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [HWC_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [HWC_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [HWC_L1I_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_L1I) },
+    [HWC_L1D_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_L1D) },
+    [HWC_ITLB_MISSES] = { PERF_TYPE_HW_CACHE, CACHE_MISSES(PERF_COUNT_HW_CACHE_ITLB) },
+    [HWC_TASK_CLOCK] = { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+};
+
+int hwcounters_open(hwcounters_t *h) {
+    int opened = 0;
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        // Through syscall(), glibc has no wrapper
+        h->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+        h->values[i] = 0;
+        opened += h->fds[i] >= 0;
+    }
+    return opened;
+}
+
+void hwcounters_close(hwcounters_t *h) {
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        if (h->fds[i] >= 0)
+            close(h->fds[i]);
+        h->fds[i] = -1;
+    }
+}
+
+bool hwcounters_counted(const hwcounters_t *h, hwc_event_t event) {
+    return h->fds[event] >= 0;
+}
+
+void hwcounters_start(hwcounters_t *h) {
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        if (h->fds[i] < 0)
+            continue;
+        ioctl(h->fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(h->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void hwcounters_stop(hwcounters_t *h) {
+    for (int i = 0; i < HWC_EVENTS; i++)
+        if (h->fds[i] >= 0)
+            ioctl(h->fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        // The count, the time enabled and the time on the PMU
+        uint64_t read_values[3];
+        if (h->fds[i] < 0 || read(h->fds[i], read_values, sizeof(read_values)) != sizeof(read_values))
+            continue;
+        uint64_t value = read_values[0];
+        if (read_values[2] > 0 && read_values[2] < read_values[1])
+            value = (uint64_t) ((double) value * (double) read_values[1] / (double) read_values[2]);
+        h->values[i] += value;
+    }
+}
+
+void hwcounters_report(FILE *f, const hwcounters_t *h, uint64_t instructions) {
+    fprintf(f, "%-14s %16s %14s\n", "event", "total", "per instr");
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        if (!hwcounters_counted(h, (hwc_event_t) i)) {
+            fprintf(f, "%-14s %16s\n", hwc_event_names[i], "not supported");
+            continue;
+        }
+        fprintf(f, "%-14s %16llu %14.4f\n", hwc_event_names[i], (unsigned long long) h->values[i],
+                instructions > 0 ? (double) h->values[i] / (double) instructions : 0.0);
+    }
+}
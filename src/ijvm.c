@@ -0,0 +1,96 @@
+#include "machine.h"
+#include "opstats.h"
+
+// Instance behind the non-reentrant interface of ijvm.h
+static machine_t machine;
+
+ijvm_t *ijvm_default(void) {
+    return &machine;
+}
+
+int init_ijvm(char *binary_file) {
+#ifdef IJVM_STATS
+    if (machine.stats == NULL && ijvm_stats_enable(&machine) < 0)
+        return -1;
+#endif
+    return ijvm_load(&machine, binary_file);
+}
+
+void destroy_ijvm(void) {
+    // A counting default instance reports what it ran on the way out
+    ijvm_stats_report(&machine, stderr, OPSTATS_TEXT);
+    ijvm_stats_disable(&machine);
+    ijvm_unload(&machine);
+}
+
+void run(void) {
+    ijvm_run(&machine);
+}
+
+bool step(void) {
+    return ijvm_step(&machine);
+}
+
+bool finished(void) {
+    return ijvm_finished(&machine);
+}
+
+word_t tos(void) {
+    return ijvm_tos(&machine);
+}
+
+word_t *get_stack(void) {
+    return ijvm_get_stack(&machine);
+}
+
+int stack_size(void) {
+    return ijvm_stack_size(&machine);
+}
+
+byte_t *get_text(void) {
+    return ijvm_get_text(&machine);
+}
+
+int text_size(void) {
+    return ijvm_text_size(&machine);
+}
+
+int get_program_counter(void) {
+    return ijvm_get_program_counter(&machine);
+}
+
+word_t get_local_variable(int i) {
+    return ijvm_get_local_variable(&machine, i);
+}
+
+word_t get_constant(int i) {
+    return ijvm_get_constant(&machine, i);
+}
+
+byte_t get_instruction(void) {
+    return ijvm_get_instruction(&machine);
+}
+
+void set_input(FILE *fp) {
+    ijvm_set_input(&machine, fp);
+}
+
+void set_output(FILE *fp) {
+    ijvm_set_output(&machine, fp);
+}
+
+ijvm_status_t run_for(uint64_t budget) {
+    return ijvm_run_for(&machine, budget);
+}
+
+void set_input_buffer(const void *data, size_t size) {
+    ijvm_set_input_buffer(&machine, data, size);
+}
+
+void set_output_buffer(void *data, size_t size) {
+    ijvm_set_output_buffer(&machine, data, size);
+}
+
+size_t output_size(void) {
+    return ijvm_output_size(&machine);
+}
@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "io.h"
+
+void io_in_file(io_in_t *in, FILE *fp) {
+    in->fp = fp;
+    in->fd = -1;
+    in->data = in->buf;
+    in->pos = 0;
+    in->len = 0;
+    // fread() on a pipe or terminal would wait for a whole block, so those
+    // are read from their descriptor; fileno() fails for memory streams
+    struct stat st;
+    int fd = fp != NULL ? fileno(fp) : -1;
+    if (fd >= 0 && fstat(fd, &st) == 0 && !S_ISREG(st.st_mode))
+        in->fd = fd;
+}
+
+void io_in_memory(io_in_t *in, const void *data, size_t size) {
+    in->fp = NULL;
+    in->fd = -1;
+    in->data = data;
+    in->pos = 0;
+    in->len = size;
+}
+
+int io_refill(io_in_t *in) {
+    if (in->fp == NULL)
+        return -1;
+    // A stream hands out what it has, rarely more than a little
+    size_t size = in->fd >= 0 ? IO_SMALL_BUFFER_SIZE : IO_BUFFER_SIZE;
+    if (in->size < size) {
+        byte_t *buf = realloc(in->buf, size);
+        if (buf == NULL) {
+            // Still correct, just one byte at a time
+            int c = getc(in->fp);
+            return c == EOF ? -1 : c;
+        }
+        in->buf = buf;
+        in->size = size;
+    }
+    ssize_t n;
+    if (in->fd >= 0) {
+        while ((n = read(in->fd, in->buf, in->size)) < 0 && errno == EINTR);
+    } else {
+        n = fread(in->buf, 1, in->size, in->fp);
+    }
+    in->data = in->buf;
+    in->pos = 0;
+    in->len = n > 0 ? n : 0;
+    if (in->len == 0)
+        return -1;
+    return in->data[in->pos++];
+}
+
+int io_in_copy(io_in_t *dst, const io_in_t *src) {
+    dst->fp = src->fp;
+    dst->fd = src->fd;
+    dst->buf = NULL;
+    dst->pos = 0;
+    if (src->fp == NULL) {
+        dst->data = src->data;
+        dst->pos = src->pos;
+        dst->len = src->len;
+        return 0;
+    }
+    // The read-ahead is gone from the FILE, so it has to come along
+    dst->len = src->len - src->pos;
+    dst->size = 0;
+    if (src->buf != NULL) {
+        dst->buf = malloc(src->size);
+        if (dst->buf == NULL)
+            return -1;
+        dst->size = src->size;
+        memcpy(dst->buf, src->data + src->pos, dst->len);
+    }
+    dst->data = dst->buf;
+    return 0;
+}
+
+void io_in_free(io_in_t *in) {
+    free(in->buf);
+    memset(in, 0, sizeof(*in));
+    in->fd = -1;
+}
+
+void io_flush(io_out_t *out) {
+    if (out->fp == NULL || out->len == 0)
+        return;
+    fwrite(out->data, 1, out->len, out->fp);
+    out->len = 0;
+}
+
+void io_out_file(io_out_t *out, FILE *fp) {
+    io_flush(out);
+    out->fp = fp;
+    out->data = out->buf;
+    out->len = 0;
+    // Allocated by the first OUT, which lands in io_overflow()
+    out->cap = 0;
+}
+
+void io_out_memory(io_out_t *out, void *data, size_t size) {
+    io_flush(out);
+    out->fp = NULL;
+    out->data = data;
+    out->len = 0;
+    out->cap = size;
+}
+
+void io_overflow(io_out_t *out, byte_t c) {
+    if (out->fp == NULL)
+        return;
+    io_flush(out);
+    if (out->size < IO_BUFFER_SIZE) {
+        size_t size = out->size ? out->size * 2 : IO_SMALL_BUFFER_SIZE;
+        byte_t *buf = realloc(out->buf, size);
+        if (buf != NULL) {
+            out->buf = buf;
+            out->size = size;
+        }
+    }
+    if (out->buf == NULL) {
+        putc(c, out->fp);
+        return;
+    }
+    out->data = out->buf;
+    out->cap = out->size;
+    out->data[out->len++] = c;
+}
+
+void io_out_copy(io_out_t *dst, const io_out_t *src) {
+    memset(dst, 0, sizeof(*dst));
+    dst->fp = src->fp;
+    if (src->fp == NULL) {
+        dst->data = src->data;
+        dst->len = src->len;
+        dst->cap = src->cap;
+    }
+}
+
+void io_out_free(io_out_t *out) {
+    io_flush(out);
+    free(out->buf);
+    memset(out, 0, sizeof(*out));
+}
@@ -0,0 +1,706 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include "jas.h"
+#include "gen.h"
+#include "machine.h"
+
+typedef enum operand {
+    OPERAND_NONE,
+    OPERAND_BYTE,     // BIPUSH value
+    OPERAND_VAR,      // ILOAD var, a byte or after WIDE a short
+    OPERAND_IINC,     // IINC var value
+    OPERAND_LABEL,    // A branch, a short offset
+    OPERAND_CONSTANT, // LDC_W constant, a short index
+    OPERAND_METHOD,   // INVOKEVIRTUAL method, the short index of its address
+    OPERAND_WIDE
+} operand_t;
+
+typedef struct instruction {
+    const char *name;
+    byte_t op;
+    operand_t operand;
+} instruction_t;
+
+static const instruction_t instructions[] = {
+    { "BIPUSH", OP_BIPUSH, OPERAND_BYTE },
+    { "DUP", OP_DUP, OPERAND_NONE },
+    { "ERR", OP_ERR, OPERAND_NONE },
+    { "GOTO", OP_GOTO, OPERAND_LABEL },
+    { "HALT", OP_HALT, OPERAND_NONE },
+    { "IADD", OP_IADD, OPERAND_NONE },
+    { "IAND", OP_IAND, OPERAND_NONE },
+    { "IFEQ", OP_IFEQ, OPERAND_LABEL },
+    { "IFLT", OP_IFLT, OPERAND_LABEL },
+    { "IF_ICMPEQ", OP_ICMPEQ, OPERAND_LABEL },
+    { "IINC", OP_IINC, OPERAND_IINC },
+    { "ILOAD", OP_ILOAD, OPERAND_VAR },
+    { "IN", OP_IN, OPERAND_NONE },
+    { "INVOKEVIRTUAL", OP_INVOKEVIRTUAL, OPERAND_METHOD },
+    { "IOR", OP_IOR, OPERAND_NONE },
+    { "IRETURN", OP_IRETURN, OPERAND_NONE },
+    { "ISTORE", OP_ISTORE, OPERAND_VAR },
+    { "ISUB", OP_ISUB, OPERAND_NONE },
+    { "LDC_W", OP_LDC_W, OPERAND_CONSTANT },
+    { "NOP", OP_NOP, OPERAND_NONE },
+    { "OUT", OP_OUT, OPERAND_NONE },
+    { "POP", OP_POP, OPERAND_NONE },
+    { "SWAP", OP_SWAP, OPERAND_NONE },
+    { "WIDE", OP_WIDE, OPERAND_WIDE },
+    { "NEWARRAY", OP_NEWARRAY, OPERAND_NONE },
+    { "IALOAD", OP_IALOAD, OPERAND_NONE },
+    { "IASTORE", OP_IASTORE, OPERAND_NONE },
+    { "NETBIND", OP_NETBIND, OPERAND_NONE },
+    { "NETCONNECT", OP_NETCONNECT, OPERAND_NONE },
+    { "NETIN", OP_NETIN, OPERAND_NONE },
+    { "NETOUT", OP_NETOUT, OPERAND_NONE },
+    { "NETCLOSE", OP_NETCLOSE, OPERAND_NONE },
+    { "SPAWN", OP_SPAWN, OPERAND_METHOD },
+    { "YIELD", OP_YIELD, OPERAND_NONE },
+};
+
+#define NUM_INSTRUCTIONS (sizeof(instructions) / sizeof(instructions[0]))
+
+typedef struct token {
+    const char *start;
+    uint32_t length;
+} token_t;
+
+typedef enum kind {
+    SYMBOL_CONSTANT,
+    SYMBOL_METHOD,
+    SYMBOL_VAR,
+    SYMBOL_LABEL
+} kind_t;
+
+// A name, keyed by its kind and, for vars and labels, the method it is in
+typedef struct symbol {
+    token_t name; // Unused while name.start is NULL
+    uint32_t scope;
+    kind_t kind;
+    uint32_t value;
+} symbol_t;
+
+// A reference to a name, to patch in once the name is known
+typedef struct fixup {
+    token_t name;
+    uint32_t scope;
+    kind_t kind;
+    gen_t *text;
+    uint32_t at;
+    uint32_t line;
+} fixup_t;
+
+typedef struct fixups {
+    fixup_t *items;
+    uint32_t count;
+    uint32_t capacity;
+} fixups_t;
+
+typedef enum section {
+    SECTION_NONE,
+    SECTION_CONSTANTS,
+    SECTION_CODE,
+    SECTION_VARS
+} section_t;
+
+typedef struct assembler {
+    gen_t out;     // The constants, then main's text
+    gen_t methods; // The text of the methods, put behind main's at the end
+    gen_t *text;   // The text being written
+    symbol_t *symbols;
+    uint32_t num_symbols;
+    uint32_t symbols_capacity;
+    fixups_t globals; // References to constants and methods
+    fixups_t labels;  // References to labels in the current method
+    uint32_t *method_offsets;
+    uint32_t num_methods;
+    uint32_t methods_capacity;
+    section_t section;
+    bool in_main;
+    bool seen_main;
+    uint32_t scope;      // Of the current method, main's is 1
+    uint32_t num_locals; // Index the next var gets
+    uint32_t first_var;  // Index of the first var, after the arguments
+    uint32_t header;     // Where the header of the current method is
+    bool wide;
+    uint32_t line;
+    char *error;
+    size_t error_size;
+    bool failed;
+} assembler_t;
+
+static bool fail(assembler_t *a, const char *format, ...) {
+    if (a->failed)
+        return false;
+    a->failed = true;
+    if (a->error_size == 0)
+        return false;
+    int n = snprintf(a->error, a->error_size, "line %u: ", a->line);
+    if (n >= 0 && (size_t) n < a->error_size) {
+        va_list args;
+        va_start(args, format);
+        vsnprintf(a->error + n, a->error_size - (size_t) n, format, args);
+        va_end(args);
+    }
+    return false;
+}
+
+static bool out_of_memory(assembler_t *a) {
+    return fail(a, "out of memory");
+}
+
+static char upper(char c) {
+    return c >= 'a' && c <= 'z' ? (char) (c - 'a' + 'A') : c;
+}
+
+// Whether t is word, ignoring case
+static bool is(token_t t, const char *word) {
+    uint32_t i = 0;
+    for (; i < t.length; i++)
+        if (word[i] == '\0' || upper(t.start[i]) != upper(word[i]))
+            return false;
+    return word[i] == '\0';
+}
+
+static bool is_separator(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f'
+           || c == ',' || c == '(' || c == ')';
+}
+
+// Reads the next token of the line ending at end, stopping at comments.
+// Returns false at the end of the line
+static bool next_token(const char **at, const char *end, token_t *t) {
+    const char *p = *at;
+    while (p < end && is_separator(*p))
+        p++;
+    if (p == end || (*p == '/' && p + 1 < end && p[1] == '/')) {
+        *at = end;
+        return false;
+    }
+    const char *start = p;
+    while (p < end && !is_separator(*p) && !(*p == '/' && p + 1 < end && p[1] == '/'))
+        p++;
+    t->start = start;
+    t->length = (uint32_t) (p - start);
+    *at = p;
+    return true;
+}
+
+// Parses a decimal or 0x number, either of them signed
+static bool parse_number(token_t t, int64_t *value) {
+    const char *p = t.start;
+    const char *end = t.start + t.length;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    int base = 10;
+    if (end - p > 2 && p[0] == '0' && (p[1] == 'x' || p[1] == 'X')) {
+        base = 16;
+        p += 2;
+    }
+    if (p == end)
+        return false;
+    int64_t n = 0;
+    for (; p < end; p++) {
+        int digit;
+        if (*p >= '0' && *p <= '9')
+            digit = *p - '0';
+        else if (upper(*p) >= 'A' && upper(*p) <= 'F')
+            digit = upper(*p) - 'A' + 10;
+        else
+            return false;
+        if (digit >= base)
+            return false;
+        n = n * base + digit;
+        if (n > UINT32_MAX)
+            return false;
+    }
+    *value = negative ? -n : n;
+    return true;
+}
+
+static uint32_t hash(token_t name, uint32_t scope, kind_t kind) {
+    // 32-bit FNV-1a
+    uint32_t h = 0x811c9dc5u ^ (scope * 4 + kind);
+    for (uint32_t i = 0; i < name.length; i++) {
+        h ^= (byte_t) name.start[i];
+        h *= 0x01000193u;
+    }
+    return h;
+}
+
+// Returns the slot of the symbol, or the empty one it would go in
+static symbol_t *slot(symbol_t *symbols, uint32_t capacity, token_t name, uint32_t scope, kind_t kind) {
+    uint32_t i = hash(name, scope, kind) & (capacity - 1);
+    for (;; i = (i + 1) & (capacity - 1)) {
+        symbol_t *s = &symbols[i];
+        if (s->name.start == NULL)
+            return s;
+        if (s->scope == scope && s->kind == kind && s->name.length == name.length
+            && memcmp(s->name.start, name.start, name.length) == 0)
+            return s;
+    }
+}
+
+static symbol_t *lookup(assembler_t *a, token_t name, uint32_t scope, kind_t kind) {
+    symbol_t *s = slot(a->symbols, a->symbols_capacity, name, scope, kind);
+    return s->name.start == NULL ? NULL : s;
+}
+
+static bool grow_symbols(assembler_t *a) {
+    uint32_t capacity = a->symbols_capacity * 2;
+    symbol_t *symbols = calloc(capacity, sizeof(symbol_t));
+    if (symbols == NULL)
+        return out_of_memory(a);
+    for (uint32_t i = 0; i < a->symbols_capacity; i++) {
+        symbol_t *s = &a->symbols[i];
+        if (s->name.start != NULL)
+            *slot(symbols, capacity, s->name, s->scope, s->kind) = *s;
+    }
+    free(a->symbols);
+    a->symbols = symbols;
+    a->symbols_capacity = capacity;
+    return true;
+}
+
+static bool define(assembler_t *a, token_t name, uint32_t scope, kind_t kind, uint32_t value) {
+    static const char *const kinds[] = { "constant", "method", "var", "label" };
+    // Keep the table at most half full
+    if (2 * (a->num_symbols + 1) > a->symbols_capacity && !grow_symbols(a))
+        return false;
+    symbol_t *s = slot(a->symbols, a->symbols_capacity, name, scope, kind);
+    if (s->name.start != NULL)
+        return fail(a, "%s '%.*s' defined twice", kinds[kind], (int) name.length, name.start);
+    *s = (symbol_t) { .name = name, .scope = scope, .kind = kind, .value = value };
+    a->num_symbols++;
+    return true;
+}
+
+static bool add_fixup(assembler_t *a, fixups_t *f, token_t name, kind_t kind, uint32_t at) {
+    if (f->count == f->capacity) {
+        uint32_t capacity = f->capacity ? 2 * f->capacity : 64;
+        fixup_t *items = realloc(f->items, capacity * sizeof(fixup_t));
+        if (items == NULL)
+            return out_of_memory(a);
+        f->items = items;
+        f->capacity = capacity;
+    }
+    f->items[f->count++] = (fixup_t) {
+        .name = name, .scope = a->scope, .kind = kind, .text = a->text, .at = at, .line = a->line
+    };
+    return true;
+}
+
+static void patch_short(gen_t *g, uint32_t at, uint16_t value) {
+    if (g->failed)
+        return;
+    g->text[at] = (byte_t) (value >> 8);
+    g->text[at + 1] = (byte_t) value;
+}
+
+// Points the branches of the method just ended at its labels
+static bool resolve_labels(assembler_t *a) {
+    for (uint32_t i = 0; i < a->labels.count; i++) {
+        fixup_t *f = &a->labels.items[i];
+        symbol_t *s = lookup(a, f->name, f->scope, SYMBOL_LABEL);
+        if (s == NULL) {
+            a->line = f->line;
+            return fail(a, "unknown label '%.*s'", (int) f->name.length, f->name.start);
+        }
+        gen_patch(f->text, f->at, s->value);
+    }
+    a->labels.count = 0;
+    return true;
+}
+
+static bool start_method(assembler_t *a, bool main, token_t name, const char **at, const char *end) {
+    if (a->section != SECTION_NONE)
+        return fail(a, "missing .end of the section before");
+    a->section = SECTION_CODE;
+    a->in_main = main;
+    a->wide = false;
+    a->num_locals = 0;
+    if (main) {
+        if (a->seen_main)
+            return fail(a, "more than one .main");
+        a->seen_main = true;
+        a->scope = 1;
+        a->text = &a->out;
+        a->first_var = 0;
+        return true;
+    }
+    a->scope = a->num_methods + 2;
+    a->text = &a->methods;
+    if (a->num_methods == a->methods_capacity) {
+        uint32_t capacity = a->methods_capacity ? 2 * a->methods_capacity : 16;
+        uint32_t *offsets = realloc(a->method_offsets, capacity * sizeof(uint32_t));
+        if (offsets == NULL)
+            return out_of_memory(a);
+        a->method_offsets = offsets;
+        a->methods_capacity = capacity;
+    }
+    if (!define(a, name, 0, SYMBOL_METHOD, a->num_methods))
+        return false;
+    a->method_offsets[a->num_methods++] = a->methods.text_size;
+    // Arguments follow OBJREF at 0
+    token_t arg;
+    uint32_t num_args = 1;
+    while (next_token(at, end, &arg))
+        if (!define(a, arg, a->scope, SYMBOL_VAR, num_args++))
+            return false;
+    if (num_args > UINT16_MAX)
+        return fail(a, "too many arguments");
+    a->header = a->methods.text_size;
+    a->first_var = num_args;
+    a->num_locals = num_args;
+    gen_short(&a->methods, (uint16_t) num_args);
+    gen_short(&a->methods, 0);
+    return true;
+}
+
+static bool end_method(assembler_t *a, bool main) {
+    if (a->section != SECTION_CODE || a->in_main != main)
+        return fail(a, main ? "unexpected .end-main" : "unexpected .end-method");
+    a->section = SECTION_NONE;
+    if (!main) {
+        uint32_t num_vars = a->num_locals - a->first_var;
+        if (num_vars > UINT16_MAX)
+            return fail(a, "too many vars");
+        patch_short(&a->methods, a->header + 2, (uint16_t) num_vars);
+    }
+    return resolve_labels(a);
+}
+
+static const instruction_t *find_instruction(token_t t) {
+    for (size_t i = 0; i < NUM_INSTRUCTIONS; i++)
+        if (is(t, instructions[i].name))
+            return &instructions[i];
+    return NULL;
+}
+
+// Reads the one operand an instruction has
+static bool operand(assembler_t *a, const char **at, const char *end, token_t *t, const instruction_t *in) {
+    if (!next_token(at, end, t))
+        return fail(a, "%s needs an operand", in->name);
+    return true;
+}
+
+static bool var_index(assembler_t *a, token_t t, uint32_t *index) {
+    symbol_t *s = lookup(a, t, a->scope, SYMBOL_VAR);
+    int64_t n;
+    if (s != NULL)
+        *index = s->value;
+    else if (parse_number(t, &n) && n >= 0 && n <= UINT16_MAX)
+        *index = (uint32_t) n;
+    else
+        return fail(a, "unknown var '%.*s'", (int) t.length, t.start);
+    return true;
+}
+
+static bool byte_value(assembler_t *a, token_t t, byte_t *value) {
+    int64_t n;
+    if (!parse_number(t, &n) || n < INT8_MIN || n > UINT8_MAX)
+        return fail(a, "'%.*s' is not a byte", (int) t.length, t.start);
+    *value = (byte_t) n;
+    return true;
+}
+
+static bool assemble_instruction(assembler_t *a, token_t mnemonic, const char **at, const char *end) {
+    const instruction_t *in = find_instruction(mnemonic);
+    if (in == NULL)
+        return fail(a, "unknown instruction '%.*s'", (int) mnemonic.length, mnemonic.start);
+    gen_t *g = a->text;
+    bool wide = a->wide;
+    a->wide = false;
+    token_t t;
+    uint32_t index;
+    byte_t value;
+    switch (in->operand) {
+        case OPERAND_NONE:
+            gen_byte(g, in->op);
+            break;
+        case OPERAND_WIDE:
+            gen_byte(g, in->op);
+            a->wide = true;
+            break;
+        case OPERAND_BYTE:
+            if (!operand(a, at, end, &t, in) || !byte_value(a, t, &value))
+                return false;
+            gen_byte(g, in->op);
+            gen_byte(g, value);
+            break;
+        case OPERAND_VAR:
+            if (!operand(a, at, end, &t, in) || !var_index(a, t, &index))
+                return false;
+            gen_byte(g, in->op);
+            if (wide) {
+                gen_short(g, (uint16_t) index);
+            } else if (index <= UINT8_MAX) {
+                gen_byte(g, (byte_t) index);
+            } else {
+                return fail(a, "%s of var %u needs WIDE", in->name, index);
+            }
+            break;
+        case OPERAND_IINC:
+            if (!operand(a, at, end, &t, in) || !var_index(a, t, &index))
+                return false;
+            if (index > UINT8_MAX)
+                return fail(a, "IINC of var %u is out of reach", index);
+            if (!operand(a, at, end, &t, in) || !byte_value(a, t, &value))
+                return false;
+            gen_byte(g, in->op);
+            gen_byte(g, (byte_t) index);
+            gen_byte(g, value);
+            break;
+        case OPERAND_LABEL: {
+            if (!operand(a, at, end, &t, in))
+                return false;
+            uint32_t start = gen_branch(g, in->op, 0);
+            if (!add_fixup(a, &a->labels, t, SYMBOL_LABEL, start))
+                return false;
+            break;
+        }
+        case OPERAND_CONSTANT:
+        case OPERAND_METHOD:
+            if (!operand(a, at, end, &t, in))
+                return false;
+            gen_byte(g, in->op);
+            if (!add_fixup(a, &a->globals, t, in->operand == OPERAND_CONSTANT ? SYMBOL_CONSTANT : SYMBOL_METHOD,
+                           g->text_size))
+                return false;
+            gen_short(g, 0);
+            break;
+    }
+    if (next_token(at, end, &t))
+        return fail(a, "unexpected '%.*s' after %s", (int) t.length, t.start, in->name);
+    return true;
+}
+
+// Assembles goJASM's #print "text" into a BIPUSH and OUT for every byte
+static bool print_string(assembler_t *a, const char *at, const char *end) {
+    while (at < end && is_separator(*at))
+        at++;
+    if (at == end || *at != '"')
+        return fail(a, "#print needs a quoted string");
+    for (at++; at < end && *at != '"'; at++) {
+        char c = *at;
+        if (c == '\\' && at + 1 < end) {
+            switch (*++at) {
+                case 'n': c = '\n'; break;
+                case 't': c = '\t'; break;
+                case 'r': c = '\r'; break;
+                case '0': c = '\0'; break;
+                default: c = *at; break;
+            }
+        }
+        gen_byte(a->text, OP_BIPUSH);
+        gen_byte(a->text, (byte_t) c);
+        gen_byte(a->text, OP_OUT);
+    }
+    if (at == end)
+        return fail(a, "#print string is not closed");
+    token_t t;
+    at++;
+    if (next_token(&at, end, &t))
+        return fail(a, "unexpected '%.*s' after #print", (int) t.length, t.start);
+    return true;
+}
+
+static bool assemble_line(assembler_t *a, const char *start, const char *end) {
+    const char *at = start;
+    token_t t;
+    if (!next_token(&at, end, &t))
+        return true;
+    if (t.start[0] == '.') {
+        token_t name = { 0 };
+        if (is(t, ".constant")) {
+            if (a->section != SECTION_NONE)
+                return fail(a, "unexpected .constant");
+            a->section = SECTION_CONSTANTS;
+        } else if (is(t, ".end-constant")) {
+            if (a->section != SECTION_CONSTANTS)
+                return fail(a, "unexpected .end-constant");
+            a->section = SECTION_NONE;
+        } else if (is(t, ".main")) {
+            return start_method(a, true, name, &at, end);
+        } else if (is(t, ".end-main")) {
+            return end_method(a, true);
+        } else if (is(t, ".method")) {
+            if (!next_token(&at, end, &name))
+                return fail(a, ".method needs a name");
+            return start_method(a, false, name, &at, end);
+        } else if (is(t, ".end-method")) {
+            return end_method(a, false);
+        } else if (is(t, ".var")) {
+            if (a->section != SECTION_CODE)
+                return fail(a, "unexpected .var");
+            a->section = SECTION_VARS;
+        } else if (is(t, ".end-var")) {
+            if (a->section != SECTION_VARS)
+                return fail(a, "unexpected .end-var");
+            a->section = SECTION_CODE;
+        } else {
+            return fail(a, "unknown directive '%.*s'", (int) t.length, t.start);
+        }
+        if (next_token(&at, end, &t))
+            return fail(a, "unexpected '%.*s'", (int) t.length, t.start);
+        return true;
+    }
+
+    token_t value;
+    int64_t n;
+    switch (a->section) {
+        case SECTION_NONE:
+            return fail(a, "'%.*s' outside of .constant, .main or .method", (int) t.length, t.start);
+        case SECTION_CONSTANTS:
+            if (!next_token(&at, end, &value) || !parse_number(value, &n) || n < INT32_MIN)
+                return fail(a, "constant '%.*s' needs a word value", (int) t.length, t.start);
+            if (!define(a, t, 0, SYMBOL_CONSTANT, gen_constant(&a->out, (word_t) n)))
+                return false;
+            if (next_token(&at, end, &t))
+                return fail(a, "unexpected '%.*s'", (int) t.length, t.start);
+            return true;
+        case SECTION_VARS:
+            do {
+                if (!define(a, t, a->scope, SYMBOL_VAR, a->num_locals++))
+                    return false;
+            } while (next_token(&at, end, &t));
+            return true;
+        case SECTION_CODE:
+            if (t.start[t.length - 1] == ':') {
+                t.length--;
+                if (t.length == 0)
+                    return fail(a, "label without a name");
+                if (!define(a, t, a->scope, SYMBOL_LABEL, a->text->text_size))
+                    return false;
+                if (!next_token(&at, end, &t))
+                    return true;
+            }
+            if (is(t, "#print"))
+                return print_string(a, at, end);
+            return assemble_instruction(a, t, &at, end);
+    }
+    return true;
+}
+
+// Lays out the method addresses, points the references to constants and
+// methods at them and puts the methods behind main
+static byte_t *finish(assembler_t *a, size_t *image_size) {
+    if (a->section != SECTION_NONE) {
+        fail(a, a->section == SECTION_CONSTANTS ? "missing .end-constant"
+                : a->in_main ? "missing .end-main" : "missing .end-method");
+        return NULL;
+    }
+    if (!a->seen_main) {
+        fail(a, "missing .main");
+        return NULL;
+    }
+    uint32_t num_constants = a->out.constants_size / sizeof(word_t);
+    if (num_constants + a->num_methods > UINT16_MAX + 1) {
+        fail(a, "too many constants");
+        return NULL;
+    }
+    for (uint32_t i = 0; i < a->num_methods; i++)
+        gen_constant(&a->out, (word_t) (a->out.text_size + a->method_offsets[i]));
+    for (uint32_t i = 0; i < a->globals.count; i++) {
+        fixup_t *f = &a->globals.items[i];
+        symbol_t *s = lookup(a, f->name, 0, f->kind);
+        if (s == NULL) {
+            a->line = f->line;
+            fail(a, "unknown %s '%.*s'", f->kind == SYMBOL_CONSTANT ? "constant" : "method",
+                 (int) f->name.length, f->name.start);
+            return NULL;
+        }
+        uint32_t index = f->kind == SYMBOL_CONSTANT ? s->value : num_constants + s->value;
+        patch_short(f->text, f->at, (uint16_t) index);
+    }
+    gen_bytes(&a->out, a->methods.text, a->methods.text_size);
+    if (a->methods.failed)
+        a->out.failed = true;
+    byte_t *image = gen_image(&a->out, image_size);
+    if (image == NULL)
+        out_of_memory(a);
+    return image;
+}
+
+byte_t *jas_assemble(const char *source, size_t size, size_t *image_size, char *error, size_t error_size) {
+    assembler_t a = { .error = error, .error_size = error_size, .symbols_capacity = 256 };
+    gen_init(&a.out);
+    gen_init(&a.methods);
+    a.text = &a.out;
+    a.symbols = calloc(a.symbols_capacity, sizeof(symbol_t));
+    if (a.symbols == NULL)
+        out_of_memory(&a);
+
+    const char *end = source + size;
+    for (const char *line = source; !a.failed && line < end; line++) {
+        const char *eol = memchr(line, '\n', (size_t) (end - line));
+        if (eol == NULL)
+            eol = end;
+        a.line++;
+        assemble_line(&a, line, eol);
+        line = eol;
+    }
+    if (!a.failed && (a.out.failed || a.methods.failed))
+        out_of_memory(&a);
+    byte_t *image = a.failed ? NULL : finish(&a, image_size);
+
+    free(a.symbols);
+    free(a.globals.items);
+    free(a.labels.items);
+    free(a.method_offsets);
+    gen_free(&a.out);
+    gen_free(&a.methods);
+    return image;
+}
+
+bool jas_is_source(const char *path) {
+    size_t length = strlen(path);
+    return length >= 4 && strcmp(path + length - 4, ".jas") == 0;
+}
+
+int jas_assemble_file(const char *jas_path, const char *ijvm_path) {
+    FILE *fp = fopen(jas_path, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "%s: can't open\n", jas_path);
+        return -1;
+    }
+    size_t capacity = 0x1000;
+    size_t size = 0;
+    char *source = malloc(capacity);
+    size_t n;
+    while (source != NULL && (n = fread(source + size, 1, capacity - size, fp)) > 0) {
+        size += n;
+        if (size == capacity) {
+            capacity *= 2;
+            char *grown = realloc(source, capacity);
+            if (grown == NULL)
+                free(source);
+            source = grown;
+        }
+    }
+    fclose(fp);
+    if (source == NULL) {
+        fprintf(stderr, "%s: out of memory\n", jas_path);
+        return -1;
+    }
+    char error[JAS_ERROR_SIZE];
+    size_t image_size;
+    byte_t *image = jas_assemble(source, size, &image_size, error, sizeof(error));
+    free(source);
+    if (image == NULL) {
+        fprintf(stderr, "%s: %s\n", jas_path, error);
+        return -1;
+    }
+    fp = fopen(ijvm_path, "wb");
+    int res = fp != NULL && fwrite(image, 1, image_size, fp) == image_size ? 0 : -1;
+    if (fp != NULL && fclose(fp) != 0)
+        res = -1;
+    free(image);
+    if (res < 0)
+        fprintf(stderr, "%s: can't write\n", ijvm_path);
+    return res;
+}
@@ -1,386 +1,666 @@
+#define _DEFAULT_SOURCE
 #include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <sys/mman.h>
 #include "machine.h"
+#include "fiber.h"
+#include "net.h"
+#include "heap.h"
+#include "engine.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "edgeprof.h"
+#include "ngram.h"
+#include "trace.h"
 #include "util.h"
 
-#define STACK_SIZE 0x10000
+void ijvm_run(ijvm_t *m) {
+#ifdef DEBUG
+    // Only the interpreter logs every instruction
+    while (machine_step(m));
+#else
+    engine_run(m, UINT64_MAX, true);
+#endif
+    io_flush(&m->out);
+}
 
-machine_t machine;
+ijvm_status_t ijvm_run_for(ijvm_t *m, uint64_t budget) {
+    ijvm_status_t res = engine_run(m, budget, false);
+    io_flush(&m->out);
+    return res;
+}
 
-static uint32_t swap_word(uint32_t num) {
-    return ((num >> 24) & 0xff) | ((num << 8) & 0xff0000) | ((num >> 8) & 0xff00) | ((num << 24) & 0xff000000);
+bool ijvm_step(ijvm_t *m) {
+    if (m->text != NULL && !ijvm_finished(m))
+        m->metrics.counts.instructions++;
+    bool res = machine_step(m);
+    // Publishing every step would make stepping half again as slow
+    if (!res || m->metrics.counts.instructions % METRICS_INTERVAL == 0)
+        metrics_publish(m);
+    // Whoever steps by hand may look at the output after every instruction
+    io_flush(&m->out);
+    return res;
 }
 
-void run() {
-    while (step());
+static bool execute(machine_t *m);
+
+uint32_t instruction_size(const byte_t *text, uint32_t size, uint32_t pc) {
+    switch (text[pc]) {
+        case OP_BIPUSH:
+        case OP_ILOAD:
+        case OP_ISTORE:
+            return 2;
+        case OP_GOTO:
+        case OP_IFEQ:
+        case OP_IFLT:
+        case OP_ICMPEQ:
+        case OP_IINC:
+        case OP_INVOKEVIRTUAL:
+        case OP_LDC_W:
+        case OP_SPAWN:
+            return 3;
+        case OP_WIDE:
+            // Only the indices of ILOAD and ISTORE widen
+            if (pc + 1 >= size)
+                return 1;
+            if (text[pc + 1] == OP_ILOAD || text[pc + 1] == OP_ISTORE)
+                return 4;
+            return 1 + instruction_size(text, size, pc + 1);
+        default:
+            return 1;
+    }
 }
 
-bool step(void) {
-    switch (get_instruction()) {
+// Steps with whatever watches the instructions told about each
+static bool instrumented_step(machine_t *m) {
+    byte_t op = ijvm_get_instruction(m);
+    uint32_t pc = m->pc;
+    opstats_t *s = m->stats;
+    bool timed = s != NULL && s->count[op]++ % OPSTATS_SAMPLE_RATE == 0;
+    uint64_t start = timed ? opstats_clock() : 0;
+    if (m->trace != NULL)
+        trace_begin(m);
+    bool res = execute(m);
+    if (m->trace != NULL)
+        trace_end(m);
+    if (timed)
+        opstats_sample(s, op, opstats_clock() - start);
+    if (m->profile != NULL)
+        profile_step(m, op);
+    if (m->edges != NULL)
+        edges_step(m, op, pc);
+    if (m->ngrams != NULL)
+        ngrams_step(m, op, pc);
+    return res;
+}
+
+bool machine_step(machine_t *m) {
+    if (machine_instrumented(m))
+        return instrumented_step(m);
+    return execute(m);
+}
+
+static bool execute(machine_t *m) {
+    switch (ijvm_get_instruction(m)) {
         case OP_BIPUSH: {
-            word_t arg = get_byte_operand(1);
-            push_stack(arg);
-            machine.pc += 2;
+            word_t arg = get_byte_operand(m, 1);
+            push_stack(m, arg);
+            m->pc += 2;
             log("BIPUSH %d\n", arg);
             break;
         }
         case OP_DUP: {
-            word_t arg = tos();
-            push_stack(arg);
-            machine.pc += 1;
+            word_t arg = ijvm_tos(m);
+            push_stack(m, arg);
+            m->pc += 1;
             log("DUP\n");
             break;
         }
         case OP_GOTO: {
-            int16_t offset = (int16_t)get_short_operand(1);
-            machine.pc += offset;
+            int16_t offset = (int16_t)get_short_operand(m, 1);
+            m->pc += offset;
             log("GOTO %d\n", offset);
             break;
         }
         case OP_IFEQ: {
-            word_t arg = pop_stack();
-            int16_t offset = (int16_t)get_short_operand(1);
+            word_t arg = pop_stack(m);
+            int16_t offset = (int16_t)get_short_operand(m, 1);
             if (arg != 0) {
                 offset = 3;
             }
-            machine.pc += offset;
+            m->pc += offset;
             log("IFEQ %d\n", offset);
             break;
         }
         case OP_IFLT: {
-            word_t arg = pop_stack();
-            int16_t offset = (int16_t)get_short_operand(1);
+            word_t arg = pop_stack(m);
+            int16_t offset = (int16_t)get_short_operand(m, 1);
             if (arg >= 0) {
                 offset = 3;
             }
-            machine.pc += offset;
+            m->pc += offset;
             log("IFLT %d\n", offset);
             break;
         }
         case OP_ICMPEQ: {
-            word_t arg1 = pop_stack();
-            word_t arg2 = pop_stack();
-            word_t offset = get_short_operand(1);
+            word_t arg1 = pop_stack(m);
+            word_t arg2 = pop_stack(m);
+            int16_t offset = (int16_t)get_short_operand(m, 1);
             if (arg1 != arg2) {
                 offset = 3;
             }
-            machine.pc += offset;
+            m->pc += offset;
             log("ICMPEQ %d\n", offset);
             break;
         }
         case OP_IADD: {
-            word_t arg2 = pop_stack();
-            word_t arg1 = pop_stack();
-            push_stack(arg1 + arg2);
-            machine.pc += 1;
+            word_t arg2 = pop_stack(m);
+            word_t arg1 = pop_stack(m);
+            push_stack(m, arg1 + arg2);
+            m->pc += 1;
             log("IADD\n");
             break;
         }
         case OP_ISUB: {
-            word_t arg2 = pop_stack();
-            word_t arg1 = pop_stack();
-            push_stack(arg1 - arg2);
-            machine.pc += 1;
+            word_t arg2 = pop_stack(m);
+            word_t arg1 = pop_stack(m);
+            push_stack(m, arg1 - arg2);
+            m->pc += 1;
             log("ISUB\n");
             break;
         }
         case OP_IAND: {
-            word_t arg2 = pop_stack();
-            word_t arg1 = pop_stack();
-            push_stack(arg1 & arg2);
-            machine.pc += 1;
+            word_t arg2 = pop_stack(m);
+            word_t arg1 = pop_stack(m);
+            push_stack(m, arg1 & arg2);
+            m->pc += 1;
             log("IAND\n");
             break;
         }
         case OP_IOR: {
-            word_t arg2 = pop_stack();
-            word_t arg1 = pop_stack();
-            push_stack(arg1 | arg2);
-            machine.pc += 1;
+            word_t arg2 = pop_stack(m);
+            word_t arg1 = pop_stack(m);
+            push_stack(m, arg1 | arg2);
+            m->pc += 1;
             log("IOR\n");
             break;
         }
         case OP_LDC_W: {
-            word_t index = get_short_operand(1);
-            push_stack(get_constant(index));
-            machine.pc += 3;
+            word_t index = get_short_operand(m, 1);
+            push_stack(m, ijvm_get_constant(m, index));
+            m->pc += 3;
             log("LDC_W %d\n", index);
             break;
         }
         case OP_ISTORE: {
-            word_t local = pop_stack();
-            word_t index = machine.wide_index
-                           ? get_short_operand(1)
-                           : get_byte_operand(1);
-            set_local_variable(index, local);
-            machine.pc += machine.wide_index ? 3 : 2;
+            word_t local = pop_stack(m);
+            word_t index = m->wide_index
+                           ? get_short_operand(m, 1)
+                           : (uint8_t)get_byte_operand(m, 1);
+            set_local_variable(m, index, local);
+            m->pc += m->wide_index ? 3 : 2;
             log("ISTORE %d\n", index);
             break;
         }
         case OP_ILOAD: {
-            word_t index = machine.wide_index
-                           ? get_short_operand(1)
-                           : get_byte_operand(1);
-            word_t local = get_local_variable(index);
-            push_stack(local);
-            machine.pc += machine.wide_index ? 3 : 2;
+            word_t index = m->wide_index
+                           ? get_short_operand(m, 1)
+                           : (uint8_t)get_byte_operand(m, 1);
+            word_t local = ijvm_get_local_variable(m, index);
+            push_stack(m, local);
+            m->pc += m->wide_index ? 3 : 2;
             log("ILOAD %d\n", index);
             break;
         }
         case OP_IINC: {
-            word_t index = get_byte_operand(1);
-            word_t value = get_byte_operand(2);
-            set_local_variable(index, get_local_variable(index) + value);
-            machine.pc += 3;
+            word_t index = (uint8_t)get_byte_operand(m, 1);
+            word_t value = get_byte_operand(m, 2);
+            set_local_variable(m, index, ijvm_get_local_variable(m, index) + value);
+            m->pc += 3;
             log("IINC %d %d\n", index, value);
             break;
         }
         case OP_NOP:
-            machine.pc += 1;
+            m->pc += 1;
             log("NOP\n");
             break;
         case OP_IN: {
-            int input = getc(machine.input);
-            if (input == EOF)
+            if (!io_ready(&m->in)) {
+                // Show a prompt before waiting for the answer
+                io_flush(&m->out);
+                // Let other fibers run while there is no input
+                if (m->fibers != NULL && m->in.fd >= 0 && fiber_wait(m, m->in.fd, POLLIN))
+                    break;
+            }
+            int input = io_getc(&m->in);
+            if (input < 0)
                 input = 0;
-            push_stack(input);
-            machine.pc += 1;
+            else
+                m->metrics.counts.bytes_in++;
+            push_stack(m, input);
+            m->pc += 1;
             log("IN\n");
             break;
         }
         case OP_OUT: {
-            word_t arg = pop_stack();
-            putc(arg, machine.output);
-            machine.pc += 1;
+            word_t arg = pop_stack(m);
+            io_putc(&m->out, arg);
+            m->metrics.counts.bytes_out++;
+            m->pc += 1;
             log("OUT\n");
             break;
         }
         case OP_POP: {
-            pop_stack();
-            machine.pc += 1;
+            pop_stack(m);
+            m->pc += 1;
             log("POP\n");
             break;
         }
         case OP_SWAP: {
-            word_t arg2 = pop_stack();
-            word_t arg1 = pop_stack();
-            push_stack(arg2);
-            push_stack(arg1);
-            machine.pc += 1;
+            word_t arg2 = pop_stack(m);
+            word_t arg1 = pop_stack(m);
+            push_stack(m, arg2);
+            push_stack(m, arg1);
+            m->pc += 1;
             log("SWAP\n");
             break;
         }
         case OP_WIDE: {
-            machine.pc += 1;
+            m->pc += 1;
             log("WIDE ");
-            machine.wide_index = true;
-            step();
-            machine.wide_index = false;
+            m->wide_index = true;
+            execute(m);
+            m->wide_index = false;
             break;
         }
         case OP_INVOKEVIRTUAL: {
             // Keep current registers
-            uint32_t prev_pc = machine.pc;
-            word_t *prev_lv = machine.lv;
+            uint32_t prev_pc = m->pc;
+            word_t *prev_lv = m->lv;
             // Load method pointer and set PC
-            word_t method = get_short_operand(1);
-            machine.pc = get_constant(method);
+            word_t method = get_short_operand(m, 1);
+            m->pc = ijvm_get_constant(m, method);
             // Read number of arguments and locals
-            word_t num_args = get_short_operand(0);
-            word_t num_locals = get_short_operand(2);
+            word_t num_args = get_short_operand(m, 0);
+            word_t num_locals = get_short_operand(m, 2);
             // Set current frame base
-            machine.lv = machine.sp - num_args + 1;
+            m->lv = m->sp - num_args + 1;
             // Make room for locals
-            machine.sp += num_locals;
+            m->sp += num_locals;
             // Store previous PC on stack
-            push_stack(prev_pc);
+            push_stack(m, prev_pc);
             // Store pointer to PC in first argument (OBJREF)
-            *machine.lv = machine.sp - machine.lv;
+            *m->lv = m->sp - m->lv;
             // Store previous frame base
-            push_stack(prev_lv - machine.stack);
+            push_stack(m, prev_lv - m->stack);
             // Move to the next OP
-            machine.pc += 4;
+            m->pc += 4;
+            m->metrics.counts.calls++;
+            machine_stack_depth(m, m->sp);
             log("INVOKEVIRTUAL %d\n", method);
             break;
         }
         case OP_IRETURN: {
             // Keep return value
-            word_t return_value = pop_stack();
+            word_t return_value = pop_stack(m);
             // Get call registries
-            word_t caller_pc = machine.lv[*machine.lv];
-            word_t caller_lv = machine.lv[*machine.lv + 1];
+            word_t caller_pc = m->lv[*m->lv];
+            word_t caller_lv = m->lv[*m->lv + 1];
             // Restore SP
-            machine.sp = machine.lv;
+            m->sp = m->lv;
             // Save return value on stack
-            *machine.sp = return_value;
+            *m->sp = return_value;
             // Restore caller registries
-            machine.lv = machine.stack + caller_lv;
-            machine.pc = caller_pc;
+            m->lv = m->stack + caller_lv;
+            m->pc = caller_pc;
             // Move to the next OP
-            machine.pc += 3;
+            m->pc += 3;
             log("IRETURN\n");
+            // Spawned fibers return past the end of the text
+            if (m->fibers != NULL && m->pc >= m->text_size)
+                fiber_exit(m);
+            break;
+        }
+        case OP_NETBIND: {
+            if (net_bind(m))
+                m->pc += 1;
+            break;
+        }
+        case OP_NETCONNECT: {
+            if (net_connect(m))
+                m->pc += 1;
+            break;
+        }
+        case OP_NETIN: {
+            if (net_in(m))
+                m->pc += 1;
+            log("NETIN\n");
+            break;
+        }
+        case OP_NETOUT: {
+            if (net_out(m))
+                m->pc += 1;
+            log("NETOUT\n");
+            break;
+        }
+        case OP_NETCLOSE: {
+            if (net_close(m))
+                m->pc += 1;
+            break;
+        }
+        case OP_SPAWN: {
+            word_t method = get_short_operand(m, 1);
+            m->pc += 3;
+            push_stack(m, fiber_spawn(m, method));
+            log("SPAWN %d\n", method);
+            break;
+        }
+        case OP_YIELD: {
+            m->pc += 1;
+            log("YIELD\n");
+            fiber_yield(m);
+            break;
+        }
+        case OP_NEWARRAY: {
+            word_t count = pop_stack(m);
+            push_stack(m, heap_new_array(m, count));
+            m->pc += 1;
+            log("NEWARRAY %d\n", count);
+            break;
+        }
+        case OP_IALOAD: {
+            word_t arrayref = pop_stack(m);
+            word_t index = pop_stack(m);
+            word_t *element = heap_element(m, arrayref, index);
+            if (element == NULL) {
+                m->halted = true;
+                log("IALOAD out of bounds\n");
+                break;
+            }
+            push_stack(m, *element);
+            m->pc += 1;
+            log("IALOAD\n");
+            break;
+        }
+        case OP_IASTORE: {
+            word_t arrayref = pop_stack(m);
+            word_t index = pop_stack(m);
+            word_t value = pop_stack(m);
+            word_t *element = heap_element(m, arrayref, index);
+            if (element == NULL) {
+                m->halted = true;
+                log("IASTORE out of bounds\n");
+                break;
+            }
+            *element = value;
+            m->pc += 1;
+            log("IASTORE\n");
             break;
         }
         case OP_ERR: {
-            machine.halted = true;
+            m->halted = true;
             log("ERR\n");
             break;
         }
         case OP_HALT: {
-            machine.halted = true;
+            m->halted = true;
             log("HALT\n");
             break;
         }
         default: {
-            machine.halted = true;
+            m->halted = true;
             log("Unknown Instruction\n");
             break;
         }
     }
-    return !finished();
-}
-
-byte_t *parse_block(FILE *fp, uint32_t *block_size) {
-    uint32_t origin;
-    // Read and ignore the origin
-    fread(&origin, sizeof(uint32_t), 1, fp);
-    // Read block size
-    fread(block_size, sizeof(uint32_t), 1, fp);
-    // Convert endianness
-    *block_size = swap_word(*block_size);
-    // Allocate memory for block data
-    byte_t *data = malloc(sizeof(byte_t) * *block_size);
-    // Read block data
-    fread(data, sizeof(byte_t), *block_size, fp);
-    return data;
-}
-
-int init_ijvm(char *binary_file) {
-    // Open ijvm file for reading
-    FILE *fp = fopen(binary_file, "rb");
-    uint32_t header;
-    // Read header
-    fread(&header, sizeof(uint32_t), 1, fp);
-    // Convert endianness
-    header = swap_word(header);
-    // Check that it is actually the ijvm file
-    if (header != MAGIC_NUMBER) {
-        // If it is not ijvm file close file and return error
-        fclose(fp);
-        return -1;
+    return !ijvm_finished(m);
+}
+
+uint32_t machine_frames(machine_t *m, uint32_t *methods, uint32_t max, bool *truncated) {
+    *truncated = false;
+    // Fiber switches move the stack from under the walk, skip it then
+    if (m->fibers != NULL || m->stack == NULL)
+        return 0;
+    word_t *stack = m->stack;
+    word_t *lv = m->lv;
+    uint32_t depth = 0;
+    while (true) {
+        intptr_t at = lv - stack;
+        // The main frame starts at the base, and links nowhere
+        if (at <= 0 || at >= STACK_SIZE)
+            break;
+        if (depth == max) {
+            *truncated = true;
+            break;
+        }
+        word_t link = lv[0];
+        if (link <= 0 || at + link + 1 >= STACK_SIZE)
+            break;
+        uint32_t caller_pc = (uint32_t) lv[link];
+        word_t caller_lv = lv[link + 1];
+        // The method is what the caller's INVOKEVIRTUAL points to
+        // A frame caught halfway through a call or return links to junk
+        if (caller_pc + 2 >= m->text_size || m->text[caller_pc] != OP_INVOKEVIRTUAL)
+            break;
+        uint32_t index = (uint32_t) m->text[caller_pc + 1] << 8 | m->text[caller_pc + 2];
+        if ((index + 1) * sizeof(word_t) > m->cp_size)
+            break;
+        const byte_t *c = m->cpp + index * sizeof(word_t);
+        methods[depth++] = (uint32_t) c[0] << 24 | (uint32_t) c[1] << 16 | (uint32_t) c[2] << 8 | c[3];
+        // Callers' frames lie further down the stack
+        if (caller_lv < 0 || caller_lv >= at)
+            break;
+        lv = stack + caller_lv;
     }
-    machine.halted = false;
-    machine.wide_index = false;
+    return depth;
+}
+
+word_t *stack_alloc(void) {
+    // Mapped rather than malloc'd so snapshots can replace it in place
+    void *stack = mmap(NULL, STACK_BYTES, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return stack == MAP_FAILED ? NULL : stack;
+}
+
+void stack_free(word_t *stack) {
+    if (stack != NULL)
+        munmap(stack, STACK_BYTES);
+}
+
+ijvm_t *ijvm_create(void) {
+    machine_t *m = calloc(1, sizeof(machine_t));
+    if (m != NULL)
+        m->in.fd = -1;
+#ifdef IJVM_STATS
+    if (m != NULL && ijvm_stats_enable(m) < 0) {
+        free(m);
+        return NULL;
+    }
+#endif
+    return m;
+}
+
+void ijvm_destroy(ijvm_t *m) {
+    if (m == NULL)
+        return;
+    ijvm_unload(m);
+    ijvm_stats_disable(m);
+    ijvm_profile_disable(m);
+    ijvm_edges_disable(m);
+    ijvm_ngrams_disable(m);
+    ijvm_trace_disable(m);
+    free(m);
+}
+
+int ijvm_load(ijvm_t *m, const char *binary_file) {
+    ijvm_program_t *p = ijvm_program_load(binary_file);
+    if (p == NULL)
+        return -1;
+    // The machine holds the only reference from here on
+    int res = ijvm_load_program(m, p);
+    ijvm_program_release(p);
+    return res;
+}
+
+int ijvm_load_program(ijvm_t *m, ijvm_program_t *p) {
+    fibers_free(m);
+    heap_free(m);
+    // A shared port stays bound, so connections queued on it survive
+    if (m->reuseport)
+        net_reset(m);
+    else
+        net_free(m);
+    // Drop the previous program, but keep its stack around for reuse
+    ijvm_program_t *old = m->program;
+    m->program = ijvm_program_retain(p);
+    ijvm_program_release(old);
+    m->text = p->text;
+    m->text_size = p->text_size;
+    m->cpp = p->cpp;
+    m->cp_size = p->cp_size;
+    m->halted = false;
+    m->wide_index = false;
+    if (m->profile != NULL)
+        profile_restart(m);
     // Reset program counter
-    machine.pc = 0;
+    m->pc = 0;
+    if (m->edges != NULL)
+        edges_restart(m);
+    if (m->ngrams != NULL)
+        ngrams_restart(m);
     // Init stack
-    machine.stack = malloc(sizeof(word_t) * STACK_SIZE);
-    machine.lv = machine.stack;
-    // Allow for 10 variables in the entry func
-    machine.sp = machine.lv + 10;
-    // Parse Constant Pool block
-    machine.cpp = parse_block(fp, &machine.cp_size);
-    // Parse Text block
-    machine.text = parse_block(fp, &machine.text_size);
+    if (m->stack == NULL)
+        m->stack = stack_alloc();
+    if (m->stack == NULL)
+        return -1;
+    m->lv = m->stack;
+    // Allow for 10 variables in the entry func, cleared since a reused (or
+    // recycled) stack still holds the words of an earlier run
+    m->sp = m->lv + 10;
+    memset(m->lv, 0, sizeof(word_t) * 11);
     // Initialize to standard I/O
-    machine.input = stdin;
-    machine.output = stdout;
-    // Close file and return success
-    fclose(fp);
+    io_in_file(&m->in, stdin);
+    io_out_file(&m->out, stdout);
     return 0;
 }
 
-void destroy_ijvm() {
+void ijvm_unload(ijvm_t *m) {
+    fibers_free(m);
+    net_free(m);
+    heap_free(m);
+    io_in_free(&m->in);
+    io_out_free(&m->out);
     // Reset program counter
-    machine.pc = 0;
-    // Free Constant Pool block memory
-    free(machine.cpp);
-    // Reset Text block size
-    machine.text_size = 0;
-    // Free Text block memory
-    free(machine.text);
-    // Reset Constant Pool Size
-    machine.cp_size = 0;
+    m->pc = 0;
+    // Release the program blocks
+    ijvm_program_release(m->program);
+    m->program = NULL;
+    m->cpp = NULL;
+    m->cp_size = 0;
+    m->text = NULL;
+    m->text_size = 0;
     // Destroy Stack
-    free(machine.stack);
-    machine.stack = NULL;
-    machine.sp = NULL;
-    machine.lv = NULL;
+    stack_free(m->stack);
+    m->stack = NULL;
+    m->sp = NULL;
+    m->lv = NULL;
 }
 
-word_t get_local_variable(int i) {
-    return machine.lv[i];
+word_t ijvm_get_local_variable(ijvm_t *m, int i) {
+    return m->lv[i];
 }
 
-void set_local_variable(int index, word_t value) {
-    machine.lv[index] = value;
+void set_local_variable(machine_t *m, int index, word_t value) {
+    m->lv[index] = value;
 }
 
-int8_t get_byte_operand(uint16_t index) {
-    return (int8_t) get_text()[get_program_counter() + index];
+int8_t get_byte_operand(machine_t *m, uint16_t index) {
+    return (int8_t) ijvm_get_text(m)[ijvm_get_program_counter(m) + index];
 }
 
-uint16_t get_short_operand(uint16_t index) {
-    uint16_t operand1 = get_text()[get_program_counter() + index];
-    uint16_t operand2 = get_text()[get_program_counter() + index + 1];
+uint16_t get_short_operand(machine_t *m, uint16_t index) {
+    uint16_t operand1 = ijvm_get_text(m)[ijvm_get_program_counter(m) + index];
+    uint16_t operand2 = ijvm_get_text(m)[ijvm_get_program_counter(m) + index + 1];
     return operand1 * 0x100 + operand2;
 }
 
-word_t get_constant(int i) {
+word_t ijvm_get_constant(ijvm_t *m, int i) {
     int offset = i * sizeof(word_t);
-    return machine.cpp[offset] * 0x1000000
-           + machine.cpp[offset + 1] * 0x10000
-           + machine.cpp[offset + 2] * 0x100
-           + machine.cpp[offset + 3];
+    return m->cpp[offset] * 0x1000000
+           + m->cpp[offset + 1] * 0x10000
+           + m->cpp[offset + 2] * 0x100
+           + m->cpp[offset + 3];
 }
 
-void push_stack(word_t value) {
-    machine.sp += 1;
-    *machine.sp = value;
+void push_stack(machine_t *m, word_t value) {
+    m->sp += 1;
+    *m->sp = value;
 }
 
-word_t pop_stack(void) {
-    word_t value = *machine.sp;
-    machine.sp -= 1;
+word_t pop_stack(machine_t *m) {
+    word_t value = *m->sp;
+    m->sp -= 1;
     return value;
 }
 
-void set_input(FILE *fp) {
-    machine.input = fp;
+void ijvm_set_input(ijvm_t *m, FILE *fp) {
+    io_in_file(&m->in, fp);
+}
+
+void ijvm_set_output(ijvm_t *m, FILE *fp) {
+    io_out_file(&m->out, fp);
+}
+
+void ijvm_set_input_buffer(ijvm_t *m, const void *data, size_t size) {
+    io_in_memory(&m->in, data, size);
+}
+
+void ijvm_set_output_buffer(ijvm_t *m, void *data, size_t size) {
+    io_out_memory(&m->out, data, size);
+}
+
+size_t ijvm_output_size(ijvm_t *m) {
+    return m->out.fp == NULL ? m->out.len : 0;
+}
+
+void ijvm_flush(ijvm_t *m) {
+    io_flush(&m->out);
 }
 
-void set_output(FILE *fp) {
-    machine.output = fp;
+void ijvm_set_reuseport(ijvm_t *m, bool reuseport) {
+    m->reuseport = reuseport;
 }
 
-int get_program_counter(void) {
-    return machine.pc;
+int ijvm_get_program_counter(ijvm_t *m) {
+    return m->pc;
 }
 
-byte_t *get_text(void) {
-    return machine.text;
+byte_t *ijvm_get_text(ijvm_t *m) {
+    return m->text;
 }
 
-int text_size(void) {
-    return machine.text_size;
+int ijvm_text_size(ijvm_t *m) {
+    return m->text_size;
 }
 
-byte_t get_instruction(void) {
-    return get_text()[get_program_counter()];
+byte_t ijvm_get_instruction(ijvm_t *m) {
+    return ijvm_get_text(m)[ijvm_get_program_counter(m)];
 }
 
-word_t tos(void) {
-    return *machine.sp;
+word_t ijvm_tos(ijvm_t *m) {
+    return *m->sp;
 }
 
-int stack_size(void) {
-    return machine.sp - machine.lv;
+int ijvm_stack_size(ijvm_t *m) {
+    return m->sp - m->lv;
 }
 
-word_t *get_stack(void) {
-    return machine.lv;
+word_t *ijvm_get_stack(ijvm_t *m) {
+    return m->lv;
 }
 
-bool finished(void) {
-    return machine.halted
-           || get_program_counter() >= text_size();
+bool ijvm_finished(ijvm_t *m) {
+    return m->halted
+           || ijvm_get_program_counter(m) >= ijvm_text_size(m);
 }
@@ -1,9 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
 #include "ijvm.h"
+#include "batch.h"
+#include "forkserver.h"
+#include "serve.h"
+#include "snapshot.h"
+#include "checkpoint.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "sampler.h"
+#include "edgeprof.h"
+#include "ngram.h"
+#include "trace.h"
+#include "perf.h"
+#include "metrics.h"
+#include "bench.h"
+#include "gen.h"
+#include "jas.h"
+#include "fuzz.h"
+#include "hwcounters.h"
 
 void print_help()
 {
     printf("Usage: ./ijvm binary \n");
+    printf("       ./ijvm --batch manifest [-j threads]\n");
+    printf("       ./ijvm --fork-server binary [pc]\n");
+    printf("       ./ijvm --serve workers binary\n");
+    printf("       ./ijvm --checkpoint file binary\n");
+    printf("       ./ijvm --opstats text|json binary\n");
+    printf("       ./ijvm --profile prefix binary [symbols]\n");
+    printf("       ./ijvm --edge-profile dir binary\n");
+    printf("       ./ijvm --ngram-stats text|json binary[:input]...\n");
+    printf("       ./ijvm --trace-decode file [last]\n");
+    printf("       ./ijvm --stats binary\n");
+    printf("       ./ijvm --hwcounters binary\n");
+    printf("       ./ijvm --bench [-r repetitions] [-b baseline] [-t percent] [binary[:input]...]\n");
+    printf("       ./ijvm --gen arith|calls|wide|arrays|output n file\n");
+    printf("       ./ijvm --assemble source.jas binary\n");
+    printf("       ./ijvm --fuzz [-s seed] [-n programs] [-o dir]\n");
+}
+
+// Writes prefix.folded for flamegraph.pl and prefix.pb for pprof
+static int profile_export(ijvm_t *m, const char *prefix)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.folded", prefix);
+  FILE *folded = fopen(path, "w");
+  snprintf(path, sizeof(path), "%s.pb", prefix);
+  FILE *pprof = fopen(path, "wb");
+  int failed = folded == NULL || pprof == NULL
+               || ijvm_profile_write_folded(m, folded, PROFILE_INSTRUCTIONS) < 0
+               || ijvm_profile_write_pprof(m, pprof) < 0;
+  if (folded != NULL && fclose(folded) != 0)
+    failed = 1;
+  if (pprof != NULL && fclose(pprof) != 0)
+    failed = 1;
+  if (failed)
+    fprintf(stderr, "Couldn't write the profile to %s.*\n", prefix);
+  return failed;
+}
+
+static const char *sample_path;
+
+// Writes what the sampler saw, for IJVM_SAMPLE
+static void write_samples(void)
+{
+  sampler_stop();
+  FILE *fp = fopen(sample_path, "w");
+  if (fp == NULL)
+  {
+    fprintf(stderr, "Couldn't write samples to %s\n", sample_path);
+    return;
+  }
+  sampler_write_folded(fp);
+  fclose(fp);
+  sampler_report(stderr);
+}
+
+// Dumps the counters of the running binary to stderr on SIGUSR1
+static void on_metrics_signal(int sig)
+{
+  (void) sig;
+  ijvm_metrics_t metrics;
+  char line[512];
+  ijvm_metrics(ijvm_default(), &metrics);
+  size_t len = ijvm_metrics_format(&metrics, line, sizeof(line));
+  if (write(STDERR_FILENO, line, len) < 0)
+    return;
 }
 
 int main(int argc, char **argv)
@@ -14,14 +101,376 @@ int main(int argc, char **argv)
     return 1;
   }
 
-  if (init_ijvm(argv[1]) < 0)
+  // Reuse assembled sources across runs when asked to, and what
+  // earlier runs recorded about their hot paths
+  ijvm_set_cache_dir(getenv("IJVM_CACHE_DIR"));
+  ijvm_set_profile_dir(getenv("IJVM_PROFILE_DIR"));
+
+  // Sample where guest code spends its time, whatever the mode
+  sample_path = getenv("IJVM_SAMPLE");
+  if (sample_path != NULL && sampler_start(0) == 0)
+    atexit(write_samples);
+
+  // Name guest methods for Linux perf: IJVM_PERF=map, jitdump or both
+  const char *perf = getenv("IJVM_PERF");
+  if (perf != NULL)
+  {
+    int what = (strstr(perf, "jitdump") != NULL ? PERF_JITDUMP : 0)
+               | (strstr(perf, "jitdump") == NULL || strstr(perf, "map") != NULL ? PERF_MAP : 0);
+    if (strcmp(perf, "both") == 0)
+      what = PERF_MAP | PERF_JITDUMP;
+    if (ijvm_perf_enable(what) < 0)
+      fprintf(stderr, "Couldn't set up perf support\n");
+  }
+
+  if (strcmp(argv[1], "--batch") == 0)
   {
-      fprintf(stderr, "Couldn't load binary %s\n", argv[1]);
+    if (argc < 3)
+    {
+      print_help();
+      return 1;
+    }
+    int threads = 0;
+    if (argc >= 5 && strcmp(argv[3], "-j") == 0)
+      threads = atoi(argv[4]);
+    int failed = batch_run_manifest(argv[2], threads);
+    if (failed < 0)
+    {
+      fprintf(stderr, "Couldn't read manifest %s\n", argv[2]);
       return 1;
+    }
+    if (failed > 0)
+      fprintf(stderr, "%d job(s) failed\n", failed);
+    return failed > 0;
   }
 
+  if (strcmp(argv[1], "--fork-server") == 0)
+  {
+    if (argc < 3)
+    {
+      print_help();
+      return 1;
+    }
+    if (init_ijvm(argv[2]) < 0)
+    {
+      fprintf(stderr, "Couldn't load binary %s\n", argv[2]);
+      return 1;
+    }
+    // Warm up to the requested pc, every request starts from there
+    if (argc >= 4 && !ijvm_run_until(ijvm_default(), strtoul(argv[3], NULL, 0)))
+    {
+      fprintf(stderr, "Program finished before reaching pc %s\n", argv[3]);
+      return 1;
+    }
+    int failed = ijvm_fork_server(ijvm_default(), stdin, stdout);
+    destroy_ijvm();
+    return failed != 0;
+  }
+
+  if (strcmp(argv[1], "--serve") == 0)
+  {
+    if (argc < 4 || atoi(argv[2]) <= 0)
+    {
+      print_help();
+      return 1;
+    }
+    if (ijvm_serve(argv[3], atoi(argv[2]), stderr) < 0)
+    {
+      fprintf(stderr, "Couldn't load binary %s\n", argv[3]);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--checkpoint") == 0)
+  {
+    if (argc < 4)
+    {
+      print_help();
+      return 1;
+    }
+    if (checkpoint_run(argv[3], argv[2], CHECKPOINT_INTERVAL) < 0)
+    {
+      fprintf(stderr, "Couldn't load binary %s\n", argv[3]);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--opstats") == 0)
+  {
+    if (argc < 4)
+    {
+      print_help();
+      return 1;
+    }
+    if (init_ijvm(argv[3]) < 0 || ijvm_stats_enable(ijvm_default()) < 0)
+    {
+      fprintf(stderr, "Couldn't load binary %s\n", argv[3]);
+      return 1;
+    }
+    run();
+    ijvm_stats_report(ijvm_default(), stderr,
+                      strcmp(argv[2], "json") == 0 ? OPSTATS_JSON : OPSTATS_TEXT);
+    ijvm_stats_disable(ijvm_default());
+    destroy_ijvm();
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--profile") == 0)
+  {
+    if (argc < 4)
+    {
+      print_help();
+      return 1;
+    }
+    if (init_ijvm(argv[3]) < 0 || ijvm_profile_enable(ijvm_default()) < 0)
+    {
+      fprintf(stderr, "Couldn't load binary %s\n", argv[3]);
+      return 1;
+    }
+    if (argc >= 5 && ijvm_profile_load_symbols(ijvm_default(), argv[4]) < 0)
+      fprintf(stderr, "Couldn't read symbols %s\n", argv[4]);
+    run();
+    ijvm_profile_report(ijvm_default(), stderr);
+    int failed = profile_export(ijvm_default(), argv[2]);
+    ijvm_profile_disable(ijvm_default());
+    destroy_ijvm();
+    return failed;
+  }
+
+  if (strcmp(argv[1], "--edge-profile") == 0)
+  {
+    if (argc < 4)
+    {
+      print_help();
+      return 1;
+    }
+    // The profile of an earlier run is read from the same directory
+    ijvm_set_profile_dir(argv[2]);
+    if (init_ijvm(argv[3]) < 0 || ijvm_edges_enable(ijvm_default()) < 0)
+    {
+      fprintf(stderr, "Couldn't load binary %s\n", argv[3]);
+      return 1;
+    }
+    run();
+    int failed = ijvm_edges_save(ijvm_default()) < 0;
+    if (failed)
+      fprintf(stderr, "Couldn't write the profile to %s\n", argv[2]);
+    ijvm_edges_disable(ijvm_default());
+    destroy_ijvm();
+    return failed;
+  }
+
+  if (strcmp(argv[1], "--ngram-stats") == 0)
+  {
+    if (argc < 4)
+    {
+      print_help();
+      return 1;
+    }
+    // The counts add up over the binaries, which run in turn, each on its
+    // own input file if given as binary:input, on stdin otherwise
+    for (int i = 3; i < argc; i++)
+    {
+      char *input = strrchr(argv[i], ':');
+      if (input != NULL)
+        *input++ = '\0';
+      FILE *in = input != NULL ? fopen(input, "r") : stdin;
+      if (in == NULL)
+      {
+        fprintf(stderr, "Couldn't open input %s\n", input);
+        return 1;
+      }
+      if (init_ijvm(argv[i]) < 0
+          || (i == 3 && ijvm_ngrams_enable(ijvm_default()) < 0))
+      {
+        fprintf(stderr, "Couldn't load binary %s\n", argv[i]);
+        return 1;
+      }
+      set_input(in);
+      run();
+      if (in != stdin)
+      {
+        set_input(stdin);
+        fclose(in);
+      }
+    }
+    ijvm_ngrams_report(ijvm_default(), stderr,
+                       strcmp(argv[2], "json") == 0 ? OPSTATS_JSON : OPSTATS_TEXT);
+    ijvm_ngrams_disable(ijvm_default());
+    destroy_ijvm();
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--bench") == 0)
+  {
+    int repetitions = 0;
+    const char *baseline = NULL;
+    double threshold = BENCH_THRESHOLD;
+    int i = 2;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2)
+    {
+      if (strcmp(argv[i], "-r") == 0)
+        repetitions = atoi(argv[i + 1]);
+      else if (strcmp(argv[i], "-b") == 0)
+        baseline = argv[i + 1];
+      else if (strcmp(argv[i], "-t") == 0)
+        threshold = atof(argv[i + 1]);
+      else
+        break;
+    }
+    // Binaries given as binary[:input] replace the default suite
+    size_t num_cases = argc > i ? (size_t) (argc - i) : bench_num_default_cases;
+    bench_case_t *cases = malloc(sizeof(bench_case_t) * num_cases);
+    bench_result_t *results = malloc(sizeof(bench_result_t) * num_cases * BENCH_ENGINES);
+    if (cases == NULL || results == NULL)
+    {
+      fprintf(stderr, "Out of memory\n");
+      return 1;
+    }
+    for (size_t c = 0; c < num_cases; c++)
+    {
+      if (argc <= i)
+      {
+        cases[c] = bench_default_cases[c];
+        continue;
+      }
+      char *input = strrchr(argv[i + c], ':');
+      if (input != NULL)
+        *input++ = '\0';
+      // Named like the default cases, to compare against their baseline
+      char *name = strrchr(argv[i + c], '/');
+      name = strdup(name != NULL ? name + 1 : argv[i + c]);
+      if (name != NULL && strrchr(name, '.') != NULL)
+        *strrchr(name, '.') = '\0';
+      cases[c] = (bench_case_t) { name != NULL ? name : argv[i + c], argv[i + c], input };
+    }
+    int failed = bench_run(cases, num_cases, repetitions, results);
+    bench_write_json(stdout, results, num_cases * BENCH_ENGINES);
+    int regressions = bench_report(stderr, results, num_cases * BENCH_ENGINES, baseline, threshold);
+    if (regressions < 0)
+      fprintf(stderr, "Couldn't read baseline %s\n", baseline);
+    else if (regressions > 0)
+      fprintf(stderr, "%d regression(s) over %.1f%%\n", regressions, threshold);
+    for (size_t c = 0; argc > i && c < num_cases; c++)
+      free((char *) cases[c].name);
+    free(cases);
+    free(results);
+    return failed > 0 || regressions != 0;
+  }
+
+  if (strcmp(argv[1], "--gen") == 0)
+  {
+    if (argc < 5 || gen_kernel_find(argv[2]) < 0)
+    {
+      print_help();
+      return 1;
+    }
+    if (gen_kernel_write(gen_kernel_find(argv[2]), strtoul(argv[3], NULL, 0), argv[4]) < 0)
+    {
+      fprintf(stderr, "Couldn't write %s\n", argv[4]);
+      return 1;
+    }
+    return 0;
+  }
+
+  if (strcmp(argv[1], "--assemble") == 0)
+  {
+    if (argc < 4)
+    {
+      print_help();
+      return 1;
+    }
+    return jas_assemble_file(argv[2], argv[3]) < 0;
+  }
+
+  if (strcmp(argv[1], "--fuzz") == 0)
+  {
+    uint64_t seed = 1;
+    uint64_t count = 1000;
+    const char *dir = NULL;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+      if (strcmp(argv[i], "-s") == 0)
+        seed = strtoull(argv[i + 1], NULL, 0);
+      else if (strcmp(argv[i], "-n") == 0)
+        count = strtoull(argv[i + 1], NULL, 0);
+      else if (strcmp(argv[i], "-o") == 0)
+        dir = argv[i + 1];
+    }
+    int diverged = fuzz_campaign(seed, count, dir, stderr);
+    if (diverged < 0)
+    {
+      fprintf(stderr, "Fuzzing failed\n");
+      return 1;
+    }
+    fprintf(stderr, "%llu programs, %d diverged\n", (unsigned long long) count, diverged);
+    return diverged > 0;
+  }
+
+  if (strcmp(argv[1], "--trace-decode") == 0)
+  {
+    if (argc < 3)
+    {
+      print_help();
+      return 1;
+    }
+    if (ijvm_trace_decode(argv[2], stdout, argc >= 4 ? strtoull(argv[3], NULL, 10) : 0) < 0)
+    {
+      fprintf(stderr, "Couldn't read trace %s\n", argv[2]);
+      return 1;
+    }
+    return 0;
+  }
+
+  // Print the counters at exit, besides on SIGUSR1
+  int stats = strcmp(argv[1], "--stats") == 0;
+  int counters = strcmp(argv[1], "--hwcounters") == 0;
+  char *binary = (stats || counters) && argc >= 3 ? argv[2] : argv[1];
+  if ((stats || counters) && argc < 3)
+  {
+    print_help();
+    return 1;
+  }
+
+  if (init_ijvm(binary) < 0)
+  {
+      fprintf(stderr, "Couldn't load binary %s\n", binary);
+      return 1;
+  }
+
+  struct sigaction sa;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = on_metrics_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGUSR1, &sa, NULL);
+
+  // Record the last instructions to a file, for --trace-decode
+  const char *trace_path = getenv("IJVM_TRACE");
+  if (trace_path != NULL && ijvm_trace_enable(ijvm_default(), trace_path, 0, true) < 0)
+    fprintf(stderr, "Couldn't trace to %s\n", trace_path);
+
+  hwcounters_t hw;
+  if (counters && hwcounters_open(&hw) == 0)
+    fprintf(stderr, "No counters could be opened, see perf_event_paranoid\n");
+  if (counters)
+    hwcounters_start(&hw);
+
   run();
 
+  if (stats)
+    ijvm_metrics_report(ijvm_default(), stderr);
+  if (counters)
+  {
+    hwcounters_stop(&hw);
+    ijvm_metrics_t metrics;
+    ijvm_metrics(ijvm_default(), &metrics);
+    hwcounters_report(stderr, &hw, metrics.instructions);
+    hwcounters_close(&hw);
+  }
+  ijvm_trace_disable(ijvm_default());
   destroy_ijvm();
 
   return 0;
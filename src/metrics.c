@@ -0,0 +1,137 @@
+#define _POSIX_C_SOURCE 200809L
+#include <string.h>
+#include <time.h>
+#include "metrics.h"
+#include "machine.h"
+
+static uint64_t clock_ns(clockid_t id) {
+    struct timespec ts;
+    clock_gettime(id, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+// Takes the depth of the stack as it is now into the high-water mark,
+// besides the one INVOKEVIRTUAL keeps
+static void sample_stack(machine_t *m) {
+    metrics_t *mt = &m->metrics;
+    if (m->stack == NULL || m->sp < m->stack || m->sp >= m->stack + STACK_SIZE)
+        return;
+    uint64_t depth = (uint64_t) (m->sp - m->stack) + 1;
+    if (depth > mt->counts.max_stack)
+        mt->counts.max_stack = depth;
+}
+
+void metrics_publish(ijvm_t *m) {
+    metrics_t *mt = &m->metrics;
+    sample_stack(m);
+    ijvm_metrics_t now = mt->counts;
+    now.stack_size = STACK_SIZE;
+    if (mt->wall_start != 0) {
+        uint64_t wall = clock_ns(CLOCK_MONOTONIC) - mt->wall_start;
+        now.wall_ns += wall;
+        now.busy_ns += mt->cpu_clock ? clock_ns(CLOCK_THREAD_CPUTIME_ID) - mt->cpu_start : wall;
+    }
+    unsigned int seq = atomic_load_explicit(&mt->seq, memory_order_relaxed);
+    atomic_store_explicit(&mt->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    mt->published[0] = now;
+    atomic_store_explicit(&mt->seq, seq + 2, memory_order_release);
+    mt->published[1] = now;
+}
+
+void metrics_begin(ijvm_t *m, bool may_wait) {
+    metrics_t *mt = &m->metrics;
+    mt->cpu_clock = may_wait;
+    mt->wall_start = clock_ns(CLOCK_MONOTONIC);
+    if (may_wait)
+        mt->cpu_start = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+void metrics_end(ijvm_t *m) {
+    metrics_t *mt = &m->metrics;
+    uint64_t wall = clock_ns(CLOCK_MONOTONIC) - mt->wall_start;
+    mt->counts.wall_ns += wall;
+    mt->counts.busy_ns += mt->cpu_clock ? clock_ns(CLOCK_THREAD_CPUTIME_ID) - mt->cpu_start : wall;
+    mt->wall_start = 0;
+    metrics_publish(m);
+}
+
+void ijvm_metrics(ijvm_t *m, ijvm_metrics_t *out) {
+    metrics_t *mt = &m->metrics;
+    while (true) {
+        unsigned int seq = atomic_load_explicit(&mt->seq, memory_order_acquire);
+        // While the first copy is being written, the second one holds
+        memcpy(out, &mt->published[seq & 1], sizeof(ijvm_metrics_t));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&mt->seq, memory_order_relaxed) == seq)
+            return;
+    }
+}
+
+// Appends s to the line in buf, as far as it fits
+static size_t append(char *buf, size_t size, size_t len, const char *s) {
+    for (; *s != '\0'; s++, len++)
+        if (len + 1 < size)
+            buf[len] = *s;
+    if (size > 0)
+        buf[len + 1 < size ? len : size - 1] = '\0';
+    return len;
+}
+
+static size_t append_number(char *buf, size_t size, size_t len, uint64_t value) {
+    char digits[24];
+    char *d = digits + sizeof(digits) - 1;
+    *d = '\0';
+    do {
+        *--d = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return append(buf, size, len, d);
+}
+
+size_t ijvm_metrics_format(const ijvm_metrics_t *x, char *buf, size_t size) {
+    const struct {
+        const char *key;
+        uint64_t value;
+    } fields[] = {
+        { "instructions", x->instructions }, { "calls", x->calls },
+        { "max_stack", x->max_stack }, { "stack_size", x->stack_size },
+        { "heap_live", x->heap_live }, { "heap_allocated", x->heap_allocated },
+        { "arrays", x->arrays }, { "bytes_in", x->bytes_in },
+        { "bytes_out", x->bytes_out }, { "net_in", x->net_in },
+        { "net_out", x->net_out }, { "wall_ns", x->wall_ns },
+        { "busy_ns", x->busy_ns },
+        // Millions of instructions per second of busy time
+        { "mips", x->busy_ns ? x->instructions * 1000 / x->busy_ns : 0 },
+    };
+    size_t len = 0;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        len = append(buf, size, len, i == 0 ? "" : " ");
+        len = append(buf, size, len, fields[i].key);
+        len = append(buf, size, len, "=");
+        len = append_number(buf, size, len, fields[i].value);
+    }
+    len = append(buf, size, len, "\n");
+    return len < size ? len : size ? size - 1 : 0;
+}
+
+void ijvm_metrics_report(ijvm_t *m, FILE *f) {
+    ijvm_metrics_t x;
+    ijvm_metrics(m, &x);
+    fprintf(f, "%-16s %20llu\n", "instructions", (unsigned long long) x.instructions);
+    fprintf(f, "%-16s %20llu\n", "calls", (unsigned long long) x.calls);
+    fprintf(f, "%-16s %20llu (%.2f%% of %llu words)\n", "max stack",
+            (unsigned long long) x.max_stack, 100.0 * x.max_stack / STACK_SIZE,
+            (unsigned long long) x.stack_size);
+    fprintf(f, "%-16s %20llu bytes\n", "heap live", (unsigned long long) x.heap_live);
+    fprintf(f, "%-16s %20llu bytes in %llu arrays\n", "heap allocated",
+            (unsigned long long) x.heap_allocated, (unsigned long long) x.arrays);
+    fprintf(f, "%-16s %20llu bytes\n", "in", (unsigned long long) x.bytes_in);
+    fprintf(f, "%-16s %20llu bytes\n", "out", (unsigned long long) x.bytes_out);
+    fprintf(f, "%-16s %20llu bytes\n", "net in", (unsigned long long) x.net_in);
+    fprintf(f, "%-16s %20llu bytes\n", "net out", (unsigned long long) x.net_out);
+    fprintf(f, "%-16s %20.6f s\n", "wall time", x.wall_ns / 1e9);
+    fprintf(f, "%-16s %20.6f s\n", "busy time", x.busy_ns / 1e9);
+    fprintf(f, "%-16s %20.1f M/s\n", "instruction rate",
+            x.busy_ns ? x.instructions * 1e3 / x.busy_ns : 0.0);
+}
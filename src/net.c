@@ -0,0 +1,393 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "net.h"
+#include "fiber.h"
+#include "util.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+static net_t *net_init(machine_t *m) {
+    if (m->net == NULL)
+        m->net = calloc(1, sizeof(net_t));
+    return m->net;
+}
+
+static bool set_nonblocking(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+/*
+ * Waits until fd is ready for events. With fibers the current one is parked
+ * and true is returned if another one took over; otherwise this blocks and
+ * returns false once the descriptor is ready.
+ */
+static bool wait_for(machine_t *m, int fd, short events) {
+    if (m->fibers != NULL)
+        return fiber_wait(m, fd, events);
+    struct pollfd pfd = { fd, events, 0 };
+    while (poll(&pfd, 1, -1) < 0 && errno == EINTR);
+    return false;
+}
+
+static conn_t *lookup(machine_t *m, word_t netref) {
+    net_t *net = m->net;
+    if (net == NULL || netref <= 0 || (size_t) netref > net->num_conns)
+        return NULL;
+    return net->conns[netref - 1];
+}
+
+static word_t add_conn(machine_t *m, int fd) {
+    net_t *net = m->net;
+    conn_t *c = calloc(1, sizeof(conn_t));
+    if (c == NULL) {
+        close(fd);
+        return 0;
+    }
+    c->fd = fd;
+    size_t i = 0;
+    while (i < net->num_conns && net->conns[i] != NULL)
+        i++;
+    if (i == net->num_conns) {
+        conn_t **conns = realloc(net->conns, sizeof(conn_t *) * (net->num_conns + 1));
+        if (conns == NULL) {
+            close(fd);
+            free(c);
+            return 0;
+        }
+        net->conns = conns;
+        net->num_conns++;
+    }
+    net->conns[i] = c;
+    net->connections++;
+    return i + 1;
+}
+
+// Writes out as much pending output as the socket takes without blocking
+static void flush(conn_t *c) {
+    size_t sent = 0;
+    while (sent < c->wlen) {
+        ssize_t n = send(c->fd, c->wbuf + sent, c->wlen - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        if (n <= 0) {
+            // The peer is gone, the rest can never be delivered
+            sent = c->wlen;
+            break;
+        }
+        sent += n;
+    }
+    memmove(c->wbuf, c->wbuf + sent, c->wlen - sent);
+    c->wlen -= sent;
+}
+
+static void flush_dirty(net_t *net) {
+    conn_t **link = &net->dirty;
+    while (*link != NULL) {
+        conn_t *c = *link;
+        flush(c);
+        if (c->wlen == 0) {
+            c->dirty = false;
+            *link = c->next_dirty;
+        } else {
+            link = &c->next_dirty;
+        }
+    }
+}
+
+static void remove_conn(machine_t *m, word_t netref) {
+    net_t *net = m->net;
+    conn_t *c = net->conns[netref - 1];
+    if (c->dirty) {
+        conn_t **link = &net->dirty;
+        while (*link != c)
+            link = &(*link)->next_dirty;
+        *link = c->next_dirty;
+    }
+    close(c->fd);
+    free(c->wbuf);
+    free(c);
+    net->conns[netref - 1] = NULL;
+}
+
+static int listen_on(machine_t *m, uint16_t port) {
+    net_t *net = m->net;
+    for (listener_t *l = net->listeners; l != NULL; l = l->next) {
+        if (l->port == port)
+            return l->fd;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    listener_t *l = malloc(sizeof(listener_t));
+    if (l == NULL
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+#ifdef SO_REUSEPORT
+        || (m->reuseport && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0)
+#endif
+        || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0
+        || listen(fd, SOMAXCONN) < 0
+        || !set_nonblocking(fd)) {
+        close(fd);
+        free(l);
+        return -1;
+    }
+    l->fd = fd;
+    l->port = port;
+    l->next = net->listeners;
+    net->listeners = l;
+    return fd;
+}
+
+bool net_bind(machine_t *m) {
+    net_t *net = net_init(m);
+    int lfd = net != NULL ? listen_on(m, (uint16_t) m->sp[0]) : -1;
+    word_t netref = 0;
+    while (lfd >= 0) {
+        int fd = accept(lfd, NULL, NULL);
+        if (fd >= 0) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            if (set_nonblocking(fd))
+                netref = add_conn(m, fd);
+            else
+                close(fd);
+            break;
+        }
+        if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            break;
+        // Pending output may be what the next client waits for
+        flush_dirty(net);
+        if (wait_for(m, lfd, POLLIN))
+            return false;
+    }
+    pop_stack(m);
+    push_stack(m, netref);
+    log("NETBIND -> %d\n", netref);
+    return true;
+}
+
+// Starts connecting a non-blocking socket, returns it or -1 on failure
+static int start_connect(word_t host, word_t port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl((uint32_t) host);
+    addr.sin_port = htons((uint16_t) port);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // Interrupted, the connection is still made in the background
+    if (!set_nonblocking(fd)
+        || (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 && errno != EINPROGRESS && errno != EINTR)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// 1 while the socket is still connecting, then 0 if it got connected or -1
+static int connect_result(int fd) {
+    struct pollfd pfd = { fd, POLLOUT, 0 };
+    if (poll(&pfd, 1, 0) <= 0)
+        return 1;
+    int error;
+    socklen_t len = sizeof(error);
+    if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0)
+        return -1;
+    return 0;
+}
+
+// Takes the socket the current fiber was connecting before it parked
+static int resume_connect(machine_t *m) {
+    net_t *net = m->net;
+    int fiber = m->fibers != NULL ? m->fibers->current->id : 0;
+    for (connecting_t **link = &net->connecting; *link != NULL; link = &(*link)->next) {
+        connecting_t *c = *link;
+        if (c->fiber != fiber)
+            continue;
+        int fd = c->fd;
+        *link = c->next;
+        free(c);
+        return fd;
+    }
+    return -1;
+}
+
+bool net_connect(machine_t *m) {
+    net_t *net = net_init(m);
+    word_t netref = 0;
+    int fd = -1;
+    if (net != NULL && (fd = resume_connect(m)) < 0)
+        fd = start_connect(m->sp[-1], m->sp[0]);
+    while (fd >= 0) {
+        int res = connect_result(fd);
+        if (res == 0) {
+            netref = add_conn(m, fd);
+            break;
+        }
+        if (res < 0) {
+            close(fd);
+            break;
+        }
+        // Kept aside while other fibers run, to be picked up again by
+        // this one when it retries
+        connecting_t *c = m->fibers != NULL ? malloc(sizeof(connecting_t)) : NULL;
+        if (m->fibers != NULL && c == NULL) {
+            close(fd);
+            break;
+        }
+        if (c != NULL) {
+            c->fd = fd;
+            c->fiber = m->fibers->current->id;
+            c->next = net->connecting;
+            net->connecting = c;
+        }
+        if (wait_for(m, fd, POLLOUT))
+            return false;
+        if (c != NULL)
+            fd = resume_connect(m);
+    }
+    pop_stack(m);
+    pop_stack(m);
+    push_stack(m, netref);
+    log("NETCONNECT -> %d\n", netref);
+    return true;
+}
+
+bool net_in(machine_t *m) {
+    conn_t *c = lookup(m, m->sp[0]);
+    word_t value = 0;
+    while (c != NULL && c->rpos == c->rlen && !c->eof) {
+        ssize_t n = recv(c->fd, c->rbuf, sizeof(c->rbuf), 0);
+        if (n > 0) {
+            c->rpos = 0;
+            c->rlen = n;
+        } else if (n == 0 || (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) {
+            c->eof = true;
+        } else if (n < 0 && errno != EINTR) {
+            // About to wait for the peer, which may be waiting for us
+            flush_dirty(m->net);
+            if (wait_for(m, c->fd, c->wlen > 0 ? POLLIN | POLLOUT : POLLIN))
+                return false;
+        }
+    }
+    if (c != NULL && c->rpos < c->rlen) {
+        value = c->rbuf[c->rpos++];
+        m->net->bytes_in++;
+        m->metrics.counts.net_in++;
+    }
+    pop_stack(m);
+    push_stack(m, value);
+    return true;
+}
+
+bool net_out(machine_t *m) {
+    conn_t *c = lookup(m, m->sp[0]);
+    if (c != NULL && c->wlen >= NET_WRITE_LIMIT) {
+        flush(c);
+        if (c->wlen >= NET_WRITE_LIMIT && wait_for(m, c->fd, POLLOUT))
+            return false;
+        flush(c);
+    }
+    pop_stack(m);
+    byte_t value = (byte_t) pop_stack(m);
+    if (c == NULL)
+        return true;
+    if (c->wlen == c->wcap) {
+        size_t wcap = c->wcap ? c->wcap * 2 : 0x1000;
+        byte_t *wbuf = realloc(c->wbuf, wcap);
+        if (wbuf == NULL)
+            return true;
+        c->wbuf = wbuf;
+        c->wcap = wcap;
+    }
+    c->wbuf[c->wlen++] = value;
+    m->net->bytes_out++;
+    m->metrics.counts.net_out++;
+    if (c->wlen >= NET_FLUSH_THRESHOLD)
+        flush(c);
+    if (c->wlen > 0 && !c->dirty) {
+        c->dirty = true;
+        c->next_dirty = m->net->dirty;
+        m->net->dirty = c;
+    }
+    return true;
+}
+
+bool net_close(machine_t *m) {
+    word_t netref = m->sp[0];
+    conn_t *c = lookup(m, netref);
+    while (c != NULL) {
+        flush(c);
+        if (c->wlen == 0)
+            break;
+        if (wait_for(m, c->fd, POLLOUT))
+            return false;
+    }
+    if (c != NULL)
+        remove_conn(m, netref);
+    pop_stack(m);
+    log("NETCLOSE %d\n", netref);
+    return true;
+}
+
+void net_reset(machine_t *m) {
+    net_t *net = m->net;
+    if (net == NULL)
+        return;
+    for (size_t i = 0; i < net->num_conns; i++) {
+        if (net->conns[i] == NULL)
+            continue;
+        // Best effort: the socket may not take everything right now
+        flush(net->conns[i]);
+        remove_conn(m, i + 1);
+    }
+    while (net->connecting != NULL) {
+        connecting_t *c = net->connecting;
+        net->connecting = c->next;
+        close(c->fd);
+        free(c);
+    }
+    net->connections = 0;
+    net->bytes_in = 0;
+    net->bytes_out = 0;
+}
+
+void net_free(machine_t *m) {
+    net_t *net = m->net;
+    if (net == NULL)
+        return;
+    net_reset(m);
+    while (net->listeners != NULL) {
+        listener_t *l = net->listeners;
+        net->listeners = l->next;
+        close(l->fd);
+        free(l);
+    }
+    free(net->conns);
+    free(net);
+    m->net = NULL;
+}
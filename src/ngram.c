@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include "ngram.h"
+
+// Shown per kind in the text report
+#define REPORT_TOP 20
+
+typedef struct slot {
+    uint32_t key; // n << 24 | opcodes, 0 for a free slot
+    uint64_t count;
+} slot_t;
+
+// Open addressing table of n-grams
+typedef struct table {
+    slot_t *slots;
+    size_t size;
+    size_t used;
+    uint64_t total[NGRAM_MAX + 1]; // Counted, per length
+} table_t;
+
+struct ngrams {
+    table_t executed;
+    table_t text;
+    byte_t history[NGRAM_MAX - 1]; // Latest first
+    int length; // Valid entries in history
+    uint64_t lost; // Counts that found no room
+};
+
+static uint32_t make_key(int n, const byte_t *latest_first) {
+    uint32_t key = (uint32_t) n << 24;
+    for (int i = 0; i < n; i++)
+        key |= (uint32_t) latest_first[i] << (8 * i);
+    return key;
+}
+
+static slot_t *lookup(table_t *t, uint32_t key) {
+    size_t i = (key * 0x9E3779B1u) & (t->size - 1);
+    while (t->slots[i].key != 0 && t->slots[i].key != key)
+        i = (i + 1) & (t->size - 1);
+    return &t->slots[i];
+}
+
+static bool grow(table_t *t) {
+    table_t old = *t;
+    t->size = old.size ? old.size * 2 : 256;
+    t->slots = calloc(t->size, sizeof(slot_t));
+    if (t->slots == NULL) {
+        *t = old;
+        return false;
+    }
+    for (size_t i = 0; i < old.size; i++)
+        if (old.slots[i].key != 0)
+            *lookup(t, old.slots[i].key) = old.slots[i];
+    free(old.slots);
+    return true;
+}
+
+static void count(ngrams_t *g, table_t *t, int n, const byte_t *latest_first) {
+    if (t->used * 2 >= t->size && !grow(t)) {
+        g->lost++;
+        return;
+    }
+    slot_t *s = lookup(t, make_key(n, latest_first));
+    if (s->key == 0) {
+        s->key = make_key(n, latest_first);
+        t->used++;
+    }
+    s->count++;
+    t->total[n]++;
+}
+
+// Counts op with whatever precedes it in the current sequence
+static void add(ngrams_t *g, table_t *t, byte_t op) {
+    byte_t seq[NGRAM_MAX] = { op };
+    memcpy(seq + 1, g->history, sizeof(g->history));
+    for (int n = 2; n <= g->length + 1; n++)
+        count(g, t, n, seq);
+    memcpy(g->history, seq, sizeof(g->history));
+    if (g->length < NGRAM_MAX - 1)
+        g->length++;
+}
+
+// Whether the instruction after op, in time, may be a different place
+static bool ends_sequence(byte_t op) {
+    switch (op) {
+        case OP_GOTO:
+        case OP_INVOKEVIRTUAL:
+        case OP_IRETURN:
+        case OP_HALT:
+        case OP_ERR:
+        case OP_SPAWN:
+        case OP_YIELD:
+            return true;
+        default:
+            return false;
+    }
+}
+
+int ijvm_ngrams_enable(ijvm_t *m) {
+    ngrams_t *g = calloc(1, sizeof(ngrams_t));
+    if (g == NULL)
+        return -1;
+    ijvm_ngrams_disable(m);
+    m->ngrams = g;
+    if (m->program != NULL)
+        ngrams_restart(m);
+    return 0;
+}
+
+void ijvm_ngrams_disable(ijvm_t *m) {
+    ngrams_t *g = m->ngrams;
+    if (g == NULL)
+        return;
+    free(g->executed.slots);
+    free(g->text.slots);
+    free(g);
+    m->ngrams = NULL;
+}
+
+void ngrams_step(machine_t *m, byte_t op, uint32_t pc) {
+    ngrams_t *g = m->ngrams;
+    add(g, &g->executed, op);
+    bool taken = (op == OP_IFEQ || op == OP_IFLT || op == OP_ICMPEQ) && m->pc != pc + 3;
+    if (taken || ends_sequence(op))
+        g->length = 0;
+}
+
+void ngrams_restart(machine_t *m) {
+    ngrams_t *g = m->ngrams;
+    g->length = 0;
+    // A branch may fall through in the text, so only what can't does end
+    // a sequence here
+    for (uint32_t pc = 0; pc < m->text_size; pc += instruction_size(m->text, m->text_size, pc)) {
+        byte_t op = m->text[pc];
+        add(g, &g->text, op);
+        if (ends_sequence(op))
+            g->length = 0;
+    }
+    g->length = 0;
+}
+
+static int compare_count(const void *a, const void *b) {
+    const ngram_t *x = a, *y = b;
+    if (x->count != y->count)
+        return x->count < y->count ? 1 : -1;
+    return memcmp(x->ops, y->ops, NGRAM_MAX);
+}
+
+// All n-grams of length n in the table, busiest first
+static ngram_t *collect(const table_t *t, int n, size_t *found) {
+    ngram_t *all = malloc(sizeof(ngram_t) * (t->used + 1));
+    *found = 0;
+    if (all == NULL)
+        return NULL;
+    for (size_t i = 0; i < t->size; i++) {
+        uint32_t key = t->slots[i].key;
+        if (key == 0 || (int) (key >> 24) != n)
+            continue;
+        ngram_t *e = &all[(*found)++];
+        memset(e, 0, sizeof(*e));
+        e->n = (uint8_t) n;
+        e->count = t->slots[i].count;
+        // Keys hold the latest opcode first, n-grams the earliest
+        for (int j = 0; j < n; j++)
+            e->ops[n - 1 - j] = (byte_t) (key >> (8 * j));
+    }
+    qsort(all, *found, sizeof(ngram_t), compare_count);
+    return all;
+}
+
+size_t ijvm_ngrams(ijvm_t *m, int n, bool dynamic, ngram_t *out, size_t max) {
+    ngrams_t *g = m->ngrams;
+    if (g == NULL || n < 2 || n > NGRAM_MAX)
+        return 0;
+    size_t found;
+    ngram_t *all = collect(dynamic ? &g->executed : &g->text, n, &found);
+    if (all == NULL)
+        return 0;
+    if (found > max)
+        found = max;
+    memcpy(out, all, sizeof(ngram_t) * found);
+    free(all);
+    return found;
+}
+
+static void format_ops(char *buf, size_t size, const ngram_t *e, const char *separator,
+                       const char *quote) {
+    size_t at = 0;
+    for (int i = 0; i < e->n && at < size; i++) {
+        const char *name = opcode_name(e->ops[i]);
+        char hex[8];
+        if (name == NULL) {
+            snprintf(hex, sizeof(hex), "0x%02X", e->ops[i]);
+            name = hex;
+        }
+        at += snprintf(buf + at, size - at, "%s%s%s%s", i ? separator : "", quote, name, quote);
+    }
+}
+
+static void report_text(const table_t *t, const char *kind, FILE *f) {
+    for (int n = 2; n <= NGRAM_MAX; n++) {
+        size_t found;
+        ngram_t *all = collect(t, n, &found);
+        if (all == NULL)
+            return;
+        fprintf(f, "%s %s, %llu in total\n", kind, n == 2 ? "bigrams" : "trigrams",
+                (unsigned long long) t->total[n]);
+        fprintf(f, "%4s  %-40s %14s %7s %7s\n", "rank", "sequence", "count", "%", "cum %");
+        uint64_t seen = 0;
+        for (size_t i = 0; i < found && i < REPORT_TOP; i++) {
+            seen += all[i].count;
+            char names[80];
+            format_ops(names, sizeof(names), &all[i], " ", "");
+            fprintf(f, "%4zu  %-40s %14llu %6.2f%% %6.2f%%\n", i + 1, names,
+                    (unsigned long long) all[i].count, 100.0 * all[i].count / t->total[n],
+                    100.0 * seen / t->total[n]);
+        }
+        fprintf(f, "\n");
+        free(all);
+    }
+}
+
+static void report_json(const table_t *t, FILE *f) {
+    fprintf(f, "{");
+    for (int n = 2; n <= NGRAM_MAX; n++) {
+        size_t found;
+        ngram_t *all = collect(t, n, &found);
+        fprintf(f, "%s\"%s\": {\"total\": %llu, \"sequences\": [", n > 2 ? ", " : "",
+                n == 2 ? "bigrams" : "trigrams", (unsigned long long) t->total[n]);
+        for (size_t i = 0; all != NULL && i < found; i++) {
+            char names[80];
+            format_ops(names, sizeof(names), &all[i], ", ", "\"");
+            fprintf(f, "%s\n    {\"names\": [%s], \"opcodes\": [", i ? "," : "", names);
+            for (int j = 0; j < n; j++)
+                fprintf(f, "%s%d", j ? ", " : "", all[i].ops[j]);
+            fprintf(f, "], \"count\": %llu}", (unsigned long long) all[i].count);
+        }
+        fprintf(f, "]}");
+        free(all);
+    }
+    fprintf(f, "}");
+}
+
+void ijvm_ngrams_report(ijvm_t *m, FILE *f, opstats_format_t format) {
+    ngrams_t *g = m->ngrams;
+    if (g == NULL)
+        return;
+    if (format == OPSTATS_JSON) {
+        fprintf(f, "{\"max_length\": %d, \"lost\": %llu,\n \"dynamic\": ", NGRAM_MAX,
+                (unsigned long long) g->lost);
+        report_json(&g->executed, f);
+        fprintf(f, ",\n \"static\": ");
+        report_json(&g->text, f);
+        fprintf(f, "}\n");
+    } else {
+        report_text(&g->executed, "dynamic", f);
+        report_text(&g->text, "static", f);
+        if (g->lost != 0)
+            fprintf(f, "%llu counts lost for lack of memory\n", (unsigned long long) g->lost);
+    }
+}
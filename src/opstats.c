@@ -0,0 +1,172 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "opstats.h"
+#include "machine.h"
+
+int ijvm_stats_enable(ijvm_t *m) {
+    opstats_t *s = calloc(1, sizeof(opstats_t));
+    if (s == NULL)
+        return -1;
+    free(m->stats);
+    m->stats = s;
+    return 0;
+}
+
+void ijvm_stats_disable(ijvm_t *m) {
+    free(m->stats);
+    m->stats = NULL;
+}
+
+const opstats_t *ijvm_stats(ijvm_t *m) {
+    return m->stats;
+}
+
+const char *opcode_name(byte_t op) {
+    switch (op) {
+        case OP_BIPUSH: return "BIPUSH";
+        case OP_DUP: return "DUP";
+        case OP_ERR: return "ERR";
+        case OP_GOTO: return "GOTO";
+        case OP_HALT: return "HALT";
+        case OP_IADD: return "IADD";
+        case OP_IAND: return "IAND";
+        case OP_IFEQ: return "IFEQ";
+        case OP_IFLT: return "IFLT";
+        case OP_ICMPEQ: return "IF_ICMPEQ";
+        case OP_IINC: return "IINC";
+        case OP_ILOAD: return "ILOAD";
+        case OP_IN: return "IN";
+        case OP_INVOKEVIRTUAL: return "INVOKEVIRTUAL";
+        case OP_IOR: return "IOR";
+        case OP_IRETURN: return "IRETURN";
+        case OP_ISTORE: return "ISTORE";
+        case OP_ISUB: return "ISUB";
+        case OP_LDC_W: return "LDC_W";
+        case OP_NOP: return "NOP";
+        case OP_OUT: return "OUT";
+        case OP_POP: return "POP";
+        case OP_SWAP: return "SWAP";
+        case OP_WIDE: return "WIDE";
+        case OP_NEWARRAY: return "NEWARRAY";
+        case OP_IALOAD: return "IALOAD";
+        case OP_IASTORE: return "IASTORE";
+        case OP_NETBIND: return "NETBIND";
+        case OP_NETCONNECT: return "NETCONNECT";
+        case OP_NETIN: return "NETIN";
+        case OP_NETOUT: return "NETOUT";
+        case OP_NETCLOSE: return "NETCLOSE";
+        case OP_SPAWN: return "SPAWN";
+        case OP_YIELD: return "YIELD";
+        default: return NULL;
+    }
+}
+
+uint64_t opstats_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#endif
+}
+
+void opstats_sample(opstats_t *s, byte_t op, uint64_t cycles) {
+    int bucket = 0;
+    while (bucket < OPSTATS_BUCKETS - 1 && cycles >> (bucket + 1) != 0)
+        bucket++;
+    s->samples[op]++;
+    s->cycles[op] += cycles;
+    s->histogram[op][bucket]++;
+}
+
+// Opcodes that ran, busiest first
+static int sorted_opcodes(const opstats_t *s, byte_t *ops) {
+    int n = 0;
+    for (int op = 0; op < 256; op++) {
+        if (s->count[op] == 0)
+            continue;
+        int i = n++;
+        while (i > 0 && s->count[ops[i - 1]] < s->count[op]) {
+            ops[i] = ops[i - 1];
+            i--;
+        }
+        ops[i] = (byte_t) op;
+    }
+    return n;
+}
+
+static void print_name(FILE *f, byte_t op) {
+    const char *name = opcode_name(op);
+    if (name != NULL)
+        fprintf(f, "%s", name);
+    else
+        fprintf(f, "0x%02X", op);
+}
+
+static void report_text(const opstats_t *s, const byte_t *ops, int n, uint64_t total, FILE *f) {
+    fprintf(f, "%-14s %14s %7s %12s %9s\n", "opcode", "count", "%", "cycles/op", "p90");
+    for (int i = 0; i < n; i++) {
+        byte_t op = ops[i];
+        // The upper bound of the bucket that holds the 90th percentile
+        uint64_t seen = 0, p90 = 0;
+        for (int b = 0; b < OPSTATS_BUCKETS && s->samples[op] > 0; b++) {
+            seen += s->histogram[op][b];
+            if (seen * 10 >= s->samples[op] * 9) {
+                p90 = (uint64_t) 2 << b;
+                break;
+            }
+        }
+        const char *name = opcode_name(op);
+        char hex[8];
+        if (name == NULL) {
+            snprintf(hex, sizeof(hex), "0x%02X", op);
+            name = hex;
+        }
+        fprintf(f, "%-14s %14llu %6.2f%% %12.1f %9llu\n", name,
+                (unsigned long long) s->count[op], 100.0 * s->count[op] / total,
+                s->samples[op] ? (double) s->cycles[op] / s->samples[op] : 0.0,
+                (unsigned long long) p90);
+    }
+    fprintf(f, "%-14s %14llu\n", "total", (unsigned long long) total);
+}
+
+static void report_json(const opstats_t *s, const byte_t *ops, int n, uint64_t total, FILE *f) {
+    fprintf(f, "{\"total\": %llu, \"sample_rate\": %d, \"opcodes\": [",
+            (unsigned long long) total, OPSTATS_SAMPLE_RATE);
+    for (int i = 0; i < n; i++) {
+        byte_t op = ops[i];
+        fprintf(f, "%s\n  {\"opcode\": %d, \"name\": \"", i ? "," : "", op);
+        print_name(f, op);
+        fprintf(f, "\", \"count\": %llu, \"samples\": %llu, \"cycles\": %llu, \"histogram\": [",
+                (unsigned long long) s->count[op], (unsigned long long) s->samples[op],
+                (unsigned long long) s->cycles[op]);
+        // Trailing empty buckets are left out
+        int last = OPSTATS_BUCKETS;
+        while (last > 0 && s->histogram[op][last - 1] == 0)
+            last--;
+        for (int b = 0; b < last; b++)
+            fprintf(f, "%s%llu", b ? ", " : "", (unsigned long long) s->histogram[op][b]);
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]}\n");
+}
+
+void ijvm_stats_report(ijvm_t *m, FILE *f, opstats_format_t format) {
+    const opstats_t *s = m->stats;
+    if (s == NULL)
+        return;
+    byte_t ops[256];
+    int n = sorted_opcodes(s, ops);
+    uint64_t total = 0;
+    for (int i = 0; i < n; i++)
+        total += s->count[ops[i]];
+    if (format == OPSTATS_JSON)
+        report_json(s, ops, n, total, f);
+    else
+        report_text(s, ops, n, total, f);
+}
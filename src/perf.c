@@ -0,0 +1,234 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#include "perf.h"
+
+// Trampolines are carved from chunks of this many bytes
+#define CHUNK_SIZE 0x10000
+#define STUB_SIZE 32
+
+// push rbp; mov rbp, rsp; call rsi; pop rbp; ret
+#if defined(__x86_64__)
+static const byte_t stub[] = { 0x55, 0x48, 0x89, 0xe5, 0xff, 0xd6, 0x5d, 0xc3 };
+#define ELF_MACH EM_X86_64
+// stp x29, x30, [sp, #-16]!; mov x29, sp; blr x1; ldp x29, x30, [sp], #16; ret
+#elif defined(__aarch64__)
+static const byte_t stub[] = {
+    0xfd, 0x7b, 0xbf, 0xa9, 0xfd, 0x03, 0x00, 0x91, 0x20, 0x00, 0x3f, 0xd6,
+    0xfd, 0x7b, 0xc1, 0xa8, 0xc0, 0x03, 0x5f, 0xd6
+};
+#define ELF_MACH EM_AARCH64
+#endif
+
+typedef void (*trampoline_t)(void *arg, void (*fn)(void *));
+
+static atomic_bool active;
+static pthread_mutex_t perf_lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *perf_map;
+static int jitdump = -1;
+static void *jitdump_marker;
+static size_t marker_size;
+static uint64_t code_index;
+// The chunk trampolines are written through, and the one they run from:
+// two views of the same memory, so no page is ever writable and executable
+static byte_t *chunk_rw;
+static byte_t *chunk_rx;
+static size_t chunk_used = CHUNK_SIZE;
+
+static uint64_t timestamp(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
+
+static bool open_jitdump(void) {
+#ifdef ELF_MACH
+    const char *dir = getenv("JITDUMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/jit-%d.dump", dir != NULL ? dir : "/tmp", (int) getpid());
+    jitdump = open(path, O_CREAT | O_TRUNC | O_RDWR | O_CLOEXEC, 0644);
+    if (jitdump < 0)
+        return false;
+    jitdump_header_t h = {
+        .magic = JITDUMP_MAGIC, .version = JITDUMP_VERSION, .total_size = sizeof(h),
+        .elf_mach = ELF_MACH, .pid = (uint32_t) getpid(), .timestamp = timestamp()
+    };
+    // perf record finds the file through an executable mapping of it
+    marker_size = (size_t) sysconf(_SC_PAGESIZE);
+    if (write(jitdump, &h, sizeof(h)) == (ssize_t) sizeof(h))
+        jitdump_marker = mmap(NULL, marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, jitdump, 0);
+    if (jitdump_marker == NULL || jitdump_marker == MAP_FAILED) {
+        jitdump_marker = NULL;
+        close(jitdump);
+        jitdump = -1;
+        unlink(path);
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void close_files(void) {
+    if (perf_map != NULL)
+        fclose(perf_map);
+    perf_map = NULL;
+    if (jitdump_marker != NULL)
+        munmap(jitdump_marker, marker_size);
+    jitdump_marker = NULL;
+    if (jitdump >= 0)
+        close(jitdump);
+    jitdump = -1;
+}
+
+int ijvm_perf_enable(int what) {
+#ifndef ELF_MACH
+    (void) what;
+    return -1;
+#else
+    pthread_mutex_lock(&perf_lock);
+    close_files();
+    bool ok = true;
+    if (what & PERF_MAP) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int) getpid());
+        perf_map = fopen(path, "a");
+        ok = perf_map != NULL;
+    }
+    if (ok && (what & PERF_JITDUMP))
+        ok = open_jitdump();
+    if (!ok)
+        close_files();
+    atomic_store(&active, ok);
+    pthread_mutex_unlock(&perf_lock);
+    return ok ? 0 : -1;
+#endif
+}
+
+void ijvm_perf_disable(void) {
+    pthread_mutex_lock(&perf_lock);
+    atomic_store(&active, false);
+    close_files();
+    pthread_mutex_unlock(&perf_lock);
+}
+
+bool perf_active(void) {
+    return atomic_load_explicit(&active, memory_order_relaxed);
+}
+
+#ifdef ELF_MACH
+static bool new_chunk(void) {
+    // Through syscall(), the wrapper needs _GNU_SOURCE, which has
+    // pthread.h include the scheduler's header in place of the system's
+    int fd = (int) syscall(SYS_memfd_create, "ijvm-perf", MFD_CLOEXEC);
+    if (fd < 0)
+        return false;
+    void *rw = MAP_FAILED, *rx = MAP_FAILED;
+    if (ftruncate(fd, CHUNK_SIZE) == 0) {
+        rw = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        rx = mmap(NULL, CHUNK_SIZE, PROT_READ | PROT_EXEC, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (rw == MAP_FAILED || rx == MAP_FAILED) {
+        if (rw != MAP_FAILED)
+            munmap(rw, CHUNK_SIZE);
+        if (rx != MAP_FAILED)
+            munmap(rx, CHUNK_SIZE);
+        return false;
+    }
+    // Earlier chunks stay mapped, their trampolines may be in use
+    chunk_rw = rw;
+    chunk_rx = rx;
+    chunk_used = 0;
+    return true;
+}
+
+static void announce(const byte_t *code, const char *name) {
+    if (perf_map != NULL) {
+        fprintf(perf_map, "%lx %x %s\n", (unsigned long) (uintptr_t) code, (unsigned) sizeof(stub), name);
+        // Readable right away, also if the process dies
+        fflush(perf_map);
+    }
+    if (jitdump >= 0) {
+        size_t name_size = strlen(name) + 1;
+        jitdump_code_load_t r = {
+            .header = { .id = JIT_CODE_LOAD, .timestamp = timestamp(),
+                        .total_size = (uint32_t) (sizeof(r) + name_size + sizeof(stub)) },
+            .pid = (uint32_t) getpid(), .tid = (uint32_t) syscall(SYS_gettid),
+            .vma = (uintptr_t) code, .code_addr = (uintptr_t) code,
+            .code_size = sizeof(stub), .code_index = code_index++
+        };
+        // A short write leaves a truncated record, which perf stops at
+        if (write(jitdump, &r, sizeof(r)) == (ssize_t) sizeof(r)
+            && write(jitdump, name, name_size) == (ssize_t) name_size)
+            (void) !write(jitdump, stub, sizeof(stub));
+    }
+}
+
+// Makes the trampoline of a method, under perf_lock
+static byte_t *make_stub(program_t *p, uint32_t method) {
+    if (chunk_used + STUB_SIZE > CHUNK_SIZE && !new_chunk())
+        return NULL;
+    byte_t *code = chunk_rx + chunk_used;
+    memcpy(chunk_rw + chunk_used, stub, sizeof(stub));
+    chunk_used += STUB_SIZE;
+    __builtin___clear_cache((char *) code, (char *) code + sizeof(stub));
+
+    const char *binary = p->path != NULL ? strrchr(p->path, '/') : NULL;
+    binary = binary != NULL ? binary + 1 : p->path != NULL ? p->path : "ijvm";
+    char name[256];
+    if (method == PERF_MAIN)
+        snprintf(name, sizeof(name), "[ijvm] %s:main", binary);
+    else
+        snprintf(name, sizeof(name), "[ijvm] %s:method_0x%x", binary, method);
+    announce(code, name);
+    return code;
+}
+#endif
+
+void perf_call(program_t *p, uint32_t method, void (*fn)(void *), void *arg) {
+#ifdef ELF_MACH
+    uint32_t index = method == PERF_MAIN ? p->text_size : method;
+    byte_t *code = NULL;
+    if (index <= p->text_size) {
+        atomic_uintptr_t *stubs = atomic_load_explicit(&p->perf_stubs, memory_order_acquire);
+        if (stubs != NULL)
+            code = (byte_t *) atomic_load_explicit(&stubs[index], memory_order_acquire);
+        if (code == NULL) {
+            pthread_mutex_lock(&perf_lock);
+            stubs = atomic_load(&p->perf_stubs);
+            if (stubs == NULL) {
+                stubs = calloc((size_t) p->text_size + 1, sizeof(atomic_uintptr_t));
+                atomic_store_explicit(&p->perf_stubs, stubs, memory_order_release);
+            }
+            if (stubs != NULL) {
+                code = (byte_t *) atomic_load(&stubs[index]);
+                if (code == NULL && (code = make_stub(p, method)) != NULL)
+                    atomic_store_explicit(&stubs[index], (uintptr_t) code, memory_order_release);
+            }
+            pthread_mutex_unlock(&perf_lock);
+        }
+    }
+    if (code != NULL) {
+        trampoline_t trampoline;
+        memcpy(&trampoline, &code, sizeof(trampoline));
+        trampoline(arg, fn);
+        return;
+    }
+#else
+    (void) p;
+    (void) method;
+#endif
+    fn(arg);
+}
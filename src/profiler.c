@@ -0,0 +1,387 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "profiler.h"
+#include "opstats.h"
+#include "machine.h"
+
+#define ROOT 0
+#define NONE UINT32_MAX
+
+// A method as reached through one call path
+typedef struct node {
+    uint32_t method; // Address its constant points to, NONE for the root
+    uint32_t parent;
+    uint32_t child; // First callee, NONE if none yet
+    uint32_t sibling; // Next callee of the parent
+    uint64_t calls;
+    uint64_t instructions; // Executed in the method itself
+    uint64_t cycles;
+} node_t;
+
+typedef struct symbol {
+    uint32_t address;
+    char *name;
+} symbol_t;
+
+struct profile {
+    node_t *nodes;
+    size_t num_nodes;
+    size_t capacity;
+    uint32_t current;
+    uint32_t lost; // Calls entered without room for their node
+    uint64_t last; // Clock at the previous instruction, 0 before the first
+    symbol_t *symbols;
+    size_t num_symbols;
+};
+
+// Totals per method, over every path that reaches it
+typedef struct method_totals {
+    uint32_t method;
+    uint64_t calls;
+    uint64_t instructions;
+    uint64_t cycles;
+    uint64_t inclusive_instructions;
+    uint64_t inclusive_cycles;
+} method_totals_t;
+
+int ijvm_profile_enable(ijvm_t *m) {
+    profile_t *p = calloc(1, sizeof(profile_t));
+    node_t *nodes = malloc(sizeof(node_t) * 64);
+    if (p == NULL || nodes == NULL) {
+        free(p);
+        free(nodes);
+        return -1;
+    }
+    p->nodes = nodes;
+    p->capacity = 64;
+    p->num_nodes = 1;
+    p->nodes[ROOT] = (node_t) { .method = NONE, .parent = NONE, .child = NONE, .sibling = NONE };
+    ijvm_profile_disable(m);
+    m->profile = p;
+    return 0;
+}
+
+void ijvm_profile_disable(ijvm_t *m) {
+    profile_t *p = m->profile;
+    if (p == NULL)
+        return;
+    for (size_t i = 0; i < p->num_symbols; i++)
+        free(p->symbols[i].name);
+    free(p->symbols);
+    free(p->nodes);
+    free(p);
+    m->profile = NULL;
+}
+
+void profile_restart(ijvm_t *m) {
+    m->profile->current = ROOT;
+    m->profile->lost = 0;
+    m->profile->last = 0;
+}
+
+static void enter(profile_t *p, uint32_t method) {
+    uint32_t i = p->nodes[p->current].child;
+    while (i != NONE && p->nodes[i].method != method)
+        i = p->nodes[i].sibling;
+    if (i == NONE) {
+        if (p->num_nodes == p->capacity) {
+            node_t *grown = realloc(p->nodes, sizeof(node_t) * p->capacity * 2);
+            if (grown == NULL) {
+                // Keep charging the caller, and remember to skip its return
+                p->lost++;
+                return;
+            }
+            p->nodes = grown;
+            p->capacity *= 2;
+        }
+        i = (uint32_t) p->num_nodes++;
+        p->nodes[i] = (node_t) {
+            .method = method, .parent = p->current, .child = NONE,
+            .sibling = p->nodes[p->current].child
+        };
+        p->nodes[p->current].child = i;
+    }
+    p->nodes[i].calls++;
+    p->current = i;
+}
+
+void profile_step(ijvm_t *m, byte_t op) {
+    profile_t *p = m->profile;
+    uint64_t now = opstats_clock();
+    node_t *n = &p->nodes[p->current];
+    n->instructions++;
+    n->cycles += p->last != 0 ? now - p->last : 0;
+    p->last = now;
+    if (op == OP_INVOKEVIRTUAL) {
+        // The call left pc past the argument and local counts
+        enter(p, m->pc - 4);
+    } else if (op == OP_IRETURN) {
+        if (p->lost > 0)
+            p->lost--;
+        else if (p->current != ROOT)
+            p->current = n->parent;
+    }
+}
+
+static int compare_symbols(const void *a, const void *b) {
+    uint32_t x = ((const symbol_t *) a)->address, y = ((const symbol_t *) b)->address;
+    return (x > y) - (x < y);
+}
+
+int ijvm_profile_load_symbols(ijvm_t *m, const char *path) {
+    profile_t *p = m->profile;
+    FILE *fp = p == NULL ? NULL : fopen(path, "r");
+    if (fp == NULL)
+        return -1;
+    char line[512], address[256], name[256];
+    size_t capacity = p->num_symbols;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        if (line[0] == '#' || sscanf(line, "%255s %255s", address, name) != 2)
+            continue;
+        if (p->num_symbols == capacity) {
+            capacity = capacity ? capacity * 2 : 16;
+            symbol_t *grown = realloc(p->symbols, sizeof(symbol_t) * capacity);
+            if (grown == NULL)
+                break;
+            p->symbols = grown;
+        }
+        char *copy = strdup(name);
+        if (copy == NULL)
+            break;
+        p->symbols[p->num_symbols++] = (symbol_t) { (uint32_t) strtoul(address, NULL, 0), copy };
+    }
+    fclose(fp);
+    qsort(p->symbols, p->num_symbols, sizeof(symbol_t), compare_symbols);
+    return 0;
+}
+
+// Writes the name of a method to buf, which holds at least 32 bytes
+static const char *method_name(profile_t *p, uint32_t method, char *buf) {
+    if (method == NONE)
+        return "main";
+    symbol_t key = { method, NULL };
+    symbol_t *s = bsearch(&key, p->symbols, p->num_symbols, sizeof(symbol_t), compare_symbols);
+    if (s != NULL)
+        return s->name;
+    sprintf(buf, "method_0x%x", method);
+    return buf;
+}
+
+// Collects the totals of every method into a new array, NULL on failure
+static method_totals_t *method_totals(profile_t *p, size_t *count) {
+    // Totals of each node with everything it called, callees come after
+    // their callers in the array
+    uint64_t *instructions = malloc(sizeof(uint64_t) * p->num_nodes);
+    uint64_t *cycles = malloc(sizeof(uint64_t) * p->num_nodes);
+    method_totals_t *totals = calloc(p->num_nodes, sizeof(method_totals_t));
+    if (instructions == NULL || cycles == NULL || totals == NULL) {
+        free(instructions);
+        free(cycles);
+        free(totals);
+        return NULL;
+    }
+    for (size_t i = 0; i < p->num_nodes; i++) {
+        instructions[i] = p->nodes[i].instructions;
+        cycles[i] = p->nodes[i].cycles;
+    }
+    for (size_t i = p->num_nodes; i-- > 1;) {
+        instructions[p->nodes[i].parent] += instructions[i];
+        cycles[p->nodes[i].parent] += cycles[i];
+    }
+
+    *count = 0;
+    for (size_t i = 0; i < p->num_nodes; i++) {
+        node_t *n = &p->nodes[i];
+        size_t t = 0;
+        while (t < *count && totals[t].method != n->method)
+            t++;
+        if (t == *count)
+            totals[(*count)++].method = n->method;
+        totals[t].calls += n->calls;
+        totals[t].instructions += n->instructions;
+        totals[t].cycles += n->cycles;
+        // Only the outermost of recursive calls adds to the inclusive total
+        uint32_t up = n->parent;
+        while (up != NONE && p->nodes[up].method != n->method)
+            up = p->nodes[up].parent;
+        if (up == NONE) {
+            totals[t].inclusive_instructions += instructions[i];
+            totals[t].inclusive_cycles += cycles[i];
+        }
+    }
+    free(instructions);
+    free(cycles);
+    return totals;
+}
+
+static int compare_inclusive(const void *a, const void *b) {
+    uint64_t x = ((const method_totals_t *) a)->inclusive_instructions;
+    uint64_t y = ((const method_totals_t *) b)->inclusive_instructions;
+    return (x < y) - (x > y);
+}
+
+void ijvm_profile_report(ijvm_t *m, FILE *f) {
+    profile_t *p = m->profile;
+    size_t count;
+    method_totals_t *totals = p == NULL ? NULL : method_totals(p, &count);
+    if (totals == NULL)
+        return;
+    qsort(totals, count, sizeof(method_totals_t), compare_inclusive);
+    uint64_t all = totals[0].inclusive_instructions;
+    fprintf(f, "%-24s %10s %14s %7s %14s %7s %16s %16s\n", "method", "calls",
+            "self", "%", "inclusive", "%", "self cycles", "incl. cycles");
+    for (size_t i = 0; i < count; i++) {
+        method_totals_t *t = &totals[i];
+        char buf[32];
+        fprintf(f, "%-24s %10llu %14llu %6.2f%% %14llu %6.2f%% %16llu %16llu\n",
+                method_name(p, t->method, buf), (unsigned long long) t->calls,
+                (unsigned long long) t->instructions, all ? 100.0 * t->instructions / all : 0.0,
+                (unsigned long long) t->inclusive_instructions,
+                all ? 100.0 * t->inclusive_instructions / all : 0.0,
+                (unsigned long long) t->cycles, (unsigned long long) t->inclusive_cycles);
+    }
+    free(totals);
+}
+
+static void print_path(profile_t *p, uint32_t i, FILE *f) {
+    char buf[32];
+    if (p->nodes[i].parent != NONE) {
+        print_path(p, p->nodes[i].parent, f);
+        fputc(';', f);
+    }
+    fputs(method_name(p, p->nodes[i].method, buf), f);
+}
+
+int ijvm_profile_write_folded(ijvm_t *m, FILE *f, profile_weight_t weight) {
+    profile_t *p = m->profile;
+    if (p == NULL)
+        return -1;
+    for (uint32_t i = 0; i < p->num_nodes; i++) {
+        uint64_t w = weight == PROFILE_CYCLES ? p->nodes[i].cycles : p->nodes[i].instructions;
+        if (w == 0)
+            continue;
+        print_path(p, i, f);
+        fprintf(f, " %llu\n", (unsigned long long) w);
+    }
+    return 0;
+}
+
+// Protocol buffer encoding, just what profile.proto needs
+
+typedef struct pb {
+    byte_t *data;
+    size_t len;
+    size_t cap;
+    bool failed;
+} pb_t;
+
+static void pb_bytes(pb_t *b, const void *data, size_t size) {
+    if (b->len + size > b->cap) {
+        size_t cap = b->cap ? b->cap : 256;
+        while (cap < b->len + size)
+            cap *= 2;
+        byte_t *grown = b->failed ? NULL : realloc(b->data, cap);
+        if (grown == NULL) {
+            b->failed = true;
+            return;
+        }
+        b->data = grown;
+        b->cap = cap;
+    }
+    memcpy(b->data + b->len, data, size);
+    b->len += size;
+}
+
+static void pb_varint(pb_t *b, uint64_t v) {
+    byte_t buf[10];
+    size_t n = 0;
+    do {
+        buf[n++] = (byte_t) ((v & 0x7f) | (v > 0x7f ? 0x80 : 0));
+        v >>= 7;
+    } while (v != 0);
+    pb_bytes(b, buf, n);
+}
+
+static void pb_uint(pb_t *b, int field, uint64_t v) {
+    pb_varint(b, (uint64_t) field << 3);
+    pb_varint(b, v);
+}
+
+static void pb_message(pb_t *b, int field, pb_t *msg) {
+    pb_varint(b, (uint64_t) field << 3 | 2);
+    pb_varint(b, msg->len);
+    pb_bytes(b, msg->data, msg->len);
+    b->failed |= msg->failed;
+    msg->len = 0;
+}
+
+static void pb_string(pb_t *b, int field, const char *s) {
+    pb_t msg = { (byte_t *) s, strlen(s), 0, false };
+    pb_message(b, field, &msg);
+}
+
+// A ValueType, with its strings at type and type + 1 in the table
+static void pb_value_type(pb_t *b, int field, pb_t *msg, uint64_t type) {
+    pb_uint(msg, 1, type);
+    pb_uint(msg, 2, type + 1);
+    pb_message(b, field, msg);
+}
+
+int ijvm_profile_write_pprof(ijvm_t *m, FILE *f) {
+    profile_t *p = m->profile;
+    size_t count;
+    method_totals_t *totals = p == NULL ? NULL : method_totals(p, &count);
+    if (totals == NULL)
+        return -1;
+    pb_t out = { 0 }, msg = { 0 }, inner = { 0 };
+
+    // Strings 1 to 4 name the sample types, function i has string 4 + i
+    pb_value_type(&out, 1, &msg, 1);
+    pb_value_type(&out, 1, &msg, 3);
+    for (uint32_t i = 0; i < p->num_nodes; i++) {
+        node_t *n = &p->nodes[i];
+        if (n->instructions == 0 && n->cycles == 0)
+            continue;
+        // Location ids are function ids, leaf first
+        for (uint32_t up = i; up != NONE; up = p->nodes[up].parent) {
+            size_t t = 0;
+            while (totals[t].method != p->nodes[up].method)
+                t++;
+            pb_varint(&inner, t + 1);
+        }
+        pb_message(&msg, 1, &inner);
+        pb_varint(&inner, n->instructions);
+        pb_varint(&inner, n->cycles);
+        pb_message(&msg, 2, &inner);
+        pb_message(&out, 2, &msg);
+    }
+    for (size_t t = 0; t < count; t++) {
+        pb_uint(&msg, 1, t + 1);
+        pb_uint(&inner, 1, t + 1);
+        pb_message(&msg, 4, &inner);
+        pb_message(&out, 4, &msg);
+    }
+    for (size_t t = 0; t < count; t++) {
+        pb_uint(&msg, 1, t + 1);
+        pb_uint(&msg, 2, 5 + t);
+        pb_uint(&msg, 3, 5 + t);
+        pb_message(&out, 5, &msg);
+    }
+    const char *strings[] = { "", "instructions", "count", "cycles", "count" };
+    for (size_t i = 0; i < sizeof(strings) / sizeof(*strings); i++)
+        pb_string(&out, 6, strings[i]);
+    for (size_t t = 0; t < count; t++) {
+        char buf[32];
+        pb_string(&out, 6, method_name(p, totals[t].method, buf));
+    }
+    pb_value_type(&out, 11, &msg, 1);
+    pb_uint(&out, 12, 1);
+
+    bool ok = !out.failed && fwrite(out.data, 1, out.len, f) == out.len;
+    free(out.data);
+    free(msg.data);
+    free(inner.data);
+    free(totals);
+    return ok ? 0 : -1;
+}
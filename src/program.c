@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "program.h"
+#include "diskcache.h"
+#include "edgeprof.h"
+#include "jas.h"
+#include "util.h"
+
+#define HEADER_SIZE 4
+#define BLOCK_HEADER_SIZE 8
+
+// Programs loaded from files, so machines running the same binary share it
+static program_t *cache;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint32_t read_word(const byte_t *p) {
+    return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+// Points data at the block starting at offset, checking it fits the image
+static bool parse_block(program_t *p, size_t *offset, byte_t **data, uint32_t *block_size) {
+    if (p->image_size - *offset < BLOCK_HEADER_SIZE)
+        return false;
+    // Skip the origin, read the block size
+    *block_size = read_word(p->image + *offset + 4);
+    *offset += BLOCK_HEADER_SIZE;
+    if (p->image_size - *offset < *block_size)
+        return false;
+    *data = p->image + *offset;
+    *offset += *block_size;
+    return true;
+}
+
+static void free_image(program_t *p) {
+    if (p->mapped)
+        munmap(p->image, p->image_size);
+    else
+        free(p->image);
+}
+
+static program_t *parse_image(byte_t *image, size_t size, bool mapped) {
+    program_t *p = calloc(1, sizeof(program_t));
+    if (p == NULL) {
+        program_t tmp = { .image = image, .image_size = size, .mapped = mapped };
+        free_image(&tmp);
+        return NULL;
+    }
+    p->image = image;
+    p->image_size = size;
+    p->mapped = mapped;
+    atomic_init(&p->refcount, 1);
+    size_t offset = HEADER_SIZE;
+    // Check that it is actually an ijvm file, with both blocks inside it
+    if (size < HEADER_SIZE || read_word(image) != MAGIC_NUMBER
+        || !parse_block(p, &offset, &p->cpp, &p->cp_size)
+        || !parse_block(p, &offset, &p->text, &p->text_size)
+        || (p->blocks = calloc(p->text_size + 1, sizeof(atomic_uint))) == NULL) {
+        free_image(p);
+        free(p);
+        return NULL;
+    }
+    return p;
+}
+
+program_t *program_from_image(byte_t *image, size_t size) {
+    return parse_image(image, size, false);
+}
+
+program_t *program_from_mapping(byte_t *image, size_t size) {
+    return parse_image(image, size, true);
+}
+
+uint64_t hash_bytes(const byte_t *data, size_t size) {
+    // 64-bit FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++) {
+        h ^= data[i];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+uint64_t program_hash(const program_t *p) {
+    return hash_bytes(p->image, p->image_size);
+}
+
+static byte_t *read_image(int fd, size_t *size) {
+    size_t capacity = 0x1000;
+    byte_t *image = malloc(capacity);
+    *size = 0;
+    ssize_t n;
+    while (image != NULL && (n = read(fd, image + *size, capacity - *size)) > 0) {
+        *size += n;
+        if (*size == capacity) {
+            capacity *= 2;
+            byte_t *grown = realloc(image, capacity);
+            if (grown == NULL)
+                free(image);
+            image = grown;
+        }
+    }
+    return image;
+}
+
+static program_t *load_file(int fd, const struct stat *st) {
+    size_t size = st->st_size;
+    if (S_ISREG(st->st_mode) && size > 0) {
+        void *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (image != MAP_FAILED)
+            return parse_image(image, size, true);
+    }
+    // Pipes and the like can't be mapped, read them instead
+    byte_t *image = read_image(fd, &size);
+    return image == NULL ? NULL : parse_image(image, size, false);
+}
+
+// Assembles a .jas source into the image of its binary, unless the disk
+// cache holds what it assembled to already
+static program_t *assemble_file(int fd, const char *path) {
+    size_t size;
+    byte_t *source = read_image(fd, &size);
+    if (source == NULL)
+        return NULL;
+    uint64_t hash = hash_bytes(source, size);
+    program_t *p = diskcache_load(hash, size);
+    if (p != NULL) {
+        free(source);
+        return p;
+    }
+    char error[JAS_ERROR_SIZE];
+    size_t image_size;
+    byte_t *image = jas_assemble((const char *) source, size, &image_size, error, sizeof(error));
+    free(source);
+    if (image == NULL) {
+        fprintf(stderr, "%s: %s\n", path, error);
+        return NULL;
+    }
+    log("loader: %s assembled, %zu bytes\n", path, image_size);
+    diskcache_store(hash, size, image, image_size);
+    return program_from_image(image, image_size);
+}
+
+static bool same_file(const program_t *p, const char *path, const struct stat *st) {
+    return p->dev == st->st_dev && p->ino == st->st_ino
+           && p->mtime.tv_sec == st->st_mtim.tv_sec
+           && p->mtime.tv_nsec == st->st_mtim.tv_nsec
+           && strcmp(p->path, path) == 0;
+}
+
+ijvm_program_t *ijvm_program_load(const char *binary_file) {
+    // Open ijvm file for reading
+    int fd = open(binary_file, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return NULL;
+    }
+    bool cacheable = S_ISREG(st.st_mode);
+
+    pthread_mutex_lock(&cache_lock);
+    for (program_t *p = cache; cacheable && p != NULL; p = p->next) {
+        unsigned int refs = atomic_load(&p->refcount);
+        // A program whose count hit zero is on its way out, skip it
+        while (refs > 0 && same_file(p, binary_file, &st)) {
+            if (atomic_compare_exchange_weak(&p->refcount, &refs, refs + 1)) {
+                pthread_mutex_unlock(&cache_lock);
+                close(fd);
+                log("loader: %s shared from cache\n", binary_file);
+                return p;
+            }
+        }
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    program_t *p = jas_is_source(binary_file) ? assemble_file(fd, binary_file) : load_file(fd, &st);
+    close(fd);
+    if (p != NULL)
+        edgeprof_attach(p);
+    if (p == NULL || !cacheable)
+        return p;
+    p->path = strdup(binary_file);
+    if (p->path == NULL)
+        return p;
+    p->dev = st.st_dev;
+    p->ino = st.st_ino;
+    p->mtime = st.st_mtim;
+    p->cached = true;
+    pthread_mutex_lock(&cache_lock);
+    p->next = cache;
+    cache = p;
+    pthread_mutex_unlock(&cache_lock);
+    return p;
+}
+
+ijvm_program_t *ijvm_program_retain(ijvm_program_t *p) {
+    atomic_fetch_add(&p->refcount, 1);
+    return p;
+}
+
+void ijvm_program_release(ijvm_program_t *p) {
+    if (p == NULL || atomic_fetch_sub(&p->refcount, 1) != 1)
+        return;
+    if (p->cached) {
+        pthread_mutex_lock(&cache_lock);
+        program_t **link = &cache;
+        while (*link != p)
+            link = &(*link)->next;
+        *link = p->next;
+        pthread_mutex_unlock(&cache_lock);
+    }
+    free_image(p);
+    free(p->blocks);
+    free(p->hot_blocks);
+    free(p->branches);
+    free(p->perf_stubs);
+    free(p->path);
+    free(p);
+}
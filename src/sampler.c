@@ -0,0 +1,329 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/time.h>
+#include "sampler.h"
+
+_Thread_local machine_t *sampler_machine;
+
+// One slot of the ring, a Vyukov bounded queue counting in laps rather than
+// positions, so the ring starts out as all zeros and costs no memory until
+// used: in lap l, a slot is free for producers when its turn is 2l, and
+// holds a sample for the consumer when it is 2l + 1
+typedef struct slot {
+    atomic_size_t turn;
+    uint32_t pc;
+    uint32_t depth;
+    bool truncated; // The stack went deeper than SAMPLER_DEPTH
+    uint32_t methods[SAMPLER_DEPTH]; // Innermost first
+} slot_t;
+
+// Samples of one pc in one call stack
+typedef struct entry {
+    uint64_t count;
+    uint32_t pc;
+    uint32_t depth;
+    bool truncated;
+    uint32_t methods[SAMPLER_DEPTH];
+} entry_t;
+
+static slot_t ring[SAMPLER_RING_SIZE];
+static atomic_size_t head;
+static size_t tail; // Guarded by drain_lock, as are the table below and stopping
+static atomic_ullong outside; // Samples that hit no machine
+static atomic_ullong dropped; // Samples that found the ring full
+static bool running;
+static struct sigaction old_action;
+static pthread_t drainer;
+static pthread_mutex_t drain_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drain_cond = PTHREAD_COND_INITIALIZER;
+static bool stopping;
+
+// Open addressing table of entries, aggregated from the ring
+static entry_t *table;
+static size_t table_size;
+static size_t table_used;
+
+static void on_sigprof(int sig) {
+    (void) sig;
+    machine_t *m = sampler_machine;
+    if (m == NULL) {
+        atomic_fetch_add_explicit(&outside, 1, memory_order_relaxed);
+        return;
+    }
+    size_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+    slot_t *s;
+    while (true) {
+        s = &ring[pos % SAMPLER_RING_SIZE];
+        size_t turn = atomic_load_explicit(&s->turn, memory_order_acquire);
+        size_t free_turn = pos / SAMPLER_RING_SIZE * 2;
+        if (turn == free_turn) {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (turn < free_turn) {
+            // Not drained since the last lap
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+        }
+    }
+    s->pc = m->pc;
+    s->depth = machine_frames(m, s->methods, SAMPLER_DEPTH, &s->truncated);
+    atomic_store_explicit(&s->turn, pos / SAMPLER_RING_SIZE * 2 + 1, memory_order_release);
+}
+
+static size_t hash_entry(const entry_t *e) {
+    size_t h = e->pc * 0x9E3779B1u ^ e->depth;
+    for (uint32_t i = 0; i < e->depth; i++)
+        h = (h ^ e->methods[i]) * 0x100000001b3ull;
+    return h;
+}
+
+static bool same_stack(const entry_t *a, const entry_t *b) {
+    return a->depth == b->depth && a->truncated == b->truncated
+           && memcmp(a->methods, b->methods, sizeof(uint32_t) * a->depth) == 0;
+}
+
+static bool same_entry(const entry_t *a, const entry_t *b) {
+    return a->pc == b->pc && same_stack(a, b);
+}
+
+static entry_t *lookup(const entry_t *key) {
+    size_t i = hash_entry(key) & (table_size - 1);
+    while (table[i].count != 0 && !same_entry(&table[i], key))
+        i = (i + 1) & (table_size - 1);
+    return &table[i];
+}
+
+static bool grow_table(void) {
+    size_t old_size = table_size;
+    entry_t *old = table;
+    table_size = old_size ? old_size * 2 : 1024;
+    table = calloc(table_size, sizeof(entry_t));
+    if (table == NULL) {
+        table = old;
+        table_size = old_size;
+        return false;
+    }
+    for (size_t i = 0; i < old_size; i++)
+        if (old[i].count != 0)
+            *lookup(&old[i]) = old[i];
+    free(old);
+    return true;
+}
+
+static void drain_locked(void) {
+    while (true) {
+        slot_t *s = &ring[tail % SAMPLER_RING_SIZE];
+        size_t lap = tail / SAMPLER_RING_SIZE;
+        if (atomic_load_explicit(&s->turn, memory_order_acquire) != lap * 2 + 1)
+            break;
+        if (table_used * 2 >= table_size && !grow_table())
+            break;
+        entry_t key = { .pc = s->pc, .depth = s->depth, .truncated = s->truncated };
+        memcpy(key.methods, s->methods, sizeof(uint32_t) * s->depth);
+        entry_t *e = lookup(&key);
+        if (e->count == 0) {
+            *e = key;
+            table_used++;
+        }
+        e->count++;
+        atomic_store_explicit(&s->turn, lap * 2 + 2, memory_order_release);
+        tail++;
+    }
+}
+
+void sampler_drain(void) {
+    pthread_mutex_lock(&drain_lock);
+    drain_locked();
+    pthread_mutex_unlock(&drain_lock);
+}
+
+// Keeps the ring from filling up for as long as the sampler runs
+static void *drain_main(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&drain_lock);
+    while (!stopping) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_nsec += SAMPLER_DRAIN_MS * 1000000L;
+        until.tv_sec += until.tv_nsec / 1000000000L;
+        until.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&drain_cond, &drain_lock, &until);
+        drain_locked();
+    }
+    pthread_mutex_unlock(&drain_lock);
+    return NULL;
+}
+
+int sampler_start(unsigned int hz) {
+    if (running)
+        return -1;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, &old_action) < 0)
+        return -1;
+    if (hz == 0)
+        hz = SAMPLER_DEFAULT_HZ;
+    long usec = 1000000 / hz > 0 ? 1000000 / hz : 1;
+    // A whole second, at 1 Hz, must be given in seconds
+    struct timeval period = { usec / 1000000, usec % 1000000 };
+    struct itimerval timer = { period, period };
+    if (setitimer(ITIMER_PROF, &timer, NULL) < 0) {
+        sigaction(SIGPROF, &old_action, NULL);
+        return -1;
+    }
+    // The drainer inherits SIGPROF blocked, so samples only land on
+    // threads doing the work
+    sigset_t prof, old_mask;
+    sigemptyset(&prof);
+    sigaddset(&prof, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &prof, &old_mask);
+    int res = pthread_create(&drainer, NULL, drain_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+    if (res != 0) {
+        memset(&timer, 0, sizeof(timer));
+        setitimer(ITIMER_PROF, &timer, NULL);
+        sigaction(SIGPROF, &old_action, NULL);
+        return -1;
+    }
+    running = true;
+    return 0;
+}
+
+void sampler_stop(void) {
+    if (!running)
+        return;
+    struct itimerval timer;
+    memset(&timer, 0, sizeof(timer));
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &old_action, NULL);
+    pthread_mutex_lock(&drain_lock);
+    stopping = true;
+    pthread_cond_signal(&drain_cond);
+    pthread_mutex_unlock(&drain_lock);
+    pthread_join(drainer, NULL);
+    stopping = false;
+    running = false;
+    sampler_drain();
+}
+
+static int compare_count(const void *a, const void *b) {
+    uint64_t x = ((const entry_t *) a)->count, y = ((const entry_t *) b)->count;
+    return (x < y) - (x > y);
+}
+
+static int compare_stack(const void *a, const void *b) {
+    const entry_t *x = a, *y = b;
+    if (x->depth != y->depth)
+        return x->depth < y->depth ? -1 : 1;
+    if (x->truncated != y->truncated)
+        return x->truncated ? 1 : -1;
+    for (uint32_t i = 0; i < x->depth; i++)
+        if (x->methods[i] != y->methods[i])
+            return x->methods[i] < y->methods[i] ? -1 : 1;
+    return 0;
+}
+
+static int compare_pc(const void *a, const void *b) {
+    uint32_t x = ((const entry_t *) a)->pc, y = ((const entry_t *) b)->pc;
+    return (x > y) - (x < y);
+}
+
+static int compare_method(const void *a, const void *b) {
+    const entry_t *x = a, *y = b;
+    uint32_t mx = x->depth ? x->methods[0] : UINT32_MAX, my = y->depth ? y->methods[0] : UINT32_MAX;
+    return (mx > my) - (mx < my);
+}
+
+// Copies the aggregate, with entries that fall together under compare
+// merged, into a new array sorted by count
+static entry_t *collect(int (*compare)(const void *, const void *), size_t *count) {
+    pthread_mutex_lock(&drain_lock);
+    drain_locked();
+    entry_t *all = malloc(sizeof(entry_t) * (table_used + 1));
+    size_t n = 0;
+    for (size_t i = 0; all != NULL && i < table_size; i++)
+        if (table[i].count != 0)
+            all[n++] = table[i];
+    pthread_mutex_unlock(&drain_lock);
+    if (all == NULL)
+        return NULL;
+    if (compare != NULL && n > 0) {
+        qsort(all, n, sizeof(entry_t), compare);
+        size_t merged = 0;
+        for (size_t i = 1; i < n; i++) {
+            if (compare(&all[merged], &all[i]) == 0)
+                all[merged].count += all[i].count;
+            else
+                all[++merged] = all[i];
+        }
+        n = merged + 1;
+    }
+    qsort(all, n, sizeof(entry_t), compare_count);
+    *count = n;
+    return all;
+}
+
+void sampler_report(FILE *f) {
+    size_t n;
+    entry_t *by_pc = collect(NULL, &n);
+    if (by_pc == NULL)
+        return;
+    uint64_t total = 0;
+    for (size_t i = 0; i < n; i++)
+        total += by_pc[i].count;
+    fprintf(f, "%llu samples in guest code, %llu elsewhere, %llu dropped\n",
+            (unsigned long long) total, (unsigned long long) atomic_load(&outside),
+            (unsigned long long) atomic_load(&dropped));
+
+    size_t methods;
+    entry_t *by_method = collect(compare_method, &methods);
+    if (by_method != NULL) {
+        fprintf(f, "%-24s %10s %7s\n", "method", "samples", "%");
+        for (size_t i = 0; i < methods && i < 20; i++) {
+            char name[32];
+            if (by_method[i].depth == 0)
+                strcpy(name, "main");
+            else
+                sprintf(name, "method_0x%x", by_method[i].methods[0]);
+            fprintf(f, "%-24s %10llu %6.2f%%\n", name, (unsigned long long) by_method[i].count,
+                    100.0 * by_method[i].count / total);
+        }
+        free(by_method);
+    }
+
+    free(by_pc);
+    by_pc = collect(compare_pc, &n);
+    if (by_pc == NULL)
+        return;
+    fprintf(f, "%-24s %10s %7s\n", "pc", "samples", "%");
+    for (size_t i = 0; i < n && i < 20; i++)
+        fprintf(f, "0x%-22x %10llu %6.2f%%\n", by_pc[i].pc, (unsigned long long) by_pc[i].count,
+                100.0 * by_pc[i].count / total);
+    free(by_pc);
+}
+
+void sampler_write_folded(FILE *f) {
+    size_t n;
+    entry_t *stacks = collect(compare_stack, &n);
+    if (stacks == NULL)
+        return;
+    for (size_t i = 0; i < n; i++) {
+        entry_t *e = &stacks[i];
+        fputs(e->truncated ? "..." : "main", f);
+        for (uint32_t d = e->depth; d-- > 0;)
+            fprintf(f, ";method_0x%x", e->methods[d]);
+        fprintf(f, " %llu\n", (unsigned long long) e->count);
+    }
+    free(stacks);
+}
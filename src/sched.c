@@ -0,0 +1,473 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include "machine.h"
+#include "sched.h"
+#include "util.h"
+
+#define MAX_EVENTS 64
+
+typedef struct task {
+    ijvm_t *m;
+    sched_done_t done;
+    void *arg;
+    struct task *next; // In a queue, or the waiters of a descriptor
+    struct task *prev_all; // In the list of all unfinished tasks
+    struct task *next_all;
+} task_t;
+
+typedef struct queue {
+    pthread_mutex_t lock;
+    task_t *head;
+    task_t *tail;
+} queue_t;
+
+typedef struct worker {
+    sched_t *s;
+    int id;
+} worker_t;
+
+// The tasks parked on one descriptor, all woken when it gets readable
+typedef struct watch {
+    task_t *waiters;
+    bool registered; // Whether the descriptor is in the epoll set
+} watch_t;
+
+struct sched {
+    queue_t *queues; // One per worker
+    worker_t *workers;
+    pthread_t *threads;
+    int num_workers;
+    uint64_t slice;
+    atomic_long queued; // Tasks on any queue
+    atomic_int sleepers; // Workers waiting for work
+    atomic_uint next_queue; // Spreads new and woken tasks over the queues
+    atomic_bool stopping;
+    pthread_mutex_t lock; // Guards the conditions and the fields below
+    pthread_cond_t work;
+    pthread_cond_t idle;
+    task_t *all;
+    size_t live; // Tasks submitted and not finished
+    // Parked tasks wait in the poller, which wakes them into the queues
+    pthread_t poller;
+    int wake[2]; // Interrupts the poller
+#ifdef __linux__
+    int epfd;
+    watch_t *watches; // Indexed by descriptor, guarded by lock
+    int num_watches;
+#else
+    task_t **parked; // Guarded by lock
+    size_t num_parked;
+    size_t parked_capacity;
+#endif
+    atomic_uint_fast64_t slices;
+    atomic_uint_fast64_t parks;
+    atomic_uint_fast64_t steals;
+    atomic_uint_fast64_t finished;
+};
+
+static task_t *pop(queue_t *q) {
+    pthread_mutex_lock(&q->lock);
+    task_t *t = q->head;
+    if (t != NULL) {
+        q->head = t->next;
+        if (q->head == NULL)
+            q->tail = NULL;
+    }
+    pthread_mutex_unlock(&q->lock);
+    return t;
+}
+
+static void push(queue_t *q, task_t *t) {
+    t->next = NULL;
+    pthread_mutex_lock(&q->lock);
+    if (q->tail != NULL)
+        q->tail->next = t;
+    else
+        q->head = t;
+    q->tail = t;
+    pthread_mutex_unlock(&q->lock);
+}
+
+// Queues a task on the queue of worker `id`, waking a worker if all sleep
+static void enqueue(sched_t *s, int id, task_t *t) {
+    push(&s->queues[id], t);
+    atomic_fetch_add(&s->queued, 1);
+    // A sleeper checks `queued` under the lock before it waits, so either
+    // it sees the task or it gets the signal
+    if (atomic_load(&s->sleepers) > 0) {
+        pthread_mutex_lock(&s->lock);
+        pthread_cond_signal(&s->work);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+static void enqueue_anywhere(sched_t *s, task_t *t) {
+    enqueue(s, (int) (atomic_fetch_add(&s->next_queue, 1) % (unsigned) s->num_workers), t);
+}
+
+// Takes the next task of worker `id`, stealing or sleeping as needed.
+// Returns NULL once the scheduler stops
+static task_t *next_task(sched_t *s, int id) {
+    while (!atomic_load(&s->stopping)) {
+        task_t *t = pop(&s->queues[id]);
+        for (int i = 1; t == NULL && i < s->num_workers; i++) {
+            t = pop(&s->queues[(id + i) % s->num_workers]);
+            if (t != NULL)
+                atomic_fetch_add(&s->steals, 1);
+        }
+        if (t != NULL) {
+            atomic_fetch_sub(&s->queued, 1);
+            return t;
+        }
+        pthread_mutex_lock(&s->lock);
+        atomic_fetch_add(&s->sleepers, 1);
+        while (atomic_load(&s->queued) <= 0 && !atomic_load(&s->stopping))
+            pthread_cond_wait(&s->work, &s->lock);
+        atomic_fetch_sub(&s->sleepers, 1);
+        pthread_mutex_unlock(&s->lock);
+    }
+    return NULL;
+}
+
+static void wake_poller(sched_t *s) {
+    char c = 0;
+    while (write(s->wake[1], &c, 1) < 0 && errno == EINTR);
+}
+
+#ifdef __linux__
+
+static watch_t *watch_for(sched_t *s, int fd) {
+    if (fd >= s->num_watches) {
+        int num = s->num_watches ? s->num_watches : 64;
+        while (num <= fd)
+            num *= 2;
+        watch_t *watches = realloc(s->watches, sizeof(watch_t) * num);
+        if (watches == NULL)
+            return NULL;
+        memset(watches + s->num_watches, 0, sizeof(watch_t) * (num - s->num_watches));
+        s->watches = watches;
+        s->num_watches = num;
+    }
+    return &s->watches[fd];
+}
+
+// Has the poller report the descriptor once it is readable
+static bool arm(sched_t *s, int fd, watch_t *w) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.fd = fd;
+    // The registration of a closed descriptor is gone, and a new one may
+    // have taken its number, so fall back between the two
+    int op = w->registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+    int res = epoll_ctl(s->epfd, op, fd, &ev);
+    if (res < 0 && (errno == ENOENT || errno == EEXIST)) {
+        op = op == EPOLL_CTL_MOD ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        res = epoll_ctl(s->epfd, op, fd, &ev);
+    }
+    w->registered = res == 0;
+    return res == 0;
+}
+
+// Hands the task to the poller until its input is readable. Tasks parked
+// on the same descriptor wait together, and are woken together. The task
+// may run again on another worker before this returns
+static bool park(sched_t *s, task_t *t) {
+    int fd = t->m->in.fd;
+    pthread_mutex_lock(&s->lock);
+    watch_t *w = watch_for(s, fd);
+    // The descriptor is armed for as long as anyone waits for it
+    bool ok = w != NULL && (w->waiters != NULL || arm(s, fd, w));
+    if (ok) {
+        t->next = w->waiters;
+        w->waiters = t;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return ok;
+}
+
+static void *poller_main(void *arg) {
+    sched_t *s = arg;
+    struct epoll_event evs[MAX_EVENTS];
+    while (true) {
+        int n = epoll_wait(s->epfd, evs, MAX_EVENTS, -1);
+        if (n < 0 && errno != EINTR)
+            return NULL;
+        for (int i = 0; i < n; i++) {
+            int fd = evs[i].data.fd;
+            if (fd == s->wake[0])
+                return NULL;
+            // Taken off the watch first, as queueing may take the lock
+            pthread_mutex_lock(&s->lock);
+            task_t *t = s->watches[fd].waiters;
+            s->watches[fd].waiters = NULL;
+            pthread_mutex_unlock(&s->lock);
+            while (t != NULL) {
+                task_t *next = t->next;
+                enqueue_anywhere(s, t);
+                t = next;
+            }
+        }
+    }
+}
+
+static bool poller_init(sched_t *s) {
+    s->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (s->epfd < 0)
+        return false;
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = s->wake[0];
+    return epoll_ctl(s->epfd, EPOLL_CTL_ADD, s->wake[0], &ev) == 0;
+}
+
+static void poller_free(sched_t *s) {
+    if (s->epfd >= 0)
+        close(s->epfd);
+    free(s->watches);
+}
+
+#else
+
+static bool park(sched_t *s, task_t *t) {
+    pthread_mutex_lock(&s->lock);
+    if (s->num_parked == s->parked_capacity) {
+        size_t capacity = s->parked_capacity ? s->parked_capacity * 2 : 64;
+        task_t **parked = realloc(s->parked, sizeof(task_t *) * capacity);
+        if (parked == NULL) {
+            pthread_mutex_unlock(&s->lock);
+            return false;
+        }
+        s->parked = parked;
+        s->parked_capacity = capacity;
+    }
+    s->parked[s->num_parked++] = t;
+    pthread_mutex_unlock(&s->lock);
+    // Have the poller pick up the new descriptor
+    wake_poller(s);
+    return true;
+}
+
+static void *poller_main(void *arg) {
+    sched_t *s = arg;
+    struct pollfd *fds = NULL;
+    while (!atomic_load(&s->stopping)) {
+        pthread_mutex_lock(&s->lock);
+        size_t n = s->num_parked;
+        struct pollfd *more = realloc(fds, sizeof(struct pollfd) * (n + 1));
+        if (more == NULL) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        fds = more;
+        fds[0] = (struct pollfd) { s->wake[0], POLLIN, 0 };
+        for (size_t i = 0; i < n; i++)
+            fds[i + 1] = (struct pollfd) { s->parked[i]->m->in.fd, POLLIN, 0 };
+        pthread_mutex_unlock(&s->lock);
+        if (poll(fds, n + 1, -1) < 0 && errno != EINTR)
+            break;
+        if (fds[0].revents != 0) {
+            char buf[64];
+            while (read(s->wake[0], buf, sizeof(buf)) > 0);
+        }
+        // Only this thread removes tasks, so the first n are the polled ones
+        pthread_mutex_lock(&s->lock);
+        for (size_t i = n; i-- > 0;) {
+            if (fds[i + 1].revents == 0)
+                continue;
+            task_t *t = s->parked[i];
+            s->parked[i] = s->parked[--s->num_parked];
+            enqueue_anywhere(s, t);
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    free(fds);
+    return NULL;
+}
+
+static bool poller_init(sched_t *s) {
+    // Drained after every wakeup, so it must not block
+    return fcntl(s->wake[0], F_SETFL, O_NONBLOCK) == 0;
+}
+
+static void poller_free(sched_t *s) {
+    free(s->parked);
+}
+
+#endif
+
+static void finish(sched_t *s, task_t *t) {
+    pthread_mutex_lock(&s->lock);
+    if (t->prev_all != NULL)
+        t->prev_all->next_all = t->next_all;
+    else
+        s->all = t->next_all;
+    if (t->next_all != NULL)
+        t->next_all->prev_all = t->prev_all;
+    pthread_mutex_unlock(&s->lock);
+    atomic_fetch_add(&s->finished, 1);
+    if (t->done != NULL)
+        t->done(t->m, t->arg);
+    free(t);
+    // Only counted out once done() returned, for sched_wait()
+    pthread_mutex_lock(&s->lock);
+    if (--s->live == 0)
+        pthread_cond_broadcast(&s->idle);
+    pthread_mutex_unlock(&s->lock);
+}
+
+static void *worker_main(void *arg) {
+    worker_t *w = arg;
+    sched_t *s = w->s;
+    task_t *t;
+    while ((t = next_task(s, w->id)) != NULL) {
+        ijvm_status_t res = ijvm_run_for(t->m, s->slice);
+        atomic_fetch_add(&s->slices, 1);
+        if (res == IJVM_HALTED) {
+            finish(s, t);
+        } else if (res == IJVM_BLOCKED && park(s, t)) {
+            atomic_fetch_add(&s->parks, 1);
+        } else {
+            // Out of fuel, or blocked on something the poller can't
+            // watch: back of the line
+            enqueue(s, w->id, t);
+        }
+    }
+    log("sched: worker %d stopped\n", w->id);
+    return NULL;
+}
+
+// Stops the first `started` workers, once the queues run dry
+static void stop_workers(sched_t *s, int started) {
+    pthread_mutex_lock(&s->lock);
+    atomic_store(&s->stopping, true);
+    pthread_cond_broadcast(&s->work);
+    pthread_mutex_unlock(&s->lock);
+    for (int i = 0; i < started; i++)
+        pthread_join(s->threads[i], NULL);
+}
+
+// Frees a scheduler whose threads have all stopped
+static void sched_free(sched_t *s) {
+    // What is left is queued or parked, and handed back as it is
+    while (s->all != NULL) {
+        task_t *t = s->all;
+        s->all = t->next_all;
+        free(t);
+    }
+    for (int i = 0; i < s->num_workers; i++)
+        pthread_mutex_destroy(&s->queues[i].lock);
+    poller_free(s);
+    close(s->wake[0]);
+    close(s->wake[1]);
+    pthread_cond_destroy(&s->work);
+    pthread_cond_destroy(&s->idle);
+    pthread_mutex_destroy(&s->lock);
+    free(s->queues);
+    free(s->workers);
+    free(s->threads);
+    free(s);
+}
+
+sched_t *sched_create(int num_workers, uint64_t slice) {
+    if (num_workers <= 0)
+        num_workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_workers <= 0)
+        num_workers = 1;
+    sched_t *s = calloc(1, sizeof(sched_t));
+    if (s == NULL)
+        return NULL;
+    s->num_workers = num_workers;
+    s->slice = slice ? slice : SCHED_DEFAULT_SLICE;
+    s->wake[0] = s->wake[1] = -1;
+#ifdef __linux__
+    s->epfd = -1;
+#endif
+    s->queues = calloc(num_workers, sizeof(queue_t));
+    s->workers = calloc(num_workers, sizeof(worker_t));
+    s->threads = calloc(num_workers, sizeof(pthread_t));
+    if (s->queues == NULL || s->workers == NULL || s->threads == NULL
+        || pipe(s->wake) < 0 || !poller_init(s)) {
+        poller_free(s);
+        if (s->wake[0] >= 0) {
+            close(s->wake[0]);
+            close(s->wake[1]);
+        }
+        free(s->queues);
+        free(s->workers);
+        free(s->threads);
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->work, NULL);
+    pthread_cond_init(&s->idle, NULL);
+    // Workers steal from each other's queues right away
+    for (int i = 0; i < num_workers; i++) {
+        pthread_mutex_init(&s->queues[i].lock, NULL);
+        s->workers[i].s = s;
+        s->workers[i].id = i;
+    }
+    int started = 0;
+    while (started < num_workers
+           && pthread_create(&s->threads[started], NULL, worker_main, &s->workers[started]) == 0)
+        started++;
+    if (started < num_workers || pthread_create(&s->poller, NULL, poller_main, s) != 0) {
+        stop_workers(s, started);
+        sched_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int sched_submit(sched_t *s, ijvm_t *m, sched_done_t done, void *arg) {
+    task_t *t = calloc(1, sizeof(task_t));
+    if (t == NULL)
+        return -1;
+    t->m = m;
+    t->done = done;
+    t->arg = arg;
+    pthread_mutex_lock(&s->lock);
+    t->next_all = s->all;
+    if (s->all != NULL)
+        s->all->prev_all = t;
+    s->all = t;
+    s->live++;
+    pthread_mutex_unlock(&s->lock);
+    enqueue_anywhere(s, t);
+    return 0;
+}
+
+void sched_wait(sched_t *s) {
+    pthread_mutex_lock(&s->lock);
+    while (s->live > 0)
+        pthread_cond_wait(&s->idle, &s->lock);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void sched_get_stats(sched_t *s, sched_stats_t *stats) {
+    stats->slices = atomic_load(&s->slices);
+    stats->parks = atomic_load(&s->parks);
+    stats->steals = atomic_load(&s->steals);
+    stats->finished = atomic_load(&s->finished);
+}
+
+void sched_destroy(sched_t *s) {
+    if (s == NULL)
+        return;
+    stop_workers(s, s->num_workers);
+    wake_poller(s);
+    pthread_join(s->poller, NULL);
+    sched_free(s);
+}
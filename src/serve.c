@@ -0,0 +1,286 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "machine.h"
+#include "net.h"
+#include "serve.h"
+#include "util.h"
+
+// A worker that fails sooner than this after starting counts as crash-looping
+#define FAST_FAILURE_NS 100000000L
+// How long to hold off restarting a crash-looping worker, or retrying a
+// fork() that failed
+#define RESTART_DELAY_NS 500000000L
+// How long a worker holds off rerunning a program that ended in ERR, doubled
+// for every further run in a row that does, up to the maximum
+#define ERROR_DELAY_NS 10000000L
+#define ERROR_DELAY_MAX_NS 1000000000L
+
+typedef struct worker {
+    pid_t pid; // -1 while waiting to be started again
+    struct timespec started; // Or when it was found to be gone
+} worker_t;
+
+static volatile sig_atomic_t stopping;
+static volatile sig_atomic_t report_requested;
+// Written to by the signal handlers, so that poll() never misses a signal
+// that came just before it
+static int wake_fds[2] = { -1, -1 };
+
+static void wake(void) {
+    int saved = errno;
+    while (write(wake_fds[1], "", 1) < 0 && errno == EINTR);
+    errno = saved;
+}
+
+static void on_stop(int sig) {
+    (void) sig;
+    stopping = 1;
+    wake();
+}
+
+static void on_report(int sig) {
+    (void) sig;
+    report_requested = 1;
+    wake();
+}
+
+static void on_child(int sig) {
+    (void) sig;
+    wake();
+}
+
+static long elapsed_ns(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000000L + (now.tv_nsec - since->tv_nsec);
+}
+
+static void send_report(int fd, const serve_stats_t *report) {
+    // A report is smaller than PIPE_BUF, so it arrives whole
+    while (write(fd, report, sizeof(*report)) < 0 && errno == EINTR);
+}
+
+// Whether the run stopped at an ERR, or at an instruction it doesn't know,
+// rather than at HALT or the end of the text
+static bool ended_in_error(ijvm_t *m) {
+    return m->pc < m->text_size && m->text[m->pc] != OP_HALT;
+}
+
+static void worker_main(ijvm_program_t *p, int report_fd) {
+    ijvm_t *m = ijvm_create();
+    if (m == NULL)
+        _exit(1);
+    // Set before loading, so the port stays bound from one run to the next
+    ijvm_set_reuseport(m, true);
+    long error_delay = 0;
+    // Runs until the server stops it
+    while (ijvm_load_program(m, p) == 0) {
+        serve_stats_t report;
+        memset(&report, 0, sizeof(report));
+        uint64_t before = m->metrics.counts.instructions;
+        ijvm_run(m);
+        report.instructions = m->metrics.counts.instructions - before;
+        if (m->net != NULL) {
+            report.connections = m->net->connections;
+            report.bytes_in = m->net->bytes_in;
+            report.bytes_out = m->net->bytes_out;
+        }
+        report.runs = 1;
+        report.errors = ended_in_error(m);
+        fflush(stdout);
+        send_report(report_fd, &report);
+        // A program that fails, say because its port is taken, would
+        // otherwise be rerun as fast as it fails
+        if (!report.errors) {
+            error_delay = 0;
+            continue;
+        }
+        error_delay = error_delay == 0 ? ERROR_DELAY_NS : error_delay * 2;
+        if (error_delay > ERROR_DELAY_MAX_NS)
+            error_delay = ERROR_DELAY_MAX_NS;
+        struct timespec delay = { error_delay / 1000000000L, error_delay % 1000000000L };
+        while (nanosleep(&delay, &delay) < 0 && errno == EINTR);
+    }
+    ijvm_destroy(m);
+    _exit(1);
+}
+
+static pid_t start_worker(ijvm_program_t *p, int report_fds[2], worker_t *w) {
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGUSR1, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        close(wake_fds[0]);
+        close(wake_fds[1]);
+        close(report_fds[0]);
+        worker_main(p, report_fds[1]);
+    }
+    w->pid = pid < 0 ? -1 : pid;
+    clock_gettime(CLOCK_MONOTONIC, &w->started);
+    if (pid < 0)
+        log("serve: fork failed, retrying in a while\n");
+    else
+        log("serve: started worker %d\n", (int) pid);
+    return pid;
+}
+
+static void collect_reports(int fd, serve_stats_t *total) {
+    serve_stats_t report;
+    while (read(fd, &report, sizeof(report)) == sizeof(report)) {
+        total->runs += report.runs;
+        total->errors += report.errors;
+        total->instructions += report.instructions;
+        total->connections += report.connections;
+        total->bytes_in += report.bytes_in;
+        total->bytes_out += report.bytes_out;
+    }
+}
+
+void serve_stats_print(const serve_stats_t *stats, FILE *fp) {
+    fprintf(fp, "serve: %llu runs (%llu failed, %llu in ERR), %llu instructions, %llu connections, "
+                "%llu bytes in, %llu bytes out\n",
+            (unsigned long long) stats->runs, (unsigned long long) stats->failures,
+            (unsigned long long) stats->errors,
+            (unsigned long long) stats->instructions, (unsigned long long) stats->connections,
+            (unsigned long long) stats->bytes_in, (unsigned long long) stats->bytes_out);
+    fflush(fp);
+}
+
+// Starts the workers that are due, after their delay. Returns the time in
+// ms until the next one is, or -1 when none is waiting
+static int start_due_workers(ijvm_program_t *p, int report_fds[2], worker_t *workers, int num_workers,
+                             serve_stats_t *total) {
+    long next = -1;
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i].pid > 0)
+            continue;
+        long left = RESTART_DELAY_NS - elapsed_ns(&workers[i].started);
+        if (left <= 0 && start_worker(p, report_fds, &workers[i]) < 0) {
+            total->failures++;
+            left = RESTART_DELAY_NS;
+        }
+        if (left > 0 && (next < 0 || left < next))
+            next = left;
+    }
+    return next < 0 ? -1 : (int) (next / 1000000L) + 1;
+}
+
+// Reaps the workers that ended and replaces them, or leaves the ones that
+// died right after starting to start_due_workers()
+static void reap_workers(ijvm_program_t *p, int report_fds[2], worker_t *workers, int num_workers,
+                         serve_stats_t *total) {
+    pid_t pid;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        int i = 0;
+        while (i < num_workers && workers[i].pid != pid)
+            i++;
+        if (i == num_workers)
+            continue;
+        // Workers only end by crashing, which takes the run along
+        total->runs++;
+        total->failures++;
+        // Don't spin on a worker that dies as soon as it starts
+        if (elapsed_ns(&workers[i].started) < FAST_FAILURE_NS) {
+            workers[i].pid = -1;
+            clock_gettime(CLOCK_MONOTONIC, &workers[i].started);
+        } else if (start_worker(p, report_fds, &workers[i]) < 0) {
+            total->failures++;
+        }
+    }
+}
+
+int ijvm_serve(const char *binary_file, int num_workers, FILE *report) {
+    ijvm_program_t *p = ijvm_program_load(binary_file);
+    int fds[2];
+    if (p == NULL || num_workers <= 0 || pipe(fds) < 0) {
+        ijvm_program_release(p);
+        return -1;
+    }
+    worker_t *workers = calloc(num_workers, sizeof(worker_t));
+    if (workers == NULL || pipe(wake_fds) < 0) {
+        free(workers);
+        close(fds[0]);
+        close(fds[1]);
+        ijvm_program_release(p);
+        return -1;
+    }
+    // The parent drains the reports as they come, the workers may block
+    // on a full pipe until it does
+    fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    for (int i = 0; i < 2; i++)
+        fcntl(wake_fds[i], F_SETFL, fcntl(wake_fds[i], F_GETFL) | O_NONBLOCK);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    sa.sa_handler = on_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = on_report;
+    sigaction(SIGUSR1, &sa, NULL);
+    sa.sa_handler = on_child;
+    sigaction(SIGCHLD, &sa, NULL);
+
+    serve_stats_t total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < num_workers; i++) {
+        if (start_worker(p, fds, &workers[i]) < 0)
+            total.failures++;
+    }
+
+    while (!stopping) {
+        struct pollfd pfds[2] = {
+            { .fd = fds[0], .events = POLLIN },
+            { .fd = wake_fds[0], .events = POLLIN },
+        };
+        int timeout = start_due_workers(p, fds, workers, num_workers, &total);
+        if (poll(pfds, 2, timeout) < 0 && errno != EINTR)
+            break;
+        char drained[64];
+        while (read(wake_fds[0], drained, sizeof(drained)) > 0);
+        collect_reports(fds[0], &total);
+        reap_workers(p, fds, workers, num_workers, &total);
+        if (report_requested) {
+            report_requested = 0;
+            serve_stats_print(&total, report);
+        }
+    }
+
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i].pid > 0)
+            kill(workers[i].pid, SIGTERM);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        if (workers[i].pid > 0)
+            while (waitpid(workers[i].pid, NULL, 0) < 0 && errno == EINTR);
+    }
+    collect_reports(fds[0], &total);
+    serve_stats_print(&total, report);
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGUSR1, SIG_DFL);
+    signal(SIGCHLD, SIG_DFL);
+    stopping = 0;
+    close(fds[0]);
+    close(fds[1]);
+    close(wake_fds[0]);
+    close(wake_fds[1]);
+    wake_fds[0] = wake_fds[1] = -1;
+    free(workers);
+    ijvm_program_release(p);
+    return 0;
+}
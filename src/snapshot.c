@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "machine.h"
+#include "fiber.h"
+#include "heap.h"
+#include "net.h"
+#include "snapshot.h"
+
+struct snapshot {
+    program_t *program;
+    uint32_t pc;
+    size_t sp; // Offset of sp from the stack base
+    size_t lv; // Offset of lv from the stack base
+    io_in_t in; // Owns its copy of the pending input
+    io_out_t out;
+    bool halted;
+    bool wide_index;
+    int fd;        // Memory file holding the stack image, -1 if unavailable
+    word_t *words; // Copy of the used stack when there is no memory file
+};
+
+bool ijvm_run_until(ijvm_t *m, uint32_t pc) {
+    while (m->pc != pc) {
+        if (!machine_step(m)) {
+            io_flush(&m->out);
+            return false;
+        }
+    }
+    io_flush(&m->out);
+    return true;
+}
+
+static int stack_file(const word_t *stack, size_t used) {
+#ifdef __linux__
+    int fd = memfd_create("ijvm-snapshot", MFD_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    // Pages past the used part stay holes and read back as zeros
+    if (ftruncate(fd, STACK_BYTES) < 0
+        || write(fd, stack, used * sizeof(word_t)) != (ssize_t) (used * sizeof(word_t))) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#else
+    (void) stack;
+    (void) used;
+    return -1;
+#endif
+}
+
+ijvm_snapshot_t *ijvm_snapshot(ijvm_t *m) {
+    if (m->program == NULL || m->fibers != NULL || m->heap != NULL)
+        return NULL;
+    ijvm_snapshot_t *s = calloc(1, sizeof(ijvm_snapshot_t));
+    if (s == NULL)
+        return NULL;
+    s->program = ijvm_program_retain(m->program);
+    s->pc = m->pc;
+    s->sp = m->sp - m->stack;
+    s->lv = m->lv - m->stack;
+    s->halted = m->halted;
+    s->wide_index = m->wide_index;
+    // Everything up to and including the top of stack
+    size_t used = s->sp + 1;
+    s->fd = stack_file(m->stack, used);
+    if (s->fd < 0) {
+        s->words = malloc(used * sizeof(word_t));
+        if (s->words == NULL) {
+            ijvm_snapshot_free(s);
+            return NULL;
+        }
+        memcpy(s->words, m->stack, used * sizeof(word_t));
+    }
+    io_flush(&m->out);
+    io_out_copy(&s->out, &m->out);
+    if (io_in_copy(&s->in, &m->in) < 0) {
+        ijvm_snapshot_free(s);
+        return NULL;
+    }
+    return s;
+}
+
+int ijvm_restore_snapshot(ijvm_t *m, ijvm_snapshot_t *s) {
+    // Drop what the snapshot didn't have, as loading a program does; this
+    // also puts the machine back on its own stack if a fiber was running
+    fibers_free(m);
+    heap_free(m);
+    if (m->reuseport)
+        net_reset(m);
+    else
+        net_free(m);
+    if (s->fd >= 0) {
+        // Map the image copy-on-write over the old stack, or anywhere
+        // if there is none yet
+        int flags = MAP_PRIVATE | (m->stack != NULL ? MAP_FIXED : 0);
+        void *stack = mmap(m->stack, STACK_BYTES, PROT_READ | PROT_WRITE, flags, s->fd, 0);
+        if (stack == MAP_FAILED)
+            return -1;
+        m->stack = stack;
+    } else {
+        if (m->stack == NULL)
+            m->stack = stack_alloc();
+        if (m->stack == NULL)
+            return -1;
+        memcpy(m->stack, s->words, (s->sp + 1) * sizeof(word_t));
+    }
+    program_t *old = m->program;
+    m->program = ijvm_program_retain(s->program);
+    ijvm_program_release(old);
+    m->text = s->program->text;
+    m->text_size = s->program->text_size;
+    m->cpp = s->program->cpp;
+    m->cp_size = s->program->cp_size;
+    m->pc = s->pc;
+    m->sp = m->stack + s->sp;
+    m->lv = m->stack + s->lv;
+    io_in_free(&m->in);
+    if (io_in_copy(&m->in, &s->in) < 0)
+        return -1;
+    io_out_free(&m->out);
+    io_out_copy(&m->out, &s->out);
+    m->halted = s->halted;
+    m->wide_index = s->wide_index;
+    return 0;
+}
+
+ijvm_t *ijvm_clone(ijvm_snapshot_t *s) {
+    ijvm_t *m = ijvm_create();
+    if (m != NULL && ijvm_restore_snapshot(m, s) < 0) {
+        ijvm_destroy(m);
+        return NULL;
+    }
+    return m;
+}
+
+void ijvm_snapshot_free(ijvm_snapshot_t *s) {
+    if (s == NULL)
+        return;
+    if (s->fd >= 0)
+        close(s->fd);
+    free(s->words);
+    io_in_free(&s->in);
+    ijvm_program_release(s->program);
+    free(s);
+}
@@ -0,0 +1,190 @@
+#define _DEFAULT_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+#include "opstats.h"
+
+struct trace {
+    trace_header_t *header; // Start of the mapping
+    trace_record_t *records;
+    uint64_t mask;
+    size_t size;
+    trace_record_t *current; // Between trace_begin() and trace_end()
+};
+
+int ijvm_trace_enable(ijvm_t *m, const char *path, uint64_t records, bool cycles) {
+    uint64_t capacity = 1;
+    if (records == 0)
+        records = TRACE_DEFAULT_RECORDS;
+    while (capacity < records)
+        capacity *= 2;
+    trace_t *t = calloc(1, sizeof(trace_t));
+    if (t == NULL)
+        return -1;
+    t->size = sizeof(trace_header_t) + capacity * sizeof(trace_record_t);
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    void *map = MAP_FAILED;
+    // Sized up front, so pages are only backed once written
+    if (fd >= 0 && ftruncate(fd, (off_t) t->size) == 0)
+        map = mmap(NULL, t->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (fd >= 0)
+        close(fd);
+    if (map == MAP_FAILED) {
+        free(t);
+        return -1;
+    }
+    t->header = map;
+    t->records = (trace_record_t *) (t->header + 1);
+    t->mask = capacity - 1;
+    memcpy(t->header->magic, TRACE_MAGIC, sizeof(t->header->magic));
+    t->header->version = TRACE_VERSION;
+    t->header->record_size = sizeof(trace_record_t);
+    t->header->capacity = capacity;
+    t->header->cycles = cycles;
+    ijvm_trace_disable(m);
+    m->trace = t;
+    return 0;
+}
+
+void ijvm_trace_disable(ijvm_t *m) {
+    trace_t *t = m->trace;
+    if (t == NULL)
+        return;
+    munmap(t->header, t->size);
+    free(t);
+    m->trace = NULL;
+}
+
+void trace_begin(machine_t *m) {
+    trace_t *t = m->trace;
+    trace_record_t *r = &t->records[t->header->head & t->mask];
+    r->cycles = t->header->cycles ? opstats_clock() : 0;
+    r->pc = m->pc;
+    // Whole words of text are cheaper to copy than to measure the
+    // instruction first; the decoder knows where it ends
+    if (m->pc + TRACE_CODE <= m->text_size) {
+        memcpy(r->code, m->text + m->pc, TRACE_CODE);
+        r->length = TRACE_CODE;
+    } else {
+        r->length = m->pc < m->text_size ? m->text_size - m->pc : 0;
+        memcpy(r->code, m->text + m->pc, r->length);
+    }
+    t->current = r;
+}
+
+void trace_end(machine_t *m) {
+    trace_t *t = m->trace;
+    trace_record_t *r = t->current;
+    bool stack = m->stack != NULL && m->sp >= m->stack;
+    r->depth = stack ? (uint32_t) (m->sp - m->stack) : 0;
+    r->tos = stack ? *m->sp : 0;
+    // Publish the record only once it is complete
+    __atomic_store_n(&t->header->head, t->header->head + 1, __ATOMIC_RELEASE);
+}
+
+static int16_t short_at(const byte_t *code) {
+    return (int16_t) (code[0] << 8 | code[1]);
+}
+
+// Formats the record the way execute() in machine.c logs it
+static void format_record(const trace_record_t *r, char *buf, size_t size) {
+    const byte_t *c = r->code;
+    const char *wide = "";
+    if (r->length == 0) {
+        snprintf(buf, size, "Unknown Instruction");
+        return;
+    }
+    uint32_t length = instruction_size(r->code, r->length, 0);
+    if (length > r->length)
+        length = r->length;
+    if (c[0] == OP_WIDE && length > 1) {
+        wide = "WIDE ";
+        c++;
+        length--;
+    }
+    // Operands that weren't recorded, at the end of the text, read as 0
+    byte_t code[TRACE_CODE + 2];
+    memset(code, 0, sizeof(code));
+    memcpy(code, c, length);
+    bool widened = *wide != '\0';
+    switch (code[0]) {
+        case OP_BIPUSH:
+            snprintf(buf, size, "BIPUSH %d", (int8_t) code[1]);
+            break;
+        case OP_GOTO:
+            snprintf(buf, size, "GOTO %d", short_at(code + 1));
+            break;
+        case OP_IFEQ:
+            snprintf(buf, size, "IFEQ %d", short_at(code + 1));
+            break;
+        case OP_IFLT:
+            snprintf(buf, size, "IFLT %d", short_at(code + 1));
+            break;
+        case OP_ICMPEQ:
+            snprintf(buf, size, "ICMPEQ %d", short_at(code + 1));
+            break;
+        case OP_LDC_W:
+            snprintf(buf, size, "LDC_W %d", (uint16_t) short_at(code + 1));
+            break;
+        case OP_ISTORE:
+        case OP_ILOAD:
+            snprintf(buf, size, "%s%s %d", wide, code[0] == OP_ILOAD ? "ILOAD" : "ISTORE",
+                     widened ? (uint16_t) short_at(code + 1) : code[1]);
+            break;
+        case OP_IINC:
+            snprintf(buf, size, "%sIINC %d %d", wide, code[1], (int8_t) code[2]);
+            break;
+        case OP_INVOKEVIRTUAL:
+            snprintf(buf, size, "INVOKEVIRTUAL %d", (uint16_t) short_at(code + 1));
+            break;
+        case OP_SPAWN:
+            snprintf(buf, size, "SPAWN %d", (uint16_t) short_at(code + 1));
+            break;
+        default: {
+            const char *name = opcode_name(code[0]);
+            snprintf(buf, size, "%s%s", wide, name != NULL ? name : "Unknown Instruction");
+            break;
+        }
+    }
+}
+
+int ijvm_trace_decode(const char *path, FILE *f, uint64_t last) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    trace_header_t h;
+    bool ok = fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) == (ssize_t) sizeof(h)
+              && memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) == 0
+              && h.version == TRACE_VERSION && h.record_size == sizeof(trace_record_t)
+              && h.capacity != 0 && (h.capacity & (h.capacity - 1)) == 0
+              && h.capacity <= ((uint64_t) st.st_size - sizeof(h)) / sizeof(trace_record_t);
+    void *map = MAP_FAILED;
+    size_t size = sizeof(h) + (ok ? h.capacity : 0) * sizeof(trace_record_t);
+    if (ok)
+        map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    const trace_record_t *records = (const trace_record_t *) ((const trace_header_t *) map + 1);
+    uint64_t head = ((const trace_header_t *) map)->head;
+    uint64_t kept = head < h.capacity ? head : h.capacity;
+    if (last == 0 || last > kept)
+        last = kept;
+    for (uint64_t i = head - last; i < head; i++) {
+        const trace_record_t *r = &records[i & (h.capacity - 1)];
+        char line[64];
+        format_record(r, line, sizeof(line));
+        fprintf(f, "%10llu  0x%04x  %-24s tos=%d depth=%u", (unsigned long long) i, r->pc, line,
+                r->tos, r->depth);
+        if (h.cycles)
+            fprintf(f, " cycles=%llu", (unsigned long long) r->cycles);
+        fputc('\n', f);
+    }
+    munmap(map, size);
+    return 0;
+}
@@ -0,0 +1,14 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include "fuzz.h"
+
+// libFuzzer target: the input is the choices a program is generated from,
+// and any program the engines disagree on is a crash
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (fuzz_check(data, size) > FUZZ_STEP)
+        abort();
+    return 0;
+}
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "testutil.h"
+
+#define NUM_JOBS 64
+
+static void read_output(const char *path, char *buf, size_t size)
+{
+    FILE *fp = fopen(path, "rb");
+    size_t n = fp ? fread(buf, 1, size - 1, fp) : 0;
+    buf[n] = '\0';
+    if (fp)
+        fclose(fp);
+}
+
+void test_batch_jobs()
+{
+    batch_job_t jobs[NUM_JOBS];
+    char outputs[NUM_JOBS][32];
+    for (int i = 0; i < NUM_JOBS; i++) {
+        sprintf(outputs[i], "tmp_batch_%d", i);
+        jobs[i].program = i % 2 ? "files/task1/program1.ijvm" : "files/task3/GOTO1.ijvm";
+        jobs[i].input = "-";
+        jobs[i].output = outputs[i];
+    }
+
+    assert(batch_run(jobs, NUM_JOBS, 4) == 0);
+
+    for (int i = 0; i < NUM_JOBS; i++) {
+        char buf[16];
+        assert(jobs[i].status == 0);
+        read_output(outputs[i], buf, sizeof(buf));
+        assert(strcmp(buf, i % 2 ? "a" : "13") == 0);
+        remove(outputs[i]);
+    }
+}
+
+void test_batch_failures()
+{
+    batch_job_t jobs[3] = {
+        { "files/task1/program1.ijvm", NULL, "tmp_batch_ok", 0 },
+        { "files/does-not-exist.ijvm", NULL, "tmp_batch_missing", 0 },
+        { "files/task1/program1.ijvm", "files/does-not-exist.txt", "tmp_batch_noinput", 0 },
+    };
+
+    assert(batch_run(jobs, 3, 2) == 2);
+    assert(jobs[0].status == 0);
+    assert(jobs[1].status == -1);
+    assert(jobs[2].status == -1);
+    remove("tmp_batch_ok");
+    remove("tmp_batch_missing");
+    remove("tmp_batch_noinput");
+}
+
+void test_batch_manifest()
+{
+    FILE *fp = fopen("tmp_batch_manifest", "w");
+    fprintf(fp, "# program input output\n\n");
+    fprintf(fp, "files/task1/program1.ijvm - tmp_batch_m1\n");
+    fprintf(fp, "files/task3/GOTO1.ijvm\t-\ttmp_batch_m2\n");
+    fclose(fp);
+
+    assert(batch_run_manifest("tmp_batch_manifest", 0) == 0);
+    char buf[16];
+    read_output("tmp_batch_m1", buf, sizeof(buf));
+    assert(strcmp(buf, "a") == 0);
+    read_output("tmp_batch_m2", buf, sizeof(buf));
+    assert(strcmp(buf, "13") == 0);
+    assert(batch_run_manifest("tmp_batch_does_not_exist", 0) == -1);
+
+    remove("tmp_batch_manifest");
+    remove("tmp_batch_m1");
+    remove("tmp_batch_m2");
+}
+
+int main()
+{
+    RUN_TEST(test_batch_jobs);
+    RUN_TEST(test_batch_failures);
+    RUN_TEST(test_batch_manifest);
+    return END_TEST();
+}
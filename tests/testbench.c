@@ -0,0 +1,52 @@
+#include <stdio.h>
+#include <string.h>
+#include "bench.h"
+#include "testutil.h"
+
+#define TMP_BASELINE "tmp_bench.json"
+
+void test_bench_and_compare()
+{
+    bench_case_t cases[] = {
+        { "Tanenbaum", "files/advanced/Tanenbaum.ijvm", NULL },
+        { "missing", "files/advanced/missing.ijvm", NULL },
+    };
+    bench_result_t results[2 * BENCH_ENGINES];
+    assert(bench_run(cases, 2, 1, results) == BENCH_ENGINES);
+    for (int engine = 0; engine < BENCH_ENGINES; engine++) {
+        bench_result_t *r = &results[engine];
+        assert(r->status == 0);
+        assert(r->engine == (bench_engine_t) engine);
+        assert(r->instructions > 0 && r->runs > 0);
+        // Tanenbaum runs a few thousand instructions, so it is run again
+        assert(r->runs > 1);
+        assert(r->ns_per_instruction > 0);
+        assert(r->peak_rss_kb > 0);
+        // Where the task clock can be read it takes a while per instruction
+        assert(r->events[HWC_TASK_CLOCK] == -1 || r->events[HWC_TASK_CLOCK] > 0);
+        assert(results[BENCH_ENGINES + engine].status == -1);
+    }
+
+    FILE *fp = fopen(TMP_BASELINE, "w");
+    assert(fp != NULL);
+    bench_write_json(fp, results, 2 * BENCH_ENGINES);
+    fclose(fp);
+
+    // Against itself nothing regressed, against a twice as fast baseline
+    // everything did
+    FILE *null_out = fopen("/dev/null", "w");
+    assert(bench_report(null_out, results, 2 * BENCH_ENGINES, TMP_BASELINE, 10) == 0);
+    for (int engine = 0; engine < BENCH_ENGINES; engine++)
+        results[engine].ns_per_instruction *= 2;
+    assert(bench_report(null_out, results, 2 * BENCH_ENGINES, TMP_BASELINE, 10) == BENCH_ENGINES);
+    assert(bench_report(null_out, results, 2 * BENCH_ENGINES, "tmp_missing.json", 10) == -1);
+    assert(bench_report(null_out, results, 2 * BENCH_ENGINES, NULL, 10) == 0);
+    fclose(null_out);
+    remove(TMP_BASELINE);
+}
+
+int main()
+{
+    RUN_TEST(test_bench_and_compare);
+    return END_TEST();
+}
@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "libijvm.h"
+#include "checkpoint.h"
+#include "jas.h"
+#include "testutil.h"
+
+#define BFI_PATH    "files/bonus/bfi2.ijvm"
+#define HELLO_WORLD "files/bonus/brainfuck/hello_world.bf"
+#define CHECKPOINT  "tmp_checkpoint"
+#define EXPECTED    "Hello World!\n"
+#define ECHO_BINARY "tmp_checkpoint.ijvm"
+#define ECHO_INPUT  "tmp_checkpoint.in"
+#define ECHO_OUTPUT "tmp_checkpoint.out"
+
+// Echoes a byte, counts to 3000 * 3000 and echoes the next
+static const char echo_twice[] =
+    ".constant\nn 3000\n.end-constant\n"
+    ".main\n.var\ni\nj\n.end-var\n"
+    "IN\nOUT\n"
+    "LDC_W n\nISTORE i\n"
+    "outer: ILOAD i\nIFEQ done\n"
+    "LDC_W n\nISTORE j\n"
+    "inner: ILOAD j\nIFEQ next\nIINC j -1\nGOTO inner\n"
+    "next: IINC i -1\nGOTO outer\n"
+    "done: IN\nOUT\nHALT\n.end-main\n";
+
+static char program[4096];
+static size_t program_size;
+
+static void read_program()
+{
+    FILE *fp = fopen(HELLO_WORLD, "rb");
+    assert(fp != NULL);
+    program_size = fread(program, 1, sizeof(program), fp);
+    fclose(fp);
+}
+
+void test_resume_where_it_left_off()
+{
+    read_program();
+    char out[64];
+    memset(out, '\0', sizeof(out));
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, BFI_PATH) != -1);
+    ijvm_set_input_buffer(m, program, program_size);
+    ijvm_set_output_buffer(m, out, sizeof(out) - 1);
+
+    // Far enough in to have allocated the tape and printed a few letters
+    assert(ijvm_run_for(m, 12300) == IJVM_OUT_OF_FUEL);
+    assert(ijvm_checkpoint(m, CHECKPOINT) == 0);
+    int pc = ijvm_get_program_counter(m);
+    int size = ijvm_stack_size(m);
+    word_t tos = ijvm_tos(m);
+    size_t written = ijvm_output_size(m);
+    assert(written > 0 && written < strlen(EXPECTED));
+    assert(ijvm_run_for(m, UINT64_MAX) == IJVM_HALTED);
+    assert(strcmp(out, EXPECTED) == 0);
+    ijvm_destroy(m);
+
+    // Twice, as every restore gets a copy of its own
+    for (int i = 0; i < 2; i++) {
+        char resumed[64];
+        memset(resumed, 'x', sizeof(resumed));
+        memcpy(resumed, out, written);
+        resumed[sizeof(resumed) - 1] = '\0';
+        ijvm_t *r = ijvm_create();
+        assert(r != NULL);
+        ijvm_set_input_buffer(r, program, program_size);
+        ijvm_set_output_buffer(r, resumed, sizeof(resumed) - 1);
+        assert(ijvm_restore(r, CHECKPOINT) == 0);
+        assert(ijvm_get_program_counter(r) == pc);
+        assert(ijvm_stack_size(r) == size);
+        assert(ijvm_tos(r) == tos);
+        assert(ijvm_output_size(r) == written);
+        assert(ijvm_run_for(r, UINT64_MAX) == IJVM_HALTED);
+        assert(ijvm_output_size(r) == strlen(EXPECTED));
+        assert(memcmp(resumed, EXPECTED, strlen(EXPECTED)) == 0);
+        ijvm_destroy(r);
+    }
+    remove(CHECKPOINT);
+}
+
+void test_bad_checkpoint()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_restore(m, "no_such_checkpoint") == -1);
+    assert(ijvm_checkpoint(m, CHECKPOINT) == -1);
+
+    // Not a checkpoint, and the loaded program stays as it was
+    assert(ijvm_load(m, "files/task1/program1.ijvm") != -1);
+    assert(ijvm_restore(m, BFI_PATH) == -1);
+    assert(ijvm_get_program_counter(m) == 0);
+    assert(ijvm_run_for(m, UINT64_MAX) == IJVM_HALTED);
+
+    // Cut short
+    assert(ijvm_checkpoint(m, CHECKPOINT) == 0);
+    FILE *fp = fopen(CHECKPOINT, "r+");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    assert(ftruncate(fileno(fp), ftell(fp) / 2) == 0);
+    fclose(fp);
+    assert(ijvm_restore(m, CHECKPOINT) == -1);
+    ijvm_destroy(m);
+    remove(CHECKPOINT);
+}
+
+// Runs checkpoint_run() in a process of its own, on the standard streams
+// opened fresh from the files
+static pid_t start_echo(uint64_t interval)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        int in = open(ECHO_INPUT, O_RDONLY);
+        int out = open(ECHO_OUTPUT, O_WRONLY | O_CREAT, 0644);
+        if (in < 0 || out < 0 || dup2(in, 0) < 0 || dup2(out, 1) < 0)
+            _exit(2);
+        int res = checkpoint_run(ECHO_BINARY, CHECKPOINT, interval);
+        fflush(stdout);
+        _exit(res == 0 ? 0 : 1);
+    }
+    assert(pid > 0);
+    return pid;
+}
+
+void test_resume_after_kill()
+{
+    char error[JAS_ERROR_SIZE];
+    size_t size;
+    byte_t *image = jas_assemble(echo_twice, strlen(echo_twice), &size, error, sizeof(error));
+    assert(image != NULL);
+    FILE *fp = fopen(ECHO_BINARY, "wb");
+    assert(fwrite(image, 1, size, fp) == size);
+    fclose(fp);
+    free(image);
+    fp = fopen(ECHO_INPUT, "wb");
+    fputs("ab", fp);
+    fclose(fp);
+    remove(ECHO_OUTPUT);
+    remove(CHECKPOINT);
+
+    // Killed outright once it saved a checkpoint somewhere in the loop,
+    // which at a checkpoint every 1000 instructions takes a long while
+    pid_t pid = start_echo(1000);
+    for (int tries = 0; tries < 5000 && access(CHECKPOINT, F_OK) != 0; tries++)
+        usleep(1000);
+    assert(kill(pid, SIGKILL) == 0);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status));
+    assert(access(CHECKPOINT, F_OK) == 0);
+
+    // Picks up the input and output past the first byte
+    pid = start_echo(UINT64_MAX);
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    char out[8];
+    fp = fopen(ECHO_OUTPUT, "rb");
+    assert(fp != NULL);
+    size_t n = fread(out, 1, sizeof(out), fp);
+    fclose(fp);
+    assert(n == 2);
+    assert(memcmp(out, "ab", 2) == 0);
+    assert(access(CHECKPOINT, F_OK) != 0);
+
+    remove(ECHO_BINARY);
+    remove(ECHO_INPUT);
+    remove(ECHO_OUTPUT);
+    remove(CHECKPOINT ".tmp");
+}
+
+int main()
+{
+    RUN_TEST(test_resume_where_it_left_off);
+    RUN_TEST(test_bad_checkpoint);
+    RUN_TEST(test_resume_after_kill);
+    return END_TEST();
+}
@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <pthread.h>
+#include "libijvm.h"
+#include "testutil.h"
+
+#define NUM_THREADS 8
+#define VMS_PER_THREAD 16
+
+void test_independent_instances()
+{
+    ijvm_t *a = ijvm_create();
+    ijvm_t *b = ijvm_create();
+    assert(a != NULL && b != NULL);
+    assert(ijvm_load(a, "files/task2/TestBipush1.ijvm") != -1);
+    assert(ijvm_load(b, "files/task3/GOTO1.ijvm") != -1);
+
+    ijvm_step(a);
+    assert(ijvm_tos(a) == 42);
+    assert(ijvm_get_program_counter(b) == 0);
+    assert(ijvm_text_size(a) != ijvm_text_size(b));
+
+    ijvm_destroy(a);
+    ijvm_destroy(b);
+}
+
+void test_default_instance_shim()
+{
+    int res = init_ijvm("files/task2/TestBipush1.ijvm");
+    assert(res != -1);
+    step();
+    assert(ijvm_tos(ijvm_default()) == tos());
+    assert(ijvm_get_program_counter(ijvm_default()) == 2);
+    destroy_ijvm();
+}
+
+void test_reload()
+{
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, "files/task1/program1.ijvm") != -1);
+    assert(ijvm_text_size(m) == 7);
+    assert(ijvm_load(m, "files/task1/program2.ijvm") != -1);
+    assert(ijvm_text_size(m) == 16);
+    ijvm_destroy(m);
+}
+
+static void *run_many(void *arg)
+{
+    int *failures = arg;
+    for (int i = 0; i < VMS_PER_THREAD; i++) {
+        ijvm_t *m = ijvm_create();
+        FILE *out = fopen("/dev/null", "w");
+        if (ijvm_load(m, "files/advanced/Tanenbaum.ijvm") < 0) {
+            (*failures)++;
+        } else {
+            ijvm_set_output(m, out);
+            ijvm_run(m);
+            if (!ijvm_finished(m))
+                (*failures)++;
+        }
+        ijvm_destroy(m);
+        fclose(out);
+    }
+    return NULL;
+}
+
+void test_threads()
+{
+    pthread_t threads[NUM_THREADS];
+    int failures[NUM_THREADS] = {0};
+    for (int i = 0; i < NUM_THREADS; i++)
+        pthread_create(&threads[i], NULL, run_many, &failures[i]);
+    for (int i = 0; i < NUM_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+        assert(failures[i] == 0);
+    }
+}
+
+int main()
+{
+    RUN_TEST(test_independent_instances);
+    RUN_TEST(test_default_instance_shim);
+    RUN_TEST(test_reload);
+    RUN_TEST(test_threads);
+    return END_TEST();
+}
@@ -0,0 +1,195 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "libijvm.h"
+#include "testutil.h"
+
+#define CACHE_DIR "tmp_diskcache"
+#define TMP_SOURCE "tmp_diskcache.jas"
+
+static char cache_file[512];
+
+// Counts the files in the cache directory, leaving the name of the last
+static int cached_files()
+{
+    DIR *dir = opendir(CACHE_DIR);
+    if (dir == NULL)
+        return 0;
+    int count = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(cache_file, sizeof(cache_file), "%s/%s", CACHE_DIR, e->d_name);
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static void clear_cache()
+{
+    while (cached_files() > 0)
+        remove(cache_file);
+    rmdir(CACHE_DIR);
+}
+
+static ino_t cache_inode()
+{
+    struct stat st;
+    assert(stat(cache_file, &st) == 0);
+    return st.st_ino;
+}
+
+// Runs the binary and returns its output, which the caller frees
+static char *run_binary(const char *binary)
+{
+    char *out = calloc(1, 0x10000);
+    assert(out != NULL);
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, binary) != -1);
+    ijvm_set_output_buffer(m, out, 0x10000 - 1);
+    assert(ijvm_run_for(m, UINT64_MAX) == IJVM_HALTED);
+    ijvm_destroy(m);
+    return out;
+}
+
+static void check_source(const char *source, const char *binary)
+{
+    clear_cache();
+    ijvm_set_cache_dir(NULL);
+    char *expected = run_binary(binary);
+
+    ijvm_set_cache_dir(CACHE_DIR);
+    // Binaries are only ever mapped, there is nothing to keep of them
+    char *out = run_binary(binary);
+    free(out);
+    assert(cached_files() == 0);
+
+    // Assembled and stored
+    out = run_binary(source);
+    assert(strcmp(out, expected) == 0);
+    free(out);
+    assert(cached_files() == 1);
+    ino_t ino = cache_inode();
+
+    // Mapped, the file is left as it is
+    out = run_binary(source);
+    assert(strcmp(out, expected) == 0);
+    free(out);
+    assert(cached_files() == 1);
+    assert(cache_inode() == ino);
+
+    free(expected);
+    ijvm_set_cache_dir(NULL);
+}
+
+void test_cached_runs_match()
+{
+    check_source("files/advanced/test-wide2.jas", "files/advanced/test-wide2.ijvm");
+    check_source("files/advanced/Tanenbaum.jas", "files/advanced/Tanenbaum.ijvm");
+    check_source("files/task5/test-nestedinvoke-frame.jas", "files/task5/test-nestedinvoke-frame.ijvm");
+    clear_cache();
+}
+
+static void copy_file(const char *from, const char *to)
+{
+    FILE *in = fopen(from, "rb");
+    FILE *out = fopen(to, "wb");
+    assert(in != NULL && out != NULL);
+    int c;
+    while ((c = fgetc(in)) != EOF)
+        fputc(c, out);
+    fclose(in);
+    fclose(out);
+}
+
+void test_changed_source()
+{
+    clear_cache();
+    ijvm_set_cache_dir(NULL);
+    char *first = run_binary("files/task1/program1.ijvm");
+    char *second = run_binary("files/task1/program2.ijvm");
+
+    ijvm_set_cache_dir(CACHE_DIR);
+    copy_file("files/task1/program1.jas", TMP_SOURCE);
+    char *out = run_binary(TMP_SOURCE);
+    assert(strcmp(out, first) == 0);
+    free(out);
+    assert(cached_files() == 1);
+
+    // Rewritten in place, the source is assembled again
+    copy_file("files/task1/program2.jas", TMP_SOURCE);
+    out = run_binary(TMP_SOURCE);
+    assert(strcmp(out, second) == 0);
+    free(out);
+    assert(cached_files() == 2);
+
+    free(first);
+    free(second);
+    remove(TMP_SOURCE);
+    ijvm_set_cache_dir(NULL);
+    clear_cache();
+}
+
+void test_copied_source_shared()
+{
+    const char *source = "files/advanced/Tanenbaum.jas";
+    clear_cache();
+    ijvm_set_cache_dir(CACHE_DIR);
+    char *expected = run_binary(source);
+    assert(cached_files() == 1);
+    ino_t ino = cache_inode();
+
+    // Another file with the same text maps what the first stored
+    copy_file(source, TMP_SOURCE);
+    char *out = run_binary(TMP_SOURCE);
+    assert(strcmp(out, expected) == 0);
+    free(out);
+    assert(cached_files() == 1);
+    assert(cache_inode() == ino);
+
+    free(expected);
+    remove(TMP_SOURCE);
+    ijvm_set_cache_dir(NULL);
+    clear_cache();
+}
+
+void test_stale_binary_replaced()
+{
+    const char *source = "files/advanced/Tanenbaum.jas";
+    clear_cache();
+    ijvm_set_cache_dir(CACHE_DIR);
+    free(run_binary(source));
+    assert(cached_files() == 1);
+    ino_t ino = cache_inode();
+
+    // Pretend another assembler or engine version wrote it
+    FILE *fp = fopen(cache_file, "r+");
+    assert(fp != NULL);
+    fseek(fp, 12, SEEK_SET);
+    fputc(0xff, fp);
+    fclose(fp);
+
+    char *out = run_binary(source);
+    free(out);
+    assert(cached_files() == 1);
+    assert(cache_inode() != ino);
+
+    ijvm_set_cache_dir(NULL);
+    clear_cache();
+}
+
+int main()
+{
+    RUN_TEST(test_cached_runs_match);
+    RUN_TEST(test_changed_source);
+    RUN_TEST(test_copied_source_shared);
+    RUN_TEST(test_stale_binary_replaced);
+    return END_TEST();
+}
@@ -0,0 +1,153 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include "libijvm.h"
+#include "edgeprof.h"
+#include "opstats.h"
+#include "testutil.h"
+
+#define PROFILE_DIR "tmp_edgeprof"
+#define BINARY      "files/advanced/Tanenbaum.ijvm"
+
+static char profile_file[512];
+
+// Finds the single profile in the profile directory
+static int profile_files()
+{
+    DIR *dir = opendir(PROFILE_DIR);
+    if (dir == NULL)
+        return 0;
+    int count = 0;
+    struct dirent *e;
+    while ((e = readdir(dir)) != NULL) {
+        if (e->d_name[0] == '.')
+            continue;
+        snprintf(profile_file, sizeof(profile_file), "%s/%s", PROFILE_DIR, e->d_name);
+        count++;
+    }
+    closedir(dir);
+    return count;
+}
+
+static void clear_profiles()
+{
+    while (profile_files() > 0)
+        remove(profile_file);
+    rmdir(PROFILE_DIR);
+}
+
+// Runs the binary to the end, recording edges and counting opcodes
+static void record_run(uint64_t *entries, uint64_t *branches)
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, BINARY) != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    assert(ijvm_edges_enable(m) == 0);
+    assert(ijvm_stats_enable(m) == 0);
+    ijvm_run(m);
+    const opstats_t *s = ijvm_stats(m);
+    *branches = s->count[OP_IFEQ] + s->count[OP_IFLT] + s->count[OP_ICMPEQ];
+    // Every branch, jump, call and return enters a block, as does the start
+    *entries = 1 + *branches + s->count[OP_GOTO] + s->count[OP_INVOKEVIRTUAL] + s->count[OP_IRETURN];
+    assert(ijvm_edges_save(m) == 0);
+    // Saving starts over, so there is nothing to add when destroyed
+    ijvm_destroy(m);
+    fclose(null_out);
+}
+
+static void read_totals(uint64_t *entries, uint64_t *branches)
+{
+    FILE *fp = fopen(profile_file, "rb");
+    assert(fp != NULL);
+    edgeprof_header_t h;
+    assert(fread(&h, sizeof(h), 1, fp) == 1);
+    assert(memcmp(h.magic, EDGEPROF_MAGIC, 8) == 0);
+    *entries = *branches = 0;
+    uint64_t last = UINT64_MAX;
+    for (uint32_t i = 0; i < h.num_blocks; i++) {
+        edgeprof_block_t b;
+        assert(fread(&b, sizeof(b), 1, fp) == 1);
+        // Hottest first
+        assert(b.count <= last);
+        last = b.count;
+        *entries += b.count;
+    }
+    for (uint32_t i = 0; i < h.num_branches; i++) {
+        edgeprof_branch_t b;
+        assert(fread(&b, sizeof(b), 1, fp) == 1);
+        *branches += b.taken + b.not_taken;
+    }
+    fclose(fp);
+}
+
+void test_counts_add_up()
+{
+    clear_profiles();
+    ijvm_set_profile_dir(PROFILE_DIR);
+    uint64_t entries, branches;
+    record_run(&entries, &branches);
+    assert(branches > 0);
+    assert(profile_files() == 1);
+    uint64_t saved_entries, saved_branches;
+    read_totals(&saved_entries, &saved_branches);
+    assert(saved_entries == entries);
+    assert(saved_branches == branches);
+
+    // A second run adds to the same profile
+    record_run(&entries, &branches);
+    assert(profile_files() == 1);
+    read_totals(&saved_entries, &saved_branches);
+    assert(saved_entries == 2 * entries);
+    assert(saved_branches == 2 * branches);
+    ijvm_set_profile_dir(NULL);
+}
+
+void test_later_runs_read_it()
+{
+    clear_profiles();
+    ijvm_set_profile_dir(PROFILE_DIR);
+    uint64_t entries, branches;
+    record_run(&entries, &branches);
+
+    ijvm_program_t *p = ijvm_program_load(BINARY);
+    assert(p != NULL);
+    uint32_t pcs[4];
+    assert(ijvm_program_hot_blocks(p, pcs, 4) == 4);
+    // Some branch of the program went both ways
+    uint64_t taken = 0, not_taken = 0, found = 0;
+    for (uint32_t pc = 0; pc < 0x10000; pc++) {
+        uint64_t t, n;
+        if (ijvm_program_branch_profile(p, pc, &t, &n) == 0) {
+            taken += t;
+            not_taken += n;
+            found++;
+        }
+    }
+    assert(found > 0);
+    assert(taken + not_taken == branches);
+    ijvm_program_release(p);
+
+    // Without a profile directory, nothing is read or written
+    ijvm_set_profile_dir(NULL);
+    p = ijvm_program_load(BINARY);
+    assert(ijvm_program_hot_blocks(p, pcs, 4) == 0);
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load_program(m, p) == 0);
+    ijvm_program_release(p);
+    assert(ijvm_edges_enable(m) == 0);
+    assert(ijvm_edges_save(m) == -1);
+    ijvm_destroy(m);
+    clear_profiles();
+}
+
+int main()
+{
+    RUN_TEST(test_counts_add_up);
+    RUN_TEST(test_later_runs_read_it);
+    return END_TEST();
+}
@@ -0,0 +1,191 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "libijvm.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_fiber.ijvm"
+#define OP_SPAWN 0xE6
+#define OP_YIELD 0xE7
+
+static void write_binary(const byte_t *cp, uint32_t cp_size, const byte_t *text, uint32_t text_size)
+{
+    byte_t header[] = { 0x1d, 0xea, 0xdf, 0xad, 0, 0x01, 0, 0, 0, 0, 0, cp_size };
+    byte_t text_header[] = { 0, 0, 0, 0, 0, 0, 0, text_size };
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(cp, 1, cp_size, fp);
+    fwrite(text_header, 1, sizeof(text_header), fp);
+    fwrite(text, 1, text_size, fp);
+    fclose(fp);
+}
+
+void test_yield_interleaves()
+{
+    const byte_t cp[] = { 0, 0, 0, 21 };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_BIPUSH, 'x', OP_SPAWN, 0, 0, OP_POP,
+        OP_BIPUSH, 'm', OP_OUT, OP_YIELD,
+        OP_BIPUSH, 'm', OP_OUT, OP_YIELD,
+        OP_BIPUSH, 'm', OP_OUT, OP_YIELD,
+        OP_HALT,
+        // worker(OBJREF, c)
+        0, 2, 0, 0,
+        OP_ILOAD, 1, OP_OUT, OP_YIELD,
+        OP_ILOAD, 1, OP_OUT, OP_YIELD,
+        OP_ILOAD, 1, OP_OUT,
+        OP_BIPUSH, 0, OP_IRETURN,
+    };
+    write_binary(cp, sizeof(cp), text, sizeof(text));
+
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, TMP_BINARY) != -1);
+    FILE *out = tmpfile();
+    ijvm_set_output(m, out);
+    int size = ijvm_stack_size(m);
+    ijvm_step(m);
+    ijvm_step(m);
+    ijvm_step(m);
+    // The fiber id was pushed in place of the arguments
+    assert(ijvm_stack_size(m) == size + 1);
+    assert(ijvm_tos(m) == 2);
+
+    ijvm_run(m);
+    assert(ijvm_finished(m));
+    char buf[16] = { 0 };
+    rewind(out);
+    fread(buf, 1, sizeof(buf) - 1, out);
+    assert(strcmp(buf, "mxmxmx") == 0);
+
+    fclose(out);
+    ijvm_destroy(m);
+    remove(TMP_BINARY);
+}
+
+void test_in_yields_when_blocked()
+{
+    const byte_t cp[] = { 0, 0, 0, 9 };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_SPAWN, 0, 0, OP_POP,
+        OP_IN, OP_OUT, OP_HALT,
+        // worker(OBJREF)
+        0, 1, 0, 0,
+        OP_BIPUSH, 'w', OP_OUT,
+        OP_BIPUSH, 0, OP_IRETURN,
+    };
+    write_binary(cp, sizeof(cp), text, sizeof(text));
+
+    int fds[2];
+    assert(pipe(fds) == 0);
+    FILE *in = fdopen(fds[0], "r");
+    FILE *out = tmpfile();
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, TMP_BINARY) != -1);
+    ijvm_set_input(m, in);
+    ijvm_set_output(m, out);
+
+    for (int i = 0; i < 4; i++)
+        ijvm_step(m);
+    // IN had nothing to read, so the worker got to run
+    assert(ijvm_get_program_counter(m) == 13);
+
+    assert(write(fds[1], "z", 1) == 1);
+    ijvm_run(m);
+    char buf[16] = { 0 };
+    rewind(out);
+    fread(buf, 1, sizeof(buf) - 1, out);
+    assert(strcmp(buf, "wz") == 0);
+
+    ijvm_destroy(m);
+    fclose(in);
+    fclose(out);
+    close(fds[1]);
+    remove(TMP_BINARY);
+}
+
+void test_reload_with_fibers()
+{
+    const byte_t cp[] = { 0, 0, 0, 6 };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_SPAWN, 0, 0, OP_YIELD,
+        // worker(OBJREF), still running when the machine is reloaded
+        0, 1, 0, 0,
+        OP_YIELD, OP_GOTO, 0xff, 0xff,
+    };
+    write_binary(cp, sizeof(cp), text, sizeof(text));
+
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, TMP_BINARY) != -1);
+    for (int i = 0; i < 3; i++)
+        ijvm_step(m);
+    assert(ijvm_get_program_counter(m) == 10);
+    assert(ijvm_load(m, "files/task2/TestBipush1.ijvm") != -1);
+    ijvm_run(m);
+    assert(ijvm_tos(m) == 42);
+    ijvm_destroy(m);
+    remove(TMP_BINARY);
+}
+
+void test_failed_spawn_pops_arguments()
+{
+    const byte_t cp[] = { 0, 0, 0, 8 };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_BIPUSH, 'x', OP_SPAWN, 0, 0, OP_HALT,
+        // worker(OBJREF, c) with more locals than a fiber stack holds
+        0, 2, 0x10, 0,
+        OP_BIPUSH, 0, OP_IRETURN,
+    };
+    write_binary(cp, sizeof(cp), text, sizeof(text));
+
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, TMP_BINARY) != -1);
+    int size = ijvm_stack_size(m);
+    ijvm_step(m);
+    ijvm_step(m);
+    ijvm_step(m);
+    // Failed, and the arguments are gone all the same
+    assert(ijvm_tos(m) == 0);
+    assert(ijvm_stack_size(m) == size + 1);
+    ijvm_destroy(m);
+    remove(TMP_BINARY);
+}
+
+void test_fiber_overflow_faults()
+{
+    const byte_t cp[] = { 0, 0, 0, 8 };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_SPAWN, 0, 0, OP_POP, OP_YIELD, OP_HALT,
+        // worker(OBJREF), calling itself without end
+        0, 1, 0, 0,
+        OP_BIPUSH, 0, OP_INVOKEVIRTUAL, 0, 0,
+    };
+    write_binary(cp, sizeof(cp), text, sizeof(text));
+
+    // Runs into the guard page past the fiber's stack, not the heap
+    pid_t pid = fork();
+    if (pid == 0) {
+        ijvm_t *m = ijvm_create();
+        if (m == NULL || ijvm_load(m, TMP_BINARY) < 0)
+            _exit(1);
+        ijvm_run(m);
+        _exit(0);
+    }
+    assert(pid > 0);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    remove(TMP_BINARY);
+}
+
+int main()
+{
+    RUN_TEST(test_yield_interleaves);
+    RUN_TEST(test_in_yields_when_blocked);
+    RUN_TEST(test_reload_with_fibers);
+    RUN_TEST(test_failed_spawn_pops_arguments);
+    RUN_TEST(test_fiber_overflow_faults);
+    return END_TEST();
+}
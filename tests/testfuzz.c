@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fuzz.h"
+#include "testutil.h"
+
+static void fill(byte_t *choices, size_t n, uint32_t seed)
+{
+    for (size_t i = 0; i < n; i++) {
+        seed = seed * 1103515245u + 12345u;
+        choices[i] = (byte_t) (seed >> 16);
+    }
+}
+
+void test_engines_agree()
+{
+    FILE *null_out = fopen("/dev/null", "w");
+    assert(fuzz_campaign(1, 500, NULL, null_out) == 0);
+    fclose(null_out);
+}
+
+void test_programs_halt()
+{
+    static fuzz_outcome_t outcome;
+    fuzz_program_t p;
+
+    // No choices make the smallest program, which only halts
+    assert(fuzz_generate(NULL, 0, &p) == 0);
+    assert(p.input_size == 0);
+    assert(fuzz_run(&p, FUZZ_STEP, &outcome) == 0);
+    assert(outcome.finished);
+    assert(outcome.output_size == 0);
+    fuzz_program_free(&p);
+
+    byte_t choices[FUZZ_CHOICES];
+    int outputs = 0;
+    for (uint32_t seed = 0; seed < 100; seed++) {
+        fill(choices, sizeof(choices), seed);
+        assert(fuzz_generate(choices, sizeof(choices), &p) == 0);
+        for (int engine = 0; engine < FUZZ_ENGINES; engine++) {
+            assert(fuzz_run(&p, (fuzz_engine_t) engine, &outcome) == 0);
+            assert(outcome.finished);
+        }
+        outputs += outcome.output_size > 0;
+        assert(fuzz_compare(&p) == FUZZ_STEP);
+        fuzz_program_free(&p);
+    }
+    // Not all of them cut short
+    assert(outputs > 10);
+}
+
+// Holds for choices whose program outputs something
+static bool outputs(const byte_t *choices, size_t n, void *arg)
+{
+    fuzz_outcome_t *outcome = arg;
+    fuzz_program_t p;
+    assert(fuzz_generate(choices, n, &p) == 0);
+    assert(fuzz_run(&p, FUZZ_STEP, outcome) == 0);
+    fuzz_program_free(&p);
+    return outcome->output_size > 0;
+}
+
+void test_minimize()
+{
+    static fuzz_outcome_t outcome;
+    byte_t choices[FUZZ_CHOICES];
+    uint32_t seed = 0;
+    do
+        fill(choices, sizeof(choices), seed++);
+    while (!outputs(choices, sizeof(choices), &outcome));
+
+    size_t n = fuzz_minimize(choices, sizeof(choices), outputs, &outcome);
+    assert(outputs(choices, n, &outcome));
+    assert(n < 32);
+    // What is left is close to a single OUT
+    assert(outcome.output_size == 1);
+}
+
+int main()
+{
+    RUN_TEST(test_engines_agree);
+    RUN_TEST(test_programs_halt);
+    RUN_TEST(test_minimize);
+    return END_TEST();
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libijvm.h"
+#include "gen.h"
+#include "testutil.h"
+
+#define TMP_KERNEL "tmp_kernel.ijvm"
+
+// Runs the kernel to the end, stepping or on the fast engine, and returns
+// what it left on the stack
+static word_t run_kernel(gen_kernel_t kernel, uint32_t n, bool stepping, char *out, size_t size)
+{
+    assert(gen_kernel_write(kernel, n, TMP_KERNEL) == 0);
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, TMP_KERNEL) == 0);
+    ijvm_set_output_buffer(m, out, size);
+    if (stepping)
+        while (ijvm_step(m));
+    else
+        ijvm_run(m);
+    assert(ijvm_finished(m));
+    word_t tos = ijvm_tos(m);
+    ijvm_destroy(m);
+    remove(TMP_KERNEL);
+    return tos;
+}
+
+void test_kernels()
+{
+    static char out[0x1000];
+    uint32_t n = 3000;
+
+    uint32_t acc = 0;
+    for (uint32_t i = n; i > 0; i--)
+        acc = (((acc + i) * 2) | 7) - i;
+    assert(run_kernel(GEN_ARITH, n, false, out, sizeof(out)) == (word_t) acc);
+    assert(run_kernel(GEN_ARITH, n, true, out, sizeof(out)) == (word_t) acc);
+
+    // Three whole recursions of GEN_CALL_DEPTH, each returning its depth
+    assert(run_kernel(GEN_CALLS, n, false, out, sizeof(out)) == 3 * GEN_CALL_DEPTH);
+    assert(run_kernel(GEN_CALLS, 10, true, out, sizeof(out)) == 10);
+
+    assert(run_kernel(GEN_WIDE, n, false, out, sizeof(out)) == (word_t) (3 * n * (n - 1) / 2));
+    assert(run_kernel(GEN_WIDE, n, true, out, sizeof(out)) == (word_t) (3 * n * (n - 1) / 2));
+
+    static uint32_t array[GEN_ARRAY_SIZE];
+    uint32_t sum = 0;
+    for (uint32_t i = n; i > 0; i--) {
+        uint32_t value = array[(i + 1) % GEN_ARRAY_SIZE] + i;
+        sum += value;
+        array[i % GEN_ARRAY_SIZE] = value;
+    }
+    assert(run_kernel(GEN_ARRAYS, n, false, out, sizeof(out)) == (word_t) sum);
+    assert(run_kernel(GEN_ARRAYS, n, true, out, sizeof(out)) == (word_t) sum);
+
+    assert(run_kernel(GEN_OUTPUT, 100, false, out, sizeof(out)) == 0);
+    for (uint32_t i = 0; i < 100; i++)
+        assert(out[i] == (char) ('0' + ((100 - i) & 0x3F)));
+}
+
+void test_builder()
+{
+    // A loop counting down from 5 to 0 in local 0, then HALT
+    gen_t g;
+    gen_init(&g);
+    gen_byte(&g, OP_LDC_W);
+    gen_short(&g, gen_constant(&g, 5));
+    gen_byte(&g, OP_ISTORE);
+    gen_byte(&g, 0);
+    uint32_t top = g.text_size;
+    gen_byte(&g, OP_ILOAD);
+    gen_byte(&g, 0);
+    uint32_t exit = gen_branch(&g, OP_IFEQ, 0);
+    gen_byte(&g, OP_IINC);
+    gen_byte(&g, 0);
+    gen_byte(&g, 0xFF);
+    gen_branch(&g, OP_GOTO, top);
+    gen_patch(&g, exit, g.text_size);
+    gen_byte(&g, OP_BIPUSH);
+    gen_byte(&g, 42);
+    gen_byte(&g, OP_HALT);
+    size_t size;
+    byte_t *image = gen_image(&g, &size);
+    gen_free(&g);
+    assert(image != NULL);
+    assert(size == 12 + 4 + 8 + 19);
+
+    FILE *fp = fopen(TMP_KERNEL, "wb");
+    assert(fwrite(image, 1, size, fp) == size);
+    fclose(fp);
+    free(image);
+    assert(init_ijvm(TMP_KERNEL) == 0);
+    run();
+    assert(tos() == 42);
+    assert(get_local_variable(0) == 0);
+    destroy_ijvm();
+    remove(TMP_KERNEL);
+
+    assert(gen_kernel_find("calls") == GEN_CALLS);
+    assert(gen_kernel_find("none") == -1);
+    assert(gen_kernel(GEN_KERNELS, 1, &size) == NULL);
+}
+
+int main()
+{
+    RUN_TEST(test_kernels);
+    RUN_TEST(test_builder);
+    return END_TEST();
+}
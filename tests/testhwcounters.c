@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include "libijvm.h"
+#include "hwcounters.h"
+#include "testutil.h"
+
+// Events that can't come out 0 on a run of any length; misses can
+static bool always_counts(int event)
+{
+    return event == HWC_CYCLES || event == HWC_INSTRUCTIONS || event == HWC_TASK_CLOCK;
+}
+
+void test_count_a_run()
+{
+    hwcounters_t hw;
+    int opened = hwcounters_open(&hw);
+    int counted = 0;
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        counted += hwcounters_counted(&hw, (hwc_event_t) i);
+        assert(hw.values[i] == 0);
+    }
+    assert(counted == opened);
+
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") == 0);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    hwcounters_start(&hw);
+    ijvm_run(m);
+    hwcounters_stop(&hw);
+    uint64_t first[HWC_EVENTS];
+    memcpy(first, hw.values, sizeof(first));
+
+    // Whatever could be counted was, and only while started
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        if (!hwcounters_counted(&hw, (hwc_event_t) i)) {
+            assert(hw.values[i] == 0);
+        } else if (always_counts(i)) {
+            assert(hw.values[i] > 0);
+        }
+    }
+    if (hwcounters_counted(&hw, HWC_INSTRUCTIONS))
+        assert(hw.values[HWC_INSTRUCTIONS] > 1000000);
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") == 0);
+    ijvm_run(m);
+    for (int i = 0; i < HWC_EVENTS; i++)
+        assert(hw.values[i] == first[i]);
+
+    // A second run adds to the first
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") == 0);
+    hwcounters_start(&hw);
+    ijvm_run(m);
+    hwcounters_stop(&hw);
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        assert(hw.values[i] >= first[i]);
+        if (hwcounters_counted(&hw, (hwc_event_t) i) && always_counts(i))
+            assert(hw.values[i] > first[i]);
+    }
+
+    ijvm_destroy(m);
+    fclose(null_out);
+    hwcounters_close(&hw);
+    for (int i = 0; i < HWC_EVENTS; i++)
+        assert(!hwcounters_counted(&hw, (hwc_event_t) i));
+}
+
+void test_report()
+{
+    hwcounters_t hw;
+    hwcounters_open(&hw);
+    hwcounters_start(&hw);
+    hwcounters_stop(&hw);
+    FILE *f = tmpfile();
+    hwcounters_report(f, &hw, 1000);
+    rewind(f);
+    char line[256];
+    assert(fgets(line, sizeof(line), f) != NULL);
+    for (int i = 0; i < HWC_EVENTS; i++) {
+        assert(fgets(line, sizeof(line), f) != NULL);
+        assert(strncmp(line, hwc_event_names[i], strlen(hwc_event_names[i])) == 0);
+        assert((strstr(line, "not supported") == NULL) == hwcounters_counted(&hw, (hwc_event_t) i));
+    }
+    fclose(f);
+    hwcounters_close(&hw);
+}
+
+int main()
+{
+    RUN_TEST(test_count_a_run);
+    RUN_TEST(test_report);
+    return END_TEST();
+}
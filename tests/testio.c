@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "libijvm.h"
+#include "testutil.h"
+
+void test_memory_io()
+{
+    int res = init_ijvm("files/advanced/SimpleCalc.ijvm");
+    assert(res != -1);
+
+    const char *input = "9 9 - ? .";
+    char buf[128];
+    memset(buf, '\0', sizeof(buf));
+    set_input_buffer(input, strlen(input));
+    set_output_buffer(buf, sizeof(buf) - 1);
+
+    run();
+
+    assert(output_size() == 2);
+    assert(strcmp(buf, "0\n") == 0);
+    destroy_ijvm();
+}
+
+void test_memory_output_overflow()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/task4/LoadTest4.ijvm") != -1);
+
+    char buf[5];
+    ijvm_set_output_buffer(m, buf, sizeof(buf));
+    ijvm_run(m);
+
+    // The rest of "kjihgfedcbaabcd" is dropped
+    assert(ijvm_output_size(m) == sizeof(buf));
+    assert(memcmp(buf, "kjihg", sizeof(buf)) == 0);
+    ijvm_destroy(m);
+}
+
+void test_bfi_from_memory()
+{
+    FILE *bf = fopen("files/bonus/brainfuck/hello_world.bf", "rb");
+    assert(bf != NULL);
+    char program[4096];
+    size_t n = fread(program, 1, sizeof(program), bf);
+    fclose(bf);
+
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/bonus/bfi2.ijvm") != -1);
+    char buf[64];
+    memset(buf, '\0', sizeof(buf));
+    ijvm_set_input_buffer(m, program, n);
+    ijvm_set_output_buffer(m, buf, sizeof(buf) - 1);
+    ijvm_run(m);
+
+    assert(strcmp(buf, "Hello World!\n") == 0);
+    ijvm_destroy(m);
+}
+
+void test_pipe_input()
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+    const char *input = "1 2 + ? .";
+    assert(write(fds[1], input, strlen(input)) == (ssize_t) strlen(input));
+    close(fds[1]);
+    FILE *in = fdopen(fds[0], "r");
+    FILE *out = tmpfile();
+    assert(in != NULL && out != NULL);
+
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/SimpleCalc.ijvm") != -1);
+    ijvm_set_input(m, in);
+    ijvm_set_output(m, out);
+    ijvm_run(m);
+
+    char buf[16];
+    memset(buf, '\0', sizeof(buf));
+    rewind(out);
+    fread(buf, 1, sizeof(buf) - 1, out);
+    assert(strcmp(buf, "3\n") == 0);
+
+    ijvm_destroy(m);
+    fclose(in);
+    fclose(out);
+}
+
+int main()
+{
+    RUN_TEST(test_memory_io);
+    RUN_TEST(test_memory_output_overflow);
+    RUN_TEST(test_bfi_from_memory);
+    RUN_TEST(test_pipe_input);
+    return END_TEST();
+}
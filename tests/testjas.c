@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libijvm.h"
+#include "jas.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_jas.ijvm"
+
+static const char *const sources[] = {
+    "files/task1/program1.jas", "files/task1/program2.jas",
+    "files/task2/TestBipush1.jas", "files/task2/TestIAND1.jas", "files/task2/TestSwap1.jas",
+    "files/task3/GOTO2.jas", "files/task3/IFICMPEQ1.jas", "files/task3/IFLT1.jas",
+    "files/task4/IINCTest.jas", "files/task4/LoadTest4.jas",
+    "files/task5/all_regular.jas", "files/task5/test-nestedinvoke-frame.jas",
+    "files/advanced/Tanenbaum.jas", "files/advanced/mandelbread.jas",
+    "files/advanced/test-wide1.jas", "files/advanced/test-wide2.jas",
+    "files/bonus/bfi2.jas", "files/bonus/test_netbind.jas",
+};
+
+static byte_t *read_file(const char *path, size_t *size) {
+    FILE *fp = fopen(path, "rb");
+    assert(fp != NULL);
+    fseek(fp, 0, SEEK_END);
+    *size = (size_t) ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    byte_t *data = malloc(*size + 1);
+    assert(fread(data, 1, *size, fp) == *size);
+    fclose(fp);
+    return data;
+}
+
+void test_matches_gojasm()
+{
+    // What goJASM made of the same sources, byte for byte
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        size_t source_size, expected_size, size;
+        char *source = (char *) read_file(sources[i], &source_size);
+        char binary[256];
+        snprintf(binary, sizeof(binary), "%.*s.ijvm", (int) (strlen(sources[i]) - 4), sources[i]);
+        byte_t *expected = read_file(binary, &expected_size);
+        char error[JAS_ERROR_SIZE];
+        byte_t *image = jas_assemble(source, source_size, &size, error, sizeof(error));
+        assert(image != NULL);
+        assert(size == expected_size);
+        assert(memcmp(image, expected, size) == 0);
+        free(image);
+        free(expected);
+        free(source);
+    }
+}
+
+void test_init_from_source()
+{
+    assert(jas_is_source("files/task5/all_regular.jas"));
+    assert(!jas_is_source("files/task5/all_regular.ijvm"));
+    assert(!jas_is_source("jas"));
+
+    // all_regular reads an A and then the end of its input
+    FILE *in = tmpfile();
+    assert(in != NULL);
+    fputc('A', in);
+    rewind(in);
+    assert(init_ijvm("files/task5/all_regular.jas") == 0);
+    set_input(in);
+    run();
+    assert(tos() == 0x41);
+    destroy_ijvm();
+    fclose(in);
+
+    assert(jas_assemble_file("files/task1/program1.jas", TMP_BINARY) == 0);
+    assert(init_ijvm(TMP_BINARY) == 0);
+    run();
+    destroy_ijvm();
+    remove(TMP_BINARY);
+}
+
+static word_t run_source(const char *source)
+{
+    char error[JAS_ERROR_SIZE];
+    size_t size;
+    byte_t *image = jas_assemble(source, strlen(source), &size, error, sizeof(error));
+    assert(image != NULL);
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    assert(fwrite(image, 1, size, fp) == size);
+    fclose(fp);
+    free(image);
+    assert(init_ijvm(TMP_BINARY) == 0);
+    run();
+    word_t result = tos();
+    destroy_ijvm();
+    remove(TMP_BINARY);
+    return result;
+}
+
+void test_syntax()
+{
+    // Methods before main, called before they are defined, in lower case
+    // and with CRLF line endings
+    assert(run_source(".method twice(x)\r\n"
+                      "  iload x\r\n  iload x\r\n  iadd\r\n  ireturn\r\n"
+                      ".end-method\r\n"
+                      ".constant\r\n  objref 0xCAFE\r\n  big -0x10\r\n.end-constant\r\n"
+                      ".main\r\n"
+                      ".var\r\n  i\r\n.end-var\r\n"
+                      "  BIPUSH 3\r\n  ISTORE i\r\n"
+                      "loop: ILOAD i\r\n  IFEQ done // count i down\r\n"
+                      "  IINC i -1\r\n  GOTO loop\r\n"
+                      "done:\r\n  LDC_W objref\r\n  LDC_W big\r\n  INVOKEVIRTUAL twice\r\n  HALT\r\n"
+                      ".end-main") == -0x20);
+
+    // Locals of a method follow its arguments, past 255 with WIDE
+    static char wide[0x4000];
+    int n = snprintf(wide, sizeof(wide), ".constant\nobjref 1\n.end-constant\n"
+                     ".main\nLDC_W objref\nBIPUSH 7\nINVOKEVIRTUAL m\nHALT\n.end-main\n"
+                     ".method m(a)\n.var\n");
+    for (int i = 0; i < 300; i++)
+        n += snprintf(wide + n, sizeof(wide) - n, "v%d\n", i);
+    snprintf(wide + n, sizeof(wide) - n, ".end-var\nILOAD a\nWIDE\nISTORE v299\nWIDE\nILOAD v299\nIRETURN\n.end-method\n");
+    assert(run_source(wide) == 7);
+}
+
+static void assert_error(const char *source, const char *message)
+{
+    char error[JAS_ERROR_SIZE];
+    size_t size;
+    assert(jas_assemble(source, strlen(source), &size, error, sizeof(error)) == NULL);
+    if (strcmp(error, message) != 0)
+        fprintf(stderr, "got '%s', expected '%s'\n", error, message);
+    assert(strcmp(error, message) == 0);
+}
+
+void test_errors()
+{
+    assert_error(".main\n  FOO\n.end-main\n", "line 2: unknown instruction 'FOO'");
+    assert_error(".main\n\n  GOTO nowhere\n.end-main\n", "line 3: unknown label 'nowhere'");
+    assert_error(".main\n  LDC_W c\n.end-main\n", "line 2: unknown constant 'c'");
+    assert_error(".main\n  INVOKEVIRTUAL m\n.end-main\n", "line 2: unknown method 'm'");
+    assert_error(".main\n.var\na\na\n.end-var\n.end-main\n", "line 4: var 'a' defined twice");
+    assert_error(".main\n  BIPUSH 256\n.end-main\n", "line 2: '256' is not a byte");
+    assert_error(".main\n  BIPUSH\n.end-main\n", "line 2: BIPUSH needs an operand");
+    assert_error(".main\n  HALT HALT\n.end-main\n", "line 2: unexpected 'HALT' after HALT");
+    assert_error(".main\n  HALT\n", "line 2: missing .end-main");
+    assert_error("HALT\n", "line 1: 'HALT' outside of .constant, .main or .method");
+    assert_error(".method m\n.end-method\n", "line 2: missing .main");
+}
+
+int main()
+{
+    RUN_TEST(test_matches_gojasm);
+    RUN_TEST(test_init_from_source);
+    RUN_TEST(test_syntax);
+    RUN_TEST(test_errors);
+    return END_TEST();
+}
@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include "libijvm.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_loader.ijvm"
+
+static const byte_t program1[] = {
+    0x1d, 0xea, 0xdf, 0xad,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03,
+    0x10, 0x2a, 0xff
+};
+
+static void write_binary(const byte_t *data, size_t size, time_t mtime)
+{
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    fwrite(data, 1, size, fp);
+    fclose(fp);
+    struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+    utimensat(AT_FDCWD, TMP_BINARY, times, 0);
+}
+
+void test_missing_file()
+{
+    assert(init_ijvm("files/does-not-exist.ijvm") == -1);
+    assert(ijvm_program_load("files") == NULL);
+}
+
+void test_truncated_blocks()
+{
+    // Every proper prefix of a valid binary is rejected
+    for (size_t size = 0; size < sizeof(program1); size++) {
+        write_binary(program1, size, 1000);
+        assert(ijvm_program_load(TMP_BINARY) == NULL);
+    }
+    write_binary(program1, sizeof(program1), 1000);
+    ijvm_program_t *p = ijvm_program_load(TMP_BINARY);
+    assert(p != NULL);
+    ijvm_program_release(p);
+
+    byte_t oversized[sizeof(program1)];
+    memcpy(oversized, program1, sizeof(program1));
+    oversized[19] = 0x04;
+    write_binary(oversized, sizeof(oversized), 1000);
+    assert(ijvm_program_load(TMP_BINARY) == NULL);
+    remove(TMP_BINARY);
+}
+
+void test_shared_image()
+{
+    ijvm_t *a = ijvm_create();
+    ijvm_t *b = ijvm_create();
+    assert(ijvm_load(a, "files/advanced/Tanenbaum.ijvm") != -1);
+    assert(ijvm_load(b, "files/advanced/Tanenbaum.ijvm") != -1);
+    // One copy of the text for both instances
+    assert(ijvm_get_text(a) == ijvm_get_text(b));
+    ijvm_destroy(a);
+    assert(ijvm_text_size(b) > 0);
+    assert(ijvm_get_instruction(b) == ijvm_get_text(b)[0]);
+    ijvm_destroy(b);
+}
+
+void test_modified_file()
+{
+    write_binary(program1, sizeof(program1), 1000);
+    ijvm_t *a = ijvm_create();
+    assert(ijvm_load(a, TMP_BINARY) != -1);
+
+    byte_t changed[sizeof(program1)];
+    memcpy(changed, program1, sizeof(program1));
+    changed[21] = 0x2b;
+    write_binary(changed, sizeof(changed), 2000);
+
+    ijvm_t *b = ijvm_create();
+    assert(ijvm_load(b, TMP_BINARY) != -1);
+    assert(ijvm_get_text(a) != ijvm_get_text(b));
+    ijvm_step(b);
+    assert(ijvm_tos(b) == 0x2b);
+
+    ijvm_destroy(a);
+    ijvm_destroy(b);
+    remove(TMP_BINARY);
+}
+
+int main()
+{
+    RUN_TEST(test_missing_file);
+    RUN_TEST(test_truncated_blocks);
+    RUN_TEST(test_shared_image);
+    RUN_TEST(test_modified_file);
+    return END_TEST();
+}
@@ -0,0 +1,153 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "libijvm.h"
+#include "metrics.h"
+#include "testutil.h"
+
+#define BFI_PATH    "files/bonus/bfi2.ijvm"
+#define HELLO_WORLD "files/bonus/brainfuck/hello_world.bf"
+
+static ijvm_t *load(const char *binary, FILE *out)
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, binary) != -1);
+    ijvm_set_output(m, out);
+    return m;
+}
+
+void test_engines_agree()
+{
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_t *stepped = load("files/advanced/Tanenbaum.ijvm", null_out);
+    ijvm_t *run = load("files/advanced/Tanenbaum.ijvm", null_out);
+    ijvm_t *sliced = load("files/advanced/Tanenbaum.ijvm", null_out);
+    uint64_t steps = 0;
+    while (ijvm_step(stepped))
+        steps++;
+    ijvm_run(run);
+    while (ijvm_run_for(sliced, 7) == IJVM_OUT_OF_FUEL);
+
+    ijvm_metrics_t a, b, c;
+    ijvm_metrics(stepped, &a);
+    ijvm_metrics(run, &b);
+    ijvm_metrics(sliced, &c);
+    assert(a.instructions == steps + 1);
+    assert(b.instructions == a.instructions);
+    assert(c.instructions == a.instructions);
+    assert(a.calls > 0);
+    assert(b.calls == a.calls && c.calls == a.calls);
+    // Slices look at the stack whenever one returns, too
+    assert(a.max_stack > 10 && a.max_stack < a.stack_size);
+    assert(b.max_stack == a.max_stack && c.max_stack >= a.max_stack);
+    assert(a.bytes_out > 0 && b.bytes_out == a.bytes_out);
+    assert(a.wall_ns == 0);
+    assert(b.wall_ns > 0 && b.busy_ns > 0);
+    ijvm_destroy(stepped);
+    ijvm_destroy(run);
+    ijvm_destroy(sliced);
+    fclose(null_out);
+}
+
+void test_heap_and_input()
+{
+    static char program[0x1000];
+    FILE *fp = fopen(HELLO_WORLD, "r");
+    assert(fp != NULL);
+    size_t size = fread(program, 1, sizeof(program), fp);
+    fclose(fp);
+
+    char output[256];
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, BFI_PATH) != -1);
+    ijvm_set_input_buffer(m, program, size);
+    ijvm_set_output_buffer(m, output, sizeof(output));
+    ijvm_run(m);
+
+    ijvm_metrics_t x;
+    ijvm_metrics(m, &x);
+    assert(x.arrays > 0);
+    assert(x.heap_allocated >= x.arrays * sizeof(word_t));
+    assert(x.heap_live == x.heap_allocated);
+    assert(x.bytes_in == size);
+    assert(x.bytes_out == ijvm_output_size(m));
+
+    // Arrays die with the program, the allocations add up
+    assert(ijvm_load(m, BFI_PATH) != -1);
+    ijvm_set_input_buffer(m, program, size);
+    ijvm_set_output_buffer(m, output, sizeof(output));
+    ijvm_run(m);
+    ijvm_metrics_t y;
+    ijvm_metrics(m, &y);
+    assert(y.heap_live == x.heap_live);
+    assert(y.heap_allocated == 2 * x.heap_allocated);
+    assert(y.instructions == 2 * x.instructions);
+
+    char line[512];
+    size_t len = ijvm_metrics_format(&y, line, sizeof(line));
+    assert(len == strlen(line) && line[len - 1] == '\n');
+    char expected[64];
+    snprintf(expected, sizeof(expected), "instructions=%llu ", (unsigned long long) y.instructions);
+    assert(strncmp(line, expected, strlen(expected)) == 0);
+    assert(strstr(line, " arrays=") != NULL);
+    // Cut short, it still ends in a terminator
+    assert(ijvm_metrics_format(&y, line, 8) == 7);
+    assert(strcmp(line, "instruc") == 0);
+    ijvm_destroy(m);
+}
+
+typedef struct reader {
+    ijvm_t *m;
+    atomic_bool done;
+    int snapshots;
+    bool consistent;
+} reader_t;
+
+static void *read_metrics(void *arg)
+{
+    reader_t *r = arg;
+    uint64_t last = 0;
+    while (!atomic_load(&r->done)) {
+        ijvm_metrics_t x;
+        ijvm_metrics(r->m, &x);
+        // Never goes back, and never mixes two publications
+        if (x.instructions < last || x.calls > x.instructions
+            || (x.instructions > 0 && x.stack_size == 0))
+            r->consistent = false;
+        last = x.instructions;
+        r->snapshots++;
+    }
+    return NULL;
+}
+
+void test_read_while_running()
+{
+    FILE *null_out = fopen("/dev/null", "w");
+    reader_t r = { .m = load("files/advanced/mandelbread.ijvm", null_out), .consistent = true };
+    atomic_init(&r.done, false);
+    pthread_t thread;
+    assert(pthread_create(&thread, NULL, read_metrics, &r) == 0);
+    ijvm_metrics_t during;
+    uint64_t published = 0;
+    while (ijvm_run_for(r.m, 3 * METRICS_INTERVAL / 2) == IJVM_OUT_OF_FUEL) {
+        ijvm_metrics(r.m, &during);
+        assert(during.instructions > published);
+        published = during.instructions;
+    }
+    atomic_store(&r.done, true);
+    pthread_join(thread, NULL);
+    assert(r.consistent);
+    assert(r.snapshots > 0);
+    ijvm_destroy(r.m);
+    fclose(null_out);
+}
+
+int main()
+{
+    RUN_TEST(test_engines_agree);
+    RUN_TEST(test_heap_and_input);
+    RUN_TEST(test_read_while_running);
+    return END_TEST();
+}
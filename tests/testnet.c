@@ -0,0 +1,249 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include "libijvm.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_net.ijvm"
+#define OP_NETBIND 0xE1
+#define OP_NETCONNECT 0xE2
+#define OP_NETIN 0xE3
+#define OP_NETOUT 0xE4
+#define OP_NETCLOSE 0xE5
+#define OP_SPAWN 0xE6
+#define OP_YIELD 0xE7
+
+typedef struct vm_thread {
+    ijvm_t *m;
+    atomic_bool stop;
+} vm_thread_t;
+
+static void *run_vm(void *arg)
+{
+    vm_thread_t *t = arg;
+    while (!atomic_load(&t->stop) && ijvm_step(t->m));
+    return NULL;
+}
+
+static int connect_to(uint16_t port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    for (int tries = 0; tries < 200; tries++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+            struct timeval timeout = { 5, 0 };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            return fd;
+        }
+        close(fd);
+        // The machine may not be listening yet
+        usleep(10000);
+    }
+    return -1;
+}
+
+void test_netbind_echo()
+{
+    vm_thread_t t = { ijvm_create(), false };
+    assert(ijvm_load(t.m, "files/bonus/test_netbind.ijvm") != -1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_vm, &t);
+
+    int fd = connect_to(5555);
+    assert(fd >= 0);
+    assert(write(fd, "ab", 2) == 2);
+    char buf[4] = { 0 };
+    size_t got = 0;
+    ssize_t n;
+    while (got < 2 && (n = read(fd, buf + got, 2 - got)) > 0)
+        got += n;
+    assert(strcmp(buf, "ba") == 0);
+    // NETCLOSE closed the connection
+    assert(read(fd, buf, 1) == 0);
+
+    pthread_join(thread, NULL);
+    assert(ijvm_finished(t.m));
+    close(fd);
+    ijvm_destroy(t.m);
+}
+
+void test_netconnect_echo()
+{
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(5555);
+    assert(bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    assert(listen(lfd, 1) == 0);
+
+    vm_thread_t t = { ijvm_create(), false };
+    assert(ijvm_load(t.m, "files/bonus/test_netconnect.ijvm") != -1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_vm, &t);
+
+    int fd = accept(lfd, NULL, NULL);
+    assert(fd >= 0);
+    assert(write(fd, "xy", 2) == 2);
+    char buf[4] = { 0 };
+    size_t got = 0;
+    ssize_t n;
+    while (got < 2 && (n = read(fd, buf + got, 2 - got)) > 0)
+        got += n;
+    assert(strcmp(buf, "yx") == 0);
+
+    pthread_join(thread, NULL);
+    close(fd);
+    close(lfd);
+    ijvm_destroy(t.m);
+}
+
+void test_concurrent_sessions()
+{
+    uint16_t port = 20000 + getpid() % 20000;
+    const byte_t cp[] = { 0, 0, 0, 22, 0, 0, port >> 8, port & 0xff };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_SPAWN, 0, 0, OP_POP,
+        OP_BIPUSH, 0, OP_SPAWN, 0, 0, OP_POP,
+        OP_BIPUSH, 0, OP_INVOKEVIRTUAL, 0, 0, OP_POP,
+        OP_YIELD, OP_GOTO, 0xff, 0xff,
+        // handler(OBJREF): echo one byte on one connection
+        0, 1, 0, 1,
+        OP_LDC_W, 0, 1, OP_NETBIND, OP_ISTORE, 1,
+        OP_ILOAD, 1, OP_NETIN, OP_ILOAD, 1, OP_NETOUT,
+        OP_ILOAD, 1, OP_NETCLOSE,
+        OP_BIPUSH, 0, OP_IRETURN,
+    };
+    byte_t header[] = { 0x1d, 0xea, 0xdf, 0xad, 0, 0x01, 0, 0, 0, 0, 0, sizeof(cp) };
+    byte_t text_header[] = { 0, 0, 0, 0, 0, 0, 0, sizeof(text) };
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(cp, 1, sizeof(cp), fp);
+    fwrite(text_header, 1, sizeof(text_header), fp);
+    fwrite(text, 1, sizeof(text), fp);
+    fclose(fp);
+
+    vm_thread_t t = { ijvm_create(), false };
+    assert(ijvm_load(t.m, TMP_BINARY) != -1);
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_vm, &t);
+
+    int fds[3];
+    for (int i = 0; i < 3; i++) {
+        fds[i] = connect_to(port);
+        assert(fds[i] >= 0);
+    }
+    // Served in the reverse order of accepting, which a machine handling
+    // one session at a time could never do
+    for (int i = 2; i >= 0; i--) {
+        char c = 'a' + i;
+        char reply = 0;
+        assert(write(fds[i], &c, 1) == 1);
+        assert(read(fds[i], &reply, 1) == 1);
+        assert(reply == c);
+        close(fds[i]);
+    }
+
+    atomic_store(&t.stop, true);
+    pthread_join(thread, NULL);
+    ijvm_destroy(t.m);
+    remove(TMP_BINARY);
+}
+
+static void write_program(const byte_t *cp, size_t cp_size, const byte_t *text, size_t text_size)
+{
+    byte_t header[] = { 0x1d, 0xea, 0xdf, 0xad, 0, 0x01, 0, 0, 0, 0, 0, cp_size };
+    byte_t text_header[] = { 0, 0, 0, 0, 0, 0, 0, text_size };
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(cp, 1, cp_size, fp);
+    fwrite(text_header, 1, sizeof(text_header), fp);
+    fwrite(text, 1, text_size, fp);
+    fclose(fp);
+}
+
+void test_connect_lets_fibers_run()
+{
+    uint16_t port = 20000 + (getpid() + 1) % 20000;
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    assert(bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    // With its accept queue full, the listener leaves further connects
+    // hanging until it accepts
+    assert(listen(lfd, 0) == 0);
+    int filler = connect_to(port);
+    assert(filler >= 0);
+
+    // A fiber connects while the main fiber keeps printing
+    const byte_t cp[] = { 0, 0, 0, 16, 0x7f, 0, 0, 1, 0, 0, port >> 8, port & 0xff };
+    const byte_t text[] = {
+        OP_BIPUSH, 0, OP_SPAWN, 0, 0, OP_POP,
+        OP_YIELD, OP_BIPUSH, 'x', OP_OUT, OP_GOTO, 0xff, 0xfc,
+        // connector(OBJREF): send 'c' on a new connection
+        0, 1, 0, 1,
+        OP_LDC_W, 0, 1, OP_LDC_W, 0, 2, OP_NETCONNECT, OP_ISTORE, 1,
+        OP_BIPUSH, 'c', OP_ILOAD, 1, OP_NETOUT,
+        OP_ILOAD, 1, OP_NETCLOSE,
+        OP_BIPUSH, 0, OP_IRETURN,
+    };
+    write_program(cp, sizeof(cp), text, sizeof(text));
+
+    char out[0x10000];
+    vm_thread_t t = { ijvm_create(), false };
+    assert(ijvm_load(t.m, TMP_BINARY) != -1);
+    ijvm_set_output_buffer(t.m, out, sizeof(out));
+    pthread_t thread;
+    pthread_create(&thread, NULL, run_vm, &t);
+    usleep(200000);
+    // Still connecting, yet the main fiber got to run
+    assert(ijvm_output_size(t.m) > 0);
+
+    // Making room in the queue lets the retried connect through
+    int fd = accept(lfd, NULL, NULL);
+    assert(fd >= 0);
+    close(fd);
+    struct pollfd pfd = { lfd, POLLIN, 0 };
+    assert(poll(&pfd, 1, 10000) == 1);
+    fd = accept(lfd, NULL, NULL);
+    assert(fd >= 0);
+    char c = 0;
+    assert(read(fd, &c, 1) == 1);
+    assert(c == 'c');
+
+    atomic_store(&t.stop, true);
+    pthread_join(thread, NULL);
+    close(fd);
+    close(filler);
+    close(lfd);
+    ijvm_destroy(t.m);
+    remove(TMP_BINARY);
+}
+
+int main()
+{
+    RUN_TEST(test_netbind_echo);
+    RUN_TEST(test_netconnect_echo);
+    RUN_TEST(test_concurrent_sessions);
+    RUN_TEST(test_connect_lets_fibers_run);
+    return END_TEST();
+}
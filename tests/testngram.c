@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+#include "libijvm.h"
+#include "ngram.h"
+#include "testutil.h"
+
+#define MAX_NGRAMS 4096
+
+static ngram_t found[MAX_NGRAMS];
+static ngram_t other[MAX_NGRAMS];
+
+static ijvm_t *count_run(const char *binary)
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, binary) != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    assert(ijvm_ngrams_enable(m) == 0);
+    assert(ijvm_stats_enable(m) == 0);
+    ijvm_run(m);
+    ijvm_set_output(m, stdout);
+    fclose(null_out);
+    return m;
+}
+
+static uint64_t count_of(const ngram_t *all, size_t n, const byte_t *ops, int length)
+{
+    for (size_t i = 0; i < n; i++)
+        if (all[i].n == length && memcmp(all[i].ops, ops, length) == 0)
+            return all[i].count;
+    return 0;
+}
+
+void test_straight_line()
+{
+    // Runs every instruction once, in the order of the text
+    ijvm_t *m = count_run("files/task1/program2.ijvm");
+    for (int n = 2; n <= NGRAM_MAX; n++) {
+        size_t executed = ijvm_ngrams(m, n, true, found, MAX_NGRAMS);
+        size_t in_text = ijvm_ngrams(m, n, false, other, MAX_NGRAMS);
+        assert(executed == in_text);
+        assert(memcmp(found, other, sizeof(ngram_t) * executed) == 0);
+    }
+    // NOP LDC_W DUP LDC_W IADD LDC_W IADD OUT NOP HALT
+    assert(ijvm_ngrams(m, 2, true, found, MAX_NGRAMS) == 8);
+    assert(found[0].count == 2);
+    assert(found[0].ops[0] == OP_LDC_W && found[0].ops[1] == OP_IADD);
+    assert(count_of(found, 8, (byte_t[]) { OP_IADD, OP_LDC_W }, 2) == 1);
+    assert(ijvm_ngrams(m, 3, true, found, MAX_NGRAMS) == 8);
+    ijvm_destroy(m);
+}
+
+void test_sequences_hold_together()
+{
+    ijvm_t *m = count_run("files/advanced/Tanenbaum.ijvm");
+    const opstats_t *s = ijvm_stats(m);
+    size_t pairs = ijvm_ngrams(m, 2, true, found, MAX_NGRAMS);
+    assert(pairs > 0);
+    uint64_t total = 0, executed = 0;
+    for (size_t i = 0; i < pairs; i++) {
+        // Busiest first, and a pair never outnumbers its first opcode
+        assert(i == 0 || found[i].count <= found[i - 1].count);
+        assert(found[i].count <= s->count[found[i].ops[0]]);
+        total += found[i].count;
+    }
+    for (int op = 0; op < 256; op++)
+        executed += s->count[op];
+    assert(total < executed);
+
+    // A triple never outnumbers the pairs it is made of
+    size_t triples = ijvm_ngrams(m, 3, true, other, MAX_NGRAMS);
+    assert(triples > 0);
+    for (size_t i = 0; i < triples; i++) {
+        assert(other[i].count <= count_of(found, pairs, other[i].ops, 2));
+        assert(other[i].count <= count_of(found, pairs, other[i].ops + 1, 2));
+    }
+    // Nothing runs on past a call
+    assert(count_of(found, pairs, (byte_t[]) { OP_INVOKEVIRTUAL, OP_BIPUSH }, 2) == 0);
+
+    ijvm_ngrams_report(m, stderr, OPSTATS_TEXT);
+    ijvm_ngrams_disable(m);
+    assert(ijvm_ngrams(m, 2, true, found, MAX_NGRAMS) == 0);
+    ijvm_destroy(m);
+}
+
+int main()
+{
+    RUN_TEST(test_straight_line);
+    RUN_TEST(test_sequences_hold_together);
+    return END_TEST();
+}
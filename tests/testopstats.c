@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include "libijvm.h"
+#include "opstats.h"
+#include "testutil.h"
+
+#define TMP_REPORT "tmp_opstats"
+
+static uint64_t total(const opstats_t *s)
+{
+    uint64_t n = 0;
+    for (int op = 0; op < 256; op++)
+        n += s->count[op];
+    return n;
+}
+
+void test_counts_every_instruction()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/Tanenbaum.ijvm") != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    uint64_t steps = 0;
+    while (ijvm_step(m))
+        steps++;
+    // The instruction that finished the program counts as well
+    steps++;
+    assert(ijvm_stats(m) == NULL);
+
+    assert(ijvm_load(m, "files/advanced/Tanenbaum.ijvm") != -1);
+    ijvm_set_output(m, null_out);
+    assert(ijvm_stats_enable(m) == 0);
+    ijvm_run(m);
+    const opstats_t *s = ijvm_stats(m);
+    assert(s != NULL);
+    assert(total(s) == steps);
+    assert(s->count[OP_HALT] == 1);
+    assert(s->count[OP_INVOKEVIRTUAL] == s->count[OP_IRETURN]);
+    // The first execution of every opcode is timed
+    for (int op = 0; op < 256; op++) {
+        assert(s->samples[op] == (s->count[op] + OPSTATS_SAMPLE_RATE - 1) / OPSTATS_SAMPLE_RATE);
+        uint64_t in_histogram = 0;
+        for (int b = 0; b < OPSTATS_BUCKETS; b++)
+            in_histogram += s->histogram[op][b];
+        assert(in_histogram == s->samples[op]);
+    }
+
+    ijvm_stats_disable(m);
+    assert(ijvm_stats(m) == NULL);
+    ijvm_destroy(m);
+    fclose(null_out);
+}
+
+void test_budget_still_holds()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    assert(ijvm_stats_enable(m) == 0);
+    assert(ijvm_run_for(m, 100) == IJVM_OUT_OF_FUEL);
+    assert(total(ijvm_stats(m)) == 100);
+    assert(ijvm_run_for(m, 5000) == IJVM_OUT_OF_FUEL);
+    assert(total(ijvm_stats(m)) == 5100);
+    ijvm_destroy(m);
+    fclose(null_out);
+}
+
+void test_reports()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/task1/program1.ijvm") != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    assert(ijvm_stats_enable(m) == 0);
+    ijvm_run(m);
+
+    char report[4096];
+    FILE *fp = fopen(TMP_REPORT, "w+");
+    assert(fp != NULL);
+    ijvm_stats_report(m, fp, OPSTATS_TEXT);
+    rewind(fp);
+    size_t n = fread(report, 1, sizeof(report) - 1, fp);
+    report[n] = '\0';
+    assert(strstr(report, "BIPUSH") != NULL);
+    assert(strstr(report, "total") != NULL);
+
+    fp = freopen(TMP_REPORT, "w+", fp);
+    assert(fp != NULL);
+    ijvm_stats_report(m, fp, OPSTATS_JSON);
+    rewind(fp);
+    n = fread(report, 1, sizeof(report) - 1, fp);
+    report[n] = '\0';
+    assert(report[0] == '{');
+    assert(strstr(report, "\"name\": \"BIPUSH\"") != NULL);
+    assert(strcmp(report + n - 3, "]}\n") == 0);
+    fclose(fp);
+    remove(TMP_REPORT);
+
+    ijvm_destroy(m);
+    fclose(null_out);
+}
+
+int main()
+{
+    RUN_TEST(test_counts_every_instruction);
+    RUN_TEST(test_budget_still_holds);
+    RUN_TEST(test_reports);
+    return END_TEST();
+}
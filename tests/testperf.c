@@ -0,0 +1,127 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "libijvm.h"
+#include "perf.h"
+#include "testutil.h"
+
+#define BUDGET 300000
+
+static char map_path[64];
+static char dump_path[64];
+
+typedef struct result {
+    word_t tos;
+    int stack_size;
+    uint32_t pc;
+    bool finished;
+    char out[4096];
+} result_t;
+
+// Runs binary for BUDGET instructions, in slices of `slice`
+static void run_slices(const char *binary, uint64_t slice, result_t *r)
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, binary) != -1);
+    memset(r, 0, sizeof(*r));
+    ijvm_set_output_buffer(m, r->out, sizeof(r->out) - 1);
+    for (uint64_t done = 0; done < BUDGET && !ijvm_finished(m); done += slice)
+        ijvm_run_for(m, BUDGET - done < slice ? BUDGET - done : slice);
+    r->tos = ijvm_tos(m);
+    r->stack_size = ijvm_stack_size(m);
+    r->pc = ijvm_get_program_counter(m);
+    r->finished = ijvm_finished(m);
+    ijvm_destroy(m);
+}
+
+static void same_as_without(const char *binary, uint64_t slice)
+{
+    result_t plain, traced;
+    run_slices(binary, BUDGET, &plain);
+    assert(ijvm_perf_enable(PERF_MAP | PERF_JITDUMP) == 0);
+    run_slices(binary, slice, &traced);
+    ijvm_perf_disable();
+    assert(traced.tos == plain.tos);
+    assert(traced.stack_size == plain.stack_size);
+    assert(traced.pc == plain.pc);
+    assert(traced.finished == plain.finished);
+    assert(strcmp(traced.out, plain.out) == 0);
+}
+
+void test_runs_the_same()
+{
+    same_as_without("files/advanced/test-nestedinvoke.ijvm", BUDGET);
+    // Resuming in the middle of calls rebuilds their frames
+    same_as_without("files/advanced/mandelbread.ijvm", 37);
+    same_as_without("files/advanced/Tanenbaum.ijvm", 11);
+}
+
+void test_names_methods()
+{
+    remove(map_path);
+    result_t r;
+    assert(ijvm_perf_enable(PERF_MAP | PERF_JITDUMP) == 0);
+    run_slices("files/advanced/test-nestedinvoke.ijvm", BUDGET, &r);
+    ijvm_perf_disable();
+
+    FILE *fp = fopen(map_path, "r");
+    assert(fp != NULL);
+    char line[256];
+    int entries = 0, methods = 0, mains = 0;
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        unsigned long start;
+        unsigned int size;
+        char name[128];
+        assert(sscanf(line, "%lx %x %127[^\n]", &start, &size, name) == 3);
+        assert(start != 0 && size > 0);
+        entries++;
+        methods += strstr(name, "[ijvm] test-nestedinvoke.ijvm:method_0x") == name;
+        mains += strcmp(name, "[ijvm] test-nestedinvoke.ijvm:main") == 0;
+    }
+    fclose(fp);
+    assert(mains == 1);
+    assert(methods >= 2);
+    assert(entries == methods + mains);
+
+    // One code load per map entry
+    fp = fopen(dump_path, "rb");
+    assert(fp != NULL);
+    jitdump_header_t h;
+    assert(fread(&h, sizeof(h), 1, fp) == 1);
+    assert(h.magic == JITDUMP_MAGIC && h.total_size == sizeof(h));
+    assert(h.pid == (uint32_t) getpid());
+    int loads = 0;
+    jitdump_code_load_t load;
+    while (fread(&load, sizeof(load), 1, fp) == 1) {
+        assert(load.header.id == JIT_CODE_LOAD);
+        assert(load.code_addr == load.vma && load.code_size > 0);
+        assert(fseek(fp, load.header.total_size - sizeof(load), SEEK_CUR) == 0);
+        loads++;
+    }
+    fclose(fp);
+    assert(loads == entries);
+    remove(map_path);
+    remove(dump_path);
+}
+
+int main()
+{
+#if !defined(__x86_64__) && !defined(__aarch64__)
+    return 0;
+#endif
+    // Out of the tree, where a run that dies halfway leaves no dump behind
+    char dump_dir[] = "/tmp/testperf-XXXXXX";
+    assert(mkdtemp(dump_dir) != NULL);
+    setenv("JITDUMPDIR", dump_dir, 1);
+    snprintf(map_path, sizeof(map_path), "/tmp/perf-%d.map", (int) getpid());
+    snprintf(dump_path, sizeof(dump_path), "%s/jit-%d.dump", dump_dir, (int) getpid());
+    RUN_TEST(test_runs_the_same);
+    RUN_TEST(test_names_methods);
+    remove(map_path);
+    remove(dump_path);
+    rmdir(dump_dir);
+    return END_TEST();
+}
@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libijvm.h"
+#include "opstats.h"
+#include "profiler.h"
+#include "testutil.h"
+
+#define BINARY      "files/advanced/test-nestedinvoke.ijvm"
+#define TMP_FOLDED  "tmp_profile.folded"
+#define TMP_PPROF   "tmp_profile.pb"
+#define TMP_SYMBOLS "tmp_profile.sym"
+
+static char folded[0x10000];
+
+static ijvm_t *profile_run(const char *symbols)
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, BINARY) != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    assert(ijvm_profile_enable(m) == 0);
+    assert(ijvm_stats_enable(m) == 0);
+    if (symbols != NULL)
+        assert(ijvm_profile_load_symbols(m, symbols) == 0);
+    ijvm_run(m);
+    ijvm_set_output(m, stdout);
+    fclose(null_out);
+
+    FILE *fp = fopen(TMP_FOLDED, "w+");
+    assert(fp != NULL);
+    assert(ijvm_profile_write_folded(m, fp, PROFILE_INSTRUCTIONS) == 0);
+    rewind(fp);
+    size_t n = fread(folded, 1, sizeof(folded) - 1, fp);
+    folded[n] = '\0';
+    fclose(fp);
+    remove(TMP_FOLDED);
+    return m;
+}
+
+void test_instructions_add_up()
+{
+    ijvm_t *m = profile_run(NULL);
+    const opstats_t *s = ijvm_stats(m);
+    uint64_t total = 0;
+    for (int op = 0; op < 256; op++)
+        total += s->count[op];
+
+    // Every instruction is charged to exactly one call path
+    uint64_t sum = 0;
+    int paths = 0, calls = 0;
+    for (char *line = strtok(folded, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        assert(strncmp(line, "main", 4) == 0);
+        sum += strtoull(strrchr(line, ' ') + 1, NULL, 10);
+        paths++;
+        for (char *c = line; *c != '\0'; c++)
+            calls += *c == ';';
+    }
+    assert(sum == total);
+    assert(paths > 1);
+    assert(calls > 0);
+
+    ijvm_profile_report(m, stderr);
+    ijvm_destroy(m);
+}
+
+void test_symbols()
+{
+    ijvm_t *m = profile_run(NULL);
+    ijvm_destroy(m);
+    // Name the first method called from main
+    char *first = strstr(folded, "main;method_");
+    assert(first != NULL);
+    unsigned int address = strtoul(first + strlen("main;method_"), NULL, 16);
+    FILE *fp = fopen(TMP_SYMBOLS, "w");
+    assert(fp != NULL);
+    fprintf(fp, "# address name\n0x%x outer\n", address);
+    fclose(fp);
+
+    m = profile_run(TMP_SYMBOLS);
+    assert(strstr(folded, "main;outer") != NULL);
+    assert(strstr(folded, "main;method_") == NULL);
+    ijvm_destroy(m);
+    remove(TMP_SYMBOLS);
+    assert(ijvm_profile_load_symbols(m = ijvm_create(), TMP_SYMBOLS) == -1);
+    ijvm_destroy(m);
+}
+
+void test_pprof()
+{
+    ijvm_t *m = profile_run(NULL);
+    FILE *fp = fopen(TMP_PPROF, "w+b");
+    assert(fp != NULL);
+    assert(ijvm_profile_write_pprof(m, fp) == 0);
+    rewind(fp);
+    unsigned char head[2];
+    assert(fread(head, 1, 2, fp) == 2);
+    // A sample_type message comes first
+    assert(head[0] == (1 << 3 | 2));
+    fclose(fp);
+    remove(TMP_PPROF);
+    ijvm_profile_disable(m);
+    assert(ijvm_profile_write_pprof(m, stdout) == -1);
+    ijvm_destroy(m);
+}
+
+int main()
+{
+    RUN_TEST(test_instructions_add_up);
+    RUN_TEST(test_symbols);
+    RUN_TEST(test_pprof);
+    return END_TEST();
+}
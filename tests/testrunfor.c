@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "libijvm.h"
+#include "metrics.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_runfor.ijvm"
+
+static void write_binary(const byte_t *text, uint32_t text_size)
+{
+    byte_t header[] = { 0x1d, 0xea, 0xdf, 0xad, 0, 0x01, 0, 0, 0, 0, 0, 0 };
+    byte_t text_header[] = { 0, 0, 0, 0, 0, 0, 0, text_size };
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    fwrite(header, 1, sizeof(header), fp);
+    fwrite(text_header, 1, sizeof(text_header), fp);
+    fwrite(text, 1, text_size, fp);
+    fclose(fp);
+}
+
+void test_infinite_loop_runs_out()
+{
+    // BIPUSH 1; POP; GOTO -3
+    const byte_t text[] = { OP_BIPUSH, 1, OP_POP, OP_GOTO, 0xFF, 0xFD };
+    write_binary(text, sizeof(text));
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, TMP_BINARY) != -1);
+
+    assert(ijvm_run_for(m, 1000) == IJVM_OUT_OF_FUEL);
+    // 1000 = 333 rounds of three, and the BIPUSH of the next
+    assert(ijvm_get_program_counter(m) == 2);
+    assert(ijvm_tos(m) == 1);
+    assert(ijvm_run_for(m, 2) == IJVM_OUT_OF_FUEL);
+    assert(ijvm_get_program_counter(m) == 0);
+    assert(ijvm_run_for(m, 0) == IJVM_OUT_OF_FUEL);
+    assert(!ijvm_finished(m));
+
+    ijvm_destroy(m);
+    remove(TMP_BINARY);
+}
+
+static uint64_t retired(ijvm_t *m)
+{
+    ijvm_metrics_t metrics;
+    ijvm_metrics(m, &metrics);
+    return metrics.instructions;
+}
+
+// Every budget stops at the same state as that many steps, and retires as
+// many instructions
+static void check_against_steps(const char *binary)
+{
+    ijvm_t *stepped = ijvm_create();
+    ijvm_t *fueled = ijvm_create();
+    assert(stepped != NULL && fueled != NULL);
+    assert(ijvm_load(stepped, binary) != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(stepped, null_out);
+
+    for (uint64_t budget = 1; !ijvm_finished(stepped); budget++) {
+        ijvm_step(stepped);
+        assert(ijvm_load(fueled, binary) != -1);
+        ijvm_set_output(fueled, null_out);
+        uint64_t before = retired(fueled);
+        ijvm_status_t res = ijvm_run_for(fueled, budget);
+        assert(retired(fueled) - before == budget);
+        assert(res == (ijvm_finished(stepped) ? IJVM_HALTED : IJVM_OUT_OF_FUEL));
+        assert(ijvm_get_program_counter(fueled) == ijvm_get_program_counter(stepped));
+        assert(ijvm_stack_size(fueled) == ijvm_stack_size(stepped));
+        assert(ijvm_tos(fueled) == ijvm_tos(stepped));
+    }
+    ijvm_destroy(stepped);
+    ijvm_destroy(fueled);
+    fclose(null_out);
+}
+
+void test_budget_matches_steps()
+{
+    check_against_steps("files/task3/IFICMPEQ1.ijvm");
+    check_against_steps("files/task5/TestInvokeArgs.ijvm");
+    check_against_steps("files/advanced/test-wide1.ijvm");
+    check_against_steps("files/advanced/Tanenbaum.ijvm");
+
+    // Runs off the end of its text inside a block that is stepped
+    const byte_t text[] = { OP_BIPUSH, 1, OP_BIPUSH, 2, OP_IADD, OP_POP };
+    write_binary(text, sizeof(text));
+    check_against_steps(TMP_BINARY);
+    remove(TMP_BINARY);
+}
+
+void test_blocked_on_input()
+{
+    int fds[2];
+    assert(pipe(fds) == 0);
+    FILE *in = fdopen(fds[0], "r");
+    assert(in != NULL);
+
+    int res = init_ijvm("files/advanced/SimpleCalc.ijvm");
+    assert(res != -1);
+    char buf[16];
+    memset(buf, '\0', sizeof(buf));
+    set_input(in);
+    set_output_buffer(buf, sizeof(buf) - 1);
+
+    assert(run_for(1000000) == IJVM_BLOCKED);
+    assert(get_instruction() == OP_IN);
+    // Blocked again, without running anything in the meantime
+    int pc = get_program_counter();
+    assert(run_for(1000000) == IJVM_BLOCKED);
+    assert(get_program_counter() == pc);
+
+    const char *input = "4 3 - ? .";
+    assert(write(fds[1], input, strlen(input)) == (ssize_t) strlen(input));
+    close(fds[1]);
+    assert(run_for(1000000) == IJVM_HALTED);
+    assert(strcmp(buf, "1\n") == 0);
+
+    destroy_ijvm();
+    fclose(in);
+}
+
+int main()
+{
+    RUN_TEST(test_infinite_loop_runs_out);
+    RUN_TEST(test_budget_matches_steps);
+    RUN_TEST(test_blocked_on_input);
+    return END_TEST();
+}
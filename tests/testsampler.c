@@ -0,0 +1,104 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include "libijvm.h"
+#include "sampler.h"
+#include "testutil.h"
+
+#define TMP_FOLDED "tmp_sampler.folded"
+
+static char folded[0x10000];
+
+// Samples written so far, with their stacks in folded
+static uint64_t folded_samples()
+{
+    FILE *fp = fopen(TMP_FOLDED, "w+");
+    assert(fp != NULL);
+    sampler_write_folded(fp);
+    rewind(fp);
+    size_t n = fread(folded, 1, sizeof(folded) - 1, fp);
+    folded[n] = '\0';
+    fclose(fp);
+    remove(TMP_FOLDED);
+    uint64_t total = 0;
+    for (char *line = folded; (line = strchr(line, ' ')) != NULL; line++)
+        total += strtoull(line + 1, NULL, 10);
+    return total;
+}
+
+void test_samples_guest_stacks()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+
+    assert(sampler_start(1000) == 0);
+    assert(sampler_start(1000) == -1);
+    // Run until a few samples landed, however slow the machine
+    while (!ijvm_finished(m) && folded_samples() < 10)
+        ijvm_run_for(m, 1000000);
+    sampler_stop();
+    uint64_t total = folded_samples();
+    assert(total >= 10);
+    // Every stack starts at main, and the program spends its time in methods
+    assert(strncmp(folded, "main", 4) == 0);
+    assert(strstr(folded, "main;method_0x") != NULL);
+
+    sampler_report(stderr);
+    // Nothing more comes in once stopped
+    ijvm_run_for(m, 1000000);
+    assert(folded_samples() == total);
+    ijvm_destroy(m);
+    fclose(null_out);
+}
+
+// Samples in guest code and dropped, from the first line of the report
+static void report_counts(unsigned long long *guest, unsigned long long *dropped)
+{
+    FILE *fp = tmpfile();
+    assert(fp != NULL);
+    sampler_report(fp);
+    rewind(fp);
+    unsigned long long elsewhere;
+    assert(fscanf(fp, "%llu samples in guest code, %llu elsewhere, %llu dropped",
+                  guest, &elsewhere, dropped) == 3);
+    fclose(fp);
+}
+
+void test_ring_drained_while_running()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") != -1);
+    unsigned long long before, dropped;
+    report_counts(&before, &dropped);
+
+    // Three rings' worth of samples, half a ring at a time with room for
+    // the drainer in between, and none of them dropped
+    assert(sampler_start(1) == 0);
+    sampler_machine = m;
+    for (int batch = 0; batch < 6; batch++) {
+        for (int i = 0; i < SAMPLER_RING_SIZE / 2; i++)
+            raise(SIGPROF);
+        usleep(3 * SAMPLER_DRAIN_MS * 1000);
+    }
+    sampler_machine = NULL;
+    sampler_stop();
+    unsigned long long after;
+    report_counts(&after, &dropped);
+    assert(after - before >= 3 * SAMPLER_RING_SIZE);
+    assert(dropped == 0);
+    ijvm_destroy(m);
+}
+
+int main()
+{
+    RUN_TEST(test_samples_guest_stacks);
+    RUN_TEST(test_ring_drained_while_running);
+    return END_TEST();
+}
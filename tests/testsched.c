@@ -0,0 +1,202 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include "sched.h"
+#include "testutil.h"
+
+#define NUM_MACHINES 2000
+#define NUM_SESSIONS 200
+
+typedef struct session {
+    ijvm_t *m;
+    char out[16];
+    int fds[2];
+    FILE *in;
+} session_t;
+
+static atomic_int done_count;
+
+static void count_done(ijvm_t *m, void *arg)
+{
+    (void) m;
+    (void) arg;
+    atomic_fetch_add(&done_count, 1);
+}
+
+static session_t *calc_session(const char *input)
+{
+    session_t *s = calloc(1, sizeof(session_t));
+    s->m = ijvm_create();
+    assert(s->m != NULL);
+    assert(ijvm_load(s->m, "files/advanced/SimpleCalc.ijvm") != -1);
+    if (input != NULL) {
+        ijvm_set_input_buffer(s->m, input, strlen(input));
+    } else {
+        assert(pipe(s->fds) == 0);
+        s->in = fdopen(s->fds[0], "r");
+        ijvm_set_input(s->m, s->in);
+    }
+    ijvm_set_output_buffer(s->m, s->out, sizeof(s->out) - 1);
+    return s;
+}
+
+static void free_session(session_t *s)
+{
+    ijvm_destroy(s->m);
+    if (s->in != NULL) {
+        fclose(s->in);
+        close(s->fds[1]);
+    }
+    free(s);
+}
+
+void test_many_machines()
+{
+    static session_t *sessions[NUM_MACHINES];
+    sched_t *s = sched_create(4, 100);
+    assert(s != NULL);
+    atomic_store(&done_count, 0);
+    for (int i = 0; i < NUM_MACHINES; i++) {
+        sessions[i] = calc_session(i % 2 ? "9 5 - ? ." : "2 3 + ? .");
+        assert(sched_submit(s, sessions[i]->m, count_done, NULL) == 0);
+    }
+    sched_wait(s);
+    assert(atomic_load(&done_count) == NUM_MACHINES);
+    for (int i = 0; i < NUM_MACHINES; i++) {
+        assert(strcmp(sessions[i]->out, i % 2 ? "4\n" : "5\n") == 0);
+        free_session(sessions[i]);
+    }
+    sched_stats_t stats;
+    sched_get_stats(s, &stats);
+    assert(stats.finished == NUM_MACHINES);
+    // With a slice of 100 instructions, every machine needs several turns
+    assert(stats.slices > NUM_MACHINES);
+    sched_destroy(s);
+}
+
+void test_parks_blocked_sessions()
+{
+    static session_t *sessions[NUM_SESSIONS];
+    sched_t *s = sched_create(2, 0);
+    assert(s != NULL);
+    atomic_store(&done_count, 0);
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        sessions[i] = calc_session(NULL);
+        assert(sched_submit(s, sessions[i]->m, count_done, NULL) == 0);
+    }
+    // Every session waits for input, taking no turns while it does
+    usleep(100000);
+    sched_stats_t before, after;
+    sched_get_stats(s, &before);
+    assert(before.parks == NUM_SESSIONS);
+    usleep(100000);
+    sched_get_stats(s, &after);
+    assert(after.slices == before.slices);
+
+    // Answer them one part at a time
+    for (int i = 0; i < NUM_SESSIONS; i++)
+        assert(write(sessions[i]->fds[1], "1 ", 2) == 2);
+    for (int i = 0; i < NUM_SESSIONS; i++)
+        assert(write(sessions[i]->fds[1], "1 + ? .", 7) == 7);
+    sched_wait(s);
+    assert(atomic_load(&done_count) == NUM_SESSIONS);
+    for (int i = 0; i < NUM_SESSIONS; i++) {
+        assert(strcmp(sessions[i]->out, "2\n") == 0);
+        free_session(sessions[i]);
+    }
+    sched_destroy(s);
+}
+
+void test_endless_loop_does_not_starve()
+{
+    // GOTO 0, forever
+    session_t *spin = calc_session("");
+    FILE *fp = fopen("tmp_sched.ijvm", "wb");
+    const byte_t binary[] = {
+        0x1d, 0xea, 0xdf, 0xad, 0, 0x01, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 3, OP_GOTO, 0, 0,
+    };
+    fwrite(binary, 1, sizeof(binary), fp);
+    fclose(fp);
+    assert(ijvm_load(spin->m, "tmp_sched.ijvm") != -1);
+    remove("tmp_sched.ijvm");
+
+    sched_t *s = sched_create(1, 1000);
+    assert(s != NULL);
+    atomic_store(&done_count, 0);
+    assert(sched_submit(s, spin->m, count_done, NULL) == 0);
+    session_t *calc = calc_session("7 1 + ? .");
+    assert(sched_submit(s, calc->m, count_done, NULL) == 0);
+    while (atomic_load(&done_count) == 0)
+        usleep(1000);
+    assert(strcmp(calc->out, "8\n") == 0);
+    // The endless one is handed back unfinished
+    sched_destroy(s);
+    assert(atomic_load(&done_count) == 1);
+    assert(!ijvm_finished(spin->m));
+    free_session(spin);
+    free_session(calc);
+}
+
+// Waits up to a few seconds for count machines to be done
+static bool wait_done(int count)
+{
+    for (int tries = 0; tries < 3000 && atomic_load(&done_count) < count; tries++)
+        usleep(1000);
+    return atomic_load(&done_count) >= count;
+}
+
+void test_two_parked_on_one_descriptor()
+{
+    // IN, OUT, HALT
+    FILE *fp = fopen("tmp_sched.ijvm", "wb");
+    const byte_t binary[] = {
+        0x1d, 0xea, 0xdf, 0xad, 0, 0x01, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 3, OP_IN, OP_OUT, OP_HALT,
+    };
+    fwrite(binary, 1, sizeof(binary), fp);
+    fclose(fp);
+    session_t *a = calc_session(NULL);
+    session_t *b = calc_session("");
+    assert(ijvm_load(a->m, "tmp_sched.ijvm") != -1);
+    assert(ijvm_load(b->m, "tmp_sched.ijvm") != -1);
+    remove("tmp_sched.ijvm");
+    // Both read the one pipe
+    ijvm_set_input(a->m, a->in);
+    ijvm_set_input(b->m, a->in);
+    ijvm_set_output_buffer(a->m, a->out, sizeof(a->out) - 1);
+    ijvm_set_output_buffer(b->m, b->out, sizeof(b->out) - 1);
+
+    sched_t *s = sched_create(2, 0);
+    assert(s != NULL);
+    atomic_store(&done_count, 0);
+    assert(sched_submit(s, a->m, count_done, NULL) == 0);
+    assert(sched_submit(s, b->m, count_done, NULL) == 0);
+    usleep(100000);
+    sched_stats_t stats;
+    sched_get_stats(s, &stats);
+    assert(stats.parks == 2);
+
+    // A byte at a time, so each is taken by whichever machine woke first
+    // and the other one parks again
+    assert(write(a->fds[1], "x", 1) == 1);
+    assert(wait_done(1));
+    assert(write(a->fds[1], "y", 1) == 1);
+    assert(wait_done(2));
+    assert(strlen(a->out) == 1 && strlen(b->out) == 1);
+    assert(a->out[0] + b->out[0] == 'x' + 'y');
+    sched_destroy(s);
+    free_session(a);
+    free_session(b);
+}
+
+int main()
+{
+    RUN_TEST(test_many_machines);
+    RUN_TEST(test_parks_blocked_sessions);
+    RUN_TEST(test_endless_loop_does_not_starve);
+    RUN_TEST(test_two_parked_on_one_descriptor);
+    return END_TEST();
+}
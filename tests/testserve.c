@@ -0,0 +1,140 @@
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include "libijvm.h"
+#include "serve.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_serve.ijvm"
+
+static bool echo_once(char a, char b)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(5555);
+    for (int tries = 0; tries < 200; tries++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+            close(fd);
+            // The workers may not be listening yet
+            usleep(10000);
+            continue;
+        }
+        struct timeval timeout = { 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        char out[2] = { a, b };
+        char in[2] = { 0, 0 };
+        bool ok = write(fd, out, 2) == 2
+                  && read(fd, in, 1) == 1
+                  && (in[1] != 0 || read(fd, in + 1, 1) == 1);
+        close(fd);
+        return ok && in[0] == b && in[1] == a;
+    }
+    return false;
+}
+
+void test_serve_reruns_program()
+{
+    pid_t server = fork();
+    if (server == 0) {
+        FILE *report = fopen("/dev/null", "w");
+        _exit(ijvm_serve("files/bonus/test_netbind.ijvm", 2, report) == 0 ? 0 : 1);
+    }
+    assert(server > 0);
+
+    // test_netbind serves one connection and halts, so every connection
+    // past the second needs a worker that went on to its next run
+    for (int i = 0; i < 6; i++)
+        assert(echo_once('a' + i, 'A' + i));
+
+    kill(server, SIGTERM);
+    int status;
+    assert(waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void test_serve_many_connections()
+{
+    FILE *report = tmpfile();
+    assert(report != NULL);
+    pid_t server = fork();
+    if (server == 0)
+        _exit(ijvm_serve("files/bonus/test_netbind.ijvm", 2, report) == 0 ? 0 : 1);
+    assert(server > 0);
+
+    // Far more runs than the reports of which fit in the pipe at once,
+    // so the server has to keep reading them while it serves
+    int served = 0;
+    for (int i = 0; i < 5000; i++)
+        served += echo_once('a' + i % 26, 'A' + i % 26);
+    assert(served == 5000);
+
+    kill(server, SIGTERM);
+    int status;
+    assert(waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    unsigned long long runs, failed, errors, instructions, connections;
+    rewind(report);
+    assert(fscanf(report, "serve: %llu runs (%llu failed, %llu in ERR), %llu instructions, %llu connections",
+                  &runs, &failed, &errors, &instructions, &connections) == 5);
+    assert(runs >= 5000);
+    assert(connections == 5000);
+    assert(failed == 0 && errors == 0);
+    fclose(report);
+}
+
+void test_serve_backs_off_on_err()
+{
+    // A program that fails straight away, as one whose port is taken does
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    const unsigned char binary[] = {
+        0x1d, 0xea, 0xdf, 0xad, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 0, 0, 0, 0, 0, 0, 1, 0xFE,
+    };
+    assert(fwrite(binary, 1, sizeof(binary), fp) == sizeof(binary));
+    fclose(fp);
+    FILE *report = tmpfile();
+    assert(report != NULL);
+
+    pid_t server = fork();
+    if (server == 0)
+        _exit(ijvm_serve(TMP_BINARY, 1, report) == 0 ? 0 : 1);
+    assert(server > 0);
+    usleep(500000);
+    kill(server, SIGTERM);
+    int status;
+    assert(waitpid(server, &status, 0) == server);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    // A handful of runs, all of them in ERR, rather than a core's worth
+    unsigned long long runs, failed, errors;
+    rewind(report);
+    assert(fscanf(report, "serve: %llu runs (%llu failed, %llu in ERR)", &runs, &failed, &errors) == 3);
+    assert(runs >= 2 && runs < 20);
+    assert(errors == runs);
+    assert(failed == 0);
+    fclose(report);
+    remove(TMP_BINARY);
+}
+
+void test_serve_bad_binary()
+{
+    assert(ijvm_serve("files/does-not-exist.ijvm", 2, stderr) == -1);
+}
+
+int main()
+{
+    RUN_TEST(test_serve_reruns_program);
+    RUN_TEST(test_serve_many_connections);
+    RUN_TEST(test_serve_backs_off_on_err);
+    RUN_TEST(test_serve_bad_binary);
+    return END_TEST();
+}
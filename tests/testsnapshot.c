@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libijvm.h"
+#include "snapshot.h"
+#include "forkserver.h"
+#include "jas.h"
+#include "testutil.h"
+
+#define TMP_BINARY "tmp_snapshot.ijvm"
+
+// Main spawns a worker that makes an array, prints x and yields back
+static const char spawner[] =
+    ".constant\nobjref 0\n.end-constant\n"
+    ".main\nLDC_W objref\nSPAWN worker\nPOP\nYIELD\n"
+    "BIPUSH 109\nOUT\nHALT\n.end-main\n"
+    ".method worker()\nBIPUSH 4\nNEWARRAY\nPOP\n"
+    "BIPUSH 120\nOUT\nYIELD\nBIPUSH 0\nIRETURN\n.end-method\n";
+
+void test_clone_after_load()
+{
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, "files/task4/LoadTest1.ijvm") != -1);
+    ijvm_snapshot_t *s = ijvm_snapshot(m);
+    assert(s != NULL);
+
+    ijvm_run(m);
+    assert(ijvm_tos(m) == 3);
+
+    ijvm_t *c = ijvm_clone(s);
+    assert(c != NULL);
+    assert(ijvm_get_program_counter(c) == 0);
+    assert(!ijvm_finished(c));
+    ijvm_step(c);
+    assert(ijvm_tos(c) == 1);
+
+    ijvm_destroy(c);
+    ijvm_destroy(m);
+    ijvm_snapshot_free(s);
+}
+
+void test_clone_at_pc()
+{
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, "files/advanced/teststack2.ijvm") != -1);
+    // First instruction of the method
+    assert(ijvm_run_until(m, 24));
+    int size = ijvm_stack_size(m);
+    ijvm_snapshot_t *s = ijvm_snapshot(m);
+    assert(s != NULL);
+
+    ijvm_t *a = ijvm_clone(s);
+    ijvm_t *b = ijvm_clone(s);
+    assert(a != NULL && b != NULL);
+    for (int i = 0; i < 2 * 1000; i++)
+        ijvm_step(a);
+    // Writes to one clone are private to it
+    assert(ijvm_stack_size(a) == size + 1000);
+    assert(ijvm_stack_size(b) == size);
+    assert(ijvm_get_program_counter(b) == 24);
+    assert(ijvm_get_local_variable(a, 0) == ijvm_get_local_variable(b, 0));
+
+    // Restoring over a running instance rewinds it
+    assert(ijvm_restore_snapshot(a, s) == 0);
+    assert(ijvm_stack_size(a) == size);
+
+    ijvm_snapshot_free(s);
+    // Clones outlive their snapshot
+    ijvm_step(b);
+    assert(ijvm_tos(b) == 2);
+    ijvm_destroy(a);
+    ijvm_destroy(b);
+    ijvm_destroy(m);
+}
+
+void test_restore_over_fiber()
+{
+    char error[JAS_ERROR_SIZE];
+    size_t size;
+    byte_t *image = jas_assemble(spawner, strlen(spawner), &size, error, sizeof(error));
+    assert(image != NULL);
+    FILE *fp = fopen(TMP_BINARY, "wb");
+    assert(fwrite(image, 1, size, fp) == size);
+    fclose(fp);
+    free(image);
+
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, TMP_BINARY) != -1);
+    char out[8] = { 0 };
+    ijvm_set_output_buffer(m, out, sizeof(out) - 1);
+    ijvm_snapshot_t *s = ijvm_snapshot(m);
+    assert(s != NULL);
+
+    // Stopped inside the worker, on its own stack and with an array made
+    while (ijvm_output_size(m) == 0)
+        assert(ijvm_step(m));
+    assert(ijvm_get_program_counter(m) > 14);
+
+    // Rewinds to main on its own stack, the fiber and the array gone
+    for (int i = 0; i < 2; i++) {
+        assert(ijvm_restore_snapshot(m, s) == 0);
+        assert(ijvm_get_program_counter(m) == 0);
+        assert(ijvm_output_size(m) == 0);
+        ijvm_run(m);
+        assert(ijvm_finished(m));
+        assert(ijvm_output_size(m) == 2);
+        assert(memcmp(out, "xm", 2) == 0);
+    }
+
+    ijvm_snapshot_free(s);
+    ijvm_destroy(m);
+    remove(TMP_BINARY);
+}
+
+void test_fork_server()
+{
+    ijvm_t *m = ijvm_create();
+    assert(ijvm_load(m, "files/task1/program1.ijvm") != -1);
+    FILE *requests = tmpfile();
+    FILE *replies = tmpfile();
+    fprintf(requests, "- tmp_fork_1\n- tmp_fork_2\nincomplete\n");
+    rewind(requests);
+
+    assert(ijvm_fork_server(m, requests, replies) == 1);
+
+    char buf[16];
+    for (int i = 1; i <= 2; i++) {
+        sprintf(buf, "tmp_fork_%d", i);
+        FILE *out = fopen(buf, "r");
+        assert(out != NULL);
+        assert(fgetc(out) == 'a');
+        fclose(out);
+        remove(buf);
+    }
+    // The parent itself never ran the program
+    assert(ijvm_get_program_counter(m) == 0);
+
+    fclose(requests);
+    fclose(replies);
+    ijvm_destroy(m);
+}
+
+int main()
+{
+    RUN_TEST(test_clone_after_load);
+    RUN_TEST(test_clone_at_pc);
+    RUN_TEST(test_restore_over_fiber);
+    RUN_TEST(test_fork_server);
+    return END_TEST();
+}
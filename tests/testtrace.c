@@ -0,0 +1,94 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "libijvm.h"
+#include "trace.h"
+#include "testutil.h"
+
+#define TMP_TRACE   "tmp_trace"
+#define TMP_DECODED "tmp_trace.txt"
+
+static char decoded[0x10000];
+
+// Decodes the trace, returning the number of lines
+static int decode(uint64_t last)
+{
+    FILE *fp = fopen(TMP_DECODED, "w+");
+    assert(fp != NULL);
+    assert(ijvm_trace_decode(TMP_TRACE, fp, last) == 0);
+    rewind(fp);
+    size_t n = fread(decoded, 1, sizeof(decoded) - 1, fp);
+    decoded[n] = '\0';
+    fclose(fp);
+    remove(TMP_DECODED);
+    int lines = 0;
+    for (char *c = decoded; *c != '\0'; c++)
+        lines += *c == '\n';
+    return lines;
+}
+
+void test_records_every_instruction()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/test-wide1.ijvm") != -1);
+    assert(ijvm_trace_enable(m, TMP_TRACE, 1000, false) == 0);
+    int steps = 1;
+    while (ijvm_step(m))
+        steps++;
+    word_t tos = ijvm_tos(m);
+    ijvm_trace_disable(m);
+    ijvm_destroy(m);
+
+    assert(decode(0) == steps);
+    assert(strncmp(decoded, "         0  0x0000  BIPUSH 0", 28) == 0);
+    assert(strstr(decoded, "WIDE ISTORE 257") != NULL);
+    // The last line is the HALT, with the stack as it was left
+    char *last = decoded + strlen(decoded) - 1;
+    while (last > decoded && last[-1] != '\n')
+        last--;
+    assert(strstr(last, "HALT") != NULL);
+    char expected[32];
+    sprintf(expected, "tos=%d ", tos);
+    assert(strstr(last, expected) != NULL);
+    assert(strstr(last, "cycles=") == NULL);
+    // Only as many as asked for, newest last
+    assert(decode(2) == 2);
+    assert(strstr(decoded, "HALT") != NULL);
+    remove(TMP_TRACE);
+}
+
+void test_ring_keeps_the_newest()
+{
+    ijvm_t *m = ijvm_create();
+    assert(m != NULL);
+    assert(ijvm_load(m, "files/advanced/mandelbread.ijvm") != -1);
+    FILE *null_out = fopen("/dev/null", "w");
+    ijvm_set_output(m, null_out);
+    // Rounded up to 64
+    assert(ijvm_trace_enable(m, TMP_TRACE, 50, true) == 0);
+    assert(ijvm_run_for(m, 1000) == IJVM_OUT_OF_FUEL);
+    // Readable while the instance still runs
+    assert(decode(0) == 64);
+    assert(strncmp(decoded, "       936  ", 12) == 0);
+    assert(strstr(decoded, "\n       999  ") != NULL);
+    assert(strstr(decoded, "cycles=") != NULL);
+    ijvm_destroy(m);
+    fclose(null_out);
+    remove(TMP_TRACE);
+
+    // Not a trace
+    FILE *fp = fopen(TMP_TRACE, "w");
+    fputs("not a trace at all, not even close to one", fp);
+    fclose(fp);
+    assert(ijvm_trace_decode(TMP_TRACE, stdout, 0) == -1);
+    remove(TMP_TRACE);
+    assert(ijvm_trace_decode(TMP_TRACE, stdout, 0) == -1);
+}
+
+int main()
+{
+    RUN_TEST(test_records_every_instruction);
+    RUN_TEST(test_ring_keeps_the_newest);
+    return END_TEST();
+}